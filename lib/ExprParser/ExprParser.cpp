@@ -91,6 +91,11 @@ char *ExprParser::resolveVariables(char *expression) {
             }
             ++pos;
         }
+        // the variable ends the expression
+        if (start != -1 && end == -1) {
+            end = pos - 1;
+            varName[varPos] = '\0';
+        }
 
         if (start != -1 && end != -1) {
             snprintf(var, 32, "%.8g", varResolveFunction(varName));
@@ -0,0 +1,445 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "Arduino.h"
+#include "esp_timer.h"
+#include <chrono>
+#include <thread>
+
+unsigned long millis() {
+    return static_cast<unsigned long>(esp_timer_get_time() / 1000);
+}
+
+unsigned long micros() {
+    return static_cast<unsigned long>(esp_timer_get_time());
+}
+
+void delay(const unsigned long ms) {
+    if (esp_timer_advance(ms * 1000LL)) {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(ms * 1000 / esp_timer_get_time_scale())));
+}
+
+void yield() {
+    // busy waiting takes time on a stepped clock too
+    esp_timer_advance(NATIVE_YIELD_STEP);
+    std::this_thread::yield();
+}
+
+float temperatureRead() {
+    return 40.0f;
+}
+
+void disableCore0WDT() {
+}
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, const size_t size) {
+    const size_t len = strlen(src);
+    if (size != 0) {
+        const size_t n = std::min(len, size - 1);
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#endif
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t n = 0;
+    while (size--) {
+        if (write(*buffer++) == 0) {
+            break;
+        }
+        n++;
+    }
+    return n;
+}
+
+size_t Print::write(const char *str) {
+    return str == nullptr ? 0 : write(reinterpret_cast<const uint8_t *>(str), strlen(str));
+}
+
+size_t Print::write(const char *buffer, const size_t size) {
+    return write(reinterpret_cast<const uint8_t *>(buffer), size);
+}
+
+size_t Print::print(const char *str) {
+    return write(str);
+}
+
+size_t Print::print(const char c) {
+    return write(static_cast<uint8_t>(c));
+}
+
+size_t Print::print(const String &str) {
+    return write(str.c_str(), str.length());
+}
+
+size_t Print::print(const std::string &str) {
+    return write(str.data(), str.length());
+}
+
+static size_t printNumber(Print &out, unsigned long value, const int base, const bool negative) {
+    char buf[8 * sizeof(long) + 2];
+    char *str = &buf[sizeof(buf) - 1];
+    *str = '\0';
+    const int b = base < 2 ? 10 : base;
+    do {
+        const char c = static_cast<char>(value % b);
+        value /= b;
+        *--str = static_cast<char>(c < 10 ? c + '0' : c + 'A' - 10);
+    } while (value);
+    if (negative) {
+        *--str = '-';
+    }
+    return out.write(str);
+}
+
+size_t Print::print(const int value, const int base) {
+    return print(static_cast<long>(value), base);
+}
+
+size_t Print::print(const unsigned int value, const int base) {
+    return print(static_cast<unsigned long>(value), base);
+}
+
+size_t Print::print(const long value, const int base) {
+    if (base == 10 && value < 0) {
+        return printNumber(*this, -static_cast<unsigned long>(value), base, true);
+    }
+    return printNumber(*this, static_cast<unsigned long>(value), base, false);
+}
+
+size_t Print::print(const unsigned long value, const int base) {
+    return printNumber(*this, value, base, false);
+}
+
+size_t Print::print(const double value, const int digits) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", digits, value);
+    return write(buf);
+}
+
+size_t Print::println() {
+    return write("\r\n");
+}
+
+size_t Print::printf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    va_list copy;
+    va_copy(copy, args);
+    const int len = vsnprintf(nullptr, 0, format, copy);
+    va_end(copy);
+    if (len < 0) {
+        va_end(args);
+        return 0;
+    }
+    std::string buf(len + 1, '\0');
+    vsnprintf(&buf[0], buf.size(), format, args);
+    va_end(args);
+    return write(buf.data(), len);
+}
+
+void Stream::setTimeout(const unsigned long timeout) {
+    this->timeout = timeout;
+}
+
+size_t Stream::readBytes(char *buffer, const size_t length) {
+    return readBytes(reinterpret_cast<uint8_t *>(buffer), length);
+}
+
+size_t Stream::readBytes(uint8_t *buffer, const size_t length) {
+    size_t count = 0;
+    const unsigned long start = millis();
+    while (count < length) {
+        const int c = read();
+        if (c < 0) {
+            if (millis() - start >= timeout) {
+                break;
+            }
+            yield();
+            continue;
+        }
+        buffer[count++] = static_cast<uint8_t>(c);
+    }
+    return count;
+}
+
+bool Stream::find(const char *target) {
+    return findUntil(target, nullptr);
+}
+
+bool Stream::findUntil(const char *target, const char *terminator) {
+    const size_t targetLen = strlen(target);
+    const size_t termLen = terminator != nullptr ? strlen(terminator) : 0;
+    size_t index = 0;
+    size_t termIndex = 0;
+    if (targetLen == 0) {
+        return true;
+    }
+    int c;
+    while ((c = read()) >= 0) {
+        index = c == target[index] ? index + 1 : (c == target[0] ? 1 : 0);
+        if (index >= targetLen) {
+            return true;
+        }
+        if (termLen != 0) {
+            termIndex = c == terminator[termIndex] ? termIndex + 1 : (c == terminator[0] ? 1 : 0);
+            if (termIndex >= termLen) {
+                return false;
+            }
+        }
+    }
+    return false;
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+}
+
+int HardwareSerial::available() {
+    return 0;
+}
+
+int HardwareSerial::read() {
+    return -1;
+}
+
+int HardwareSerial::peek() {
+    return -1;
+}
+
+size_t HardwareSerial::write(const uint8_t c) {
+    return fputc(c, stdout) == EOF ? 0 : 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, const size_t size) {
+    return fwrite(buffer, 1, size, stdout);
+}
+
+HardwareSerial::operator bool() const {
+    return true;
+}
+
+HardwareSerial Serial;
+
+String::String(const char *str) : str(str != nullptr ? str : "") {
+}
+
+String::String(const std::string &str) : str(str) {
+}
+
+String::String(const char c) : str(1, c) {
+}
+
+String::String(const int value) : str(std::to_string(value)) {
+}
+
+String::String(const unsigned int value) : str(std::to_string(value)) {
+}
+
+String::String(const long value) : str(std::to_string(value)) {
+}
+
+String::String(const unsigned long value) : str(std::to_string(value)) {
+}
+
+String::String(const double value, const unsigned int decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    str = buf;
+}
+
+const char *String::c_str() const {
+    return str.c_str();
+}
+
+size_t String::length() const {
+    return str.length();
+}
+
+bool String::isEmpty() const {
+    return str.empty();
+}
+
+bool String::startsWith(const String &prefix) const {
+    return str.compare(0, prefix.str.length(), prefix.str) == 0;
+}
+
+bool String::endsWith(const String &suffix) const {
+    return str.length() >= suffix.str.length() &&
+           str.compare(str.length() - suffix.str.length(), suffix.str.length(), suffix.str) == 0;
+}
+
+int String::indexOf(const char c, const unsigned int from) const {
+    const size_t pos = str.find(c, from);
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+}
+
+int String::indexOf(const String &str, const unsigned int from) const {
+    const size_t pos = this->str.find(str.str, from);
+    return pos == std::string::npos ? -1 : static_cast<int>(pos);
+}
+
+String String::substring(const unsigned int from) const {
+    return from >= str.length() ? String() : String(str.substr(from));
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+    if (from > to) {
+        std::swap(from, to);
+    }
+    return from >= str.length() ? String() : String(str.substr(from, to - from));
+}
+
+void String::replace(const String &find, const String &replace) {
+    if (find.str.empty()) {
+        return;
+    }
+    size_t pos = 0;
+    while ((pos = str.find(find.str, pos)) != std::string::npos) {
+        str.replace(pos, find.str.length(), replace.str);
+        pos += replace.str.length();
+    }
+}
+
+void String::trim() {
+    const size_t start = str.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos) {
+        str.clear();
+        return;
+    }
+    str = str.substr(start, str.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+void String::toLowerCase() {
+    std::transform(str.begin(), str.end(), str.begin(), [](const unsigned char c) { return std::tolower(c); });
+}
+
+void String::toUpperCase() {
+    std::transform(str.begin(), str.end(), str.begin(), [](const unsigned char c) { return std::toupper(c); });
+}
+
+long String::toInt() const {
+    return strtol(str.c_str(), nullptr, 10);
+}
+
+float String::toFloat() const {
+    return strtof(str.c_str(), nullptr);
+}
+
+char String::charAt(const unsigned int index) const {
+    return index < str.length() ? str[index] : '\0';
+}
+
+char String::operator[](const unsigned int index) const {
+    return charAt(index);
+}
+
+bool String::concat(const char *str) {
+    if (str == nullptr) {
+        return false;
+    }
+    this->str += str;
+    return true;
+}
+
+bool String::concat(const char c) {
+    str += c;
+    return true;
+}
+
+bool String::reserve(const unsigned int size) {
+    str.reserve(size);
+    return true;
+}
+
+String &String::operator+=(const String &other) {
+    str += other.str;
+    return *this;
+}
+
+String &String::operator+=(const char *other) {
+    str += other;
+    return *this;
+}
+
+String &String::operator+=(const char c) {
+    str += c;
+    return *this;
+}
+
+String String::operator+(const String &other) const {
+    return String(str + other.str);
+}
+
+String String::operator+(const char *other) const {
+    return String(str + other);
+}
+
+bool String::operator==(const String &other) const {
+    return str == other.str;
+}
+
+bool String::operator==(const char *other) const {
+    return str == other;
+}
+
+bool String::operator!=(const String &other) const {
+    return str != other.str;
+}
+
+bool String::operator!=(const char *other) const {
+    return str != other;
+}
+
+bool String::operator<(const String &other) const {
+    return str < other.str;
+}
+
+String operator+(const char *lhs, const String &rhs) {
+    return String(lhs) + rhs;
+}
+
+void EspClass::restart() {
+    fflush(stdout);
+    exit(0);
+}
+
+uint32_t EspClass::getFreeHeap() {
+    return heap_caps_get_free_size(MALLOC_CAP_8BIT);
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+    return heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+}
+
+uint32_t EspClass::getPsramSize() {
+    return 0;
+}
+
+uint32_t EspClass::getFreePsram() {
+    return 0;
+}
+
+uint32_t EspClass::getMinFreePsram() {
+    return 0;
+}
+
+EspClass ESP;
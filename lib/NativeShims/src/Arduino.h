@@ -0,0 +1,258 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+
+#define NATIVE_SHIMS 1
+
+// µs a busy wait in yield() takes on a stepped clock
+#define NATIVE_YIELD_STEP   100
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+using std::isinf;
+using std::isnan;
+
+unsigned long millis();
+
+unsigned long micros();
+
+void delay(unsigned long ms);
+
+void yield();
+
+float temperatureRead();
+
+void disableCore0WDT();
+
+#if !defined(__GLIBC__) || !__GLIBC_PREREQ(2, 38)
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+class String;
+
+class Print {
+public:
+    virtual ~Print() = default;
+
+    virtual size_t write(uint8_t c) = 0;
+
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t write(const char *str);
+
+    size_t write(const char *buffer, size_t size);
+
+    size_t print(const char *str);
+
+    size_t print(char c);
+
+    size_t print(const String &str);
+
+    size_t print(const std::string &str);
+
+    size_t print(int value, int base = 10);
+
+    size_t print(unsigned int value, int base = 10);
+
+    size_t print(long value, int base = 10);
+
+    size_t print(unsigned long value, int base = 10);
+
+    size_t print(double value, int digits = 2);
+
+    size_t println();
+
+    template<typename T>
+    size_t println(const T &value) {
+        return print(value) + println();
+    }
+
+    template<typename T>
+    size_t println(const T &value, int format) {
+        return print(value, format) + println();
+    }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    virtual void flush() {
+    }
+};
+
+class Stream : public Print {
+    unsigned long timeout = 1000;
+
+public:
+    virtual int available() = 0;
+
+    virtual int read() = 0;
+
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout);
+
+    size_t readBytes(char *buffer, size_t length);
+
+    size_t readBytes(uint8_t *buffer, size_t length);
+
+    bool find(const char *target);
+
+    bool findUntil(const char *target, const char *terminator);
+};
+
+/**
+ * Writes to stdout, reads nothing.
+ */
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud);
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    using Print::write;
+
+    operator bool() const;
+};
+
+extern HardwareSerial Serial;
+
+/**
+ * Subset of the Arduino String on top of std::string.
+ */
+class String {
+    std::string str;
+
+public:
+    String() = default;
+
+    String(const char *str);
+
+    String(const std::string &str);
+
+    explicit String(char c);
+
+    explicit String(int value);
+
+    explicit String(unsigned int value);
+
+    explicit String(long value);
+
+    explicit String(unsigned long value);
+
+    explicit String(double value, unsigned int decimals = 2);
+
+    const char *c_str() const;
+
+    size_t length() const;
+
+    bool isEmpty() const;
+
+    bool startsWith(const String &prefix) const;
+
+    bool endsWith(const String &suffix) const;
+
+    int indexOf(char c, unsigned int from = 0) const;
+
+    int indexOf(const String &str, unsigned int from = 0) const;
+
+    String substring(unsigned int from) const;
+
+    String substring(unsigned int from, unsigned int to) const;
+
+    void replace(const String &find, const String &replace);
+
+    void trim();
+
+    void toLowerCase();
+
+    void toUpperCase();
+
+    long toInt() const;
+
+    float toFloat() const;
+
+    char charAt(unsigned int index) const;
+
+    char operator[](unsigned int index) const;
+
+    bool concat(const char *str);
+
+    bool concat(char c);
+
+    bool reserve(unsigned int size);
+
+    String &operator+=(const String &other);
+
+    String &operator+=(const char *other);
+
+    String &operator+=(char c);
+
+    String operator+(const String &other) const;
+
+    String operator+(const char *other) const;
+
+    bool operator==(const String &other) const;
+
+    bool operator==(const char *other) const;
+
+    bool operator!=(const String &other) const;
+
+    bool operator!=(const char *other) const;
+
+    bool operator<(const String &other) const;
+};
+
+String operator+(const char *lhs, const String &rhs);
+
+class EspClass {
+public:
+    void restart();
+
+    uint32_t getFreeHeap();
+
+    uint32_t getMinFreeHeap();
+
+    uint32_t getPsramSize();
+
+    uint32_t getFreePsram();
+
+    uint32_t getMinFreePsram();
+};
+
+extern EspClass ESP;
@@ -0,0 +1,177 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "BLESerial.h"
+
+#define NATIVE_ADAPTER_NAME     "OBDBLE"
+#define NATIVE_ADAPTER_ADDRESS  "00:00:00:00:0b:1e"
+
+NimBLEAddress::NimBLEAddress(const std::string &address, const uint8_t type) : address(address) {
+}
+
+NimBLEAddress::NimBLEAddress(const uint8_t *address, const uint8_t type) {
+    // NimBLE keeps the bytes in reverse order
+    char str[18];
+    snprintf(str, sizeof(str), "%02x:%02x:%02x:%02x:%02x:%02x",
+             address[5], address[4], address[3], address[2], address[1], address[0]);
+    this->address = str;
+}
+
+std::string NimBLEAddress::toString() const {
+    return address.empty() ? "00:00:00:00:00:00" : address;
+}
+
+bool NimBLEAddress::isNull() const {
+    return address.empty() || address == "00:00:00:00:00:00";
+}
+
+NimBLEAddress::operator bool() const {
+    return !isNull();
+}
+
+bool NimBLEAddress::operator==(const NimBLEAddress &other) const {
+    return toString() == other.toString();
+}
+
+NimBLEAdvertisedDevice::NimBLEAdvertisedDevice(const std::string &name, const NimBLEAddress &address)
+    : name(name), address(address) {
+}
+
+std::string NimBLEAdvertisedDevice::getName() const {
+    return name;
+}
+
+NimBLEAddress NimBLEAdvertisedDevice::getAddress() const {
+    return address;
+}
+
+int NimBLEAdvertisedDevice::getRSSI() const {
+    return -40;
+}
+
+std::string NimBLEAdvertisedDevice::toString() const {
+    return "Name: " + name + ", Address: " + address.toString();
+}
+
+int BLEScanResultsSet::getCount() {
+    return static_cast<int>(devices.size());
+}
+
+NimBLEAdvertisedDevice *BLEScanResultsSet::getDevice(const int i) {
+    return i >= 0 && i < getCount() ? &devices[i] : nullptr;
+}
+
+void BLEScanResultsSet::add(const NimBLEAdvertisedDevice &device) {
+    devices.push_back(device);
+}
+
+void BLEScanResultsSet::clear() {
+    devices.clear();
+}
+
+Stream *BLESerial::adapter = nullptr;
+
+void BLESerial::setAdapter(Stream *adapter) {
+    BLESerial::adapter = adapter;
+}
+
+bool BLESerial::begin(const char *name) {
+    started = true;
+    return true;
+}
+
+void BLESerial::end() {
+    disconnect();
+    started = false;
+}
+
+bool BLESerial::connect(const NimBLEAddress &address) {
+    isConnected = started && adapter != nullptr;
+    return isConnected;
+}
+
+bool BLESerial::disconnect() {
+    if (isConnected) {
+        isConnected = false;
+        if (disconnectCallback != nullptr) {
+            disconnectCallback();
+        }
+    }
+    return true;
+}
+
+bool BLESerial::isClosed() {
+    return !isConnected;
+}
+
+bool BLESerial::connected() {
+    return isConnected;
+}
+
+void BLESerial::onDisconnect(void (*callback)()) {
+    disconnectCallback = callback;
+}
+
+void BLESerial::discoverClear() {
+    scanResults.clear();
+}
+
+BLEScanResultsSet *BLESerial::getScanResults() {
+    return &scanResults;
+}
+
+bool BLESerial::discoverAsync(const std::function<void(const NimBLEAdvertisedDevice *)> &callback) {
+    if (adapter != nullptr) {
+        scanResults.add(NimBLEAdvertisedDevice(NATIVE_ADAPTER_NAME, NimBLEAddress(NATIVE_ADAPTER_ADDRESS, 0)));
+        if (callback) {
+            callback(scanResults.getDevice(scanResults.getCount() - 1));
+        }
+    }
+    return true;
+}
+
+void BLESerial::discoverAsyncStop() {
+}
+
+int BLESerial::available() {
+    return isConnected ? adapter->available() : 0;
+}
+
+int BLESerial::read() {
+    return isConnected ? adapter->read() : -1;
+}
+
+int BLESerial::peek() {
+    return isConnected ? adapter->peek() : -1;
+}
+
+void BLESerial::flush() {
+    if (isConnected) {
+        adapter->flush();
+    }
+}
+
+size_t BLESerial::write(const uint8_t c) {
+    return isConnected ? adapter->write(c) : 0;
+}
+
+size_t BLESerial::write(const uint8_t *buffer, const size_t size) {
+    return isConnected ? adapter->write(buffer, size) : 0;
+}
+
+BLESerial::operator bool() const {
+    return started;
+}
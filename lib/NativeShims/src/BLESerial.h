@@ -0,0 +1,130 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+class NimBLEAddress {
+    std::string address;
+
+public:
+    NimBLEAddress() = default;
+
+    NimBLEAddress(const std::string &address, uint8_t type);
+
+    NimBLEAddress(const uint8_t *address, uint8_t type);
+
+    std::string toString() const;
+
+    bool isNull() const;
+
+    explicit operator bool() const;
+
+    bool operator==(const NimBLEAddress &other) const;
+};
+
+class NimBLEAdvertisedDevice {
+    std::string name;
+
+    NimBLEAddress address;
+
+public:
+    NimBLEAdvertisedDevice(const std::string &name, const NimBLEAddress &address);
+
+    std::string getName() const;
+
+    NimBLEAddress getAddress() const;
+
+    int getRSSI() const;
+
+    std::string toString() const;
+};
+
+class BLEScanResultsSet {
+    std::vector<NimBLEAdvertisedDevice> devices{};
+
+public:
+    int getCount();
+
+    NimBLEAdvertisedDevice *getDevice(int i);
+
+    void add(const NimBLEAdvertisedDevice &device);
+
+    void clear();
+};
+
+/**
+ * BLE serial without radio, connecting succeeds only if an adapter stream was registered with setAdapter(),
+ * which is then advertised as device <code>OBDBLE</code>.
+ */
+class BLESerial : public Stream {
+    static Stream *adapter;
+
+    BLEScanResultsSet scanResults;
+
+    bool isConnected = false;
+
+    bool started = false;
+
+    void (*disconnectCallback)() = nullptr;
+
+public:
+    /**
+     * @param adapter the stream of the simulated adapter, <code>nullptr</code> to remove it
+     */
+    static void setAdapter(Stream *adapter);
+
+    bool begin(const char *name);
+
+    void end();
+
+    bool connect(const NimBLEAddress &address);
+
+    bool disconnect();
+
+    bool isClosed();
+
+    bool connected();
+
+    void onDisconnect(void (*callback)());
+
+    void discoverClear();
+
+    BLEScanResultsSet *getScanResults();
+
+    bool discoverAsync(const std::function<void(const NimBLEAdvertisedDevice *)> &callback);
+
+    void discoverAsyncStop();
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    void flush() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    using Print::write;
+
+    operator bool() const;
+};
@@ -0,0 +1,249 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "ELMduino.h"
+
+static int hexValue(const char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static bool parseHex(const char *str, const size_t len, uint64_t &value) {
+    value = 0;
+    for (size_t i = 0; i < len; i++) {
+        const int digit = hexValue(str[i]);
+        if (digit < 0) {
+            return false;
+        }
+        value = value << 4 | digit;
+    }
+    return true;
+}
+
+ELM327::~ELM327() {
+    delete[] payload;
+}
+
+bool ELM327::begin(Stream &stream, const bool &debug, const uint16_t &timeout, const char &protocol,
+                   const uint16_t &payloadLen, const byte &dataTimeout) {
+    elm_port = &stream;
+    debugMode = debug;
+    this->timeout = timeout;
+
+    delete[] payload;
+    PAYLOAD_LEN = payloadLen;
+    payload = new char[PAYLOAD_LEN + 1]{};
+
+    char protocolCommand[16];
+    snprintf(protocolCommand, sizeof(protocolCommand), SET_PROTOCOL_TO_H_SAVE, protocol);
+
+    sendCommand_Blocking(RESET_ALL);
+    connected = sendCommand_Blocking(ECHO_OFF) == ELM_SUCCESS &&
+                sendCommand_Blocking(PRINTING_SPACES_OFF) == ELM_SUCCESS &&
+                sendCommand_Blocking(protocolCommand) == ELM_SUCCESS && strstr(payload, RESPONSE_OK) != nullptr;
+
+    return connected;
+}
+
+void ELM327::sendCommand(const char *cmd) {
+    if (elm_port == nullptr) {
+        nb_rx_state = ELM_GENERAL_ERROR;
+        return;
+    }
+
+    // drop leftovers of a previous response
+    while (elm_port->available() > 0) {
+        elm_port->read();
+    }
+
+    if (debugMode) {
+        Serial.printf("Sending: %s\n", cmd);
+    }
+
+    // the command without spaces to remove its echo from the response
+    size_t len = 0;
+    for (const char *c = cmd; *c != '\0' && len < sizeof(command) - 1; c++) {
+        if (*c != ' ') {
+            command[len++] = *c;
+        }
+    }
+    command[len] = '\0';
+
+    elm_port->print(cmd);
+    elm_port->print('\r');
+    nb_rx_state = ELM_GETTING_MSG;
+}
+
+int8_t ELM327::get_response() {
+    if (elm_port == nullptr || payload == nullptr) {
+        return nb_rx_state = ELM_GENERAL_ERROR;
+    }
+
+    size_t len = 0;
+    payload[0] = '\0';
+
+    const unsigned long start = millis();
+    for (;;) {
+        const int c = elm_port->read();
+        if (c < 0) {
+            if (millis() - start >= timeout) {
+                payload[len] = '\0';
+                return nb_rx_state = ELM_TIMEOUT;
+            }
+            yield();
+            continue;
+        }
+        if (c == '>') {
+            break;
+        }
+        // spaces and line breaks are removed like by ELMduino
+        if (c == ' ' || c == '\r' || c == '\n') {
+            continue;
+        }
+        if (len >= PAYLOAD_LEN) {
+            payload[len] = '\0';
+            return nb_rx_state = ELM_BUFFER_OVERFLOW;
+        }
+        payload[len++] = static_cast<char>(c);
+    }
+    payload[len] = '\0';
+
+    // echo is enabled again by AT D
+    const size_t commandLen = strlen(command);
+    if (commandLen != 0 && strncmp(payload, command, commandLen) == 0) {
+        len -= commandLen;
+        memmove(payload, payload + commandLen, len + 1);
+    }
+
+    if (debugMode) {
+        Serial.printf("Received: %s\n", payload);
+    }
+
+    if (len == 0) {
+        nb_rx_state = ELM_NO_RESPONSE;
+    } else if (strstr(payload, "UNABLETOCONNECT") != nullptr) {
+        nb_rx_state = ELM_UNABLE_TO_CONNECT;
+    } else if (strstr(payload, "NODATA") != nullptr) {
+        nb_rx_state = ELM_NO_DATA;
+    } else if (strstr(payload, "STOPPED") != nullptr) {
+        nb_rx_state = ELM_STOPPED;
+    } else if (strstr(payload, "ERROR") != nullptr) {
+        nb_rx_state = ELM_GENERAL_ERROR;
+    } else {
+        nb_rx_state = ELM_SUCCESS;
+    }
+
+    return nb_rx_state;
+}
+
+int8_t ELM327::sendCommand_Blocking(const char *cmd) {
+    sendCommand(cmd);
+    if (nb_rx_state != ELM_GETTING_MSG) {
+        return nb_rx_state;
+    }
+    return get_response();
+}
+
+bool ELM327::parseResponse(const uint8_t service, const uint16_t pid, const uint8_t numExpectedBytes) {
+    char header[8];
+    if (pid > 0xFF) {
+        snprintf(header, sizeof(header), "%02X%04X", service + 0x40, pid);
+    } else {
+        snprintf(header, sizeof(header), "%02X%02X", service + 0x40, pid);
+    }
+
+    const char *data = strstr(payload, header);
+    if (data == nullptr) {
+        return false;
+    }
+    data += strlen(header);
+
+    const size_t numDigits = std::min<size_t>(numExpectedBytes, sizeof(response)) * 2;
+    return strlen(data) >= numDigits && parseHex(data, numDigits, response);
+}
+
+double ELM327::processPID(const uint8_t &service, const uint16_t &pid, const uint8_t &num_responses,
+                          const uint8_t &numExpectedBytes, const double &scaleFactor, const float &bias) {
+    char query[12];
+    if (pid > 0xFF) {
+        snprintf(query, sizeof(query), "%02X%04X", service, pid);
+    } else {
+        snprintf(query, sizeof(query), "%02X%02X", service, pid);
+    }
+    if (specifyNumResponses && num_responses > 0 && num_responses < 0x10) {
+        snprintf(query + strlen(query), sizeof(query) - strlen(query), "%X", num_responses);
+    }
+
+    response = 0;
+    if (sendCommand_Blocking(query) != ELM_SUCCESS) {
+        return 0;
+    }
+
+    if (!parseResponse(service, pid, numExpectedBytes)) {
+        nb_rx_state = ELM_GARBAGE;
+        return 0;
+    }
+
+    return static_cast<double>(response) * scaleFactor + bias;
+}
+
+float ELM327::batteryVoltage() {
+    if (sendCommand_Blocking(READ_VOLTAGE) != ELM_SUCCESS) {
+        return 0;
+    }
+    return strtof(payload, nullptr);
+}
+
+void ELM327::currentDTCCodes(const bool &isBlocking) {
+    static const char categories[] = {'P', 'C', 'B', 'U'};
+
+    DTC_Response = dtcResponse();
+    if (sendCommand_Blocking("03") != ELM_SUCCESS) {
+        return;
+    }
+
+    const char *data = strstr(payload, "43");
+    if (data == nullptr) {
+        nb_rx_state = ELM_GARBAGE;
+        return;
+    }
+
+    // every code has two bytes, padding codes are zero
+    for (data += 2; strlen(data) >= 4 && DTC_Response.codesFound < DTC_MAX_CODES; data += 4) {
+        uint64_t code;
+        if (!parseHex(data, 4, code)) {
+            break;
+        }
+        if (code == 0) {
+            continue;
+        }
+        snprintf(DTC_Response.codes[DTC_Response.codesFound++], DTC_CODE_LEN, "%c%04X",
+                 categories[code >> 14 & 0x03], static_cast<unsigned int>(code & 0x3FFF));
+    }
+}
+
+void ELM327::printError() {
+    Serial.printf("Received: %s\n", payload != nullptr ? payload : "");
+    Serial.printf("ERROR: %d\n", nb_rx_state);
+}
@@ -0,0 +1,102 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+
+#define ELM_SUCCESS             0
+#define ELM_NO_RESPONSE         1
+#define ELM_BUFFER_OVERFLOW     2
+#define ELM_GARBAGE             3
+#define ELM_UNABLE_TO_CONNECT   4
+#define ELM_NO_DATA             5
+#define ELM_STOPPED             6
+#define ELM_TIMEOUT             7
+#define ELM_GETTING_MSG         8
+#define ELM_MSG_RXD             9
+#define ELM_GENERAL_ERROR       -1
+
+#define AUTOMATIC               '0'
+#define PID_INTERVAL_OFFSET     0x20
+
+#define SET_HEADER              "AT SH %s"
+#define SET_ALL_TO_DEFAULTS     "AT D"
+#define RESET_ALL               "AT Z"
+#define ECHO_OFF                "AT E0"
+#define PRINTING_SPACES_OFF     "AT S0"
+#define SET_PROTOCOL_TO_H_SAVE  "AT SP A%c"
+#define READ_VOLTAGE            "AT RV"
+#define RESPONSE_OK             "OK"
+
+#define DTC_MAX_CODES           16
+#define DTC_CODE_LEN            6
+
+struct dtcResponse {
+    uint8_t codesFound = 0;
+    char codes[DTC_MAX_CODES][DTC_CODE_LEN]{};
+};
+
+/**
+ * Blocking subset of the ELMduino ELM327 client, which speaks the ELM327 protocol on any stream.
+ * A request is sent and its response read up to the prompt within one call, so <code>nb_rx_state</code>
+ * never stays at <code>ELM_GETTING_MSG</code>.
+ */
+class ELM327 {
+    uint16_t timeout = 1000;
+
+    char command[20]{};
+
+    bool parseResponse(uint8_t service, uint16_t pid, uint8_t numExpectedBytes);
+
+public:
+    Stream *elm_port = nullptr;
+
+    bool connected = false;
+
+    bool debugMode = false;
+
+    bool specifyNumResponses = true;
+
+    int8_t nb_rx_state = ELM_GETTING_MSG;
+
+    char *payload = nullptr;
+
+    uint16_t PAYLOAD_LEN = 40;
+
+    uint64_t response = 0;
+
+    dtcResponse DTC_Response;
+
+    ~ELM327();
+
+    bool begin(Stream &stream, const bool &debug = false, const uint16_t &timeout = 1000,
+               const char &protocol = '0', const uint16_t &payloadLen = 40, const byte &dataTimeout = 0);
+
+    double processPID(const uint8_t &service, const uint16_t &pid, const uint8_t &num_responses,
+                      const uint8_t &numExpectedBytes, const double &scaleFactor = 1, const float &bias = 0);
+
+    void sendCommand(const char *cmd);
+
+    int8_t sendCommand_Blocking(const char *cmd);
+
+    int8_t get_response();
+
+    float batteryVoltage();
+
+    void currentDTCCodes(const bool &isBlocking = true);
+
+    void printError();
+};
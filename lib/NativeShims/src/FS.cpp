@@ -0,0 +1,290 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "FS.h"
+#include <cerrno>
+#include <cstdio>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace fs {
+    /**
+     * Open host file or directory listing.
+     */
+    class FileImpl {
+    public:
+        FILE *file = nullptr;
+
+        std::string path;
+
+        std::string hostPath;
+
+        std::string name;
+
+        bool directory = false;
+
+        std::vector<std::string> entries{};
+
+        size_t entryIndex = 0;
+
+        ~FileImpl() {
+            if (file != nullptr) {
+                fclose(file);
+            }
+        }
+    };
+
+    File::File(std::shared_ptr<FileImpl> impl) : impl(std::move(impl)) {
+    }
+
+    size_t File::write(const uint8_t c) {
+        return write(&c, 1);
+    }
+
+    size_t File::write(const uint8_t *buffer, const size_t size) {
+        if (!impl || impl->file == nullptr || size == 0) {
+            return 0;
+        }
+        return fwrite(buffer, 1, size, impl->file);
+    }
+
+    int File::available() {
+        if (!impl || impl->file == nullptr) {
+            return 0;
+        }
+        const long remaining = static_cast<long>(size()) - ftell(impl->file);
+        return remaining > 0 ? static_cast<int>(remaining) : 0;
+    }
+
+    int File::read() {
+        if (!impl || impl->file == nullptr) {
+            return -1;
+        }
+        const int c = fgetc(impl->file);
+        return c == EOF ? -1 : c;
+    }
+
+    int File::peek() {
+        if (!impl || impl->file == nullptr) {
+            return -1;
+        }
+        const int c = fgetc(impl->file);
+        if (c == EOF) {
+            return -1;
+        }
+        ungetc(c, impl->file);
+        return c;
+    }
+
+    void File::flush() {
+        if (impl && impl->file != nullptr) {
+            fflush(impl->file);
+        }
+    }
+
+    size_t File::read(uint8_t *buffer, const size_t size) {
+        if (!impl || impl->file == nullptr) {
+            return 0;
+        }
+        return fread(buffer, 1, size, impl->file);
+    }
+
+    bool File::seek(const uint32_t pos, const SeekMode mode) {
+        if (!impl || impl->file == nullptr) {
+            return false;
+        }
+        const int whence = mode == SeekCur ? SEEK_CUR : mode == SeekEnd ? SEEK_END : SEEK_SET;
+        return fseek(impl->file, pos, whence) == 0;
+    }
+
+    size_t File::position() const {
+        if (!impl || impl->file == nullptr) {
+            return 0;
+        }
+        const long pos = ftell(impl->file);
+        return pos < 0 ? 0 : static_cast<size_t>(pos);
+    }
+
+    size_t File::size() const {
+        if (!impl || impl->file == nullptr) {
+            return 0;
+        }
+        fflush(impl->file);
+        struct stat st{};
+        return fstat(fileno(impl->file), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+    }
+
+    void File::close() {
+        impl.reset();
+    }
+
+    File::operator bool() const {
+        return impl != nullptr;
+    }
+
+    bool File::isDirectory() const {
+        return impl && impl->directory;
+    }
+
+    const char *File::name() const {
+        return impl ? impl->name.c_str() : "";
+    }
+
+    const char *File::path() const {
+        return impl ? impl->path.c_str() : "";
+    }
+
+    /**
+     * Lists a directory sorted by name.
+     */
+    static bool readEntries(FileImpl &impl) {
+        DIR *dir = opendir(impl.hostPath.c_str());
+        if (dir == nullptr) {
+            return false;
+        }
+        while (const dirent *entry = readdir(dir)) {
+            if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0) {
+                impl.entries.emplace_back(entry->d_name);
+            }
+        }
+        closedir(dir);
+        std::sort(impl.entries.begin(), impl.entries.end());
+        impl.directory = true;
+        return true;
+    }
+
+    File File::openNextFile(const char *mode) {
+        if (!impl || !impl->directory || impl->entryIndex >= impl->entries.size()) {
+            return {};
+        }
+
+        const std::string &entry = impl->entries[impl->entryIndex++];
+        auto next = std::make_shared<FileImpl>();
+        next->path = impl->path == "/" ? "/" + entry : impl->path + "/" + entry;
+        next->hostPath = impl->hostPath + "/" + entry;
+        next->name = entry;
+
+        struct stat st{};
+        if (stat(next->hostPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (!readEntries(*next)) {
+                return {};
+            }
+        } else if ((next->file = fopen(next->hostPath.c_str(), "rb")) == nullptr) {
+            return {};
+        }
+        return File(next);
+    }
+
+    void File::rewindDirectory() {
+        if (impl) {
+            impl->entryIndex = 0;
+        }
+    }
+
+    time_t File::getLastWrite() {
+        struct stat st{};
+        return impl && stat(impl->hostPath.c_str(), &st) == 0 ? st.st_mtime : 0;
+    }
+
+    std::string FS::hostPath(const char *path) const {
+        return root + (path[0] == '/' ? "" : "/") + path;
+    }
+
+    void FS::setRoot(const char *root) {
+        this->root = root;
+        while (this->root.length() > 1 && this->root.back() == '/') {
+            this->root.pop_back();
+        }
+    }
+
+    const char *FS::getRoot() const {
+        return root.c_str();
+    }
+
+    File FS::open(const char *path, const char *mode, const bool create) {
+        auto impl = std::make_shared<FileImpl>();
+        impl->path = path;
+        impl->hostPath = hostPath(path);
+        const size_t slash = impl->path.find_last_of('/');
+        impl->name = slash == std::string::npos ? impl->path : impl->path.substr(slash + 1);
+
+        struct stat st{};
+        if (stat(impl->hostPath.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (!readEntries(*impl)) {
+                return {};
+            }
+            return File(impl);
+        }
+
+        if (create && mode[0] != 'r' && slash != std::string::npos && slash != 0) {
+            mkdir(impl->path.substr(0, slash).c_str());
+        }
+
+        const char *hostMode = mode[0] == 'w' ? "wb" : mode[0] == 'a' ? "ab" : mode[1] == '+' ? "r+b" : "rb";
+        impl->file = fopen(impl->hostPath.c_str(), hostMode);
+        if (impl->file == nullptr) {
+            return {};
+        }
+        return File(impl);
+    }
+
+    File FS::open(const String &path, const char *mode, const bool create) {
+        return open(path.c_str(), mode, create);
+    }
+
+    bool FS::exists(const char *path) {
+        struct stat st{};
+        return stat(hostPath(path).c_str(), &st) == 0;
+    }
+
+    bool FS::exists(const String &path) {
+        return exists(path.c_str());
+    }
+
+    bool FS::remove(const char *path) {
+        return ::unlink(hostPath(path).c_str()) == 0;
+    }
+
+    bool FS::remove(const String &path) {
+        return remove(path.c_str());
+    }
+
+    bool FS::rename(const char *from, const char *to) {
+        return ::rename(hostPath(from).c_str(), hostPath(to).c_str()) == 0;
+    }
+
+    bool FS::rename(const String &from, const String &to) {
+        return rename(from.c_str(), to.c_str());
+    }
+
+    bool FS::mkdir(const char *path) {
+        return ::mkdir(hostPath(path).c_str(), 0755) == 0 || errno == EEXIST;
+    }
+
+    bool FS::mkdir(const String &path) {
+        return mkdir(path.c_str());
+    }
+
+    bool FS::rmdir(const char *path) {
+        return ::rmdir(hostPath(path).c_str()) == 0;
+    }
+
+    bool FS::rmdir(const String &path) {
+        return rmdir(path.c_str());
+    }
+}
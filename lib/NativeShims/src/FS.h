@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <memory>
+#include <string>
+
+#define FILE_READ       "r"
+#define FILE_WRITE      "w"
+#define FILE_APPEND     "a"
+
+namespace fs {
+    enum SeekMode {
+        SeekSet = 0,
+        SeekCur = 1,
+        SeekEnd = 2
+    };
+
+    class FileImpl;
+
+    /**
+     * File or directory on the host filesystem, copies share the same handle like on the device.
+     */
+    class File : public Stream {
+        std::shared_ptr<FileImpl> impl;
+
+    public:
+        File() = default;
+
+        explicit File(std::shared_ptr<FileImpl> impl);
+
+        size_t write(uint8_t c) override;
+
+        size_t write(const uint8_t *buffer, size_t size) override;
+
+        using Print::write;
+
+        int available() override;
+
+        int read() override;
+
+        int peek() override;
+
+        void flush() override;
+
+        size_t read(uint8_t *buffer, size_t size);
+
+        bool seek(uint32_t pos, SeekMode mode = SeekSet);
+
+        size_t position() const;
+
+        size_t size() const;
+
+        void close();
+
+        operator bool() const;
+
+        bool isDirectory() const;
+
+        const char *name() const;
+
+        const char *path() const;
+
+        File openNextFile(const char *mode = FILE_READ);
+
+        void rewindDirectory();
+
+        time_t getLastWrite();
+    };
+
+    /**
+     * Filesystem below a host directory, paths are relative to it.
+     */
+    class FS {
+    protected:
+        std::string root = "littlefs";
+
+        std::string hostPath(const char *path) const;
+
+    public:
+        void setRoot(const char *root);
+
+        const char *getRoot() const;
+
+        File open(const char *path, const char *mode = FILE_READ, bool create = false);
+
+        File open(const String &path, const char *mode = FILE_READ, bool create = false);
+
+        bool exists(const char *path);
+
+        bool exists(const String &path);
+
+        bool remove(const char *path);
+
+        bool remove(const String &path);
+
+        bool rename(const char *from, const char *to);
+
+        bool rename(const String &from, const String &to);
+
+        bool mkdir(const char *path);
+
+        bool mkdir(const String &path);
+
+        bool rmdir(const char *path);
+
+        bool rmdir(const String &path);
+    };
+}
+
+using fs::FS;
+using fs::File;
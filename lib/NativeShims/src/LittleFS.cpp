@@ -0,0 +1,68 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "LittleFS.h"
+#include <cerrno>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define NATIVE_FS_SIZE  (1472 * 1024)
+
+static size_t directorySize(const std::string &path) {
+    size_t size = 0;
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        return 0;
+    }
+    while (const dirent *entry = readdir(dir)) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        const std::string child = path + "/" + entry->d_name;
+        struct stat st{};
+        if (stat(child.c_str(), &st) == 0) {
+            size += S_ISDIR(st.st_mode) ? directorySize(child) : static_cast<size_t>(st.st_size);
+        }
+    }
+    closedir(dir);
+    return size;
+}
+
+bool LittleFSFS::begin(const bool formatOnFail, const char *basePath, const uint8_t maxOpenFiles,
+                       const char *partitionLabel) {
+    if (const char *root = getenv("LITTLEFS_ROOT")) {
+        setRoot(root);
+    }
+
+    struct stat st{};
+    if (stat(root.c_str(), &st) == 0) {
+        return S_ISDIR(st.st_mode);
+    }
+    return formatOnFail && ::mkdir(root.c_str(), 0755) == 0;
+}
+
+void LittleFSFS::end() {
+}
+
+size_t LittleFSFS::totalBytes() {
+    return NATIVE_FS_SIZE;
+}
+
+size_t LittleFSFS::usedBytes() {
+    return directorySize(root);
+}
+
+LittleFSFS LittleFS;
@@ -0,0 +1,36 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <FS.h>
+
+/**
+ * LittleFS on the host, the root directory defaults to <code>littlefs</code> in the working directory
+ * and can be changed with the environment variable <code>LITTLEFS_ROOT</code> or setRoot().
+ */
+class LittleFSFS : public fs::FS {
+public:
+    bool begin(bool formatOnFail = false, const char *basePath = "/littlefs", uint8_t maxOpenFiles = 10,
+               const char *partitionLabel = nullptr);
+
+    void end();
+
+    size_t totalBytes();
+
+    size_t usedBytes();
+};
+
+extern LittleFSFS LittleFS;
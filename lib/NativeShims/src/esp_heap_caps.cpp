@@ -0,0 +1,85 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "esp_heap_caps.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+// heap of an ESP32 without PSRAM, allocations with MALLOC_CAP_SPIRAM fail like on the device
+#define NATIVE_HEAP_SIZE    (320 * 1024)
+
+struct alignas(16) AllocHeader {
+    size_t size;
+};
+
+static std::atomic<size_t> allocatedBytes{0};
+
+static std::atomic<size_t> peakBytes{0};
+
+void *heap_caps_malloc(const size_t size, const uint32_t caps) {
+    if ((caps & MALLOC_CAP_SPIRAM) != 0 || allocatedBytes + size > NATIVE_HEAP_SIZE) {
+        return nullptr;
+    }
+
+    auto *header = static_cast<AllocHeader *>(malloc(sizeof(AllocHeader) + size));
+    if (header == nullptr) {
+        return nullptr;
+    }
+    header->size = size;
+
+    const size_t allocated = allocatedBytes += size;
+    size_t peak = peakBytes;
+    while (allocated > peak && !peakBytes.compare_exchange_weak(peak, allocated)) {
+    }
+
+    return header + 1;
+}
+
+void *heap_caps_calloc(const size_t n, const size_t size, const uint32_t caps) {
+    if (size != 0 && n > SIZE_MAX / size) {
+        return nullptr;
+    }
+
+    void *ptr = heap_caps_malloc(n * size, caps);
+    if (ptr != nullptr) {
+        memset(ptr, 0, n * size);
+    }
+    return ptr;
+}
+
+void heap_caps_free(void *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+
+    auto *header = static_cast<AllocHeader *>(ptr) - 1;
+    allocatedBytes -= header->size;
+    free(header);
+}
+
+size_t heap_caps_get_free_size(const uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) != 0 ? 0 : NATIVE_HEAP_SIZE - allocatedBytes;
+}
+
+size_t heap_caps_get_minimum_free_size(const uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) != 0 ? 0 : NATIVE_HEAP_SIZE - peakBytes;
+}
+
+size_t heap_caps_get_largest_free_block(const uint32_t caps) {
+    return heap_caps_get_free_size(caps);
+}
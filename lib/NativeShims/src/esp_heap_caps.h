@@ -0,0 +1,42 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#define MALLOC_CAP_SPIRAM       (1 << 10)
+#define MALLOC_CAP_8BIT         (1 << 2)
+#define MALLOC_CAP_INTERNAL     (1 << 11)
+
+/**
+ * Allocates from a simulated 320 KB heap, requests for PSRAM fail like on a board without PSRAM.
+ * Memory allocated with <code>new</code> or <code>malloc</code> isn't counted.
+ */
+void *heap_caps_malloc(size_t size, uint32_t caps);
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps);
+
+void heap_caps_free(void *ptr);
+
+/**
+ * @return the free bytes of the simulated heap
+ */
+size_t heap_caps_get_free_size(uint32_t caps);
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+size_t heap_caps_get_largest_free_block(uint32_t caps);
@@ -0,0 +1,67 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "esp_timer.h"
+#include <chrono>
+#include <mutex>
+
+static std::mutex clockMutex;
+
+static auto realBase = std::chrono::steady_clock::now();
+
+static int64_t virtualBase = 0;
+
+static double timeScale = 1.0;
+
+static int64_t virtualTime(const std::chrono::steady_clock::time_point now) {
+    if (timeScale == 0) {
+        return virtualBase;
+    }
+    const int64_t real = std::chrono::duration_cast<std::chrono::microseconds>(now - realBase).count();
+    return virtualBase + static_cast<int64_t>(real * timeScale);
+}
+
+int64_t esp_timer_get_time() {
+    std::lock_guard<std::mutex> lock(clockMutex);
+    return virtualTime(std::chrono::steady_clock::now());
+}
+
+void esp_timer_set_time_scale(const double scale) {
+    if (scale < 0) {
+        return;
+    }
+
+    // continue from the current virtual time, so the clock never jumps
+    std::lock_guard<std::mutex> lock(clockMutex);
+    const auto now = std::chrono::steady_clock::now();
+    virtualBase = virtualTime(now);
+    realBase = now;
+    timeScale = scale;
+}
+
+double esp_timer_get_time_scale() {
+    std::lock_guard<std::mutex> lock(clockMutex);
+    return timeScale;
+}
+
+bool esp_timer_advance(const int64_t us) {
+    std::lock_guard<std::mutex> lock(clockMutex);
+    if (timeScale != 0) {
+        return false;
+    }
+    virtualBase += us;
+    return true;
+}
@@ -0,0 +1,45 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <cstdint>
+
+/**
+ * @return the µs since the start of the program, scaled by the time scale
+ */
+int64_t esp_timer_get_time();
+
+/**
+ * Runs the clock of millis(), micros(), delay() and esp_timer_get_time() faster or slower than the host clock,
+ * e.g. to replay a recorded drive in a fraction of its duration. Only available in the native build.
+ *
+ * With scale <code>0</code> the clock is stepped, it stands still and only advances by esp_timer_advance(),
+ * i.e. on delay() and while busy waiting in yield(), so a program runs as fast as the host allows and
+ * its timing doesn't depend on the speed of the host.
+ *
+ * @param scale the virtual time per host time, <code>1</code> for real time, <code>0</code> for a stepped clock
+ */
+void esp_timer_set_time_scale(double scale);
+
+double esp_timer_get_time_scale();
+
+/**
+ * Advances the stepped clock, does nothing if the clock runs.
+ *
+ * @param us the µs to advance
+ * @return <code>true</code> if the clock is stepped
+ */
+bool esp_timer_advance(int64_t us);
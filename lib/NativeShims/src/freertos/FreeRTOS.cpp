@@ -0,0 +1,180 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "freertos/FreeRTOS.h"
+#include <Arduino.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Queue of fixed size items, the items are copied like in FreeRTOS.
+ */
+struct NativeQueue {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<std::vector<uint8_t>> items;
+    size_t length;
+    size_t itemSize;
+};
+
+struct NativeTask {
+    std::string name;
+    TaskFunction_t function;
+    void *parameters;
+};
+
+static thread_local NativeTask *currentTask = nullptr;
+
+static char mainTaskName[] = "loopTask";
+
+template<typename Predicate>
+static bool waitFor(std::condition_variable &cv, std::unique_lock<std::mutex> &lock, const TickType_t ticksToWait,
+                    Predicate predicate) {
+    if (ticksToWait == portMAX_DELAY) {
+        cv.wait(lock, predicate);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(ticksToWait * portTICK_PERIOD_MS), predicate);
+}
+
+void portENTER_CRITICAL(portMUX_TYPE *mux) {
+    int expected = 0;
+    while (!__atomic_compare_exchange_n(&mux->locked, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        expected = 0;
+        std::this_thread::yield();
+    }
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE *mux) {
+    __atomic_store_n(&mux->locked, 0, __ATOMIC_RELEASE);
+}
+
+QueueHandle_t xQueueCreate(const UBaseType_t length, const UBaseType_t itemSize) {
+    auto *queue = new NativeQueue();
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, const TickType_t ticksToWait) {
+    auto *q = static_cast<NativeQueue *>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->changed, lock, ticksToWait, [q] { return q->items.size() < q->length; })) {
+        return pdFALSE;
+    }
+    const auto *data = static_cast<const uint8_t *>(item);
+    q->items.emplace_back(data, data + q->itemSize);
+    q->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, const TickType_t ticksToWait) {
+    auto *q = static_cast<NativeQueue *>(queue);
+    std::unique_lock<std::mutex> lock(q->mutex);
+    if (!waitFor(q->changed, lock, ticksToWait, [q] { return !q->items.empty(); })) {
+        return pdFALSE;
+    }
+    memcpy(item, q->items.front().data(), q->itemSize);
+    q->items.pop_front();
+    q->changed.notify_all();
+    return pdTRUE;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+    auto *q = static_cast<NativeQueue *>(queue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    q->items.clear();
+    q->changed.notify_all();
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    auto *q = static_cast<NativeQueue *>(queue);
+    std::lock_guard<std::mutex> lock(q->mutex);
+    return q->items.size();
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    delete static_cast<NativeQueue *>(queue);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+    return new std::timed_mutex();
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, const TickType_t ticksToWait) {
+    auto *mutex = static_cast<std::timed_mutex *>(semaphore);
+    if (ticksToWait == portMAX_DELAY) {
+        mutex->lock();
+        return pdTRUE;
+    }
+    return mutex->try_lock_for(std::chrono::milliseconds(ticksToWait * portTICK_PERIOD_MS)) ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+    static_cast<std::timed_mutex *>(semaphore)->unlock();
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore) {
+    delete static_cast<std::timed_mutex *>(semaphore);
+}
+
+BaseType_t xTaskCreate(const TaskFunction_t function, const char *name, const uint32_t stackSize, void *parameters,
+                       const UBaseType_t priority, TaskHandle_t *handle) {
+    auto *task = new NativeTask{name, function, parameters};
+    if (handle != nullptr) {
+        *handle = task;
+    }
+    std::thread([task] {
+        currentTask = task;
+        task->function(task->parameters);
+    }).detach();
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(const TaskFunction_t function, const char *name, const uint32_t stackSize,
+                                   void *parameters, const UBaseType_t priority, TaskHandle_t *handle,
+                                   const BaseType_t core) {
+    return xTaskCreate(function, name, stackSize, parameters, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    // a thread can't be stopped from outside, all tasks delete themselves as their last statement
+    // and the thread ends when the task function returns
+}
+
+void vTaskDelay(const TickType_t ticks) {
+    delay(ticks * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount() {
+    return static_cast<TickType_t>(millis() / portTICK_PERIOD_MS);
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return 0;
+}
+
+char *pcTaskGetName(TaskHandle_t task) {
+    auto *t = static_cast<NativeTask *>(task != nullptr ? task : currentTask);
+    return t != nullptr ? &t->name[0] : mainTaskName;
+}
@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <cstdint>
+
+typedef void *TaskHandle_t;
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+/**
+ * Critical sections are emulated with a spinning flag, they only protect against other host threads.
+ */
+typedef struct {
+    volatile int locked;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portMAX_DELAY       0xffffffffUL
+#define portTICK_PERIOD_MS  1
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              1
+#define pdFAIL              0
+#define pdMS_TO_TICKS(ms)   (static_cast<TickType_t>(ms))
+#define tskNO_AFFINITY      0x7FFFFFFF
+
+/**
+ * Spinlock, like on a dual core ESP32 the critical section doesn't stop other tasks.
+ */
+void portENTER_CRITICAL(portMUX_TYPE *mux);
+
+void portEXIT_CRITICAL(portMUX_TYPE *mux);
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticksToWait);
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticksToWait);
+
+BaseType_t xQueueReset(QueueHandle_t queue);
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+void vQueueDelete(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticksToWait);
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+/**
+ * Tasks run as detached host threads, priority, core and stack size are ignored.
+ */
+/**
+ * Tasks run as detached threads, stack size, priority and core are ignored.
+ */
+BaseType_t xTaskCreate(TaskFunction_t function, const char *name, uint32_t stackSize, void *parameters,
+                       UBaseType_t priority, TaskHandle_t *handle);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t function, const char *name, uint32_t stackSize,
+                                   void *parameters, UBaseType_t priority, TaskHandle_t *handle, BaseType_t core);
+
+/**
+ * Only a task deleting itself is supported, the calling thread exits.
+ */
+void vTaskDelete(TaskHandle_t task);
+
+void vTaskDelay(TickType_t ticks);
+
+TickType_t xTaskGetTickCount();
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+char *pcTaskGetName(TaskHandle_t task);
@@ -17,7 +17,16 @@
 
 #include "OBDState.h"
 
+#include <algorithm>
 #include <ExprParser.h>
+#include <esp_timer.h>
+#include <limits>
+#include <new>
+
+#include "trace.h"
+
+// value writes are short and must not be preempted by readers on the same core, which would spin forever
+static portMUX_TYPE valueMux = portMUX_INITIALIZER_UNLOCKED;
 
 void *OBDState::operator new(const size_t size) {
     void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
@@ -44,6 +53,47 @@ OBDState::OBDState(const obd::OBDStateType type, const char *name, const char *d
     this->updateInterval = 100;
 }
 
+OBDState::OBDState(const OBDState &other) {
+    this->elm327 = other.elm327;
+    this->type = other.type;
+    strlcpy(this->name, other.name, sizeof(this->name));
+    strlcpy(this->description, other.description, sizeof(this->description));
+    strlcpy(this->icon, other.icon, sizeof(this->icon));
+    strlcpy(this->unit, other.unit, sizeof(this->unit));
+    strlcpy(this->deviceClass, other.deviceClass, sizeof(this->deviceClass));
+    this->measurement = other.measurement;
+    this->diagnostic = other.diagnostic;
+
+    this->service = other.service;
+    this->pid = other.pid;
+    this->header = other.header;
+    this->numResponses = other.numResponses;
+    this->numExpectedBytes = other.numExpectedBytes;
+    this->byteOffset = other.byteOffset;
+    this->numBytes = other.numBytes;
+    this->bitOffset = other.bitOffset;
+    this->numBits = other.numBits;
+    this->scaleFactor = other.scaleFactor;
+    strlcpy(this->scaleFactorExpression, other.scaleFactorExpression, sizeof(this->scaleFactorExpression));
+    this->bias = other.bias;
+    strlcpy(this->calcExpression, other.calcExpression, sizeof(this->calcExpression));
+    setPollWhen(other.getPollWhen());
+
+    this->checkPidSupport = other.checkPidSupport;
+    this->enabled = other.enabled;
+    this->visible = other.visible;
+    this->updateInterval = other.updateInterval;
+    this->maxInterval = other.maxInterval;
+    this->deadband = other.deadband;
+    this->deadbandRelative = other.deadbandRelative;
+    this->maxSilence = other.maxSilence;
+}
+
+OBDState::~OBDState() {
+    free(this->pollWhenExpression);
+    delete this->histogram.load();
+}
+
 obd::OBDStateType OBDState::getType() const {
     return this->type;
 }
@@ -93,6 +143,31 @@ bool OBDState::hasCalcExpression() const {
     return strlen(this->calcExpression) != 0;
 }
 
+const char *OBDState::getCalcExpression() const {
+    return this->calcExpression;
+}
+
+void OBDState::setPollWhen(const char *expression) {
+    free(this->pollWhenExpression);
+    this->pollWhenExpression = strlen(expression) != 0 ? strndup(expression, 256) : nullptr;
+}
+
+bool OBDState::hasPollWhen() const {
+    return this->pollWhenExpression != nullptr;
+}
+
+const char *OBDState::getPollWhen() const {
+    return this->pollWhenExpression != nullptr ? this->pollWhenExpression : "";
+}
+
+bool OBDState::isSuspended() const {
+    return this->suspended;
+}
+
+void OBDState::setSuspended(const bool suspended) {
+    this->suspended = suspended;
+}
+
 uint32_t OBDState::supportedPIDs(const uint8_t &service, const uint16_t &pid) const {
     const uint8_t pidInterval = (pid / PID_INTERVAL_OFFSET) * PID_INTERVAL_OFFSET;
     return static_cast<uint32_t>(elm327->processPID(service, pidInterval, 1, 4));
@@ -161,6 +236,111 @@ OBDState *OBDState::withPIDSettings(const uint8_t &service, const uint16_t &pid,
     return this;
 }
 
+uint8_t OBDState::getService() const {
+    return this->service;
+}
+
+uint16_t OBDState::getPID() const {
+    return this->pid;
+}
+
+uint16_t OBDState::getHeader() const {
+    return this->header;
+}
+
+uint8_t OBDState::getNumResponses() const {
+    return this->numResponses;
+}
+
+uint8_t OBDState::getNumExpectedBytes() const {
+    return this->numExpectedBytes;
+}
+
+double OBDState::getScaleFactor() const {
+    return this->scaleFactor;
+}
+
+const char *OBDState::getScaleFactorExpression() const {
+    return this->scaleFactorExpression;
+}
+
+void OBDState::setScaleFactorExpression(const char *expression) {
+    strlcpy(this->scaleFactorExpression, expression, sizeof(this->scaleFactorExpression));
+}
+
+float OBDState::getBias() const {
+    return this->bias;
+}
+
+void OBDState::setExtraction(const uint8_t byteOffset, const uint8_t numBytes, const uint8_t bitOffset,
+                             const uint8_t numBits) {
+    this->byteOffset = byteOffset;
+    this->numBytes = numBytes;
+    this->bitOffset = bitOffset;
+    this->numBits = numBits;
+}
+
+bool OBDState::hasExtraction() const {
+    return this->byteOffset != 0 || this->numBytes != 0 || this->bitOffset != 0 || this->numBits != 0;
+}
+
+uint8_t OBDState::getByteOffset() const {
+    return this->byteOffset;
+}
+
+uint8_t OBDState::getNumBytes() const {
+    return this->numBytes;
+}
+
+uint8_t OBDState::getBitOffset() const {
+    return this->bitOffset;
+}
+
+uint8_t OBDState::getNumBits() const {
+    return this->numBits;
+}
+
+static uint64_t lowBits(const uint64_t value, const uint8_t bits) {
+    return bits >= 64 ? value : value & ((1ULL << bits) - 1);
+}
+
+double OBDState::decodeResponse(uint64_t raw) const {
+    if (this->byteOffset != 0 || this->numBytes != 0) {
+        if (this->byteOffset >= this->numExpectedBytes) {
+            return this->bias;
+        }
+        const uint8_t len = std::min<uint8_t>(this->numBytes != 0 ? this->numBytes : this->numExpectedBytes,
+                                              this->numExpectedBytes - this->byteOffset);
+        const int shift = (this->numExpectedBytes - this->byteOffset - len) * 8;
+        raw = shift < 64 ? lowBits(raw >> shift, len * 8) : 0;
+    }
+    if (this->bitOffset != 0 || this->numBits != 0) {
+        raw = this->bitOffset < 64 ? raw >> this->bitOffset : 0;
+        if (this->numBits != 0) {
+            raw = lowBits(raw, this->numBits);
+        }
+    }
+    return static_cast<double>(raw) * this->scaleFactor + this->bias;
+}
+
+uint64_t OBDState::getRawResponse() const {
+    return this->rawResponse;
+}
+
+int8_t OBDState::getUpdateStatus() const {
+    return this->updateStatus;
+}
+
+bool OBDState::sharesRequest(const OBDState *other) const {
+    return this->type == obd::READ && other->type == obd::READ && this->service == other->service &&
+           this->pid == other->pid && this->header == other->header && this->numResponses == other->numResponses &&
+           this->numExpectedBytes == other->numExpectedBytes && !this->hasReadFunc() && !other->hasReadFunc();
+}
+
+bool OBDState::hasReadFunc() const {
+    return false;
+}
+
 bool OBDState::isInit() const {
     return this->init;
 }
@@ -211,13 +391,86 @@ long OBDState::getUpdateInterval() const {
     return this->updateInterval;
 }
 
+long OBDState::getMaxInterval() const {
+    return this->maxInterval;
+}
+
+void OBDState::setMaxInterval(const long interval) {
+    this->maxInterval = interval;
+}
+
+bool OBDState::isAdaptive() const {
+    return this->updateInterval > 0 && this->maxInterval > this->updateInterval;
+}
+
+long OBDState::getAdaptiveInterval() const {
+    if (!isAdaptive() || this->adaptiveInterval == 0) {
+        return this->updateInterval;
+    }
+    return std::min(std::max(this->adaptiveInterval, this->updateInterval), this->maxInterval);
+}
+
+long OBDState::getPlannedInterval() const {
+    return this->plannedInterval;
+}
+
+void OBDState::setPlannedInterval(const long interval) {
+    this->plannedInterval = interval;
+}
+
+float OBDState::getDeadband() const {
+    return this->deadband;
+}
+
+bool OBDState::isDeadbandRelative() const {
+    return this->deadbandRelative;
+}
+
+void OBDState::setDeadband(const float deadband, const bool relative) {
+    this->deadband = deadband;
+    this->deadbandRelative = relative;
+}
+
+long OBDState::getMaxSilence() const {
+    return this->maxSilence;
+}
+
+void OBDState::setMaxSilence(const long maxSilence) {
+    this->maxSilence = maxSilence;
+}
+
 OBDState *OBDState::withUpdateInterval(const long interval) {
     this->updateInterval = interval;
     return this;
 }
 
+void OBDState::beginWrite() {
+    portENTER_CRITICAL(&valueMux);
+    this->sequence.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void OBDState::endWrite() {
+    this->sequence.fetch_add(1, std::memory_order_release);
+    portEXIT_CRITICAL(&valueMux);
+}
+
+uint32_t OBDState::beginRead() const {
+    uint32_t seq;
+    while ((seq = this->sequence.load(std::memory_order_acquire)) & 1) {
+    }
+    return seq;
+}
+
+bool OBDState::retryRead(const uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return this->sequence.load(std::memory_order_relaxed) != seq;
+}
+
 void OBDState::setPreviousUpdate(const long timestamp) {
+    beginWrite();
     this->previousUpdate = timestamp;
+    endWrite();
 }
 
 long OBDState::getPreviousUpdate() const {
@@ -225,13 +478,120 @@ long OBDState::getPreviousUpdate() const {
 }
 
 void OBDState::setLastUpdate(const long timestamp) {
+    beginWrite();
     this->lastUpdate = timestamp;
+    endWrite();
 }
 
 long OBDState::getLastUpdate() const {
     return this->lastUpdate;
 }
 
+const OBDStateMetrics &OBDState::getMetrics() const {
+    return this->metrics;
+}
+
+const LatencyHistogram *OBDState::getLatency() const {
+    return this->histogram;
+}
+
+void OBDState::recordInterval() {
+    if (previousUpdate > 0 && lastUpdate > previousUpdate) {
+        metrics.intervalSum += lastUpdate - previousUpdate;
+        ++metrics.intervalCount;
+    }
+}
+
+void OBDState::recordRequest(const uint32_t latency, const int8_t status) {
+    if (status == ELM_SUCCESS) {
+        ++metrics.updates;
+        recordInterval();
+    } else if (status == ELM_NO_DATA) {
+        ++metrics.noData;
+    } else if (status == ELM_TIMEOUT) {
+        ++metrics.timeouts;
+    } else {
+        ++metrics.errors;
+    }
+
+    metrics.lastLatency = latency;
+    metrics.latencySum += latency;
+    if (this->histogram == nullptr) {
+        this->histogram = new(std::nothrow) LatencyHistogram();
+    }
+    if (this->histogram != nullptr) {
+        this->histogram.load()->record(latency);
+    }
+
+    Trace.record(trace::REQUEST, this->name, nullptr, esp_timer_get_time() - latency, latency, status);
+}
+
+uint32_t OBDState::getAvgInterval() const {
+    return metrics.intervalCount != 0 ? metrics.intervalSum / metrics.intervalCount : 0;
+}
+
+uint32_t OBDState::getAvgLatency() const {
+    const uint32_t count = getRequests();
+    return count != 0 ? metrics.latencySum / count : 0;
+}
+
+uint32_t OBDState::getRequests() const {
+    return metrics.updates + metrics.noData + metrics.timeouts + metrics.errors;
+}
+
+uint16_t OBDState::getFailures() const {
+    return failures;
+}
+
+void OBDState::recordResult(const int8_t status, const bool linkResponding) {
+    if (status == ELM_SUCCESS) {
+        if (quarantined) {
+            Serial.printf("%s responds again and is released from quarantine.\n", this->name);
+        }
+        failures = 0;
+        quarantined = false;
+        return;
+    }
+
+    failures = std::min<uint16_t>(failures + 1, UINT16_MAX);
+    if (linkResponding && failures >= OBD_QUARANTINE_FAILURES) {
+        if (!quarantined) {
+            Serial.printf("%s quarantined after %u failed requests.\n", this->name, failures);
+            ++metrics.quarantines;
+        }
+        quarantined = true;
+        retryAt = millis() + OBD_QUARANTINE_PROBE;
+    } else {
+        const long base = std::max<long>(this->updateInterval, OBD_BACKOFF_MIN_DELAY);
+        retryAt = millis() + std::min<long>(base << std::min(failures - 1, 16), OBD_BACKOFF_MAX_DELAY);
+    }
+}
+
+void OBDState::resetFailures() {
+    failures = 0;
+    quarantined = false;
+}
+
+bool OBDState::isQuarantined() const {
+    return quarantined;
+}
+
+bool OBDState::isBackingOff() const {
+    return failures != 0 && static_cast<long>(millis() - retryAt) < 0;
+}
+
+long OBDState::getRetryIn() const {
+    return isBackingOff() ? static_cast<long>(retryAt - millis()) : 0;
+}
+
+void OBDState::resetMetrics() {
+    this->metrics = OBDStateMetrics{};
+    // readers may hold the histogram, it is only cleared
+    if (this->histogram != nullptr) {
+        this->histogram.load()->reset();
+    }
+}
+
 void OBDState::readValue() {
 }
 
@@ -239,12 +599,26 @@ void OBDState::calcValue(const std::function<double(const char *)> &func,
                          const std::map<const char *, const std::function<double(double)>> &funcs) {
 }
 
+void OBDState::applyValue(double value, long timestamp) {
+}
+
+void OBDState::applyResponse(const uint64_t raw, const long timestamp) {
+    this->rawResponse = raw;
+    applyValue(decodeResponse(raw), timestamp);
+    ++metrics.shared;
+    recordInterval();
+}
+
 void OBDState::toJSON(JsonDocument &doc) {
     doc["type"] = this->getType();
     doc["valueType"] = this->valueType();
     doc["enabled"] = this->isEnabled();
     doc["visible"] = this->isVisible();
     doc["interval"] = this->getUpdateInterval();
+    doc["deadband"] = this->deadband;
+    doc["deadbandRelative"] = this->deadbandRelative;
+    doc["maxSilence"] = this->maxSilence;
+    doc["maxInterval"] = this->maxInterval;
 
     doc["name"] = this->getName();
     doc["description"] = this->getDescription();
@@ -257,6 +631,36 @@ void OBDState::toJSON(JsonDocument &doc) {
     if (this->type == obd::CALC && strlen(this->calcExpression) != 0) {
         doc["expr"] = this->calcExpression;
     }
+    if (hasPollWhen()) {
+        doc["pollWhen"] = this->pollWhenExpression;
+    }
+}
+
+void OBDState::carryOver(const OBDState *other) {
+    this->previousUpdate = other->previousUpdate;
+    this->lastUpdate = other->lastUpdate;
+    this->updateStatus = other->updateStatus;
+    this->reportedAt = other->reportedAt;
+    this->metrics = other->metrics;
+    if (const LatencyHistogram *otherHistogram = other->histogram) {
+        if (this->histogram == nullptr) {
+            this->histogram = new(std::nothrow) LatencyHistogram(*otherHistogram);
+        } else {
+            *this->histogram.load() = *otherHistogram;
+        }
+    }
+    this->adaptiveInterval = other->adaptiveInterval;
+
+    // the PID support is only known for the same request
+    if (this->type == other->type && this->service == other->service && this->pid == other->pid &&
+        this->header == other->header) {
+        this->init = other->init;
+        this->supported = other->supported;
+        this->failures = other->failures;
+        this->retryAt = other->retryAt;
+        this->quarantined = other->quarantined;
+        this->rawResponse = other->rawResponse;
+    }
 }
 
 template<typename T>
@@ -266,6 +670,20 @@ TypedOBDState<T>::TypedOBDState(obd::OBDStateType type, const char *name, const
     type, name, description, icon, unit, deviceClass, measurement, diagnostic) {
 }
 
+template<typename T>
+TypedOBDState<T>::TypedOBDState(const TypedOBDState &other): OBDState(other) {
+    this->oldValue = T();
+    this->value = T();
+    this->reportedValue = T();
+    strlcpy(this->readFunctionName, other.readFunctionName, sizeof(this->readFunctionName));
+    this->readFunction = other.readFunction;
+    this->postProcessFunction = other.postProcessFunction;
+    strlcpy(this->valueFormat, other.valueFormat, sizeof(this->valueFormat));
+    strlcpy(this->valueFormatExpression, other.valueFormatExpression, sizeof(this->valueFormatExpression));
+    strlcpy(this->valueFormatFunctionName, other.valueFormatFunctionName, sizeof(this->valueFormatFunctionName));
+    this->valueFormatFunction = other.valueFormatFunction;
+}
+
 template<typename T>
 const char *TypedOBDState<T>::valueType() const {
     return "generic";
@@ -300,24 +718,106 @@ TypedOBDState<T> *TypedOBDState<T>::withVisible(const bool visible) {
     return this;
 }
 
+template<typename T>
+OBDValueSnapshot<T> TypedOBDState<T>::getSnapshot() const {
+    OBDValueSnapshot<T> snapshot;
+    uint32_t seq;
+    do {
+        seq = beginRead();
+        snapshot.value = this->value;
+        snapshot.oldValue = this->oldValue;
+        snapshot.lastUpdate = this->lastUpdate;
+        snapshot.previousUpdate = this->previousUpdate;
+    } while (retryRead(seq));
+
+    return snapshot;
+}
+
+template<typename T>
+void TypedOBDState<T>::estimateChange(T value, const long timestamp) {
+    if (!this->isAdaptive() || this->lastUpdate <= 0 || timestamp <= this->lastUpdate) {
+        return;
+    }
+
+    const double rate = fabs(static_cast<double>(value) - static_cast<double>(this->value)) /
+                        (timestamp - this->lastUpdate);
+    this->changeRate = rate > this->changeRate
+                           ? rate
+                           : this->changeRate + (rate - this->changeRate) * OBD_ADAPTIVE_DECAY;
+
+    double threshold = this->deadband > 0 && !this->deadbandRelative
+                           ? this->deadband
+                           : fabs(static_cast<double>(value)) *
+                             (this->deadband > 0 ? this->deadband : OBD_ADAPTIVE_CHANGE) / 100.0;
+    // the smallest possible change of integers and booleans
+    if (std::numeric_limits<T>::is_integer) {
+        threshold = std::max(threshold, 1.0);
+    }
+
+    const double interval = this->changeRate > 0 ? threshold / this->changeRate : this->maxInterval;
+    this->adaptiveInterval = static_cast<long>(std::min<double>(std::max<double>(interval, this->updateInterval),
+                                                                this->maxInterval));
+}
+
+template<typename T>
+void TypedOBDState<T>::publishValue(T value, const long timestamp, const bool estimate) {
+    if (estimate) {
+        estimateChange(value, timestamp);
+    }
+
+    beginWrite();
+    this->oldValue = this->value;
+    this->previousUpdate = this->lastUpdate;
+    this->value = value;
+    this->lastUpdate = timestamp;
+    endWrite();
+}
+
+template<typename T>
+bool TypedOBDState<T>::checkReport(T value, const long timestamp) {
+    bool report = this->reportedAt == 0 || this->maxSilence > 0 && timestamp - this->reportedAt >= this->maxSilence;
+    if (!report) {
+        const double delta = fabs(static_cast<double>(value) - static_cast<double>(this->reportedValue));
+        if (this->deadband > 0) {
+            const double threshold = this->deadbandRelative
+                                         ? fabs(static_cast<double>(this->reportedValue)) * this->deadband / 100.0
+                                         : this->deadband;
+            report = delta > threshold;
+        } else {
+            report = delta != 0;
+        }
+    }
+
+    if (report) {
+        this->reportedValue = value;
+        this->reportedAt = timestamp;
+    }
+
+    return report;
+}
+
 template<typename T>
 T TypedOBDState<T>::getOldValue() {
-    return this->oldValue;
+    return getSnapshot().oldValue;
 }
 
 template<typename T>
 void TypedOBDState<T>::setOldValue(T value) {
+    beginWrite();
     this->oldValue = value;
+    endWrite();
 }
 
 template<typename T>
 T TypedOBDState<T>::getValue() {
-    return this->value;
+    return getSnapshot().value;
 }
 
 template<typename T>
 void TypedOBDState<T>::setValue(T value) {
+    beginWrite();
     this->value = value;
+    endWrite();
 }
 
 template<typename T>
@@ -326,6 +826,11 @@ TypedOBDState<T> *TypedOBDState<T>::withUpdateInterval(long interval) {
     return this;
 }
 
+template<typename T>
+const char *TypedOBDState<T>::getReadFuncName() const {
+    return this->readFunctionName;
+}
+
 template<typename T>
 void TypedOBDState<T>::setReadFuncName(const char *funcName) {
     strlcpy(this->readFunctionName, funcName, sizeof(this->readFunctionName));
@@ -349,6 +854,11 @@ TypedOBDState<T> *TypedOBDState<T>::withReadFunc(const std::function<T()> &func)
     return this;
 }
 
+template<typename T>
+bool TypedOBDState<T>::hasReadFunc() const {
+    return this->readFunction != nullptr;
+}
+
 template<typename T>
 void TypedOBDState<T>::readValue() {
     if (elm327 != nullptr && elm327->elm_port && this->type == obd::READ) {
@@ -374,9 +884,8 @@ void TypedOBDState<T>::readValue() {
                     }
                 }
 
-                this->oldValue = this->value;
-                this->previousUpdate = this->lastUpdate;
                 this->processing = true;
+                this->requestStart = micros();
             }
 
             T value = static_cast<T>(this->readFunction != nullptr
@@ -384,20 +893,26 @@ void TypedOBDState<T>::readValue() {
                                          : elm327->processPID(this->service, this->pid, this->numResponses,
                                                               this->numExpectedBytes,
                                                               this->scaleFactor, this->bias));
+            if (this->readFunction == nullptr && elm327->nb_rx_state == ELM_SUCCESS) {
+                this->rawResponse = elm327->response;
+                if (this->hasExtraction()) {
+                    value = static_cast<T>(this->decodeResponse(this->rawResponse));
+                }
+            }
 
+            // value, old value and timestamps are published together after the response is complete
             if (elm327->nb_rx_state == ELM_SUCCESS) {
-                this->value = value;
+                publishValue(value, millis());
 
                 if (this->postProcessFunction != nullptr) {
                     this->postProcessFunction(this);
                 }
 
-                this->lastUpdate = millis();
                 this->processing = false;
                 this->updateStatus = elm327->nb_rx_state;
             } else if (elm327->nb_rx_state == ELM_NO_DATA) {
-                this->value = 0;
-                this->lastUpdate = millis();
+                // the ECU has no current value, e.g. the fuel rate with the engine off, it is backed off all the same
+                publishValue(0, millis(), false);
                 this->processing = false;
                 this->updateStatus = elm327->nb_rx_state;
             } else if (elm327->nb_rx_state != ELM_GETTING_MSG) {
@@ -405,6 +920,10 @@ void TypedOBDState<T>::readValue() {
                 this->updateStatus = elm327->nb_rx_state;
             }
 
+            if (!this->processing) {
+                recordRequest(micros() - this->requestStart, this->updateStatus);
+            }
+
             if (this->header > 0 && this->setHeader && !this->processing) {
                 if (elm327->sendCommand_Blocking(SET_ALL_TO_DEFAULTS) == ELM_SUCCESS) {
                     if (strstr(elm327->payload, RESPONSE_OK) != nullptr) {
@@ -426,16 +945,12 @@ template<typename T>
 void TypedOBDState<T>::calcValue(const std::function<double(const char *)> &func,
                                  const std::map<const char *, const std::function<double(double)>> &funcs) {
     if (this->type == obd::CALC && strlen(this->calcExpression) != 0) {
-        if (!this->processing) {
-            this->oldValue = this->value;
-            this->previousUpdate = this->lastUpdate;
-            this->processing = true;
-        }
+        this->processing = true;
 
         ExprParser parser;
         parser.setCustomFunctions(funcs);
         parser.setVariableResolveFunction(func);
-        this->value = static_cast<T>(parser.evalExp(const_cast<char *>(this->calcExpression)));
+        publishValue(static_cast<T>(parser.evalExp(const_cast<char *>(this->calcExpression))), millis());
         if (strlen(parser.errormsg) > 0) {
             Serial.println();
             Serial.print(this->name);
@@ -444,11 +959,15 @@ void TypedOBDState<T>::calcValue(const std::function<double(const char *)> &func
             Serial.print(") : ");
             Serial.println(parser.errormsg);
         }
-        this->lastUpdate = millis();
         this->processing = false;
     }
 }
 
+template<typename T>
+void TypedOBDState<T>::applyValue(const double value, const long timestamp) {
+    publishValue(static_cast<T>(value), timestamp);
+}
+
 template<typename T>
 void TypedOBDState<T>::setPostProcessFunc(const std::function<void(TypedOBDState *)> &postProcessFunction) {
     this->postProcessFunction = postProcessFunction;
@@ -461,6 +980,11 @@ TypedOBDState<T> *TypedOBDState<
     return this;
 }
 
+template<typename T>
+const char *TypedOBDState<T>::getValueFormat() const {
+    return this->valueFormat;
+}
+
 template<typename T>
 void TypedOBDState<T>::setValueFormat(const char *format) {
     strlcpy(this->valueFormat, format, sizeof(this->valueFormat));
@@ -472,6 +996,11 @@ TypedOBDState<T> *TypedOBDState<T>::withValueFormat(const char *format) {
     return this;
 }
 
+template<typename T>
+const char *TypedOBDState<T>::getValueFormatExpression() const {
+    return this->valueFormatExpression;
+}
+
 template<typename T>
 void TypedOBDState<T>::setValueFormatExpression(const char *expression) {
     strlcpy(this->valueFormatExpression, expression, sizeof(this->valueFormatExpression));
@@ -483,6 +1012,11 @@ TypedOBDState<T> *TypedOBDState<T>::withValueFormatExpression(const char *expres
     return this;
 }
 
+template<typename T>
+const char *TypedOBDState<T>::getValueFormatFuncName() const {
+    return this->valueFormatFunctionName;
+}
+
 template<typename T>
 void TypedOBDState<T>::setValueFormatFuncName(const char *funcName) {
     strlcpy(this->valueFormatFunctionName, funcName, sizeof(this->valueFormatFunctionName));
@@ -547,6 +1081,12 @@ void TypedOBDState<T>::toJSON(JsonDocument &doc) {
             doc["pid"]["header"] = this->header;
             doc["pid"]["numResponses"] = this->numResponses;
             doc["pid"]["numExpectedBytes"] = this->numExpectedBytes;
+            if (this->hasExtraction()) {
+                doc["pid"]["byteOffset"] = this->byteOffset;
+                doc["pid"]["numBytes"] = this->numBytes;
+                doc["pid"]["bitOffset"] = this->bitOffset;
+                doc["pid"]["numBits"] = this->numBits;
+            }
             if (this->scaleFactorExpression != nullptr) {
                 doc["pid"]["scaleFactor"] = this->scaleFactorExpression;
             }
@@ -560,15 +1100,35 @@ void TypedOBDState<T>::toJSON(JsonDocument &doc) {
     if (this->valueFormatFunction != nullptr && strlen(this->valueFormatFunctionName) != 0) {
         doc["value"]["func"] = this->valueFormatFunctionName;
     } else if (strlen(this->valueFormatExpression) != 0) {
-        doc["value"]["expression"] = this->valueFormatExpression;
+        doc["value"]["expr"] = this->valueFormatExpression;
     }
 }
 
+template<typename T>
+void TypedOBDState<T>::carryOver(const OBDState *other) {
+    OBDState::carryOver(other);
+
+    if (strcmp(this->valueType(), other->valueType()) == 0) {
+        auto *typed = static_cast<const TypedOBDState *>(other);
+        this->oldValue = typed->oldValue;
+        this->value = typed->value;
+        this->reportedValue = typed->reportedValue;
+        this->changeRate = typed->changeRate;
+    } else {
+        this->reportedAt = 0;
+    }
+}
+
+template class TypedOBDState<bool>;
+template class TypedOBDState<int>;
+template class TypedOBDState<float>;
+
 OBDStateBool::OBDStateBool(obd::OBDStateType type, const char *name, const char *description,
                            const char *icon, const char *unit, const char *deviceClass,
                            const bool measurement, const bool diagnostic): TypedOBDState(
     type, name, description, icon, unit, deviceClass, measurement, diagnostic) {
     this->oldValue = false;
+    this->reportedValue = false;
     this->value = false;
     this->TypedOBDState::setValueFormatFunc([](const bool val) {
         return strdup(val ? "on" : "off");
@@ -579,6 +1139,10 @@ const char *OBDStateBool::valueType() const {
     return "bool";
 }
 
+OBDStateBool *OBDStateBool::clone() const {
+    return new OBDStateBool(*this);
+}
+
 OBDStateBool *OBDStateBool::withPIDSettings(const uint8_t &service, const uint16_t &pid, const uint16_t &header,
                                             const uint8_t &numResponses,
                                             const uint8_t &numExpectedBytes, const double &scaleFactor,
@@ -655,6 +1219,7 @@ OBDStateFloat::OBDStateFloat(obd::OBDStateType type, const char *name, const cha
                              const bool measurement, const bool diagnostic): TypedOBDState(
     type, name, description, icon, unit, deviceClass, measurement, diagnostic) {
     this->oldValue = 0.0;
+    this->reportedValue = 0.0;
     this->value = 0.0;
     this->TypedOBDState::setValueFormat("%4.2f");
 }
@@ -663,6 +1228,10 @@ const char *OBDStateFloat::valueType() const {
     return "float";
 }
 
+OBDStateFloat *OBDStateFloat::clone() const {
+    return new OBDStateFloat(*this);
+}
+
 OBDStateFloat *OBDStateFloat::withPIDSettings(const uint8_t &service, const uint16_t &pid, const uint16_t &header,
                                               const uint8_t &numResponses,
                                               const uint8_t &numExpectedBytes, const double &scaleFactor,
@@ -739,6 +1308,7 @@ OBDStateInt::OBDStateInt(obd::OBDStateType type, const char *name, const char *d
                          const bool measurement, const bool diagnostic): TypedOBDState(
     type, name, description, icon, unit, deviceClass, measurement, diagnostic) {
     this->oldValue = 0;
+    this->reportedValue = 0;
     this->value = 0;
     this->TypedOBDState::setValueFormat("%d");
 }
@@ -747,6 +1317,10 @@ const char *OBDStateInt::valueType() const {
     return "int";
 }
 
+OBDStateInt *OBDStateInt::clone() const {
+    return new OBDStateInt(*this);
+}
+
 OBDStateInt *OBDStateInt::withPIDSettings(const uint8_t &service, const uint16_t &pid, const uint16_t &header,
                                           const uint8_t &numResponses,
                                           const uint8_t &numExpectedBytes, const double &scaleFactor,
@@ -16,10 +16,20 @@
  */
 
 #pragma once
+#include <atomic>
 #include <ELMduino.h>
 #include <functional>
 #include <map>
 #include <ArduinoJson.h>
+#include "histogram.h"
+
+#define OBD_ADAPTIVE_CHANGE     1
+#define OBD_ADAPTIVE_DECAY      0.25
+
+#define OBD_BACKOFF_MIN_DELAY   100
+#define OBD_BACKOFF_MAX_DELAY   60000
+#define OBD_QUARANTINE_FAILURES 10
+#define OBD_QUARANTINE_PROBE    300000
 
 namespace obd {
     typedef enum {
@@ -28,7 +38,39 @@ namespace obd {
     } OBDStateType;
 }
 
+/**
+ * Consistent copy of a value together with its update timestamps.
+ */
+template<typename T>
+struct OBDValueSnapshot {
+    T value;
+    T oldValue;
+    long lastUpdate;
+    long previousUpdate;
+};
+
+/**
+ * Request counters of a state, only written by the polling task.
+ * Readers may see a partially updated set, which is good enough for monitoring.
+ */
+struct OBDStateMetrics {
+    uint32_t updates;
+    uint32_t noData;
+    uint32_t timeouts;
+    uint32_t errors;
+    uint32_t quarantines;
+    uint32_t shared;
+    uint32_t lastLatency;
+    uint64_t latencySum;
+    uint64_t intervalSum;
+    uint32_t intervalCount;
+};
+
+struct OBDStateSet;
+
 class OBDState {
+    friend struct OBDStateSet;
+
 protected:
     ELM327 *elm327 = nullptr;
 
@@ -47,12 +89,20 @@ protected:
     uint16_t header = 0;
     uint8_t numResponses = 0;
     uint8_t numExpectedBytes = 0;
+    uint8_t byteOffset = 0;
+    uint8_t numBytes = 0;
+    uint8_t bitOffset = 0;
+    uint8_t numBits = 0;
+    uint64_t rawResponse = 0;
     double scaleFactor = 1;
     char scaleFactorExpression[257] = "\0";
     float bias = 0;
 
     char calcExpression[257] = "\0";
 
+    /** allocated only for states with a poll guard */
+    char *pollWhenExpression = nullptr;
+
     bool init = false;
     bool checkPidSupport = false;
     bool setHeader = false;
@@ -60,19 +110,80 @@ protected:
     bool enabled = true;
     bool visible = true;
     bool processing = false;
+    bool suspended = false;
 
     long updateInterval = 1000;
 
+    long plannedInterval = 0;
+
+    long maxInterval = 0;
+
+    long adaptiveInterval = 0;
+
+    float deadband = 0;
+
+    bool deadbandRelative = false;
+
+    long maxSilence = 0;
+
+    long reportedAt = 0;
+
     long previousUpdate = 0;
 
     long lastUpdate = 0;
 
     int8_t updateStatus = 0;
 
+    uint16_t failures = 0;
+
+    unsigned long retryAt = 0;
+
+    bool quarantined = false;
+
+    unsigned long requestStart = 0;
+
+    OBDStateMetrics metrics{};
+
+    /** allocated with the first finished request, so CALC and disabled states don't hold one */
+    std::atomic<LatencyHistogram *> histogram{nullptr};
+
+    /**
+     * Sequence counter of the value and timestamps, odd while they are written.
+     */
+    std::atomic<uint32_t> sequence{0};
+
+    /** the number of state sets holding this state */
+    std::atomic<uint8_t> sets{0};
+
+    void beginWrite();
+
+    void endWrite();
+
+    uint32_t beginRead() const;
+
+    bool retryRead(uint32_t seq) const;
+
     void setPreviousUpdate(long timestamp);
 
     void setLastUpdate(long timestamp);
 
+    /**
+     * Counts a finished request in the metrics, must be called after the value was published.
+     *
+     * @param latency the time from request to response in µs
+     * @param status the ELM327 receive state
+     */
+    void recordRequest(uint32_t latency, int8_t status);
+
+    void recordInterval();
+
+    /**
+     * Copies the configuration, the runtime data is taken over by carryOver().
+     *
+     * @param other the state
+     */
+    OBDState(const OBDState &other);
+
 public:
     void *operator new(size_t size);
 
@@ -81,7 +192,7 @@ public:
     OBDState(obd::OBDStateType type, const char *name, const char *description, const char *icon,
              const char *unit = "", const char *deviceClass = "", bool measurement = true, bool diagnostic = false);
 
-    virtual ~OBDState() = default;
+    virtual ~OBDState();
 
     obd::OBDStateType getType() const;
 
@@ -107,6 +218,32 @@ public:
 
     virtual bool hasCalcExpression() const;
 
+    const char *getCalcExpression() const;
+
+    /**
+     * Sets the poll guard, the state is left out of the schedule while the expression evaluates to <code>0</code>,
+     * e.g. <code>$engineRunning</code> for states, which only respond with the engine running.
+     *
+     * @param expression the guard expression, empty to always poll the state
+     */
+    void setPollWhen(const char *expression);
+
+    bool hasPollWhen() const;
+
+    const char *getPollWhen() const;
+
+    /**
+     * @return <code>true</code> if the poll guard is false and the state isn't polled
+     */
+    bool isSuspended() const;
+
+    /**
+     * Must be called by the polling task only.
+     *
+     * @param suspended <code>true</code> to leave the state out of the schedule
+     */
+    void setSuspended(bool suspended);
+
     uint32_t supportedPIDs(const uint8_t &service, const uint16_t &pid) const;
 
     bool isPIDSupported(const uint8_t &service, const uint16_t &pid) const;
@@ -130,6 +267,79 @@ public:
                                       const char *scaleFactorExpression = nullptr,
                                       const float &bias = 0);
 
+    uint8_t getService() const;
+
+    uint16_t getPID() const;
+
+    uint16_t getHeader() const;
+
+    uint8_t getNumResponses() const;
+
+    uint8_t getNumExpectedBytes() const;
+
+    double getScaleFactor() const;
+
+    const char *getScaleFactorExpression() const;
+
+    /**
+     * Sets the scale factor expression without evaluating it, e.g. if the scale factor was already evaluated.
+     *
+     * @param expression the scale factor expression
+     */
+    void setScaleFactorExpression(const char *expression);
+
+    float getBias() const;
+
+    /**
+     * Selects the bytes and bits of the response, which hold the value, e.g. a flag of a bit encoded PID.
+     * Must be set after the PID settings.
+     *
+     * @param byteOffset the first byte of the value, <code>0</code> for byte A
+     * @param numBytes the number of bytes, <code>0</code> up to the end of the response
+     * @param bitOffset the lowest bit of the value within these bytes
+     * @param numBits the number of bits, <code>0</code> for all bits
+     */
+    void setExtraction(uint8_t byteOffset, uint8_t numBytes, uint8_t bitOffset = 0, uint8_t numBits = 0);
+
+    bool hasExtraction() const;
+
+    uint8_t getByteOffset() const;
+
+    uint8_t getNumBytes() const;
+
+    uint8_t getBitOffset() const;
+
+    uint8_t getNumBits() const;
+
+    /**
+     * Decodes a response of the PID with the extraction, the scale factor and the bias of this state.
+     *
+     * @param raw the data bytes of the response, big endian
+     * @return the value
+     */
+    double decodeResponse(uint64_t raw) const;
+
+    /**
+     * @return the data bytes of the last successful response, big endian
+     */
+    uint64_t getRawResponse() const;
+
+    /**
+     * @return the ELM327 receive state of the last finished request
+     */
+    int8_t getUpdateStatus() const;
+
+    /**
+     * @param other the other state
+     * @return <code>true</code> if both states send the same request, so they can share the response
+     */
+    bool sharesRequest(const OBDState *other) const;
+
+    /**
+     * @return <code>true</code> if the value is read by a function instead of the response of the PID
+     */
+    virtual bool hasReadFunc() const;
+
     bool isInit() const;
 
     void setCheckPidSupport(bool enable);
@@ -156,16 +366,166 @@ public:
 
     long getUpdateInterval() const;
 
+    long getMaxInterval() const;
+
+    /**
+     * Makes the interval adaptive, it is lengthened up to the max interval while the value is stable and
+     * shortened down to the update interval if it changes quickly.
+     *
+     * @param interval the longest interval in ms, <code>0</code> to always use the update interval
+     */
+    void setMaxInterval(long interval);
+
+    /**
+     * @return <code>true</code> if the interval adapts to the signal dynamics
+     */
+    bool isAdaptive() const;
+
+    /**
+     * @return the interval adapted to the last changes of the value in ms, the update interval if the state isn't
+     * adaptive or not read yet
+     */
+    long getAdaptiveInterval() const;
+
+    /**
+     * @return the interval, which the link can sustain according to the schedule plan in ms,
+     * <code>0</code> if the state isn't planned
+     */
+    long getPlannedInterval() const;
+
+    /**
+     * Must be called by the polling task only.
+     *
+     * @param interval the achievable interval in ms, <code>0</code> if the state isn't planned
+     */
+    void setPlannedInterval(long interval);
+
+    float getDeadband() const;
+
+    bool isDeadbandRelative() const;
+
+    /**
+     * Sets the minimum change against the last reported value, which is reported again.
+     *
+     * @param deadband the minimum change, <code>0</code> to report every change
+     * @param relative <code>true</code> if the deadband is a percentage of the last reported value
+     */
+    void setDeadband(float deadband, bool relative = false);
+
+    long getMaxSilence() const;
+
+    /**
+     * Sets the time after which a value is reported even if it is within the deadband.
+     *
+     * @param maxSilence the time in ms, <code>0</code> to disable
+     */
+    void setMaxSilence(long maxSilence);
+
     long getPreviousUpdate() const;
 
     long getLastUpdate() const;
 
+    const OBDStateMetrics &getMetrics() const;
+
+    /**
+     * @return the latency histogram or <code>nullptr</code> if no request finished yet
+     */
+    const LatencyHistogram *getLatency() const;
+
+    /**
+     * @return the average time between two updates in ms or <code>0</code> if unknown
+     */
+    uint32_t getAvgInterval() const;
+
+    /**
+     * @return the average request latency in µs
+     */
+    uint32_t getAvgLatency() const;
+
+    /**
+     * @return the number of finished requests since the metrics were reset
+     */
+    uint32_t getRequests() const;
+
+    /**
+     * @return the number of consecutive failed requests
+     */
+    uint16_t getFailures() const;
+
+    /**
+     * Counts the result of a finished request toward backoff and quarantine. Consecutive NO DATA, timeouts and
+     * errors back off the next request exponentially, starting with the update interval up to
+     * OBD_BACKOFF_MAX_DELAY. After OBD_QUARANTINE_FAILURES the state is quarantined and only probed every
+     * OBD_QUARANTINE_PROBE ms, until it responds again. Must be called by the polling task only.
+     *
+     * @param status the ELM327 receive state
+     * @param linkResponding <code>false</code> if the whole link fails, the failure then only backs off the state
+     */
+    void recordResult(int8_t status, bool linkResponding);
+
+    /**
+     * Clears the failures, the backoff and the quarantine. Must be called by the polling task only.
+     */
+    void resetFailures();
+
+    /**
+     * @return <code>true</code> if the state is quarantined after too many failed requests
+     */
+    bool isQuarantined() const;
+
+    /**
+     * @return <code>true</code> if the next request is delayed after a failed request
+     */
+    bool isBackingOff() const;
+
+    /**
+     * @return the time in ms until the next request is allowed, <code>0</code> if it isn't delayed
+     */
+    long getRetryIn() const;
+
+    /**
+     * Clears all request counters and the latency histogram, must be called by the polling task.
+     */
+    void resetMetrics();
+
     virtual void readValue();
 
     virtual void calcValue(const std::function<double(const char *)> &func,
                            const std::map<const char *, const std::function<double(double)>> &funcs = {});
 
+    /**
+     * Sets a recorded value like it was read, e.g. to evaluate expressions over a trip log.
+     *
+     * @param value the value
+     * @param timestamp the time of the update
+     */
+    virtual void applyValue(double value, long timestamp);
+
+    /**
+     * Publishes the value of a response, which was requested by another state with the same request.
+     * Failures and quarantine are left to the requests of the state itself. Must be called by the polling task only.
+     *
+     * @param raw the data bytes of the response, big endian
+     * @param timestamp the time of the response
+     */
+    void applyResponse(uint64_t raw, long timestamp);
+
     virtual void toJSON(JsonDocument &doc);
+
+    /**
+     * Takes over the runtime data of a replaced state, like update timestamps and the PID support.
+     *
+     * @param other the replaced state with the same name
+     */
+    virtual void carryOver(const OBDState *other);
+
+    /**
+     * Copies the configuration of the state, e.g. to patch it while the state itself is polled.
+     * The runtime data, like values and metrics, is taken over with carryOver() once the copy replaces the state.
+     *
+     * @return the copy
+     */
+    virtual OBDState *clone() const = 0;
 };
 
 template<typename T>
@@ -189,6 +549,31 @@ protected:
 
     std::function<char *(T)> valueFormatFunction = nullptr;
 
+    T reportedValue;
+
+    /**
+     * Smoothed change of the value per ms, follows faster changes immediately and slower ones gradually.
+     */
+    double changeRate = 0;
+
+    /**
+     * Updates the change rate with a new value and derives the adaptive interval, the time until the value is
+     * expected to change by the deadband or by OBD_ADAPTIVE_CHANGE percent.
+     *
+     * @param value the new value
+     * @param timestamp the update timestamp of the value
+     */
+    void estimateChange(T value, long timestamp);
+
+    /**
+     * @param value the new value
+     * @param timestamp the update timestamp of the value
+     * @param estimate <code>false</code> if the value isn't a measurement, e.g. on NO DATA
+     */
+    void publishValue(T value, long timestamp, bool estimate = true);
+
+    TypedOBDState(const TypedOBDState &other);
+
 public:
     TypedOBDState(obd::OBDStateType type, const char *name, const char *description, const char *icon,
                   const char *unit = "", const char *deviceClass = "", bool measurement = true,
@@ -210,6 +595,23 @@ public:
 
     TypedOBDState *withVisible(bool visible) override;
 
+    /**
+     * Reads value, old value and their update timestamps without blocking the polling task.
+     *
+     * @return the consistent snapshot
+     */
+    OBDValueSnapshot<T> getSnapshot() const;
+
+    /**
+     * Checks a new value against the deadband and max silence and remembers it if it should be reported.
+     * Must be called by the polling task only.
+     *
+     * @param value the new value
+     * @param timestamp the update timestamp of the value
+     * @return <code>true</code> if the value should be reported
+     */
+    bool checkReport(T value, long timestamp);
+
     virtual T getOldValue();
 
     virtual void setOldValue(T value);
@@ -220,6 +622,8 @@ public:
 
     TypedOBDState *withUpdateInterval(long interval) override;
 
+    const char *getReadFuncName() const;
+
     void setReadFuncName(const char *funcName);
 
     virtual TypedOBDState *withReadFuncName(const char *funcName);
@@ -228,6 +632,8 @@ public:
 
     virtual TypedOBDState *withReadFunc(const std::function<T()> &func);
 
+    bool hasReadFunc() const override;
+
     void readValue() override;
 
     virtual TypedOBDState *withCalcExpression(const char *expression);
@@ -235,18 +641,26 @@ public:
     void calcValue(const std::function<double(const char *)> &func,
                    const std::map<const char *, const std::function<double(double)>> &funcs) override;
 
+    void applyValue(double value, long timestamp) override;
+
     virtual void setPostProcessFunc(const std::function<void(TypedOBDState *)> &postProcessFunction);
 
     virtual TypedOBDState *withPostProcessFunc(const std::function<void(TypedOBDState *)> &postProcessFunction);
 
+    const char *getValueFormat() const;
+
     virtual void setValueFormat(const char *format);
 
     virtual TypedOBDState *withValueFormat(const char *format);
 
+    const char *getValueFormatExpression() const;
+
     virtual void setValueFormatExpression(const char *expression);
 
     virtual TypedOBDState *withValueFormatExpression(const char *expression);
 
+    const char *getValueFormatFuncName() const;
+
     virtual void setValueFormatFuncName(const char *funcName);
 
     virtual TypedOBDState *withValueFormatFuncName(const char *funcName);
@@ -264,6 +678,8 @@ public:
     virtual char *formatValue();
 
     void toJSON(JsonDocument &doc) override;
+
+    void carryOver(const OBDState *other) override;
 };
 
 class OBDStateBool final : public TypedOBDState<bool> {
@@ -304,6 +720,8 @@ public:
     OBDStateBool *withValueFormatFuncName(const char *funcName) override;
 
     OBDStateBool *withValueFormatFunc(const std::function<char *(bool)> &valueFormatFunction) override;
+
+    OBDStateBool *clone() const override;
 };
 
 class OBDStateFloat final : public TypedOBDState<float> {
@@ -345,6 +763,8 @@ public:
     OBDStateFloat *withValueFormatFuncName(const char *funcName) override;
 
     OBDStateFloat *withValueFormatFunc(const std::function<char *(float)> &valueFormatFunction) override;
+
+    OBDStateFloat *clone() const override;
 };
 
 class OBDStateInt final : public TypedOBDState<int> {
@@ -385,4 +805,6 @@ public:
     OBDStateInt *withValueFormatFuncName(const char *funcName) override;
 
     OBDStateInt *withValueFormatFunc(const std::function<char *(int)> &valueFormatFunction) override;
+
+    OBDStateInt *clone() const override;
 };
@@ -18,15 +18,236 @@
 #include "OBDStates.h"
 #include <Arduino.h>
 #include <algorithm>
+#include <esp_timer.h>
+#include <ExprParser.h>
 #include <numeric>
 
+OBDStateSet::~OBDStateSet() {
+    for (OBDState *state: states) {
+        if (--state->sets == 0) {
+            delete state;
+        }
+    }
+}
+
+void OBDStateSet::add(OBDState *state) {
+    ++state->sets;
+    states.push_back(state);
+}
+
 OBDStates::OBDStates(ELM327 *elm327) {
     this->elm327 = elm327;
+    this->updateMutex = xSemaphoreCreateMutex();
+}
+
+const OBDStateSet *OBDStates::currentStates() const {
+    static const OBDStateSet empty;
+    const OBDStateSet *set = current.load();
+    return set != nullptr ? set : &empty;
+}
+
+uint8_t OBDStates::readLock() {
+    for (;;) {
+        const uint8_t readEpoch = epoch.load();
+        readers[readEpoch]++;
+        // the epoch was flipped in between, the swap may not have seen this reader
+        if (epoch.load() == readEpoch) {
+            return readEpoch;
+        }
+        readers[readEpoch]--;
+    }
+}
+
+void OBDStates::readUnlock(const uint8_t readEpoch) {
+    readers[readEpoch]--;
+}
+
+void OBDStates::lockUpdates() {
+    xSemaphoreTake(updateMutex, portMAX_DELAY);
+}
+
+void OBDStates::unlockUpdates() {
+    xSemaphoreGive(updateMutex);
+}
+
+void OBDStates::beginUpdate() {
+    lockUpdates();
+    building = new OBDStateSet();
+}
+
+void OBDStates::commitUpdate() {
+    OBDStateSet *set = building;
+    building = nullptr;
+
+    // nothing to wait for before the first set is published
+    set->generation = ++generation;
+    OBDStateSet *expected = nullptr;
+    if (!current.compare_exchange_strong(expected, set)) {
+        // a committed set which wasn't published yet was never visible to readers
+        delete pending.exchange(set);
+    }
+
+    unlockUpdates();
+}
+
+void OBDStates::abortUpdate() {
+    delete building;
+    building = nullptr;
+    unlockUpdates();
+}
+
+void OBDStates::shareState(OBDState *state) {
+    building->add(state);
+}
+
+OBDStateSet *OBDStates::updatingStates() const {
+    return building;
+}
+
+const OBDStateSet *OBDStates::latestStates() const {
+    const OBDStateSet *set = pending.load();
+    return set != nullptr ? set : currentStates();
+}
+
+void OBDStates::synchronize() {
+    if (retired != nullptr) {
+        if (readers[retiredEpoch].load() != 0) {
+            return;
+        }
+        delete retired;
+        retired = nullptr;
+    }
+
+    if (pending.load() == nullptr) {
+        return;
+    }
+
+    OBDStateSet *old = current.load();
+    // a running request belongs to the old set, swap after it is finished
+    for (const OBDState *state: old->states) {
+        if (state->isProcessing()) {
+            return;
+        }
+    }
+
+    OBDStateSet *set = pending.exchange(nullptr);
+    if (set == nullptr) {
+        return;
+    }
+
+    for (OBDState *state: set->states) {
+        for (const OBDState *oldState: old->states) {
+            if (strcmp(state->getName(), oldState->getName()) == 0) {
+                // a shared state keeps its values anyway
+                if (state != oldState) {
+                    state->carryOver(oldState);
+                }
+                break;
+            }
+        }
+    }
+
+    set->generation = ++generation;
+    current.store(set);
+    retiredEpoch = epoch.load();
+    epoch.store(retiredEpoch ^ 1);
+    retired = old;
+}
+
+QueueHandle_t OBDStates::subscribe(const size_t length) {
+    const uint8_t index = numSubscribers.load();
+    if (index >= OBD_MAX_SUBSCRIBERS) {
+        return nullptr;
+    }
+
+    QueueHandle_t queue = xQueueCreate(length, sizeof(OBDStateEvent));
+    if (queue != nullptr) {
+        subscribers[index] = queue;
+        numSubscribers = index + 1;
+    }
+
+    return queue;
+}
+
+OBDState *OBDStates::getEventState(const OBDStateEvent &event) const {
+    return currentStates()->generation == event.generation ? event.state : nullptr;
+}
+
+uint32_t OBDStates::getDroppedEvents() const {
+    return droppedEvents.load();
+}
+
+uint32_t OBDStates::getSuppressedEvents() const {
+    return suppressedEvents.load();
+}
+
+uint32_t OBDStates::getCompletedUpdates() const {
+    return completedUpdates.load();
+}
+
+template<typename T>
+static bool readEventValue(OBDState *state, OBDStateEvent &event) {
+    auto *typed = reinterpret_cast<TypedOBDState<T> *>(state);
+    const OBDValueSnapshot<T> snapshot = typed->getSnapshot();
+    event.value = snapshot.value;
+    event.timestamp = snapshot.lastUpdate;
+    return typed->checkReport(snapshot.value, snapshot.lastUpdate);
+}
+
+void OBDStates::notify(OBDState *state) {
+    const uint8_t count = numSubscribers.load();
+    if (count == 0) {
+        return;
+    }
+
+    OBDStateEvent event{};
+    event.state = state;
+    event.generation = currentStates()->generation;
+
+    bool changed = false;
+    if (strcmp(state->valueType(), "bool") == 0) {
+        changed = readEventValue<bool>(state, event);
+    } else if (strcmp(state->valueType(), "int") == 0) {
+        changed = readEventValue<int>(state, event);
+    } else if (strcmp(state->valueType(), "float") == 0) {
+        changed = readEventValue<float>(state, event);
+    }
+    if (!changed) {
+        suppressedEvents++;
+        return;
+    }
+
+    event.published = micros();
+    for (uint8_t i = 0; i < count; i++) {
+        if (xQueueSend(subscribers[i], &event, 0) != pdTRUE) {
+            droppedEvents++;
+        }
+    }
+}
+
+void OBDStates::setScaleIntervals(const bool enable) {
+    this->scaleIntervals = enable;
+}
+
+uint16_t OBDStates::getSuspendedStates() const {
+    return suspendedStates.load();
+}
+
+uint32_t OBDStates::getGuardEvaluations() const {
+    return guardEvaluations.load();
+}
+
+uint16_t OBDStates::getQuarantinedStates() const {
+    return quarantinedStates.load();
+}
+
+uint32_t OBDStates::getSharedReads() const {
+    return sharedReads.load();
 }
 
 void OBDStates::setCheckPidSupport(const bool enable) {
     this->checkPidSupport = enable;
-    for (auto &state: states) {
+    for (auto &state: currentStates()->states) {
         state->setCheckPidSupport(checkPidSupport);
     }
 }
@@ -44,32 +265,273 @@ void OBDStates::setCustomFunctions(const std::map<const char *, const std::funct
 }
 
 void OBDStates::clearStates() {
-    if (!states.empty()) {
-        for (unsigned i = 0; i < states.size(); ++i) {
-            OBDState *state = states[i];
-            free(state);
-        }
-        states.clear();
-    }
+    beginUpdate();
+    commitUpdate();
 }
 
 void OBDStates::getStates(const std::function<bool(OBDState *)> &pred, std::vector<OBDState *> &states) {
+    const OBDStateSet *set = currentStates();
     std::copy_if(
-        this->states.begin(),
-        this->states.end(),
+        set->states.begin(),
+        set->states.end(),
         std::back_inserter(states),
         pred
     );
 }
 
-bool OBDStates::compareStates(const OBDState *a, const OBDState *b) {
+bool OBDStates::compareStates(const OBDState *a, const OBDState *b) const {
     return a->isProcessing() && !b->isProcessing()
-           || (a->getLastUpdate() + a->getUpdateInterval()) < (b->getLastUpdate() + b->getUpdateInterval());
+           || (a->getLastUpdate() + getScheduledInterval(a)) < (b->getLastUpdate() + getScheduledInterval(b));
+}
+
+long OBDStates::getScheduledInterval(const OBDState *state) const {
+    const long interval = state->getAdaptiveInterval();
+    return scaleIntervals && state->getPlannedInterval() > interval ? state->getPlannedInterval() : interval;
+}
+
+void OBDStates::planSchedule() {
+    const OBDStateSet *set = currentStates();
+    const bool changed = set->generation != planGeneration;
+    if (changed) {
+        planComplete = false;
+    }
+    planGeneration = set->generation;
+    lastPlan = millis();
+
+    std::vector<OBDState *> periodic{};
+    uint64_t latencySum = 0;
+    uint32_t measured = 0;
+    uint16_t quarantined = 0;
+    for (auto *state: set->states) {
+        const bool read = state->isEnabled() && state->isSupported() && state->getType() == obd::READ;
+        if (read && state->getAvgLatency() != 0) {
+            latencySum += state->getAvgLatency();
+            ++measured;
+        }
+        quarantined += state->isQuarantined() ? 1 : 0;
+        if (read && state->getUpdateInterval() > 0 && !state->isSuspended() && !state->isQuarantined()) {
+            periodic.push_back(state);
+        } else {
+            state->setPlannedInterval(0);
+        }
+    }
+
+    // states without requests yet, e.g. after a config change, are expected to be as slow as the others
+    const uint32_t defaultLatency = measured != 0 ? latencySum / measured : OBD_DEFAULT_REQUEST_LATENCY;
+    const uint32_t overhead = requestOverhead;
+
+    std::stable_sort(periodic.begin(), periodic.end(), [](const OBDState *a, const OBDState *b) {
+        return a->getAdaptiveInterval() < b->getAdaptiveInterval();
+    });
+
+    // share of the link time, which every state needs for its configured interval
+    std::vector<double> demands(periodic.size());
+    double demand = 0;
+    for (size_t i = 0; i < periodic.size(); i++) {
+        // the response of a request, which is already sent at least as often, is reused
+        const auto shared = std::find_if(periodic.begin(), periodic.begin() + i, [&](const OBDState *state) {
+            return state->sharesRequest(periodic[i]);
+        });
+        if (shared != periodic.begin() + i) {
+            demands[i] = 0;
+            continue;
+        }
+        const uint32_t latency = periodic[i]->getAvgLatency() != 0 ? periodic[i]->getAvgLatency() : defaultLatency;
+        demands[i] = (latency + overhead) / (periodic[i]->getAdaptiveInterval() * 1000.0);
+        demand += demands[i];
+    }
+    planDemand = static_cast<uint32_t>(demand * 1000);
+
+    double remaining = OBD_PLAN_UTILIZATION;
+    size_t met = 0;
+    while (met < periodic.size() && demands[met] <= remaining) {
+        remaining -= demands[met];
+        periodic[met]->setPlannedInterval(periodic[met]->getAdaptiveInterval());
+        ++met;
+    }
+
+    const double rest = std::accumulate(demands.begin() + met, demands.end(), 0.0);
+    const double factor = remaining > 0 ? rest / remaining : OBD_MAX_PLANNED_INTERVAL;
+    for (size_t i = met; i < periodic.size(); i++) {
+        const double interval = std::min<double>(periodic[i]->getAdaptiveInterval() * factor,
+                                                 OBD_MAX_PLANNED_INTERVAL);
+        periodic[i]->setPlannedInterval(static_cast<long>(interval));
+    }
+
+    // reported on a config change with estimates and again once every periodic state was requested
+    const bool complete = std::all_of(periodic.begin(), periodic.end(), [](const OBDState *state) {
+        return state->getAvgLatency() != 0;
+    });
+    const auto unmet = static_cast<uint16_t>(periodic.size() - met);
+    if (changed || complete && !planComplete) {
+        Serial.printf("Schedule: %u periodic states need %.0f%% of the link with %u µs overhead per request, "
+                      "%u intervals can't be met%s.\n", static_cast<unsigned>(periodic.size()), demand * 100, overhead,
+                      unmet, unmet != 0 && scaleIntervals ? " and are scaled" : "");
+        for (size_t i = met; i < periodic.size(); i++) {
+            Serial.printf("  %s: %ld ms needed, %ld ms achievable\n", periodic[i]->getName(),
+                          periodic[i]->getAdaptiveInterval(), periodic[i]->getPlannedInterval());
+        }
+    }
+    planComplete = complete;
+    unmetIntervals = unmet;
+    quarantinedStates = quarantined;
+}
+
+/**
+ * Calls the function with the state name of every variable in the expression, e.g. <code>rpm</code> for
+ * <code>$rpm.lu</code>.
+ */
+static void forEachVariable(const char *expression, const std::function<void(const std::string &)> &func) {
+    const char *pos = expression;
+    while ((pos = strchr(pos, '$')) != nullptr) {
+        ++pos;
+        const size_t len = strcspn(pos, " \t\r\n+-*/%^&=(),.");
+        if (len != 0 && strncmp(pos, "millis", len) != 0) {
+            func(std::string(pos, len));
+        }
+        pos += len;
+    }
+}
+
+bool OBDStates::dependsOn(const char *expression, const OBDState *state, std::vector<const OBDState *> &visited) {
+    bool found = false;
+    forEachVariable(expression, [&](const std::string &name) {
+        const OBDState *input = getStateByName(name.c_str());
+        if (found || input == nullptr || std::find(visited.begin(), visited.end(), input) != visited.end()) {
+            return;
+        }
+        if (input == state) {
+            found = true;
+            return;
+        }
+        visited.push_back(input);
+        found = input->getType() == obd::CALC && dependsOn(input->getCalcExpression(), state, visited) ||
+                dependsOn(input->getPollWhen(), state, visited);
+    });
+    return found;
+}
+
+void OBDStates::buildGuards() {
+    guards.clear();
+    guardGeneration = currentStates()->generation;
+    suspendedStates = 0;
+
+    for (auto *state: currentStates()->states) {
+        if (!state->hasPollWhen()) {
+            continue;
+        }
+
+        std::vector<const OBDState *> visited{};
+        if (dependsOn(state->getPollWhen(), state, visited)) {
+            Serial.printf("Poll guard of %s depends on the state itself and is ignored.\n", state->getName());
+            continue;
+        }
+
+        OBDPollGuard guard{state, {}, -1};
+        forEachVariable(state->getPollWhen(), [&](const std::string &name) {
+            const OBDState *input = getStateByName(name.c_str());
+            if (input != nullptr && std::find(guard.inputs.begin(), guard.inputs.end(), input) == guard.inputs.end()) {
+                guard.inputs.push_back(input);
+            }
+        });
+        guards.push_back(guard);
+    }
+}
+
+void OBDStates::buildSharedResponses() {
+    sharedResponses.clear();
+    responseGeneration = currentStates()->generation;
+
+    for (auto *state: currentStates()->states) {
+        if (state->getType() != obd::READ || state->hasReadFunc()) {
+            continue;
+        }
+
+        auto it = std::find_if(sharedResponses.begin(), sharedResponses.end(), [&](const OBDSharedResponse &r) {
+            return r.states.front()->sharesRequest(state);
+        });
+        if (it != sharedResponses.end()) {
+            it->states.push_back(state);
+        } else {
+            sharedResponses.push_back({{state}, 0, 0});
+        }
+    }
+
+    sharedResponses.erase(std::remove_if(sharedResponses.begin(), sharedResponses.end(),
+                                         [](const OBDSharedResponse &r) {
+                                             return r.states.size() < 2;
+                                         }), sharedResponses.end());
+}
+
+OBDSharedResponse *OBDStates::getSharedResponse(const OBDState *state) {
+    for (auto &response: sharedResponses) {
+        if (std::find(response.states.begin(), response.states.end(), state) != response.states.end()) {
+            return &response;
+        }
+    }
+    return nullptr;
+}
+
+bool OBDStates::updateGuards() {
+    // states sharing a guard expression, e.g. $engineRunning, are decided by a single evaluation
+    std::vector<std::pair<const char *, bool>> results{};
+    bool changed = false;
+    uint16_t suspended = 0;
+
+    for (auto &guard: guards) {
+        long inputUpdate = 0;
+        for (const auto *input: guard.inputs) {
+            inputUpdate = std::max(inputUpdate, input->getLastUpdate());
+        }
+
+        if (inputUpdate != guard.inputUpdate) {
+            guard.inputUpdate = inputUpdate;
+
+            const char *expression = guard.state->getPollWhen();
+            const auto it = std::find_if(results.begin(), results.end(), [&](const std::pair<const char *, bool> &r) {
+                return strcmp(r.first, expression) == 0;
+            });
+            bool poll;
+            if (it != results.end()) {
+                poll = it->second;
+            } else {
+                ExprParser parser;
+                parser.setCustomFunctions(customFunctions);
+                parser.setVariableResolveFunction(varResolveFunction);
+                poll = parser.evalExp(expression) != 0;
+                ++guardEvaluations;
+                if (strlen(parser.errormsg) > 0) {
+                    // a broken guard never suspends its state and isn't evaluated again
+                    Serial.printf("Poll guard of %s (%s) : %s\n", guard.state->getName(), expression, parser.errormsg);
+                    poll = true;
+                    guard.inputs.clear();
+                    guard.inputUpdate = 0;
+                }
+                results.emplace_back(expression, poll);
+            }
+
+            if (guard.state->isSuspended() == poll) {
+                guard.state->setSuspended(!poll);
+                changed = true;
+
+                // the last response of a suspended state isn't current anymore, e.g. the MAF rate with the engine off
+                if (!poll && guard.state->getType() == obd::READ) {
+                    guard.state->applyValue(0, millis());
+                    notify(guard.state);
+                }
+            }
+        }
+
+        suspended += guard.state->isSuspended() ? 1 : 0;
+    }
+    suspendedStates = suspended;
+
+    return changed;
 }
 
 template<typename T>
 T *OBDStates::getStateByName(const char *name) {
-    for (auto &state: states) {
+    for (auto &state: currentStates()->states) {
         if (strcmp(state->getName(), name) == 0) {
             return static_cast<T *>(state);
         }
@@ -112,15 +574,15 @@ OBDState *OBDStates::getStateByName(const char *name) {
 double OBDStates::getStateValue(const char *name) {
     auto *state = getStateByName(name);
     if (state != nullptr) {
-        if (state->valueType() == "int") {
+        if (strcmp(state->valueType(), "int") == 0) {
             auto *is = reinterpret_cast<OBDStateInt *>(state);
             return is->getValue();
         }
-        if (state->valueType() == "float") {
+        if (strcmp(state->valueType(), "float") == 0) {
             auto *is = reinterpret_cast<OBDStateFloat *>(state);
             return is->getValue();
         }
-        if (state->valueType() == "bool") {
+        if (strcmp(state->valueType(), "bool") == 0) {
             auto *is = reinterpret_cast<OBDStateBool *>(state);
             return is->getValue();
         }
@@ -152,16 +614,27 @@ void OBDStates::setStateValue(const char *name, const int value) {
     setStateValue<int>(name, value);
 }
 
-void OBDStates::addState(OBDState *state) {
-    if (getStateByName<OBDState>(state->getName()) == nullptr) {
-        state->setELM327(elm327);
-        state->setCheckPidSupport(checkPidSupport);
-        states.push_back(state);
+bool OBDStates::addState(OBDState *state) {
+    if (building == nullptr) {
+        delete state;
+        return false;
     }
+
+    for (const OBDState *existing: building->states) {
+        if (strcmp(existing->getName(), state->getName()) == 0) {
+            delete state;
+            return false;
+        }
+    }
+
+    state->setELM327(elm327);
+    state->setCheckPidSupport(checkPidSupport);
+    building->add(state);
+    return true;
 }
 
 void OBDStates::listStates() const {
-    for (auto &state: states) {
+    for (auto &state: currentStates()->states) {
         Serial.printf("%s: %d %d\n", state->getName(), state->getType(), state->isEnabled());
     }
 }
@@ -178,41 +651,256 @@ double OBDStates::avgLastUpdate(const std::function<bool(OBDState *)> &pred) {
     return static_cast<double>(sum) / data.size();
 }
 
+void OBDStates::printMetrics(Print &out) {
+    StatesReadGuard guard(*this);
+
+    JsonDocument doc;
+    bool first = true;
+    out.print('[');
+    for (const auto *state: currentStates()->states) {
+        if (!state->isEnabled()) {
+            continue;
+        }
+
+        const OBDStateMetrics &metrics = state->getMetrics();
+        const uint32_t avgInterval = state->getAvgInterval();
+
+        doc.clear();
+        doc["name"] = state->getName();
+        doc["interval"] = state->getUpdateInterval();
+        doc["adaptiveInterval"] = state->getAdaptiveInterval();
+        doc["suspended"] = state->isSuspended();
+        doc["avgInterval"] = avgInterval;
+        doc["rate"] = avgInterval != 0 ? 1000.0 / avgInterval : 0.0;
+        doc["updates"] = metrics.updates;
+        doc["noData"] = metrics.noData;
+        doc["timeouts"] = metrics.timeouts;
+        doc["errors"] = metrics.errors;
+        doc["failures"] = state->getFailures();
+        doc["quarantined"] = state->isQuarantined();
+        doc["quarantines"] = metrics.quarantines;
+        doc["retryIn"] = state->getRetryIn();
+        doc["shared"] = metrics.shared;
+        doc["latency"]["last"] = metrics.lastLatency;
+        doc["latency"]["avg"] = state->getAvgLatency();
+        const LatencyHistogram *histogram = state->getLatency();
+        doc["latency"]["p99"] = histogram != nullptr ? histogram->getPercentile(99) : 0;
+
+        if (!first) {
+            out.print(',');
+        }
+        serializeJson(doc, out);
+        first = false;
+    }
+    out.print(']');
+}
+
+void OBDStates::printSchedule(Print &out) {
+    StatesReadGuard guard(*this);
+
+    JsonDocument doc;
+    out.printf("{\"demand\":%.3f,\"utilization\":%.2f,\"overhead\":%u,\"unmet\":%u,\"suspended\":%u,"
+               "\"quarantined\":%u,\"sharedReads\":%u,\"scaled\":%s,\"states\":[", planDemand / 1000.0,
+               OBD_PLAN_UTILIZATION, requestOverhead.load(), unmetIntervals.load(), suspendedStates.load(),
+               quarantinedStates.load(), sharedReads.load(), scaleIntervals ? "true" : "false");
+    bool first = true;
+    for (const auto *state: currentStates()->states) {
+        const long planned = state->getPlannedInterval();
+        if (planned == 0) {
+            continue;
+        }
+
+        doc.clear();
+        doc["name"] = state->getName();
+        doc["interval"] = state->getUpdateInterval();
+        doc["adaptiveInterval"] = state->getAdaptiveInterval();
+        doc["planned"] = planned;
+        doc["rate"] = 1000.0 / planned;
+        doc["latency"] = state->getAvgLatency();
+        doc["met"] = planned <= state->getAdaptiveInterval();
+
+        if (!first) {
+            out.print(',');
+        }
+        serializeJson(doc, out);
+        first = false;
+    }
+    out.print("]}");
+}
+
+void OBDStates::printLatency(Print &out) {
+    StatesReadGuard guard(*this);
+
+    JsonDocument doc;
+    bool first = true;
+    out.print('[');
+    for (const auto *state: currentStates()->states) {
+        const LatencyHistogram *histogram = state->getLatency();
+        if (!state->isEnabled() || histogram == nullptr || histogram->getCount() == 0) {
+            continue;
+        }
+        const LatencyHistogram &latency = *histogram;
+
+        doc.clear();
+        doc["name"] = state->getName();
+        doc["count"] = latency.getCount();
+        doc["max"] = latency.getMax();
+        doc["p50"] = latency.getPercentile(50);
+        doc["p90"] = latency.getPercentile(90);
+        doc["p99"] = latency.getPercentile(99);
+        // only filled buckets as [lower bound in ms, upper bound in ms, count]
+        JsonArray buckets = doc["buckets"].to<JsonArray>();
+        for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+            if (latency.getCount(i) != 0) {
+                JsonArray bucket = buckets.add<JsonArray>();
+                bucket.add(LatencyHistogram::lowerBound(i));
+                bucket.add(LatencyHistogram::upperBound(i));
+                bucket.add(latency.getCount(i));
+            }
+        }
+
+        if (!first) {
+            out.print(',');
+        }
+        serializeJson(doc, out);
+        first = false;
+    }
+    out.print(']');
+}
+
+void OBDStates::resetMetrics() {
+    metricsResetRequested = true;
+}
+
+void OBDStates::resetFailures() {
+    failuresResetRequested = true;
+}
+
+void OBDStates::recordResult(OBDState *state) {
+    // the link failure time starts with the first request, not at boot
+    if (!requestRecorded) {
+        requestRecorded = true;
+        lastSuccess = millis();
+    }
+
+    if (state->getUpdateStatus() == ELM_SUCCESS) {
+        if (linkFailing) {
+            Serial.println("OBD link responds again, failures of all states are cleared.");
+            for (auto *s: currentStates()->states) {
+                s->resetFailures();
+            }
+            linkFailing = false;
+            planSchedule();
+        }
+        lastSuccess = millis();
+    } else if (millis() - lastSuccess >= OBD_LINK_FAILURE_TIME) {
+        linkFailing = true;
+    }
+
+    state->recordResult(state->getUpdateStatus(), !linkFailing);
+}
+
+void OBDStates::calcState(OBDState *state) {
+    state->calcValue(varResolveFunction, customFunctions);
+}
+
 OBDState *OBDStates::nextState() {
-    if (!states.empty() && elm327 != nullptr && elm327->elm_port) {
+    if (metricsResetRequested.exchange(false)) {
+        for (auto *state: currentStates()->states) {
+            state->resetMetrics();
+        }
+    }
+    const bool failuresReset = failuresResetRequested.exchange(false);
+    if (failuresReset) {
+        for (auto *state: currentStates()->states) {
+            state->resetFailures();
+        }
+        lastSuccess = millis();
+        requestRecorded = true;
+        linkFailing = false;
+    }
+
+    if (currentStates()->generation != guardGeneration) {
+        buildGuards();
+    }
+    const bool guardsChanged = updateGuards();
+    if (currentStates()->generation != responseGeneration) {
+        buildSharedResponses();
+    }
+
+    if (guardsChanged || failuresReset || currentStates()->generation != planGeneration ||
+        millis() - lastPlan >= OBD_PLAN_INTERVAL) {
+        planSchedule();
+    }
+
+    if (!currentStates()->states.empty() && elm327 != nullptr && elm327->elm_port) {
         std::vector<OBDState *> readStates{};
         getStates([](const OBDState *state) {
-            return state->isEnabled() &&
+            return state->isEnabled() && !state->isSuspended() && !state->isBackingOff() &&
                    (state->getType() ==  obd::READ || state->getType() ==  obd::CALC && state->hasCalcExpression()) &&
                    (state->getUpdateInterval() != -1 || state->getUpdateInterval() == -1 && state->getLastUpdate() ==
                     0);
         }, readStates);
-        sort(readStates.begin(), readStates.end(), compareStates);
+        sort(readStates.begin(), readStates.end(), [this](const OBDState *a, const OBDState *b) {
+            return compareStates(a, b);
+        });
 
         if (readStates.empty()) {
             return nullptr;
         }
 
-        OBDState &state = *readStates.at(0);
-        if (state.getUpdateInterval() == -1 || state.getLastUpdate() + state.getUpdateInterval() < millis()) {
-            // int aFreeInternalHeapSizeBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
+        OBDState *next = readStates.at(0);
+        long interval = getScheduledInterval(next);
+        if (scaleIntervals && !next->isProcessing() && next->getUpdateInterval() != -1 &&
+            next->getLastUpdate() + interval >= static_cast<long>(millis())) {
+            // link time left over by the planned intervals goes to the state, which is most overdue
+            next = *std::min_element(readStates.begin(), readStates.end(), [](const OBDState *a, const OBDState *b) {
+                return a->getLastUpdate() + a->getAdaptiveInterval() < b->getLastUpdate() + b->getAdaptiveInterval();
+            });
+            interval = next->getAdaptiveInterval();
+        }
 
-            if (state.getType() ==  obd::READ) {
+        OBDState &state = *next;
+        if (state.getUpdateInterval() == -1 || state.getLastUpdate() + interval < static_cast<long>(millis())) {
+            const long lastUpdate = state.getLastUpdate();
+            const bool quarantined = state.isQuarantined();
+            OBDSharedResponse *shared = state.getType() == obd::READ ? getSharedResponse(&state) : nullptr;
+            if (shared != nullptr && !state.isProcessing() && shared->timestamp > lastUpdate &&
+                (state.getUpdateInterval() == -1 || static_cast<long>(millis() - shared->timestamp) < interval)) {
+                // another state got the response within the interval of this state
+                state.applyResponse(shared->raw, shared->timestamp);
+                ++sharedReads;
+            } else if (state.getType() ==  obd::READ) {
+                // the time between two back to back requests, which isn't spent waiting for the adapter
+                const int64_t requestStart = esp_timer_get_time();
+                const bool backlogged = state.getUpdateInterval() == -1 ||
+                                        state.getLastUpdate() + interval < lastRequestEnd / 1000;
+                if (backlogged && lastRequestEnd != 0 && requestStart - lastRequestEnd < 1000000) {
+                    const uint32_t avg = requestOverhead;
+                    requestOverhead = avg + (static_cast<int32_t>(requestStart - lastRequestEnd - avg) >> 3);
+                }
+                const uint32_t requests = state.getRequests();
                 state.readValue();
+                lastRequestEnd = esp_timer_get_time();
+                if (state.getRequests() != requests) {
+                    recordResult(&state);
+                }
+                // NO DATA or a timeout leaves the last response in place, which must not be shared as a new one
+                if (shared != nullptr && !state.isProcessing() && state.getUpdateStatus() == ELM_SUCCESS &&
+                    state.getLastUpdate() != lastUpdate) {
+                    shared->raw = state.getRawResponse();
+                    shared->timestamp = state.getLastUpdate();
+                }
             } else if (state.getType() ==  obd::CALC) {
-                state.calcValue(varResolveFunction, customFunctions);
+                calcState(&state);
+            }
+            if (state.getLastUpdate() != lastUpdate) {
+                completedUpdates++;
+                notify(&state);
+            }
+            if (state.isQuarantined() != quarantined) {
+                planSchedule();
             }
-
-            // int aFreeInternalHeapSizeAfter = heap_caps_get_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
-            // int aMinFreeInternalHeapSize =  heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL);
-            // Serial.print("heap: ");
-            // Serial.print(aFreeInternalHeapSizeBefore);
-            // Serial.print(", after ");
-            // Serial.print(aFreeInternalHeapSizeAfter);
-            // Serial.print(", delta ");
-            // Serial.print(aFreeInternalHeapSizeBefore - aFreeInternalHeapSizeAfter);
-            // Serial.print(", lowest free ");
-            // Serial.println(aMinFreeInternalHeapSize);
 
             return &state;
         }
@@ -220,3 +908,11 @@ OBDState *OBDStates::nextState() {
 
     return nullptr;
 }
+
+StatesReadGuard::StatesReadGuard(OBDStates &states) : states(states) {
+    epoch = states.readLock();
+}
+
+StatesReadGuard::~StatesReadGuard() {
+    states.readUnlock(epoch);
+}
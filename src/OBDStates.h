@@ -16,14 +16,217 @@
  */
 #pragma once
 
+#include <atomic>
 #include <ELMduino.h>
 #include <map>
 #include <OBDState.h>
 #include <vector>
 
+#define OBD_MAX_SUBSCRIBERS 4
+
+#define OBD_PLAN_INTERVAL               10000
+#define OBD_PLAN_UTILIZATION            0.9
+#define OBD_MAX_PLANNED_INTERVAL        3600000
+#define OBD_DEFAULT_REQUEST_LATENCY     50000
+#define OBD_DEFAULT_REQUEST_OVERHEAD    10000
+#define OBD_LINK_FAILURE_TIME           5000
+
+/**
+ * A set of states, never changed after it was published.
+ * States may be held by several sets, e.g. the unchanged states of a patch, the last set holding a state deletes it.
+ */
+struct OBDStateSet {
+    std::vector<OBDState *> states{};
+
+    uint32_t generation = 0;
+
+    OBDStateSet() = default;
+
+    OBDStateSet(const OBDStateSet &) = delete;
+
+    OBDStateSet &operator=(const OBDStateSet &) = delete;
+
+    ~OBDStateSet();
+
+    void add(OBDState *state);
+};
+
+/**
+ * The poll guard of a state with the states its expression reads.
+ */
+struct OBDPollGuard {
+    OBDState *state;
+    std::vector<const OBDState *> inputs;
+    /** the latest update of the inputs, when the guard was evaluated */
+    long inputUpdate;
+};
+
+/**
+ * The latest response of a request, which is sent by several READ states, e.g. for different bits of one PID.
+ */
+struct OBDSharedResponse {
+    std::vector<OBDState *> states;
+    /** the data bytes of the response, big endian */
+    uint64_t raw;
+    long timestamp;
+};
+
+/**
+ * Published to all subscribers if a state got a new value outside its deadband or after its max silence.
+ * The state pointer is only valid within a StatesReadGuard, see OBDStates::getEventState().
+ */
+struct OBDStateEvent {
+    OBDState *state;
+    uint32_t generation;
+    double value;
+    long timestamp;
+    unsigned long published;
+};
+
+/**
+ * Holds the states of OBDStates.
+ *
+ * Configuration changes build a new state set, which is published by the polling task between two requests.
+ * The replaced set is deleted after all readers, which started before the swap, have left.
+ * All tasks except the polling task must access states within a StatesReadGuard.
+ */
 class OBDStates {
     ELM327 *elm327;
-    std::vector<OBDState *> states{};
+
+    std::atomic<OBDStateSet *> current{nullptr};
+
+    std::atomic<OBDStateSet *> pending{nullptr};
+
+    OBDStateSet *building = nullptr;
+
+    OBDStateSet *retired = nullptr;
+
+    uint8_t retiredEpoch = 0;
+
+    std::atomic<uint8_t> epoch{0};
+
+    std::atomic<uint32_t> readers[2]{};
+
+    SemaphoreHandle_t updateMutex;
+
+    std::atomic<uint32_t> generation{0};
+
+    QueueHandle_t subscribers[OBD_MAX_SUBSCRIBERS]{};
+
+    std::atomic<uint8_t> numSubscribers{0};
+
+    std::atomic<uint32_t> droppedEvents{0};
+
+    std::atomic<uint32_t> suppressedEvents{0};
+
+    std::atomic<uint32_t> completedUpdates{0};
+
+    std::atomic_bool metricsResetRequested{false};
+
+    std::atomic_bool failuresResetRequested{false};
+
+    /** the time of the latest successful request on the link */
+    unsigned long lastSuccess = 0;
+
+    /** a request was recorded, lastSuccess is valid */
+    bool requestRecorded = false;
+
+    /** no request on the link succeeded for OBD_LINK_FAILURE_TIME */
+    bool linkFailing = false;
+
+    std::atomic_bool scaleIntervals{false};
+
+    uint32_t planGeneration = 0;
+
+    unsigned long lastPlan = 0;
+
+    int64_t lastRequestEnd = 0;
+
+    std::atomic<uint32_t> requestOverhead{OBD_DEFAULT_REQUEST_OVERHEAD};
+
+    std::atomic<uint32_t> planDemand{0};
+
+    std::atomic<uint16_t> unmetIntervals{0};
+
+    bool planComplete = false;
+
+    std::vector<OBDPollGuard> guards{};
+
+    uint32_t guardGeneration = 0;
+
+    std::atomic<uint32_t> guardEvaluations{0};
+
+    std::atomic<uint16_t> suspendedStates{0};
+
+    std::atomic<uint16_t> quarantinedStates{0};
+
+    std::vector<OBDSharedResponse> sharedResponses{};
+
+    uint32_t responseGeneration = 0;
+
+    std::atomic<uint32_t> sharedReads{0};
+
+    void notify(OBDState *state);
+
+    /**
+     * Counts the result of a finished request toward the failures of the state. Failures while no state on the link
+     * gets a response don't quarantine states, the first response after such a link failure clears the failures of
+     * all states.
+     *
+     * @param state the state of the finished request
+     */
+    void recordResult(OBDState *state);
+
+    /**
+     * Groups the READ states of the current states, which send the same request.
+     */
+    void buildSharedResponses();
+
+    /**
+     * @param state the state
+     * @return the shared response of the state or <code>nullptr</code> if no other state sends its request
+     */
+    OBDSharedResponse *getSharedResponse(const OBDState *state);
+
+    /**
+     * Collects the poll guards of the current states and their inputs. A guard, which depends on its own state
+     * directly or through CALC states and other guards, would never resume the state and is ignored.
+     */
+    void buildGuards();
+
+    /**
+     * Checks whether the state is read by the expression or by the expressions of the states it reads.
+     *
+     * @param expression the expression
+     * @param state the state
+     * @param visited the states, whose expressions were already followed
+     * @return <code>true</code> if the expression depends on the state
+     */
+    bool dependsOn(const char *expression, const OBDState *state, std::vector<const OBDState *> &visited);
+
+    /**
+     * Evaluates the poll guards, whose inputs got a new value since the last evaluation.
+     * A suspended READ state is set to 0 and its subscribers are notified.
+     *
+     * @return <code>true</code> if a state was suspended or resumed
+     */
+    bool updateGuards();
+
+    /**
+     * Plans the intervals of all periodic READ states rate monotonic, the shorter the interval, the higher
+     * the priority. A request costs its average latency and the measured time between two back to back requests.
+     * States are planned with their configured interval as long as the link has capacity left, the remaining states
+     * share the rest in proportion to their configured rates. Suspended and quarantined states aren't planned,
+     * a state, whose request is already sent for a state with a shorter interval, costs no link time.
+     */
+    void planSchedule();
+
+    /**
+     * @param state the state
+     * @return the planned interval if intervals are scaled and the configured one can't be met,
+     * otherwise the configured interval
+     */
+    long getScheduledInterval(const OBDState *state) const;
 
     bool checkPidSupport = false;
 
@@ -31,7 +234,7 @@ class OBDStates {
 
     std::map<const char *, const std::function<double(double)>> customFunctions{};
 
-    static bool compareStates(const OBDState *a, const OBDState *b);
+    bool compareStates(const OBDState *a, const OBDState *b) const;
 
     void setCustomFunctions(const std::map<const char *, const std::function<double(double)>> &funcs);
 
@@ -47,15 +250,133 @@ class OBDStates {
     template<typename T>
     void setStateValue(const std::string &name, T value);
 
+protected:
+    void lockUpdates();
+
+    void unlockUpdates();
+
+    /**
+     * Starts a new state set, states are added to it until commitUpdate() or abortUpdate() is called.
+     * Only one update can be in progress, other updates wait until it is finished.
+     */
+    void beginUpdate();
+
+    /**
+     * Hands over the new state set to the polling task.
+     */
+    void commitUpdate();
+
+    void abortUpdate();
+
+    /**
+     * Adds a state of the latest set unchanged to the update in progress, it's shared by both sets.
+     *
+     * @param state the state
+     */
+    void shareState(OBDState *state);
+
+    /**
+     * @return the state set of the update in progress
+     */
+    OBDStateSet *updatingStates() const;
+
+    /**
+     * Must only be called with locked updates.
+     *
+     * @return the latest committed state set, even if it isn't published yet
+     */
+    const OBDStateSet *latestStates() const;
+
 public:
     explicit OBDStates(ELM327 *elm327);
 
+    uint8_t readLock();
+
+    void readUnlock(uint8_t readEpoch);
+
+    /**
+     * Publishes a committed state set and deletes the replaced set after its grace period.
+     * Must be called by the polling task only.
+     */
+    void synchronize();
+
+    /**
+     * Must be used within a StatesReadGuard or by the polling task.
+     *
+     * @return the published state set
+     */
+    const OBDStateSet *currentStates() const;
+
+    /**
+     * Creates a queue, which receives an event for every changed state value.
+     * Events are dropped if the queue is full, the polling task is never blocked.
+     *
+     * @param length the queue length
+     * @return the queue or <code>nullptr</code> if there are too many subscribers
+     */
+    QueueHandle_t subscribe(size_t length);
+
+    /**
+     * Must be used within a StatesReadGuard.
+     *
+     * @param event the received event
+     * @return the state of the event or <code>nullptr</code> if the states were replaced in between
+     */
+    OBDState *getEventState(const OBDStateEvent &event) const;
+
+    uint32_t getDroppedEvents() const;
+
+    /**
+     * @return the number of updates, which weren't published because of the deadband or an unchanged value
+     */
+    uint32_t getSuppressedEvents() const;
+
+    /**
+     * @return the number of reads and calculations, which produced a new value
+     */
+    uint32_t getCompletedUpdates() const;
+
     void setCheckPidSupport(bool enable);
 
+    /**
+     * @return the number of states, which are suspended by their poll guard
+     */
+    uint16_t getSuspendedStates() const;
+
+    /**
+     * @return the number of poll guard evaluations
+     */
+    uint32_t getGuardEvaluations() const;
+
+    /**
+     * @return the number of states, which are quarantined after too many failed requests
+     */
+    uint16_t getQuarantinedStates() const;
+
+    /**
+     * @return the number of values, which were taken from the response of another state instead of a request
+     */
+    uint32_t getSharedReads() const;
+
+    /**
+     * Polls states, whose configured interval exceeds the link capacity, with their planned interval instead of
+     * letting them starve. Link time left over by the planned intervals goes to the most overdue state.
+     *
+     * @param enable <code>true</code> to scale intervals
+     */
+    void setScaleIntervals(bool enable);
+
     void setVariableResolveFunction(const std::function<double(const char *)> &func);
 
     void addCustomFunction(const char *name, const std::function<double(double)> &func);
 
+    /**
+     * Evaluates the expression of a CALC state with the variables and custom functions of these states.
+     *
+     * @param state the state
+     */
+    void calcState(OBDState *state);
+
     void clearStates();
 
     void getStates(const std::function<bool(OBDState *)> &pred, std::vector<OBDState *> &states);
@@ -79,11 +400,67 @@ public:
 
     void setStateValue(const char *name, int value);
 
-    void addState(OBDState *state);
+    /**
+     * Adds the state to the update in progress, the state is deleted if it isn't added.
+     *
+     * @param state the state
+     * @return <code>true</code> if added
+     */
+    bool addState(OBDState *state);
 
     void listStates() const;
 
+    /**
+     * Prints the request metrics of all enabled states as JSON array.
+     *
+     * @param out the output
+     */
+    void printMetrics(Print &out);
+
+    /**
+     * Prints the latency histograms of all enabled states with at least one request as JSON array.
+     *
+     * @param out the output
+     */
+    void printLatency(Print &out);
+
+    /**
+     * Prints the schedule plan with the link demand, the number of suspended and quarantined states and
+     * the configured and achievable interval of all periodic READ states as JSON.
+     *
+     * @param out the output
+     */
+    void printSchedule(Print &out);
+
+    /**
+     * Clears the request metrics of all states before the next request, e.g. at the start of a trip.
+     */
+    void resetMetrics();
+
+    /**
+     * Clears the failures, backoff and quarantine of all states before the next request, e.g. after a (re)connect.
+     */
+    void resetFailures();
+
     double avgLastUpdate(const std::function<bool(OBDState *)> &pred);
 
     OBDState *nextState();
 };
+
+/**
+ * Keeps the current states alive until the guard is destroyed.
+ */
+class StatesReadGuard {
+    OBDStates &states;
+
+    uint8_t epoch;
+
+public:
+    explicit StatesReadGuard(OBDStates &states);
+
+    StatesReadGuard(const StatesReadGuard &) = delete;
+
+    StatesReadGuard &operator=(const StatesReadGuard &) = delete;
+
+    ~StatesReadGuard();
+};
@@ -0,0 +1,336 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#ifdef NATIVE
+#include "benchmark.h"
+#include "simulator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <esp_timer.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#define BENCHMARK_COUNT_ALLOCATIONS
+
+// from sanitizer/allocator_interface.h, which isn't installed with every toolchain
+extern "C" int __sanitizer_install_malloc_and_free_hooks(void (*malloc_hook)(const volatile void *, size_t),
+                                                         void (*free_hook)(const volatile void *));
+#endif
+
+// only allocations of the measuring thread are counted, e.g. not those of the shim tasks
+static thread_local bool countAllocations = false;
+static std::atomic<uint64_t> allocations{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+/**
+ * Called by the sanitizer allocator for every malloc(), calloc(), realloc() and operator new.
+ */
+static void onAllocation(const volatile void *ptr, const size_t size) {
+    if (countAllocations) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+static void onFree(const volatile void *ptr) {
+}
+#endif
+
+PollBenchmark::PollBenchmark(OBDClass &obd) : obd(obd) {
+}
+
+bool PollBenchmark::loadThresholds(fs::FS &fs, const char *path) {
+    File file = fs.open(path, FILE_READ);
+    if (!file) {
+        Serial.printf("Failed to open %s.\n", path);
+        return false;
+    }
+
+    const DeserializationError error = deserializeJson(thresholds, file);
+    file.close();
+    if (error) {
+        Serial.printf("Failed to deserialize thresholds: %s\n", error.c_str());
+        return false;
+    }
+
+    adapter = thresholds["adapter"] | BENCHMARK_ADAPTER;
+    duration = thresholds["duration"] | BENCHMARK_DURATION;
+
+    return true;
+}
+
+void PollBenchmark::findProfiles(File &dir, const std::string &prefix,
+                                 std::vector<std::pair<std::string, std::string>> &profiles) {
+    File file = dir.openNextFile();
+    while (file) {
+        const std::string name = prefix.empty() ? file.name() : prefix + "/" + file.name();
+        if (file.isDirectory()) {
+            findProfiles(file, name, profiles);
+        } else if (name.size() > 5 && name.compare(name.size() - 5, 5, ".json") == 0) {
+            std::string json(file.size(), '\0');
+            json.resize(file.read(reinterpret_cast<uint8_t *>(&json[0]), json.size()));
+            // profiles are a state array, other JSON files like thresholds are skipped
+            const size_t first = json.find_first_not_of(" \t\r\n");
+            if (first != std::string::npos && json[first] == '[') {
+                profiles.emplace_back(name, std::move(json));
+            }
+        }
+        file.close();
+        file = dir.openNextFile();
+    }
+}
+
+bool PollBenchmark::load(const std::string &json) {
+    // publish an empty set in between, nothing is carried over from the previous run
+    obd.clearStates();
+    obd.synchronize();
+    if (!obd.parseJSON(json.c_str(), json.size())) {
+        return false;
+    }
+    obd.synchronize();
+
+    return true;
+}
+
+bool PollBenchmark::measureThroughput(BenchmarkResult &result) {
+    ELM327Simulator simulator;
+    if (!simulator.begin(adapter.c_str())) {
+        Serial.printf("Unknown simulator profile %s.\n", adapter.c_str());
+        return false;
+    }
+    obd.setAdapter(&simulator);
+    obd.connect();
+
+    std::map<const OBDState *, long> lastUpdates{};
+    std::map<const OBDState *, uint32_t> updates{};
+    const uint32_t requestsStart = simulator.getRequests();
+    const uint32_t updatesStart = obd.getCompletedUpdates();
+    const unsigned long start = millis();
+    while (millis() - start < duration * 1000UL) {
+        const OBDState *state = obd.loop();
+        if (state != nullptr) {
+            auto it = lastUpdates.find(state);
+            if (it == lastUpdates.end() || it->second != state->getLastUpdate()) {
+                lastUpdates[state] = state->getLastUpdate();
+                ++updates[state];
+            }
+        }
+        delay(BENCHMARK_LOOP_DELAY);
+    }
+    obd.setAdapter(nullptr);
+
+    result.requestsPerSecond = static_cast<double>(simulator.getRequests() - requestsStart) / duration;
+    result.updatesPerSecond = static_cast<double>(obd.getCompletedUpdates() - updatesStart) / duration;
+
+    result.states = 0;
+    for (auto *state: obd.currentStates()->states) {
+        if (!state->isEnabled() || state->getType() != obd::READ && state->getType() != obd::CALC) {
+            continue;
+        }
+        ++result.states;
+        const auto it = updates.find(state);
+        const uint32_t count = it != updates.end() ? it->second : 0;
+        result.stateResults.push_back({state->getName(), state->getUpdateInterval(), count,
+                                       static_cast<double>(count) / duration});
+    }
+
+    return true;
+}
+
+bool PollBenchmark::measureCPU(BenchmarkResult &result) {
+    ELM327Simulator simulator;
+    simulator.begin("ideal");
+    obd.setAdapter(&simulator);
+    obd.connect();
+
+#ifdef BENCHMARK_COUNT_ALLOCATIONS
+    // hooks can't be removed, they count only while countAllocations is set
+    static const bool hooksInstalled = __sanitizer_install_malloc_and_free_hooks(onAllocation, onFree) != 0;
+    result.allocationsCounted = hooksInstalled;
+#else
+    result.allocationsCounted = false;
+#endif
+
+    uint64_t loopTime = 0;
+    result.polls = 0;
+    allocations = 0;
+    allocatedBytes = 0;
+    const unsigned long start = millis();
+    while (millis() - start < duration * 1000UL) {
+        const auto loopStart = std::chrono::steady_clock::now();
+        countAllocations = true;
+        const OBDState *state = obd.loop();
+        countAllocations = false;
+        loopTime += std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - loopStart).count();
+        if (state != nullptr) {
+            ++result.polls;
+        }
+        delay(BENCHMARK_LOOP_DELAY);
+    }
+    obd.setAdapter(nullptr);
+
+    if (result.polls != 0) {
+        result.cpuPerRequest = loopTime / 1000.0 / result.polls;
+        result.allocationsPerRequest = static_cast<double>(allocations) / result.polls;
+        result.bytesPerRequest = static_cast<double>(allocatedBytes) / result.polls;
+    }
+
+    return true;
+}
+
+JsonVariantConst PollBenchmark::getThreshold(const std::string &profile, const char *key) const {
+    JsonVariantConst limit = thresholds["profiles"][profile][key];
+    return !limit.isNull() ? limit : thresholds["default"][key];
+}
+
+void PollBenchmark::check(BenchmarkResult &result, const char *key, const double value, const bool minimum) const {
+    JsonVariantConst limit = getThreshold(result.profile, key);
+    if (limit.isNull()) {
+        return;
+    }
+
+    if (minimum ? value < limit.as<double>() : value > limit.as<double>()) {
+        char message[96];
+        snprintf(message, sizeof(message), "%s %.2f %s %.2f", key, value, minimum ? "<" : ">", limit.as<double>());
+        result.regressions.emplace_back(message);
+    }
+}
+
+void PollBenchmark::checkThresholds(BenchmarkResult &result) const {
+    check(result, "minRequestsPerSecond", result.requestsPerSecond, true);
+    check(result, "maxCpuPerRequest", result.cpuPerRequest, false);
+    if (result.allocationsCounted) {
+        check(result, "maxAllocationsPerRequest", result.allocationsPerRequest, false);
+        check(result, "maxBytesPerRequest", result.bytesPerRequest, false);
+    }
+
+    JsonObjectConst minRates = thresholds["profiles"][result.profile]["states"];
+    for (JsonPairConst minRate: minRates) {
+        const auto it = std::find_if(result.stateResults.begin(), result.stateResults.end(),
+                                     [&](const BenchmarkStateResult &s) {
+                                         return s.name == minRate.key().c_str();
+                                     });
+        char message[96];
+        if (it == result.stateResults.end()) {
+            snprintf(message, sizeof(message), "%s missing", minRate.key().c_str());
+        } else if (it->rate < minRate.value().as<double>()) {
+            snprintf(message, sizeof(message), "%s %.2f Hz < %.2f Hz", it->name.c_str(), it->rate,
+                     minRate.value().as<double>());
+        } else {
+            continue;
+        }
+        result.regressions.emplace_back(message);
+    }
+}
+
+bool PollBenchmark::run(fs::FS &fs, const char *dir) {
+    File root = fs.open(dir);
+    if (!root || !root.isDirectory()) {
+        Serial.printf("Failed to open %s.\n", dir);
+        return false;
+    }
+
+    std::vector<std::pair<std::string, std::string>> profiles;
+    findProfiles(root, "", profiles);
+    root.close();
+    std::sort(profiles.begin(), profiles.end());
+
+    // a stepped clock, the results only depend on the simulated latencies
+    esp_timer_set_time_scale(0);
+    obd.begin("", "");
+
+    for (const auto &profile: profiles) {
+        BenchmarkResult result{};
+        result.profile = profile.first;
+
+        if (!load(profile.second) || !measureThroughput(result) || !load(profile.second) || !measureCPU(result)) {
+            Serial.printf("Failed to measure %s.\n", profile.first.c_str());
+            result.regressions.emplace_back("failed");
+        } else {
+            checkThresholds(result);
+        }
+
+        results.push_back(result);
+    }
+    obd.clearStates();
+    obd.synchronize();
+
+    return !results.empty();
+}
+
+void PollBenchmark::writeJSON(Print &out) const {
+    JsonDocument doc;
+    doc["adapter"] = adapter;
+    doc["duration"] = duration;
+    doc["passed"] = isPassed();
+
+    JsonArray profiles = doc["profiles"].to<JsonArray>();
+    for (const auto &result: results) {
+        JsonObject profile = profiles.add<JsonObject>();
+        profile["profile"] = result.profile;
+        profile["requestsPerSecond"] = result.requestsPerSecond;
+        profile["updatesPerSecond"] = result.updatesPerSecond;
+        profile["cpuPerRequest"] = result.cpuPerRequest;
+        if (result.allocationsCounted) {
+            profile["allocationsPerRequest"] = result.allocationsPerRequest;
+            profile["bytesPerRequest"] = result.bytesPerRequest;
+        }
+
+        JsonArray states = profile["states"].to<JsonArray>();
+        for (const auto &s: result.stateResults) {
+            JsonObject state = states.add<JsonObject>();
+            state["name"] = s.name;
+            state["interval"] = s.interval;
+            state["updates"] = s.updates;
+            state["rate"] = s.rate;
+        }
+
+        JsonArray regressions = profile["regressions"].to<JsonArray>();
+        for (const auto &regression: result.regressions) {
+            regressions.add(regression);
+        }
+    }
+
+    serializeJsonPretty(doc, out);
+}
+
+void PollBenchmark::printStats(Print &out) const {
+    out.printf("%-32s %6s %10s %10s %10s %10s %10s\n", "profile", "states", "req/s", "updates/s", "µs/req",
+               "allocs/req", "bytes/req");
+    for (const auto &result: results) {
+        out.printf("%-32s %6u %10.2f %10.2f %10.2f %10.2f %10.1f\n", result.profile.c_str(), result.states,
+                   result.requestsPerSecond, result.updatesPerSecond, result.cpuPerRequest,
+                   result.allocationsPerRequest, result.bytesPerRequest);
+        for (const auto &regression: result.regressions) {
+            out.printf("  regression: %s\n", regression.c_str());
+        }
+    }
+}
+
+bool PollBenchmark::isPassed() const {
+    for (const auto &result: results) {
+        if (!result.regressions.empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
@@ -0,0 +1,141 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <string>
+#include <vector>
+#include "obd.h"
+
+#define BENCHMARK_ADAPTER           "vlinker"
+#define BENCHMARK_DURATION          60
+#define BENCHMARK_LOOP_DELAY        10
+
+/**
+ * Achieved update rate of a state.
+ */
+struct BenchmarkStateResult {
+    std::string name;
+    long interval;
+    uint32_t updates;
+    double rate;
+};
+
+/**
+ * Measurements of a profile, times in µs.
+ */
+struct BenchmarkResult {
+    std::string profile;
+    uint32_t states;
+    double requestsPerSecond;
+    double updatesPerSecond;
+    uint32_t polls;
+    double cpuPerRequest;
+    /** the allocations are only counted with AddressSanitizer */
+    bool allocationsCounted;
+    double allocationsPerRequest;
+    double bytesPerRequest;
+    std::vector<BenchmarkStateResult> stateResults;
+    std::vector<std::string> regressions;
+};
+
+/**
+ * Measures the polling throughput of all profiles of a directory against simulated adapters.
+ *
+ * Every profile is polled twice on a stepped clock with the delay of the polling task between two iterations,
+ * so results don't depend on the host load. Against the timing of a real adapter, the achieved rate of every state
+ * and the adapter requests per second are measured. Against the "ideal" adapter, which answers without latency,
+ * the host time and the heap allocations of <code>OBD.loop()</code> per polled state are measured. This covers
+ * the scheduler, the ELM327 response parsing and the simulator itself. Allocations of the polling thread are
+ * counted by the malloc hook of AddressSanitizer, which sees <code>malloc()</code> and <code>operator new</code>,
+ * the allocation limits are skipped without it. The host time is wall time, so it depends on the host and the
+ * sanitizers.
+ *
+ * Thresholds are read from a JSON file with limits in <code>default</code>, which can be overridden per profile
+ * in <code>profiles</code>, e.g.
+ * <code>{"adapter": "vlinker", "duration": 60, "default": {"minRequestsPerSecond": 15, "maxCpuPerRequest": 500},
+ * "profiles": {"states-metric.json": {"states": {"engineSpeed": 0.5}}}}</code>.
+ * Supported limits are minRequestsPerSecond, maxCpuPerRequest, maxAllocationsPerRequest, maxBytesPerRequest and
+ * the minimum rate in Hz per state name in <code>states</code>. Only available in the native build.
+ */
+class PollBenchmark {
+    OBDClass &obd;
+
+    std::string adapter = BENCHMARK_ADAPTER;
+
+    uint32_t duration = BENCHMARK_DURATION;
+
+    JsonDocument thresholds;
+
+    std::vector<BenchmarkResult> results{};
+
+    static void findProfiles(File &dir, const std::string &prefix,
+                             std::vector<std::pair<std::string, std::string>> &profiles);
+
+    bool load(const std::string &json);
+
+    bool measureThroughput(BenchmarkResult &result);
+
+    bool measureCPU(BenchmarkResult &result);
+
+    JsonVariantConst getThreshold(const std::string &profile, const char *key) const;
+
+    void check(BenchmarkResult &result, const char *key, double value, bool minimum) const;
+
+    void checkThresholds(BenchmarkResult &result) const;
+
+public:
+    explicit PollBenchmark(OBDClass &obd);
+
+    /**
+     * Reads the thresholds and the adapter and duration of the throughput run.
+     *
+     * @param fs the filesystem
+     * @param path the path of the thresholds file
+     * @return <code>true</code> if the file is valid
+     */
+    bool loadThresholds(fs::FS &fs, const char *path);
+
+    /**
+     * Measures all profiles in the directory and its subdirectories, profiles are JSON files with a state array.
+     *
+     * @param fs the filesystem
+     * @param dir the path of the profiles directory
+     * @return <code>true</code> if at least one profile was measured
+     */
+    bool run(fs::FS &fs, const char *dir);
+
+    /**
+     * Writes the results and the exceeded thresholds as JSON.
+     *
+     * @param out the output
+     */
+    void writeJSON(Print &out) const;
+
+    /**
+     * Prints a summary per profile and the exceeded thresholds.
+     *
+     * @param out the output
+     */
+    void printStats(Print &out) const;
+
+    /**
+     * @return <code>true</code> if no threshold was exceeded
+     */
+    bool isPassed() const;
+};
@@ -0,0 +1,614 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "capture.h"
+
+#include <esp_timer.h>
+
+static size_t putU16(uint8_t *buf, const uint16_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    return 2;
+}
+
+static size_t putU32(uint8_t *buf, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (value >> (i * 8)) & 0xFF;
+    }
+    return 4;
+}
+
+static size_t putVarInt(uint8_t *buf, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = static_cast<uint8_t>(value);
+    return len;
+}
+
+static bool getVarInt(const std::vector<uint8_t> &buf, size_t &pos, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < buf.size(); shift += 7) {
+        const uint8_t b = buf[pos++];
+        value |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CaptureClass::begin(fs::FS &fs, const size_t maxSize, const size_t freeBytes) {
+    if (running) {
+        return true;
+    }
+
+    this->fs = &fs;
+
+    if (!fs.exists(CAPTURE_DIR)) {
+        fs.mkdir(CAPTURE_DIR);
+    }
+
+    size_t usedBytes = 0;
+    fileSeq = 0;
+    File dir = fs.open(CAPTURE_DIR);
+    if (dir && dir.isDirectory()) {
+        File entry = dir.openNextFile();
+        while (entry) {
+            const uint32_t seq = strtoul(entry.name(), nullptr, 10);
+            if (seq >= fileSeq) {
+                fileSeq = seq + 1;
+            }
+            usedBytes += entry.size();
+            entry.close();
+            entry = dir.openNextFile();
+        }
+        dir.close();
+    }
+
+    this->maxSize = maxSize;
+    const size_t remainingBytes = enforceBudget();
+
+    // keep two buffers reserve for other files
+    const size_t freeAfterCleanup = freeBytes + usedBytes - std::min(usedBytes, remainingBytes);
+    const size_t available = freeAfterCleanup > 2 * CAPTURE_BUFFER_SIZE
+                                 ? freeAfterCleanup - 2 * CAPTURE_BUFFER_SIZE
+                                 : 0;
+    this->maxSize = std::min(maxSize > remainingBytes ? maxSize - remainingBytes : 0, available);
+    if (this->maxSize < 2 * CAPTURE_BUFFER_SIZE) {
+        Serial.printf("Capture disabled, not enough space (%u bytes).\n", static_cast<unsigned>(this->maxSize));
+        return false;
+    }
+
+    buffers = static_cast<CaptureBuffer *>(malloc(sizeof(CaptureBuffer) * CAPTURE_NUM_BUFFERS));
+    freeBuffers = xQueueCreate(CAPTURE_NUM_BUFFERS, sizeof(CaptureBuffer *));
+    fullBuffers = xQueueCreate(CAPTURE_NUM_BUFFERS + 1, sizeof(CaptureBuffer *));
+    if (buffers == nullptr || freeBuffers == nullptr || fullBuffers == nullptr) {
+        Serial.println("Failed to allocate capture buffers.");
+        releaseResources();
+        return false;
+    }
+
+    for (int i = 0; i < CAPTURE_NUM_BUFFERS; i++) {
+        CaptureBuffer *buffer = &buffers[i];
+        buffer->len = 0;
+        buffer->count = 0;
+        xQueueSend(freeBuffers, &buffer, 0);
+    }
+    activeBuffer = nullptr;
+    lastState = nullptr;
+    lastStateUpdate = 0;
+    fileSize = 0;
+    lastRecordTime = esp_timer_get_time();
+
+    running = true;
+    writerRunning = true;
+    xTaskCreatePinnedToCore(writerTask, "CaptureTask", 4096, this, 1, &writerTaskHdl, 0);
+
+    Serial.printf("Capture %u started, budget %u bytes.\n", fileSeq, static_cast<unsigned>(this->maxSize));
+
+    return true;
+}
+
+void CaptureClass::end() {
+    if (!running) {
+        return;
+    }
+    running = false;
+
+    // the adapter task may still fill the active buffer, it's checked after recording is set
+    const unsigned long waitStart = millis();
+    while (recording && millis() - waitStart < 1000) {
+        delay(1);
+    }
+
+    if (activeBuffer != nullptr) {
+        xQueueSend(fullBuffers, &activeBuffer, 0);
+        activeBuffer = nullptr;
+    }
+
+    // nullptr signals the writer to close the file and stop
+    CaptureBuffer *stop = nullptr;
+    xQueueSend(fullBuffers, &stop, portMAX_DELAY);
+
+    const unsigned long start = millis();
+    while (writerRunning && millis() - start < 5000) {
+        delay(10);
+    }
+
+    if (!writerRunning) {
+        releaseResources();
+    }
+}
+
+void CaptureClass::releaseResources() {
+    if (freeBuffers != nullptr) {
+        vQueueDelete(freeBuffers);
+        freeBuffers = nullptr;
+    }
+    if (fullBuffers != nullptr) {
+        vQueueDelete(fullBuffers);
+        fullBuffers = nullptr;
+    }
+    free(buffers);
+    buffers = nullptr;
+}
+
+bool CaptureClass::isRunning() const {
+    return running;
+}
+
+void CaptureClass::append(const capture::RecordKind kind, const uint8_t *data, const size_t len, const uint8_t *data2,
+                          const size_t len2) {
+    if (activeBuffer == nullptr) {
+        if (xQueueReceive(freeBuffers, &activeBuffer, 0) != pdTRUE) {
+            activeBuffer = nullptr;
+            ++droppedRecords;
+            return;
+        }
+        activeBuffer->started = millis();
+    }
+
+    const int64_t now = esp_timer_get_time();
+    uint8_t *record = activeBuffer->data + activeBuffer->len;
+    size_t pos = 0;
+    record[pos++] = kind;
+    pos += putVarInt(record + pos, now - lastRecordTime);
+    pos += putVarInt(record + pos, len + len2);
+    memcpy(record + pos, data, len);
+    pos += len;
+    if (len2 != 0) {
+        memcpy(record + pos, data2, len2);
+        pos += len2;
+    }
+    lastRecordTime = now;
+
+    activeBuffer->len += pos;
+    ++activeBuffer->count;
+    ++records;
+
+    if (activeBuffer->len + CAPTURE_MAX_RECORD_SIZE > CAPTURE_BUFFER_SIZE ||
+        millis() - activeBuffer->started >= CAPTURE_FLUSH_INTERVAL) {
+        xQueueSend(fullBuffers, &activeBuffer, 0);
+        activeBuffer = nullptr;
+    }
+}
+
+void CaptureClass::record(const capture::RecordKind kind, const uint8_t *data, const size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    recording = true;
+    if (running) {
+        append(kind, data, std::min(len, static_cast<size_t>(CAPTURE_CHUNK_SIZE)));
+    }
+    recording = false;
+}
+
+void CaptureClass::record(OBDState *state) {
+    if (state == nullptr || state->isProcessing() || state->getLastUpdate() == 0) {
+        return;
+    }
+
+    recording = true;
+    if (running) {
+        recordValue(state);
+    }
+    recording = false;
+}
+
+void CaptureClass::recordValue(OBDState *state) {
+    if (state == lastState && state->getLastUpdate() == lastStateUpdate) {
+        return;
+    }
+    lastState = state;
+    lastStateUpdate = state->getLastUpdate();
+
+    char value[CAPTURE_VALUE_SIZE];
+    formatValue(state, value, sizeof(value));
+
+    // the name is terminated, the value ends with the record
+    const size_t nameLen = std::min(strlen(state->getName()), static_cast<size_t>(32));
+    char name[33];
+    memcpy(name, state->getName(), nameLen);
+    name[nameLen] = '\0';
+
+    append(capture::VALUE, reinterpret_cast<const uint8_t *>(name), nameLen + 1,
+           reinterpret_cast<const uint8_t *>(value), strlen(value));
+}
+
+void CaptureClass::formatValue(OBDState *state, char *buffer, const size_t len) {
+    char *str = nullptr;
+    if (strcmp(state->valueType(), "float") == 0) {
+        str = reinterpret_cast<OBDStateFloat *>(state)->formatValue();
+    } else if (strcmp(state->valueType(), "bool") == 0) {
+        str = reinterpret_cast<OBDStateBool *>(state)->formatValue();
+    } else if (strcmp(state->valueType(), "int") == 0) {
+        str = reinterpret_cast<OBDStateInt *>(state)->formatValue();
+    }
+
+    strlcpy(buffer, str != nullptr ? str : "", len);
+    free(str);
+}
+
+uint32_t CaptureClass::getRecords() const {
+    return records;
+}
+
+uint32_t CaptureClass::getDroppedRecords() const {
+    return droppedRecords;
+}
+
+void CaptureClass::writerTask(void *parameters) {
+    auto *capture = static_cast<CaptureClass *>(parameters);
+
+    for (;;) {
+        CaptureBuffer *buffer = nullptr;
+        if (xQueueReceive(capture->fullBuffers, &buffer, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (buffer == nullptr) {
+            break;
+        }
+
+        if (buffer->len > 0) {
+            if (capture->fileSize + buffer->len > capture->maxSize ||
+                !capture->file && !capture->openFile() ||
+                capture->file.write(buffer->data, buffer->len) != buffer->len) {
+                capture->droppedRecords += buffer->count;
+            } else {
+                capture->file.flush();
+                capture->fileSize += buffer->len;
+            }
+        }
+
+        buffer->len = 0;
+        buffer->count = 0;
+        xQueueSend(capture->freeBuffers, &buffer, 0);
+    }
+
+    if (capture->file) {
+        capture->file.close();
+    }
+    capture->writerTaskHdl = nullptr;
+    capture->writerRunning = false;
+    vTaskDelete(nullptr);
+}
+
+bool CaptureClass::openFile() {
+    char path[32];
+    snprintf(path, sizeof(path), CAPTURE_DIR "/%08u.cap", fileSeq);
+    file = fs->open(path, FILE_WRITE);
+    if (!file) {
+        Serial.printf("Failed to open capture %s.\n", path);
+        return false;
+    }
+
+    uint8_t header[CAPTURE_HEADER_SIZE] = {0};
+    memcpy(header, CAPTURE_MAGIC, 4);
+    putU16(header + 4, CAPTURE_VERSION);
+    putU32(header + 8, fileSeq);
+    putU32(header + 12, millis());
+    file.write(header, sizeof(header));
+    fileSize = sizeof(header);
+
+    return true;
+}
+
+size_t CaptureClass::enforceBudget() {
+    for (;;) {
+        size_t usedBytes = 0;
+        uint32_t oldestSeq = UINT32_MAX;
+
+        File dir = fs->open(CAPTURE_DIR);
+        if (!dir || !dir.isDirectory()) {
+            return 0;
+        }
+        File entry = dir.openNextFile();
+        while (entry) {
+            const uint32_t seq = strtoul(entry.name(), nullptr, 10);
+            oldestSeq = std::min(oldestSeq, seq);
+            usedBytes += entry.size();
+            entry.close();
+            entry = dir.openNextFile();
+        }
+        dir.close();
+
+        // keep the newest captures, but at least half of the budget for the new one
+        if (oldestSeq == UINT32_MAX || usedBytes <= maxSize / 2) {
+            return usedBytes;
+        }
+
+        char path[32];
+        snprintf(path, sizeof(path), CAPTURE_DIR "/%08u.cap", oldestSeq);
+        if (!fs->remove(path)) {
+            return usedBytes;
+        }
+    }
+}
+
+CaptureClass Capture;
+
+CaptureStream &CaptureStream::attach(Stream &stream) {
+    this->stream = &stream;
+    chunkLen = 0;
+    return *this;
+}
+
+int CaptureStream::available() {
+    return stream->available();
+}
+
+int CaptureStream::read() {
+    const int c = stream->read();
+    if (c >= 0) {
+        capture(capture::RX, static_cast<uint8_t>(c));
+    }
+    return c;
+}
+
+int CaptureStream::peek() {
+    return stream->peek();
+}
+
+void CaptureStream::flush() {
+    stream->flush();
+}
+
+size_t CaptureStream::write(const uint8_t c) {
+    capture(capture::TX, c);
+    return stream->write(c);
+}
+
+size_t CaptureStream::write(const uint8_t *buffer, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        capture(capture::TX, buffer[i]);
+    }
+    return stream->write(buffer, size);
+}
+
+void CaptureStream::capture(const capture::RecordKind kind, const uint8_t c) {
+    if (!Capture.isRunning()) {
+        chunkLen = 0;
+        return;
+    }
+
+    if (chunkLen != 0 && chunkKind != kind) {
+        finishChunk();
+    }
+    chunkKind = kind;
+    chunk[chunkLen++] = c;
+
+    if (chunkLen == sizeof(chunk) || kind == capture::TX && c == '\r' || kind == capture::RX && c == '>') {
+        finishChunk();
+    }
+}
+
+void CaptureStream::finishChunk() {
+    Capture.record(chunkKind, chunk, chunkLen);
+    chunkLen = 0;
+}
+
+bool ReplayStream::begin(fs::FS &fs, const char *path, const bool realTiming) {
+    File file = fs.open(path, FILE_READ);
+    if (!file) {
+        Serial.printf("Failed to open capture %s.\n", path);
+        return false;
+    }
+
+    std::vector<uint8_t> buf(file.size());
+    const size_t len = file.read(buf.data(), buf.size());
+    file.close();
+    buf.resize(len);
+
+    if (len < CAPTURE_HEADER_SIZE || memcmp(buf.data(), CAPTURE_MAGIC, 4) != 0 ||
+        (buf[4] | buf[5] << 8) != CAPTURE_VERSION) {
+        Serial.printf("Invalid capture %s.\n", path);
+        return false;
+    }
+
+    records.clear();
+    int64_t time = 0;
+    size_t pos = CAPTURE_HEADER_SIZE;
+    while (pos < len) {
+        CaptureRecord record;
+        record.kind = buf[pos++];
+        uint64_t delta = 0, recordLen = 0;
+        if (record.kind > capture::VALUE || !getVarInt(buf, pos, delta) || !getVarInt(buf, pos, recordLen) ||
+            recordLen > len - pos) {
+            break;
+        }
+        time += static_cast<int64_t>(delta);
+        record.time = time;
+        record.data.assign(reinterpret_cast<const char *>(&buf[pos]), recordLen);
+        pos += recordLen;
+        records.push_back(std::move(record));
+    }
+
+    this->realTiming = realTiming;
+    consumed.assign(records.size(), false);
+    this->pos = 0;
+    lastMatch = SIZE_MAX;
+    command.clear();
+    pending.clear();
+    pendingPos = 0;
+    matchedCommands = skippedCommands = unmatchedCommands = 0;
+
+    Serial.printf("Capture %s loaded, %u records over %.1f s.\n", path, static_cast<unsigned>(records.size()),
+                  time / 1000000.0);
+
+    return true;
+}
+
+void ReplayStream::onValue(const std::function<void(const char *name, const char *value)> &callback) {
+    valueCallback = callback;
+}
+
+bool ReplayStream::isFinished() const {
+    // commands requested less often than others may still be unused
+    for (size_t i = records.size(); i > pos; i--) {
+        if (records[i - 1].kind == capture::TX) {
+            return consumed[i - 1];
+        }
+    }
+    return true;
+}
+
+void ReplayStream::finish() {
+    emitValues();
+    lastMatch = SIZE_MAX;
+    for (; pos < records.size(); pos++) {
+        if (records[pos].kind == capture::TX && !consumed[pos]) {
+            ++skippedCommands;
+        }
+    }
+}
+
+int64_t ReplayStream::getDuration() const {
+    return records.empty() ? 0 : records.back().time;
+}
+
+void ReplayStream::printStats(Print &out) const {
+    out.printf("Replay: %u commands matched, %u recorded commands skipped, %u unknown commands\n",
+               matchedCommands, skippedCommands, unmatchedCommands);
+}
+
+void ReplayStream::emitValues() {
+    if (lastMatch == SIZE_MAX || valueCallback == nullptr) {
+        return;
+    }
+
+    for (size_t i = lastMatch + 1; i < records.size() && records[i].kind != capture::TX; i++) {
+        const CaptureRecord &record = records[i];
+        if (record.kind != capture::VALUE) {
+            continue;
+        }
+        const size_t nameLen = strnlen(record.data.c_str(), record.data.length());
+        if (nameLen < record.data.length()) {
+            valueCallback(record.data.c_str(), record.data.c_str() + nameLen + 1);
+        }
+    }
+}
+
+void ReplayStream::handleCommand() {
+    // the previous response was processed, a new command aborts it like on the adapter
+    emitValues();
+    lastMatch = SIZE_MAX;
+    pending.clear();
+    pendingPos = 0;
+
+    const size_t end = std::min(records.size(), pos + CAPTURE_REPLAY_WINDOW);
+    size_t match = pos;
+    for (; match < end; match++) {
+        if (records[match].kind == capture::TX && !consumed[match] && records[match].data == command) {
+            break;
+        }
+    }
+
+    const int64_t now = esp_timer_get_time();
+    if (match >= end) {
+        ++unmatchedCommands;
+        pending.push_back({now, "NO DATA\r\r>"});
+        return;
+    }
+
+    consumed[match] = true;
+    lastMatch = match;
+    ++matchedCommands;
+
+    const int64_t commandTime = records[match].time;
+    for (size_t i = match + 1; i < records.size() && records[i].kind == capture::RX; i++) {
+        pending.push_back({realTiming ? now + records[i].time - commandTime : now, records[i].data});
+    }
+
+    // continue with the oldest unused command, unless it's too old to be requested anymore
+    for (; pos < records.size(); pos++) {
+        if (records[pos].kind == capture::TX && !consumed[pos]) {
+            if (records[pos].time + CAPTURE_REPLAY_SKEW >= commandTime) {
+                break;
+            }
+            consumed[pos] = true;
+            ++skippedCommands;
+        }
+    }
+}
+
+bool ReplayStream::isReady() const {
+    return !pending.empty() && pending.front().readyAt <= esp_timer_get_time();
+}
+
+int ReplayStream::available() {
+    return isReady() ? static_cast<int>(pending.front().data.length() - pendingPos) : 0;
+}
+
+int ReplayStream::read() {
+    if (!isReady()) {
+        return -1;
+    }
+
+    const uint8_t c = pending.front().data[pendingPos++];
+    if (pendingPos >= pending.front().data.length()) {
+        pending.pop_front();
+        pendingPos = 0;
+    }
+    return c;
+}
+
+int ReplayStream::peek() {
+    return isReady() ? static_cast<uint8_t>(pending.front().data[pendingPos]) : -1;
+}
+
+void ReplayStream::flush() {
+}
+
+size_t ReplayStream::write(const uint8_t c) {
+    command += static_cast<char>(c);
+    if (c == '\r') {
+        handleCommand();
+        command.clear();
+    }
+    return 1;
+}
+
+size_t ReplayStream::write(const uint8_t *buffer, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
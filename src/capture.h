@@ -0,0 +1,323 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <FS.h>
+#include <OBDState.h>
+
+#define CAPTURE_DIR                 "/captures"
+
+#define CAPTURE_MAGIC               "OBCP"
+#define CAPTURE_VERSION             1
+#define CAPTURE_HEADER_SIZE         16
+
+#define CAPTURE_BUFFER_SIZE         4096
+#define CAPTURE_NUM_BUFFERS         3
+#define CAPTURE_CHUNK_SIZE          64
+#define CAPTURE_VALUE_SIZE          48
+#define CAPTURE_FLUSH_INTERVAL      10000
+#define CAPTURE_MAX_SIZE            (256 * 1024)
+
+// kind + time delta + length + a chunk or a value record (name, value)
+#define CAPTURE_MAX_RECORD_SIZE     (1 + 10 + 2 + 33 + CAPTURE_VALUE_SIZE)
+
+#define CAPTURE_REPLAY_WINDOW       256
+#define CAPTURE_REPLAY_SKEW         2000000
+
+namespace capture {
+    typedef enum {
+        RX,
+        TX,
+        VALUE,
+    } RecordKind;
+}
+
+struct CaptureBuffer {
+    uint16_t len;
+    uint16_t count;
+    unsigned long started;
+    uint8_t data[CAPTURE_BUFFER_SIZE];
+};
+
+/**
+ * Recorder of the raw adapter I/O for reproducing field issues.
+ *
+ * Every session is written into its own file on the filesystem, which starts with a header followed by records of
+ * kind, µs since the previous record, length and data. Received and sent bytes are recorded in chunks, which end with
+ * the <code>&gt;</code> prompt or a carriage return, the formatted values of updated states are recorded too, so a
+ * replay can be compared against the values of the drive.
+ * Records are collected in RAM buffers and handed over to a writer task like the trip log. Old captures are removed
+ * at start to keep at least half of the size budget for the new session, which stops recording if it runs out.
+ * Responses are kept as received text, a request takes about 55 bytes including the values, so the default budget
+ * holds less than two minutes of polling at 50 requests per second.
+ *
+ * All methods except begin() and end() must be called by the task, which talks to the adapter.
+ *
+ * @see ReplayStream
+ */
+class CaptureClass {
+    fs::FS *fs = nullptr;
+
+    size_t maxSize = 0;
+
+    std::atomic_bool running{false};
+
+    std::atomic_bool writerRunning{false};
+
+    /** set while a record is appended, end() waits for it before handing over the active buffer */
+    std::atomic_bool recording{false};
+
+    CaptureBuffer *buffers = nullptr;
+
+    CaptureBuffer *activeBuffer = nullptr;
+
+    QueueHandle_t freeBuffers = nullptr;
+
+    QueueHandle_t fullBuffers = nullptr;
+
+    TaskHandle_t writerTaskHdl = nullptr;
+
+    int64_t lastRecordTime = 0;
+
+    const OBDState *lastState = nullptr;
+
+    long lastStateUpdate = 0;
+
+    File file;
+
+    uint32_t fileSeq = 0;
+
+    size_t fileSize = 0;
+
+    std::atomic<uint32_t> records{0};
+
+    std::atomic<uint32_t> droppedRecords{0};
+
+    static void writerTask(void *parameters);
+
+    void append(capture::RecordKind kind, const uint8_t *data, size_t len, const uint8_t *data2 = nullptr,
+                size_t len2 = 0);
+
+    void recordValue(OBDState *state);
+
+    bool openFile();
+
+    size_t enforceBudget();
+
+    void releaseResources();
+
+public:
+    /**
+     * Starts a new capture.
+     *
+     * @param fs the filesystem
+     * @param maxSize the maximum size of all captures in bytes
+     * @param freeBytes the free bytes it may use in addition to its own files
+     * @return <code>true</code> if started
+     */
+    bool begin(fs::FS &fs, size_t maxSize, size_t freeBytes);
+
+    /**
+     * Writes all pending records and stops the writer, should be called before restart or sleep.
+     * May be called by another task, it waits for a record in progress to be appended.
+     */
+    void end();
+
+    bool isRunning() const;
+
+    /**
+     * Records bytes sent to or received from the adapter.
+     * Never blocks, records are dropped if the writer can't keep up.
+     *
+     * @param kind the direction
+     * @param data the bytes
+     * @param len the number of bytes
+     */
+    void record(capture::RecordKind kind, const uint8_t *data, size_t len);
+
+    /**
+     * Records the formatted value of given state if it was updated since the last call.
+     *
+     * @param state the state, may be <code>nullptr</code>
+     */
+    void record(OBDState *state);
+
+    /**
+     * Formats the value of the state like it's published.
+     *
+     * @param state the state
+     * @param buffer receives the value
+     * @param len the size of the buffer
+     */
+    static void formatValue(OBDState *state, char *buffer, size_t len);
+
+    uint32_t getRecords() const;
+
+    uint32_t getDroppedRecords() const;
+};
+
+extern CaptureClass Capture;
+
+/**
+ * Stream wrapper, which passes all adapter I/O to the capture while it's running.
+ */
+class CaptureStream : public Stream {
+    Stream *stream = nullptr;
+
+    uint8_t chunk[CAPTURE_CHUNK_SIZE]{};
+
+    size_t chunkLen = 0;
+
+    capture::RecordKind chunkKind = capture::TX;
+
+    void capture(capture::RecordKind kind, uint8_t c);
+
+    void finishChunk();
+
+public:
+    /**
+     * @param stream the adapter stream
+     * @return this wrapper
+     */
+    CaptureStream &attach(Stream &stream);
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    void flush() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+};
+
+/**
+ * A decoded capture record, the time is in µs since the start of the capture.
+ */
+struct CaptureRecord {
+    int64_t time;
+    uint8_t kind;
+    std::string data;
+};
+
+/**
+ * Adapter stream, which answers with the responses of a capture.
+ *
+ * A command is matched with the next unused recorded command with the same text within a window of records,
+ * so commands may be sent in a slightly different order than recorded. Recorded commands, which are more than
+ * two seconds older than the last match, are skipped, e.g. if a state was disabled. Unknown commands are answered
+ * with <code>NO DATA</code>. Responses are available after their recorded latency or immediately, the clock can be
+ * accelerated or stepped on the host with <code>esp_timer_set_time_scale()</code>. The values recorded after
+ * a response are passed to the value callback once the following command is written, i.e. after the response
+ * was processed.
+ *
+ * The whole capture is loaded into memory, so it's meant for the native build.
+ */
+class ReplayStream : public Stream {
+    std::vector<CaptureRecord> records{};
+
+    std::vector<bool> consumed{};
+
+    size_t pos = 0;
+
+    size_t lastMatch = SIZE_MAX;
+
+    bool realTiming = true;
+
+    std::string command{};
+
+    struct PendingChunk {
+        int64_t readyAt;
+        std::string data;
+    };
+
+    std::deque<PendingChunk> pending{};
+
+    size_t pendingPos = 0;
+
+    std::function<void(const char *name, const char *value)> valueCallback = nullptr;
+
+    uint32_t matchedCommands = 0;
+
+    uint32_t skippedCommands = 0;
+
+    uint32_t unmatchedCommands = 0;
+
+    void handleCommand();
+
+    void emitValues();
+
+    bool isReady() const;
+
+public:
+    /**
+     * Loads a capture, a record cut off at the end is ignored.
+     *
+     * @param fs the filesystem
+     * @param path the path of the capture
+     * @param realTiming <code>true</code> to delay responses by their recorded latency
+     * @return <code>true</code> if the capture is valid
+     */
+    bool begin(fs::FS &fs, const char *path, bool realTiming = true);
+
+    /**
+     * @param callback called with the name and formatted value of every recorded state update
+     */
+    void onValue(const std::function<void(const char *name, const char *value)> &callback);
+
+    /**
+     * @return <code>true</code> if the last recorded command was replayed
+     */
+    bool isFinished() const;
+
+    /**
+     * Passes the remaining recorded values to the value callback.
+     */
+    void finish();
+
+    /**
+     * @return the recorded duration in µs
+     */
+    int64_t getDuration() const;
+
+    /**
+     * Prints the number of matched, skipped and unknown commands.
+     *
+     * @param out the output
+     */
+    void printStats(Print &out) const;
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    void flush() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+};
@@ -0,0 +1,275 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#ifdef NATIVE
+#include "evaluator.h"
+#include "triplog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <esp_timer.h>
+
+static uint16_t getU16(const std::vector<uint8_t> &buf, const size_t pos) {
+    return buf[pos] | (buf[pos + 1] << 8);
+}
+
+static uint32_t getU32(const std::vector<uint8_t> &buf, const size_t pos) {
+    return buf[pos] | (buf[pos + 1] << 8) | (buf[pos + 2] << 16) | (static_cast<uint32_t>(buf[pos + 3]) << 24);
+}
+
+static bool getVarInt(const std::vector<uint8_t> &buf, size_t &pos, const size_t end, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        const uint8_t b = buf[pos++];
+        value |= static_cast<uint64_t>(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int64_t decodeZigZag(const uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+BatchEvaluator::BatchEvaluator(OBDStates &states) : states(states) {
+}
+
+bool BatchEvaluator::decodeBlock(const std::vector<uint8_t> &buf, size_t &pos,
+                                 std::vector<EvaluatorSample> &samples) {
+    const size_t start = pos;
+    if (start + 13 > buf.size()) {
+        return false;
+    }
+    const size_t end = start + getU16(buf, start + 4);
+    if (end > buf.size() || end < start + 13) {
+        return false;
+    }
+    const uint32_t baseTime = getU32(buf, start + 8);
+    const uint8_t numColumns = buf[start + 12];
+
+    pos = start + 13;
+    for (uint8_t c = 0; c < numColumns; c++) {
+        if (pos + 4 > end) {
+            return false;
+        }
+        const uint8_t valueType = buf[pos + 1];
+        const uint8_t decimals = buf[pos + 2];
+        const uint8_t nameLen = buf[pos + 3];
+        pos += 4;
+        if (pos + nameLen > end) {
+            return false;
+        }
+        const std::string name(reinterpret_cast<const char *>(&buf[pos]), nameLen);
+        pos += nameLen;
+
+        uint64_t count = 0;
+        if (!getVarInt(buf, pos, end, count)) {
+            return false;
+        }
+
+        uint32_t time = baseTime;
+        int64_t value = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t timeDelta = 0, valueDelta = 0;
+            if (!getVarInt(buf, pos, end, timeDelta) || !getVarInt(buf, pos, end, valueDelta)) {
+                return false;
+            }
+            time += timeDelta;
+            value += decodeZigZag(valueDelta);
+            samples.push_back({
+                time, valueType == triplog::FLOAT ? value / pow(10, decimals) : static_cast<double>(value), name
+            });
+        }
+    }
+
+    pos = end;
+    return true;
+}
+
+bool BatchEvaluator::addSegment(fs::FS &fs, const char *path) {
+    File file = fs.open(path, FILE_READ);
+    if (!file) {
+        Serial.printf("Failed to open trip log segment %s.\n", path);
+        return false;
+    }
+
+    std::vector<uint8_t> buf(file.size());
+    buf.resize(file.read(buf.data(), buf.size()));
+    file.close();
+
+    if (buf.size() < TRIPLOG_HEADER_SIZE || memcmp(buf.data(), TRIPLOG_MAGIC, 4) != 0 ||
+        getU16(buf, 4) != TRIPLOG_VERSION) {
+        Serial.printf("Invalid trip log segment %s.\n", path);
+        return false;
+    }
+    const size_t pageSize = std::max<size_t>(getU16(buf, 6), 1);
+
+    std::vector<EvaluatorSample> segmentSamples;
+    size_t pos = TRIPLOG_HEADER_SIZE;
+    while (pos + 4 <= buf.size()) {
+        if (getU32(buf, pos) == TRIPLOG_BLOCK_MAGIC && decodeBlock(buf, pos, segmentSamples)) {
+            continue;
+        }
+        // zero padding or corruption, continue at the next page
+        pos = (pos / pageSize + 1) * pageSize;
+    }
+    if (segmentSamples.empty()) {
+        return true;
+    }
+
+    std::stable_sort(segmentSamples.begin(), segmentSamples.end(),
+                     [](const EvaluatorSample &a, const EvaluatorSample &b) {
+                         return a.time < b.time;
+                     });
+
+    // the uptime starts again after a power cycle
+    const uint32_t lastTime = samples.empty() ? 0 : samples.back().time;
+    const uint32_t offset = segmentSamples.front().time <= lastTime ? lastTime + 1 : 0;
+    for (auto &sample: segmentSamples) {
+        sample.time += offset;
+        samples.push_back(std::move(sample));
+    }
+    duration = samples.back().time - samples.front().time;
+
+    return true;
+}
+
+double BatchEvaluator::getValue(OBDState *state) {
+    if (strcmp(state->valueType(), "float") == 0) {
+        return reinterpret_cast<OBDStateFloat *>(state)->getValue();
+    }
+    if (strcmp(state->valueType(), "bool") == 0) {
+        return reinterpret_cast<OBDStateBool *>(state)->getValue() ? 1 : 0;
+    }
+    if (strcmp(state->valueType(), "int") == 0) {
+        return reinterpret_cast<OBDStateInt *>(state)->getValue();
+    }
+    return NAN;
+}
+
+void BatchEvaluator::writeRow(Print &csv, const uint32_t time) {
+    csv.printf("%u", time);
+    for (const auto &s: stats) {
+        csv.printf(",%.10g", getValue(s.state));
+    }
+    csv.print("\n");
+}
+
+void BatchEvaluator::run(Print &csv) {
+    StatesReadGuard guard(states);
+
+    std::vector<OBDState *> calcStates;
+    states.getStates([](const OBDState *state) {
+        return state->isEnabled() && state->getType() == obd::CALC && state->hasCalcExpression();
+    }, calcStates);
+
+    stats.clear();
+    csv.print("time");
+    for (auto *state: calcStates) {
+        stats.push_back({state, 0, 0, 0, 0, 0, 0});
+        csv.printf(",%s", state->getName());
+    }
+    csv.print("\n");
+
+    // the clock only advances to the recorded timestamps
+    esp_timer_set_time_scale(0);
+
+    std::vector<const EvaluatorSample *> recorded;
+    const auto runStart = std::chrono::steady_clock::now();
+    size_t i = 0;
+    while (i < samples.size()) {
+        const uint32_t time = samples[i].time;
+        const int64_t now = esp_timer_get_time();
+        if (time * 1000LL > now) {
+            esp_timer_advance(time * 1000LL - now);
+        }
+
+        recorded.clear();
+        for (; i < samples.size() && samples[i].time == time; i++) {
+            OBDState *state = states.getStateByName(samples[i].state.c_str());
+            if (state == nullptr) {
+                continue;
+            }
+            if (state->getType() == obd::CALC) {
+                recorded.push_back(&samples[i]);
+            } else {
+                state->applyValue(samples[i].value, millis());
+            }
+        }
+
+        bool changed = false;
+        for (auto &s: stats) {
+            const long interval = s.state->getUpdateInterval();
+            if (interval == -1 ? s.state->getLastUpdate() != 0
+                               : s.state->getLastUpdate() + interval >= static_cast<long>(millis())) {
+                continue;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            states.calcState(s.state);
+            const auto elapsed = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count());
+            ++s.evaluations;
+            s.totalTime += elapsed;
+            s.maxTime = std::max(s.maxTime, elapsed);
+            changed = true;
+        }
+
+        for (const auto *sample: recorded) {
+            for (auto &s: stats) {
+                if (sample->state == s.state->getName()) {
+                    const double difference = fabs(getValue(s.state) - sample->value);
+                    ++s.compared;
+                    if (difference > EVALUATOR_TOLERANCE) {
+                        ++s.different;
+                    }
+                    s.maxDifference = std::max(s.maxDifference, difference);
+                    break;
+                }
+            }
+        }
+
+        if (changed) {
+            writeRow(csv, time);
+        }
+    }
+    runTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - runStart).count();
+}
+
+void BatchEvaluator::printStats(Print &out) const {
+    out.printf("%u samples over %.1f s evaluated in %.1f ms (%.0fx real time)\n", static_cast<unsigned>(samples.size()),
+               duration / 1000.0, runTime / 1000.0, runTime != 0 ? duration * 1000.0 / runTime : 0.0);
+    out.printf("%-24s %8s %10s %10s %8s %8s %10s\n", "state", "evals", "mean µs", "max µs", "compared", "differ",
+               "max diff");
+    for (const auto &s: stats) {
+        out.printf("%-24s %8u %10.2f %10.2f %8u %8u %10.4g\n", s.state->getName(), s.evaluations,
+                   s.evaluations != 0 ? s.totalTime / 1000.0 / s.evaluations : 0.0, s.maxTime / 1000.0,
+                   s.compared, s.different, s.maxDifference);
+    }
+}
+
+bool BatchEvaluator::isReproduced() const {
+    for (const auto &s: stats) {
+        if (s.different != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
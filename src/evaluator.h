@@ -0,0 +1,107 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <OBDStates.h>
+#include <string>
+#include <vector>
+
+#define EVALUATOR_TOLERANCE         0.001
+
+/**
+ * A decoded trip log sample, the time is the device uptime in ms.
+ */
+struct EvaluatorSample {
+    uint32_t time;
+    double value;
+    std::string state;
+};
+
+/**
+ * Evaluation counters of a CALC state.
+ */
+struct EvaluatorStats {
+    OBDState *state;
+    uint32_t evaluations;
+    uint64_t totalTime;
+    uint32_t maxTime;
+    uint32_t compared;
+    uint32_t different;
+    double maxDifference;
+};
+
+/**
+ * Computes all CALC states of a profile over recorded trip log segments without adapter, e.g. to validate changed
+ * expressions against a real drive.
+ *
+ * The recorded values of READ states are applied in the order of their timestamps on a stepped clock, so
+ * expressions see the recorded timing, e.g. for <code>$millis</code> or <code>.lu</code>. After every timestamp
+ * the due CALC states are evaluated like by the polling task and the recorded values of CALC states are compared
+ * with the computed ones. Only available in the native build.
+ *
+ * @see tools/trip-log-decoder
+ */
+class BatchEvaluator {
+    OBDStates &states;
+
+    std::vector<EvaluatorSample> samples{};
+
+    std::vector<EvaluatorStats> stats{};
+
+    uint32_t duration = 0;
+
+    uint64_t runTime = 0;
+
+    static bool decodeBlock(const std::vector<uint8_t> &buf, size_t &pos, std::vector<EvaluatorSample> &samples);
+
+    static double getValue(OBDState *state);
+
+    void writeRow(Print &csv, uint32_t time);
+
+public:
+    explicit BatchEvaluator(OBDStates &states);
+
+    /**
+     * Adds the samples of a trip log segment, segments must be added in the order they were written.
+     * Samples of a later power cycle continue after the previous segment.
+     *
+     * @param fs the filesystem
+     * @param path the path of the segment
+     * @return <code>true</code> if the segment is valid
+     */
+    bool addSegment(fs::FS &fs, const char *path);
+
+    /**
+     * Evaluates the CALC states over all samples as fast as possible.
+     *
+     * @param csv receives a row with the values of all CALC states for every timestamp, which changed one of them
+     */
+    void run(Print &csv);
+
+    /**
+     * Prints the evaluation time and the differences to the recorded values per CALC state.
+     *
+     * @param out the output
+     */
+    void printStats(Print &out) const;
+
+    /**
+     * @return <code>true</code> if all recorded CALC values were reproduced within the tolerance
+     */
+    bool isReproduced() const;
+};
@@ -44,3 +44,41 @@ void parseBytes(const char *str, const char sep, byte *bytes, const int maxBytes
 std::string stripChars(const std::string &str, std::regex reg) {
     return std::regex_replace(str, reg, "");
 }
+
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc) {
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    while (len--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+    return ~crc;
+}
+
+BufferStream::BufferStream(const uint8_t *buffer, const size_t size): buffer(buffer), size(size) {
+}
+
+int BufferStream::available() {
+    return static_cast<int>(size - pos);
+}
+
+int BufferStream::read() {
+    return pos < size ? buffer[pos++] : -1;
+}
+
+int BufferStream::peek() {
+    return pos < size ? buffer[pos] : -1;
+}
+
+size_t BufferStream::write(uint8_t) {
+    return 0;
+}
+
+void BufferStream::rewind() {
+    pos = 0;
+}
@@ -47,3 +47,35 @@ void parseBytes(const char *str, char sep, byte *bytes, int maxBytes, int base);
  * @param reg the regex, default <code>[^a-zA-Z0-9_-]</code>
  */
 std::string stripChars(const std::string &str, std::regex reg = std::regex("[^a-zA-Z0-9_-]"));
+
+/**
+ * Calculates the CRC-32 (IEEE 802.3) checksum of given data.
+ *
+ * @param data the data
+ * @param len the length of data
+ * @param crc the checksum of previous data to continue with
+ * @return the checksum
+ */
+uint32_t crc32(const uint8_t *data, size_t len, uint32_t crc = 0);
+
+/**
+ * Read only stream over a memory buffer, e.g. to parse a request body without copying it.
+ */
+class BufferStream : public Stream {
+    const uint8_t *buffer;
+    size_t size;
+    size_t pos = 0;
+
+public:
+    BufferStream(const uint8_t *buffer, size_t size);
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    size_t write(uint8_t) override;
+
+    void rewind();
+};
@@ -0,0 +1,99 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "histogram.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+uint8_t LatencyHistogram::bucketOf(const uint32_t value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+
+    const uint8_t msb = 31 - __builtin_clz(value);
+    const uint32_t bucket = (msb - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS +
+                            ((value >> (msb - HISTOGRAM_SUB_BUCKET_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1));
+    return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+uint32_t LatencyHistogram::lowerBound(const uint8_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    const uint8_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    return (HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+uint32_t LatencyHistogram::upperBound(const uint8_t bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket + 1;
+    }
+
+    return lowerBound(bucket) + (1UL << (bucket / HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+void LatencyHistogram::record(const uint32_t latency) {
+    uint16_t &count = counts[bucketOf(latency / 1000)];
+    if (count != UINT16_MAX) {
+        ++count;
+    }
+    ++total;
+    if (latency > max) {
+        max = latency;
+    }
+}
+
+void LatencyHistogram::reset() {
+    memset(counts, 0, sizeof(counts));
+    total = 0;
+    max = 0;
+}
+
+uint32_t LatencyHistogram::getCount() const {
+    return total;
+}
+
+uint16_t LatencyHistogram::getCount(const uint8_t bucket) const {
+    return bucket < HISTOGRAM_BUCKETS ? counts[bucket] : 0;
+}
+
+uint32_t LatencyHistogram::getMax() const {
+    return max;
+}
+
+uint32_t LatencyHistogram::getPercentile(const uint8_t percent) const {
+    uint32_t sum = 0;
+    for (const auto count: counts) {
+        sum += count;
+    }
+    if (sum == 0) {
+        return 0;
+    }
+
+    const uint32_t rank = (sum * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+            // the last bucket is open ended, the maximum is the better estimate there
+            return i == HISTOGRAM_BUCKETS - 1 ? max : std::min(upperBound(i) * 1000, max);
+        }
+    }
+    return max;
+}
@@ -0,0 +1,79 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <cstdint>
+
+#define HISTOGRAM_SUB_BUCKET_BITS   3
+#define HISTOGRAM_SUB_BUCKETS       (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS           80
+
+/**
+ * Log scaled latency histogram with fixed buckets, similar to HDR histograms.
+ *
+ * Values are counted in ms, every power of two is split into 8 linear sub buckets, so values below 16 ms
+ * are exact and larger ones have a resolution of 12.5% up to 4095 ms, twice the adapter timeout.
+ * Larger values go into the last bucket.
+ * Recording needs a count leading zeros and a few shifts, no floating point.
+ */
+class LatencyHistogram {
+    uint16_t counts[HISTOGRAM_BUCKETS]{};
+
+    uint32_t total = 0;
+
+    uint32_t max = 0;
+
+public:
+    /**
+     * @param value the value in ms
+     * @return the bucket index
+     */
+    static uint8_t bucketOf(uint32_t value);
+
+    /**
+     * @param bucket the bucket index
+     * @return the smallest value in ms of the bucket
+     */
+    static uint32_t lowerBound(uint8_t bucket);
+
+    /**
+     * @param bucket the bucket index
+     * @return the first value in ms, which isn't in the bucket anymore
+     */
+    static uint32_t upperBound(uint8_t bucket);
+
+    /**
+     * @param latency the latency in µs
+     */
+    void record(uint32_t latency);
+
+    void reset();
+
+    uint32_t getCount() const;
+
+    uint16_t getCount(uint8_t bucket) const;
+
+    /**
+     * @return the largest recorded latency in µs
+     */
+    uint32_t getMax() const;
+
+    /**
+     * @param percent the percentile, e.g. <code>99</code>
+     * @return the upper bound in µs of the bucket, which contains the percentile
+     */
+    uint32_t getPercentile(uint8_t percent) const;
+};
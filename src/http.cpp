@@ -17,6 +17,8 @@
 #include "http.h"
 #include <LittleFS.h>
 #include <obd.h>
+#include <capture.h>
+#include <triplog.h>
 
 #if OTA_ENABLED
 #include <ota.h>
@@ -27,6 +29,7 @@ HTTPServer::HTTPServer(const int port): server(port) {
 }
 
 void HTTPServer::init(fs::FS &fs) {
+    server.serveStatic("/api/captures/", fs, CAPTURE_DIR "/");
     server.serveStatic("/", fs, "/public/").setDefaultFile("index.html");
     server.onNotFound([](AsyncWebServerRequest *request) {
         String message = "File Not Found\n\n";
@@ -50,6 +53,8 @@ void HTTPServer::init(fs::FS &fs) {
             if (request->hasParam("reboot")) {
                 request->send(200);
                 Serial.println("Rebooting...");
+                TripLog.end();
+                Capture.end();
                 delay(2000);
                 ESP.restart();
             }
@@ -38,31 +38,40 @@
 #include <LittleFS.h>
 
 #define FORMAT_LITTLEFS_IF_FAILED true
+// kept free for settings, states, the states cache and journal and discovered devices
+#define STORAGE_HEADROOM        (32 * 1024)
 
 #define DISCOVERED_DEVICES_FILE "/discovered_devices.json"
 
+#define OUTPUT_EVENT_QUEUE_LENGTH   64
+
+#define READ_STATES_TASK_PRIORITY   5
+
 #include <numeric>
 
 #include "settings.h"
+#include "capture.h"
 #include "helper.h"
 #include "obd.h"
+#ifdef OBD_SIMULATOR
+#include "simulator.h"
+#endif
 #include "http.h"
+#include "mqtt.h"
+#include "spool.h"
+#include "trace.h"
+#include "triplog.h"
 
 HTTPServer server(80);
 
-#define DEBUG_PORT Serial
-
-// #define DUMP_AT_COMMANDS
-
-#ifdef DUMP_AT_COMMANDS
-#include <StreamDebugger.h>
-StreamDebugger debugger(SerialAT, Serial);
-GSM gsm(debugger);
+#ifdef OBD_SIMULATOR
+ELM327Simulator simulator;
 #endif
 
+#define DEBUG_PORT Serial
+
 
 std::atomic_bool wifiAPStarted{ false };
-std::atomic_bool wifiAPInUse{ false };
 std::atomic<unsigned int> wifiAPStaConnected{ 0 };
 
 std::atomic<int> obdConnectErrors{ 0 };
@@ -72,20 +81,43 @@ std::atomic<unsigned long> startTime{ 0 };
 TaskHandle_t outputTaskHdl;
 TaskHandle_t stateTaskHdl;
 
+QueueHandle_t stateEvents;
+
+unsigned long outputLatencyMax = 0;
+unsigned long outputLatencySum = 0;
+unsigned long outputLatencyCount = 0;
+
+std::atomic<uint32_t> pollLoopLast{ 0 };
+std::atomic<uint32_t> pollLoopAvg{ 0 };
+std::atomic<uint32_t> pollLoopMax{ 0 };
+
+uint32_t lastCompletedUpdates = 0;
+unsigned long lastPollRateTime = 0;
+
+std::atomic<unsigned long> httpLatencyMax{ 0 };
+std::atomic<unsigned long> httpLatencySum{ 0 };
+std::atomic<unsigned long> httpLatencyCount{ 0 };
+
 size_t getESPHeapSize() {
     return heap_caps_get_free_size(MALLOC_CAP_8BIT);
 }
 
 void deepSleep(const int sec) {
     DEBUG_PORT.println("Prepare nap...");
+    MQTT.end();
     WiFi.disconnect(true);
     OBD.end();
-    if (outputTaskHdl != nullptr) {
-        vTaskDelete(outputTaskHdl);
-    }
+    // the polling task records into the buffers of the trip log and the capture, stop it before they are released
     if (stateTaskHdl != nullptr) {
         vTaskDelete(stateTaskHdl);
+        stateTaskHdl = nullptr;
     }
+    TripLog.end();
+    Capture.end();
+    if (outputTaskHdl != nullptr) {
+        vTaskDelete(outputTaskHdl);
+    }
+    Spool.end();
     DEBUG_PORT.println("...ZzZzZz.");
 }
 
@@ -106,33 +138,29 @@ void WiFiAPStart(WiFiEvent_t event, WiFiEventInfo_t info) {
 
 void WiFiAPStop(WiFiEvent_t event, WiFiEventInfo_t info) {
     wifiAPStarted = false;
-    wifiAPInUse = false;
     wifiAPStaConnected = 0;
     DEBUG_PORT.println("WiFi AP stopped.");
 }
 
 void WiFiAPStationConnected(WiFiEvent_t event, WiFiEventInfo_t info) {
     ++wifiAPStaConnected;
-    wifiAPInUse = true;
-
-    if (wifiAPStaConnected == 1) {
-        DEBUG_PORT.println("WiFi AP in use. Stop all other task.");
-        OBD.end();
-    }
+    DEBUG_PORT.printf("WiFi AP client connected (%u).\n", wifiAPStaConnected.load());
 }
 
 void WiFiAPStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info) {
     if (wifiAPStaConnected != 0) {
         --wifiAPStaConnected;
     }
+    DEBUG_PORT.printf("WiFi AP client disconnected (%u).\n", wifiAPStaConnected.load());
+}
 
-    if (wifiAPStaConnected == 0) {
-        DEBUG_PORT.println("WiFi AP all clients disconnected. Start all other task.");
-        OBD.begin(Settings.OBD2.getName(OBD_ADP_NAME), Settings.OBD2.getMAC(), Settings.OBD2.getProtocol(),
-            Settings.OBD2.getCheckPIDSupport(), Settings.OBD2.getDebug(), Settings.OBD2.getSpecifyNumResponses());
-        OBD.connect(true);
-        wifiAPInUse = false;
+void recordHttpLatency(const unsigned long start) {
+    const unsigned long latency = micros() - start;
+    unsigned long max = httpLatencyMax;
+    while (latency > max && !httpLatencyMax.compare_exchange_weak(max, latency)) {
     }
+    httpLatencySum += latency;
+    ++httpLatencyCount;
 }
 
 void startWiFiAP() {
@@ -164,7 +192,9 @@ void startHttpServer() {
         });
 
     server.on("/api/settings", HTTP_GET, [](AsyncWebServerRequest* request) {
-        request->send(200, "application/json", Settings.buildJson().c_str());
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        Settings.printJson(*response);
+        request->send(response);
         });
 
     server.on(
@@ -200,7 +230,18 @@ void startHttpServer() {
     );
 
     server.on("/api/states", HTTP_GET, [](AsyncWebServerRequest* request) {
-        request->send(200, "application/json", OBD.buildJSON().c_str());
+        const unsigned long start = micros();
+        auto writer = std::make_shared<StatesJSONWriter>(OBD);
+        AsyncWebServerResponse* response = request->beginChunkedResponse(
+            "application/json",
+            [writer, start](uint8_t* buffer, size_t maxLen, size_t index) {
+                const size_t len = writer->read(buffer, maxLen);
+                if (len == 0) {
+                    recordHttpLatency(start);
+                }
+                return len;
+            });
+        request->send(response);
         });
 
     server.on(
@@ -219,8 +260,7 @@ void startHttpServer() {
                     memcpy(static_cast<uint8_t*>(request->_tempObject) + index, data, len);
 
                     if (index + len == total) {
-                        auto json = std::string(static_cast<const char*>(request->_tempObject), total);
-                        if (OBD.parseJSON(json)) {
+                        if (OBD.parseJSON(static_cast<const char*>(request->_tempObject), total)) {
                             if (OBD.writeStates(LittleFS)) {
                                 request->send(200);
                             }
@@ -235,6 +275,122 @@ void startHttpServer() {
         }
     );
 
+    server.on(
+        "/api/states/*",
+        HTTP_PATCH,
+        [](AsyncWebServerRequest* request) {
+        },
+        nullptr,
+        [](AsyncWebServerRequest* request, uint8_t* data, size_t len, size_t index, size_t total) {
+            if (request->contentType() == "application/json") {
+                if (!index) {
+                    request->_tempObject = malloc(total);
+                }
+
+                if (request->_tempObject != nullptr) {
+                    memcpy(static_cast<uint8_t*>(request->_tempObject) + index, data, len);
+
+                    if (index + len == total) {
+                        // names may contain spaces or other escaped characters
+                        const String name = request->urlDecode(request->url().substring(strlen("/api/states/")));
+                        JsonDocument doc;
+                        std::string error = "invalid JSON";
+                        if (!deserializeJson(doc, static_cast<const char*>(request->_tempObject), total) &&
+                            OBD.patchState(LittleFS, name.c_str(), doc, error)) {
+                            request->send(200);
+                        } else {
+                            request->send(400, "text/plain", error.c_str());
+                        }
+                    }
+                }
+            } else {
+                request->send(406);
+            }
+        }
+    );
+
+    server.on("/api/metrics", HTTP_GET, [](AsyncWebServerRequest* request) {
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+
+        JsonDocument system;
+        system["uptime"] = (millis() - startTime) / 1000;
+        system["heap"]["free"] = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        system["heap"]["min"] = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+        system["heap"]["largestBlock"] = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+        system["psram"]["free"] = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+        system["psram"]["min"] = heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM);
+        system["tasks"]["ReadStatesTask"] = uxTaskGetStackHighWaterMark(stateTaskHdl);
+        system["tasks"]["OutputTask"] = uxTaskGetStackHighWaterMark(outputTaskHdl);
+        system["tasks"][pcTaskGetName(nullptr)] = uxTaskGetStackHighWaterMark(nullptr);
+        system["pollLoop"]["last"] = pollLoopLast.load();
+        system["pollLoop"]["avg"] = pollLoopAvg.load();
+        system["pollLoop"]["max"] = pollLoopMax.load();
+        system["updates"] = OBD.getCompletedUpdates();
+        system["droppedEvents"] = OBD.getDroppedEvents();
+        system["droppedSamples"] = TripLog.getDroppedSamples();
+        if (Capture.isRunning()) {
+            system["capture"]["records"] = Capture.getRecords();
+            system["capture"]["dropped"] = Capture.getDroppedRecords();
+        }
+
+        response->print("{\"system\":");
+        serializeJson(system, *response);
+        response->print(",\"states\":");
+        OBD.printMetrics(*response);
+        response->print('}');
+
+        request->send(response);
+        });
+
+    server.on("/api/schedule", HTTP_GET, [](AsyncWebServerRequest* request) {
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        OBD.printSchedule(*response);
+        request->send(response);
+        });
+
+    server.on("/api/latency", HTTP_GET, [](AsyncWebServerRequest* request) {
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        OBD.printLatency(*response);
+        request->send(response);
+        });
+
+    server.on("/api/latency", HTTP_DELETE, [](AsyncWebServerRequest* request) {
+        OBD.resetMetrics();
+        request->send(200);
+        });
+
+    server.on("/api/trace", HTTP_GET, [](AsyncWebServerRequest* request) {
+        auto writer = std::make_shared<TraceJSONWriter>();
+        AsyncWebServerResponse* response = request->beginChunkedResponse(
+            "application/json",
+            [writer](uint8_t* buffer, size_t maxLen, size_t index) {
+                return writer->read(buffer, maxLen);
+            });
+        response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+        request->send(response);
+        });
+
+    server.on("/api/captures", HTTP_GET, [](AsyncWebServerRequest* request) {
+        JsonDocument doc;
+        JsonArray captures = doc.to<JsonArray>();
+        File dir = LittleFS.open(CAPTURE_DIR);
+        if (dir && dir.isDirectory()) {
+            File file = dir.openNextFile();
+            while (file) {
+                JsonObject capture = captures.add<JsonObject>();
+                capture["name"] = file.name();
+                capture["size"] = file.size();
+                file.close();
+                file = dir.openNextFile();
+            }
+            dir.close();
+        }
+
+        AsyncResponseStream* response = request->beginResponseStream("application/json");
+        serializeJson(doc, *response);
+        request->send(response);
+        });
+
     server.on("/api/wifi", HTTP_GET, [](AsyncWebServerRequest* request) {
         std::string payload;
         JsonDocument wifiInfo;
@@ -345,56 +501,42 @@ void onBTDevicesDiscovered(BTScanResults* btDeviceList) {
 }
 #endif
 
-bool sendOBDData() {
-    const unsigned long start = millis();
+bool sendOBDData(const OBDStateEvent& event) {
     bool allSendsSucceeded = false;
 
-    DEBUG_PORT.print("Send OBD data...");
-
-    // allSendsSucceeded |= mqtt.sendTopicUpdate(LWT_TOPIC, LWT_CONNECTED);
-
-    std::vector<OBDState*> states{};
-    OBD.getStates([](const OBDState* state) {
-        return state->isVisible() && state->isEnabled() && state->isSupported() && !(
-            state->isDiagnostic() && state->getUpdateInterval() == -1);
-        }, states);
-    if (!states.empty()) {
-        DEBUG_PORT.printf("Found %d states to send\n", states.size());
-
-        for (auto& state : states) {
-            char tmp_char[50];
-            if (state->getLastUpdate() + state->getUpdateInterval() > millis()) {
-                continue;
-            }
-
-            DEBUG_PORT.printf("Sending state %s...\n", state->getName());
+    StatesReadGuard guard(OBD);
+    OBDState* state = OBD.getEventState(event);
+    if (state == nullptr || !(state->isVisible() && state->isEnabled() && state->isSupported() && !(
+        state->isDiagnostic() && state->getUpdateInterval() == -1))) {
+        return true;
+    }
 
-            if (state->valueType() == "int") {
-                auto* is = reinterpret_cast<OBDStateInt*>(state);
-                char* str = is->formatValue();
-                strcpy(tmp_char, str);
-                free(str);
-            } else if (state->valueType() == "float") {
-                auto* is = reinterpret_cast<OBDStateFloat*>(state);
-                char* str = is->formatValue();
-                strcpy(tmp_char, str);
-                free(str);
-            } else if (state->valueType() == "bool") {
-                auto* is = reinterpret_cast<OBDStateBool*>(state);
-                char* str = is->formatValue();
-                strcpy(tmp_char, str);
-                free(str);
-            }
+    char tmp_char[50] = "";
+    if (state->valueType() == "int") {
+        auto* is = reinterpret_cast<OBDStateInt*>(state);
+        char* str = is->formatValue();
+        strlcpy(tmp_char, str, sizeof(tmp_char));
+        free(str);
+    } else if (state->valueType() == "float") {
+        auto* is = reinterpret_cast<OBDStateFloat*>(state);
+        char* str = is->formatValue();
+        strlcpy(tmp_char, str, sizeof(tmp_char));
+        free(str);
+    } else if (state->valueType() == "bool") {
+        auto* is = reinterpret_cast<OBDStateBool*>(state);
+        char* str = is->formatValue();
+        strlcpy(tmp_char, str, sizeof(tmp_char));
+        free(str);
+    }
 
-            DEBUG_PORT.printf("State %s: %s\n", state->getName(), std::string(tmp_char));
+    DEBUG_PORT.printf("State %s: %s\n", state->getName(), tmp_char);
 
-            // allSendsSucceeded |= mqtt.sendTopicUpdate(state->getName(), std::string(tmp_char));
-        }
-    } else {
-        allSendsSucceeded = true;
-    }
+    allSendsSucceeded |= MQTT.sendTopicUpdate(state->getName(), tmp_char);
 
-    DEBUG_PORT.printf("...%s (%dms)\n", allSendsSucceeded ? "done" : "failed", millis() - start);
+    const unsigned long latency = micros() - event.published;
+    outputLatencyMax = std::max(outputLatencyMax, latency);
+    outputLatencySum += latency;
+    ++outputLatencyCount;
 
     return allSendsSucceeded;
 }
@@ -408,15 +550,43 @@ bool sendDiagnosticData() {
 
     sprintf(tmp_char, "%d", static_cast<int>(temperatureRead()));
     DEBUG_PORT.printf("Temperature: %s\n", tmp_char);
-    // allSendsSucceeded |= mqtt.sendTopicUpdate("cpuTemp", std::string(tmp_char));
+    allSendsSucceeded |= MQTT.sendTopicUpdate("cpuTemp", tmp_char);
 
     sprintf(tmp_char, "%lu", static_cast<long>(getESPHeapSize()));
     DEBUG_PORT.printf("Heap size: %s\n", tmp_char);
-    // allSendsSucceeded |= mqtt.sendTopicUpdate("freeMem", std::string(tmp_char));
+    allSendsSucceeded |= MQTT.sendTopicUpdate("freeMem", tmp_char);
 
     sprintf(tmp_char, "%lu", (millis() - startTime) / 1000);
     DEBUG_PORT.printf("Uptime: %s\n", tmp_char);
-    // allSendsSucceeded |= mqtt.sendTopicUpdate("uptime", std::string(tmp_char));
+    allSendsSucceeded |= MQTT.sendTopicUpdate("uptime", tmp_char);
+
+    if (outputLatencyCount != 0) {
+        DEBUG_PORT.printf("Output latency: avg %luus, max %luus, %lu updates, %u suppressed, %u dropped\n",
+            outputLatencySum / outputLatencyCount, outputLatencyMax, outputLatencyCount, OBD.getSuppressedEvents(),
+            OBD.getDroppedEvents());
+        outputLatencyMax = 0;
+        outputLatencySum = 0;
+        outputLatencyCount = 0;
+    }
+
+    const uint32_t completedUpdates = OBD.getCompletedUpdates();
+    if (lastPollRateTime != 0 && millis() > lastPollRateTime) {
+        DEBUG_PORT.printf("Poll rate: %.1f updates/s, %u AP clients\n",
+            (completedUpdates - lastCompletedUpdates) * 1000.0 / (millis() - lastPollRateTime),
+            wifiAPStaConnected.load());
+    }
+    lastCompletedUpdates = completedUpdates;
+    lastPollRateTime = millis();
+
+    if (httpLatencyCount != 0) {
+        DEBUG_PORT.printf("HTTP /api/states latency: avg %luus, max %luus, %lu requests\n",
+            httpLatencySum / httpLatencyCount, httpLatencyMax.load(), httpLatencyCount.load());
+        httpLatencyMax = 0;
+        httpLatencySum = 0;
+        httpLatencyCount = 0;
+    }
+
+    MQTT.printStats(DEBUG_PORT);
 
     DEBUG_PORT.printf("...%s (%dms)\n", allSendsSucceeded ? "done" : "failed", millis() - start);
 
@@ -429,6 +599,7 @@ bool sendStaticDiagnosticData() {
 
     DEBUG_PORT.print("Send static diagnostic data...");
 
+    StatesReadGuard guard(OBD);
     std::vector<OBDState*> states{};
     OBD.getStates([](const OBDState* state) {
         return state->isVisible() && state->isEnabled() && state->isSupported() && state->isDiagnostic() && state->
@@ -460,7 +631,7 @@ bool sendStaticDiagnosticData() {
 
             DEBUG_PORT.printf("State %s: %s\n", state->getName(), std::string(tmp_char));
 
-            // allSendsSucceeded |= mqtt.sendTopicUpdate(state->getName(), std::string(tmp_char));
+            allSendsSucceeded |= MQTT.sendTopicUpdate(state->getName(), tmp_char);
         }
     } else {
         allSendsSucceeded = true;
@@ -473,26 +644,60 @@ bool sendStaticDiagnosticData() {
 
 [[noreturn]] void readStatesTask(void* parameters) {
     for (;;) {
-        if (!wifiAPInUse) {
-            OBD.loop();
+        const unsigned long start = micros();
+        OBDState* state = OBD.loop();
+        TripLog.record(state);
+        Capture.record(state);
+
+        // moving average over the last ~16 iterations, cheap enough for every loop
+        const uint32_t duration = micros() - start;
+        const uint32_t avg = pollLoopAvg;
+        pollLoopAvg = avg + (static_cast<int32_t>(duration - avg) >> 4);
+        pollLoopLast = duration;
+        if (duration > pollLoopMax) {
+            pollLoopMax = duration;
         }
+
         delay(10);
     }
 }
 
 [[noreturn]] void outputTask(void* parameters) {
+    unsigned long lastFlush = 0;
+    unsigned long lastDiagnostic = 0;
+    unsigned long lastDiscovery = 0;
+    OBDStateEvent event{};
+
     for (;;) {
+        // wakes up on every changed state, the collected values are flushed once per data interval
+        const unsigned long dataInterval = Settings.MQTT.getDataInterval() * 1000;
+        const unsigned long sinceFlush = millis() - lastFlush;
+        if (xQueueReceive(stateEvents, &event,
+                          pdMS_TO_TICKS(sinceFlush < dataInterval ? dataInterval - sinceFlush : 0)) == pdTRUE) {
+            sendOBDData(event);
+        }
+
+        MQTT.loop();
+
+        // patches of the web server are compacted here, writing states.json would stall the polling
+        OBD.compactJournal();
 
-        if (wifiAPInUse) {
-            delay(1000);
-            continue;
+        if (millis() - lastDiagnostic >= Settings.MQTT.getDiagnosticInterval() * 1000) {
+            //sendStaticDiagnosticData();
+            sendDiagnosticData();
+            lastDiagnostic = millis();
         }
 
-        //sendStaticDiagnosticData();
-        sendDiagnosticData();
-        sendOBDData();
+        if (millis() - lastFlush >= dataInterval) {
+            MQTT.flush();
+            lastFlush = millis();
+        }
 
-        delay(2000);
+        if (MQTT.isDiscoveryRequested() ||
+            millis() - lastDiscovery >= Settings.MQTT.getDiscoveryInterval() * 1000) {
+            MQTT.sendDiscovery(OBD);
+            lastDiscovery = millis();
+        }
     }
 }
 
@@ -521,6 +726,30 @@ void setup() {
     success = OBD.readStates(LittleFS);
     DEBUG_PORT.printf("OBD states read %s\n", success ? "success" : "failed");
 
+    // trip log, capture and spool share the free space in proportion to their maximum sizes
+    const bool spoolEnabled = Settings.MQTT.getAllowOffline() && !Settings.MQTT.getHostname().isEmpty();
+    const size_t tripLogSize = Settings.Logging.getEnabled() ? Settings.Logging.getMaxSize() : 0;
+    const size_t captureSize = Settings.Logging.getCapture() ? Settings.Logging.getCaptureMaxSize() : 0;
+    const size_t spoolSize = spoolEnabled ? SPOOL_MAX_SIZE : 0;
+    const size_t freeBytes = LittleFS.totalBytes() - LittleFS.usedBytes();
+    const size_t sharedBytes = freeBytes > STORAGE_HEADROOM ? freeBytes - STORAGE_HEADROOM : 0;
+    const size_t totalSize = tripLogSize + captureSize + spoolSize;
+    auto storageShare = [&](const size_t maxSize) -> size_t {
+        // e.g. logging enabled with a max size of 0, the only user gets all shared bytes
+        return totalSize != 0 ? static_cast<uint64_t>(sharedBytes) * maxSize / totalSize : sharedBytes;
+    };
+
+    if (Settings.Logging.getEnabled()) {
+        TripLog.begin(LittleFS, tripLogSize, storageShare(tripLogSize));
+    }
+
+    // the capture starts before connecting, so the initialization of the adapter is recorded too
+    if (Settings.Logging.getCapture()) {
+        Capture.begin(LittleFS, captureSize, storageShare(captureSize));
+    }
+
+    Trace.begin();
+
     // disable Watch Dog for Core 0 - should fix crashes
     disableCore0WDT();
 
@@ -531,16 +760,31 @@ void setup() {
     OBD.onConnectError(onOBDConnectError);
     OBD.begin(Settings.OBD2.getName(OBD_ADP_NAME), Settings.OBD2.getMAC(), Settings.OBD2.getProtocol(),
         Settings.OBD2.getCheckPIDSupport(), Settings.OBD2.getDebug(), Settings.OBD2.getSpecifyNumResponses());
+    OBD.setScaleIntervals(Settings.OBD2.getScaleIntervals());
 #ifdef USE_BLE
     OBD.onDevicesDiscovered(onBLEDevicesDiscovered);
 #else
     OBD.onDevicesDiscovered(onBTDevicesDiscovered);
+#endif
+#ifdef OBD_SIMULATOR
+    // demo build without car, the simulator replaces the Bluetooth adapter
+    if (simulator.begin(OBD_SIMULATOR)) {
+        OBD.setAdapter(&simulator);
+    }
 #endif
     OBD.connect();
 
+    if (spoolEnabled) {
+        Spool.begin(LittleFS, spoolSize, storageShare(spoolSize));
+    }
+    MQTT.begin(stripChars(WiFi.macAddress().c_str()).c_str());
+
+    stateEvents = OBD.subscribe(OUTPUT_EVENT_QUEUE_LENGTH);
     xTaskCreatePinnedToCore(outputTask, "OutputTask", 9216, nullptr, 10, &outputTaskHdl, 0);
 
-    xTaskCreatePinnedToCore(readStatesTask, "ReadStatesTask", 9216, nullptr, 1, &stateTaskHdl, 1);
+    // polling owns core 1, the Wi-Fi, Bluetooth and web server tasks run on core 0
+    xTaskCreatePinnedToCore(readStatesTask, "ReadStatesTask", 9216, nullptr, READ_STATES_TASK_PRIORITY,
+        &stateTaskHdl, 1);
 }
 
 void loop() {
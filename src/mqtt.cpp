@@ -0,0 +1,325 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "mqtt.h"
+#include "settings.h"
+#include "spool.h"
+
+template<typename T>
+void MQTTClass::setup(T *client) {
+    client->setServer(hostname, Settings.MQTT.getPort());
+    if (strlen(username) != 0) {
+        client->setCredentials(username, password);
+    }
+    client->setClientId(deviceId);
+    client->setKeepAlive(MQTT_KEEP_ALIVE);
+    client->setCleanSession(true);
+    client->setWill(statusTopic, 1, true, MQTT_STATUS_OFFLINE);
+    client->onConnect([this](bool sessionPresent) {
+        Serial.printf("MQTT connected to %s.\n", hostname);
+        this->client->publish(statusTopic, 1, true, MQTT_STATUS_ONLINE);
+        discoveryRequested = true;
+    });
+    client->onDisconnect([](espMqttClientTypes::DisconnectReason reason) {
+        Serial.printf("MQTT disconnected (%d).\n", static_cast<int>(reason));
+    });
+    client->onPublish([this](uint16_t packetId) {
+        ++acknowledgedMessages;
+        // the spool belongs to the output task
+        xQueueSend(acknowledgments, &packetId, 0);
+    });
+    this->client = client;
+}
+
+void MQTTClass::begin(const char *deviceId) {
+    if (client != nullptr || Settings.MQTT.getHostname().isEmpty()) {
+        return;
+    }
+
+    strlcpy(this->deviceId, deviceId, sizeof(this->deviceId));
+    snprintf(baseTopic, sizeof(baseTopic), "%s/%s", MQTT_TOPIC_PREFIX, this->deviceId);
+    snprintf(statusTopic, sizeof(statusTopic), "%s/%s", baseTopic, MQTT_STATUS_TOPIC);
+
+    // the client keeps pointers to these strings
+    strlcpy(hostname, Settings.MQTT.getHostname().c_str(), sizeof(hostname));
+    strlcpy(username, Settings.MQTT.getUsername().c_str(), sizeof(username));
+    strlcpy(password, Settings.MQTT.getPassword().c_str(), sizeof(password));
+
+    batch = Settings.MQTT.getBatch();
+
+    acknowledgments = xQueueCreate(MQTT_MAX_QUEUE_SIZE, sizeof(uint16_t));
+
+    if (Settings.MQTT.getSecure()) {
+        auto *secureClient = new espMqttClientSecure();
+        secureClient->setInsecure();
+        setup(secureClient);
+    } else {
+        setup(new espMqttClient());
+    }
+
+    Serial.printf("MQTT connecting to %s:%d as %s...\n", hostname, Settings.MQTT.getPort(), this->deviceId);
+    lastConnectAttempt = millis();
+    client->connect();
+}
+
+void MQTTClass::end() {
+    if (client == nullptr) {
+        return;
+    }
+
+    client->publish(statusTopic, 1, true, MQTT_STATUS_OFFLINE);
+    client->disconnect();
+}
+
+bool MQTTClass::isEnabled() const {
+    return client != nullptr;
+}
+
+bool MQTTClass::isConnected() const {
+    return client != nullptr && client->connected();
+}
+
+void MQTTClass::loop() {
+    if (client == nullptr) {
+        return;
+    }
+
+    Spool.loop();
+
+    uint16_t packetId;
+    while (xQueueReceive(acknowledgments, &packetId, 0) == pdTRUE) {
+        Spool.acknowledge(packetId);
+    }
+
+    if (client->connected()) {
+        drain();
+    } else {
+        // messages in flight are lost with the connection
+        Spool.rewind();
+        if (client->disconnected() && millis() - lastConnectAttempt >= MQTT_RECONNECT_INTERVAL) {
+            lastConnectAttempt = millis();
+            client->connect();
+        }
+    }
+}
+
+void MQTTClass::drain() {
+    std::string topic, payload;
+    size_t count = 0;
+    while (count < MQTT_DRAIN_BATCH_SIZE && client->queueSize() < MQTT_MAX_QUEUE_SIZE &&
+           Spool.peek(topic, payload)) {
+        const uint16_t packetId = client->publish(topic.c_str(), 1, false,
+                                                  reinterpret_cast<const uint8_t *>(payload.data()), payload.length());
+        if (packetId == 0) {
+            break;
+        }
+        Spool.sent(packetId);
+        ++publishedMessages;
+        publishedBytes += payload.length();
+        ++count;
+    }
+}
+
+bool MQTTClass::publish(const char *topic, const char *payload, const size_t len, const bool retain) {
+    if (client == nullptr) {
+        return false;
+    }
+
+    // while offline or spooled messages are pending, values go into the spool to keep their order,
+    // retained messages are sent again on connect anyway
+    if (!retain && Spool.isEnabled() && (!client->connected() || !Spool.isEmpty())) {
+        if (Spool.push(topic, reinterpret_cast<const uint8_t *>(payload), len)) {
+            return true;
+        }
+        ++droppedMessages;
+        return false;
+    }
+
+    if (!client->connected() || client->queueSize() >= MQTT_MAX_QUEUE_SIZE) {
+        ++droppedMessages;
+        return false;
+    }
+
+    if (client->publish(topic, 1, retain, reinterpret_cast<const uint8_t *>(payload), len) == 0) {
+        ++droppedMessages;
+        return false;
+    }
+
+    ++publishedMessages;
+    publishedBytes += len;
+    return true;
+}
+
+bool MQTTClass::sendTopicUpdate(const char *name, const char *value) {
+    if (client == nullptr) {
+        return false;
+    }
+
+    if (!batch) {
+        char topic[80];
+        snprintf(topic, sizeof(topic), "%s/%s", baseTopic, name);
+        return publish(topic, value, strlen(value));
+    }
+
+    // numbers are added as they are formatted to keep their precision and avoid quotes
+    char *end = nullptr;
+    const double num = strtod(value, &end);
+    if (end != value && *end == '\0' && std::isfinite(num)) {
+        pending[name] = serialized(std::string(value));
+    } else {
+        pending[name] = value;
+    }
+    ++pendingCount;
+
+    return true;
+}
+
+bool MQTTClass::flush() {
+    if (client == nullptr || pendingCount == 0) {
+        return true;
+    }
+
+    char topic[48];
+    snprintf(topic, sizeof(topic), "%s/%s", baseTopic, MQTT_BATCH_TOPIC);
+
+    pending[MQTT_BATCH_TIMESTAMP] = millis();
+
+    std::string payload;
+    serializeJson(pending, payload);
+    pending.clear();
+    pendingCount = 0;
+
+    return publish(topic, payload.c_str(), payload.length());
+}
+
+void MQTTClass::buildDiscovery(const OBDState *state, std::string &topic, std::string &payload) const {
+    const bool binary = strcmp(state->valueType(), "bool") == 0;
+
+    topic = MQTT_DISCOVERY_PREFIX;
+    topic += binary ? "/binary_sensor/" : "/sensor/";
+    topic += deviceId;
+    topic += "/";
+    topic += state->getName();
+    topic += "/config";
+
+    JsonDocument doc;
+    doc["name"] = state->getDescription();
+    doc["unique_id"] = std::string(deviceId) + "_" + state->getName();
+    doc["availability_topic"] = statusTopic;
+    if (batch) {
+        doc["state_topic"] = std::string(baseTopic) + "/" + MQTT_BATCH_TOPIC;
+        // a batch only holds the changed states, the others keep their state
+        const std::string value = std::string("value_json.") + state->getName();
+        doc["value_template"] = "{{ " + value + " if " + value + " is defined else this.state }}";
+    } else {
+        doc["state_topic"] = std::string(baseTopic) + "/" + state->getName();
+    }
+    if (binary) {
+        // as formatted by OBDStateBool
+        doc["payload_on"] = "on";
+        doc["payload_off"] = "off";
+    } else {
+        if (strlen(state->getUnit()) != 0) {
+            doc["unit_of_measurement"] = state->getUnit();
+        }
+        if (state->isMeasurement()) {
+            doc["state_class"] = "measurement";
+        }
+    }
+    if (strlen(state->getDeviceClass()) != 0) {
+        doc["device_class"] = state->getDeviceClass();
+    }
+    if (strlen(state->getIcon()) != 0) {
+        doc["icon"] = std::string("mdi:") + state->getIcon();
+    }
+    if (state->isDiagnostic()) {
+        doc["entity_category"] = "diagnostic";
+    }
+
+    JsonObject device = doc["device"].to<JsonObject>();
+    device["identifiers"].add(deviceId);
+    device["name"] = MQTT_DEVICE_NAME;
+
+    serializeJson(doc, payload);
+}
+
+bool MQTTClass::sendDiscovery(OBDStates &states) {
+    discoveryRequested = false;
+
+    if (client == nullptr || !client->connected()) {
+        return false;
+    }
+
+    bool allSendsSucceeded = true;
+
+    StatesReadGuard guard(states);
+    const OBDStateSet *set = states.currentStates();
+    if (set->generation != discoveryGeneration) {
+        discoveryCache.clear();
+        discoveryGeneration = set->generation;
+    }
+
+    for (const auto *state: set->states) {
+        if (!(state->isVisible() && state->isEnabled() && state->isSupported())) {
+            continue;
+        }
+
+        auto it = discoveryCache.find(state->getName());
+        if (it == discoveryCache.end()) {
+            std::string topic, payload;
+            buildDiscovery(state, topic, payload);
+            it = discoveryCache.emplace(state->getName(), std::make_pair(topic, payload)).first;
+        }
+
+        allSendsSucceeded &= publish(it->second.first.c_str(), it->second.second.c_str(), it->second.second.length(),
+                                     true);
+    }
+
+    return allSendsSucceeded;
+}
+
+bool MQTTClass::isDiscoveryRequested() const {
+    return discoveryRequested;
+}
+
+void MQTTClass::printStats(Print &out) const {
+    if (client == nullptr) {
+        return;
+    }
+
+    out.printf("MQTT %s: %u published (%u bytes), %u acknowledged, %u dropped, %u queued, %u cached discoveries\n",
+               client->connected() ? "connected" : "disconnected", getPublishedMessages(), getPublishedBytes(),
+               getAcknowledgedMessages(), getDroppedMessages(), client->queueSize(), discoveryCache.size());
+    Spool.printStats(out);
+}
+
+uint32_t MQTTClass::getPublishedMessages() const {
+    return publishedMessages;
+}
+
+uint32_t MQTTClass::getPublishedBytes() const {
+    return publishedBytes;
+}
+
+uint32_t MQTTClass::getAcknowledgedMessages() const {
+    return acknowledgedMessages;
+}
+
+uint32_t MQTTClass::getDroppedMessages() const {
+    return droppedMessages;
+}
+
+MQTTClass MQTT;
@@ -0,0 +1,167 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <espMqttClient.h>
+#include <OBDStates.h>
+
+#define MQTT_TOPIC_PREFIX           "obledash"
+#define MQTT_DISCOVERY_PREFIX       "homeassistant"
+#define MQTT_STATUS_TOPIC           "status"
+#define MQTT_BATCH_TOPIC            "states"
+#define MQTT_STATUS_ONLINE          "online"
+#define MQTT_STATUS_OFFLINE         "offline"
+
+#define MQTT_KEEP_ALIVE             30
+#define MQTT_RECONNECT_INTERVAL     5000
+#define MQTT_MAX_QUEUE_SIZE         32
+#define MQTT_DRAIN_BATCH_SIZE       16
+#define MQTT_BATCH_TIMESTAMP        "ts"
+#define MQTT_DEVICE_NAME            "OBLEDash"
+
+/**
+ * MQTT publisher for state values.
+ *
+ * In batch mode all values of one output cycle are collected and published as a single JSON object
+ * on <code>obledash/&lt;id&gt;/states</code>, otherwise every value is published on its own topic.
+ * Messages are sent with QoS 1, the client keeps them in its outbox and doesn't wait for the acknowledgment,
+ * so several messages are in flight at once. Spooled messages are only removed from the spool after the broker
+ * acknowledged them, unacknowledged ones are sent again after a reconnect.
+ * A batch holds the uptime in ms, when it was collected, as <code>ts</code>, so spooled batches can be placed in time.
+ * Home Assistant discovery payloads are built once per state set and reused until the states are replaced.
+ * If the spool is enabled, values are stored while the broker is unreachable and drained after reconnect.
+ *
+ * All methods except begin() must be called by the output task.
+ */
+class MQTTClass {
+    MqttClient *client = nullptr;
+
+    char deviceId[17]{};
+
+    char baseTopic[40]{};
+
+    char statusTopic[48]{};
+
+    char hostname[65]{};
+
+    char username[33]{};
+
+    char password[33]{};
+
+    bool batch = true;
+
+    JsonDocument pending;
+
+    size_t pendingCount = 0;
+
+    std::map<std::string, std::pair<std::string, std::string>> discoveryCache{};
+
+    uint32_t discoveryGeneration = 0;
+
+    std::atomic_bool discoveryRequested{false};
+
+    unsigned long lastConnectAttempt = 0;
+
+    std::atomic<uint32_t> publishedMessages{0};
+
+    std::atomic<uint32_t> publishedBytes{0};
+
+    std::atomic<uint32_t> acknowledgedMessages{0};
+
+    std::atomic<uint32_t> droppedMessages{0};
+
+    /** the packet ids acknowledged by the broker, handed over from the client task */
+    QueueHandle_t acknowledgments = nullptr;
+
+    template<typename T>
+    void setup(T *client);
+
+    bool publish(const char *topic, const char *payload, size_t len, bool retain = false);
+
+    void drain();
+
+    void buildDiscovery(const OBDState *state, std::string &topic, std::string &payload) const;
+
+public:
+    /**
+     * Starts the client and connects to the broker in background.
+     *
+     * @param deviceId the unique id of this device, used for topics and the client id
+     */
+    void begin(const char *deviceId);
+
+    void end();
+
+    bool isEnabled() const;
+
+    bool isConnected() const;
+
+    /**
+     * Reconnects if the connection was lost and drains the spool.
+     */
+    void loop();
+
+    /**
+     * Adds the value to the pending batch or publishes it directly in per-topic mode.
+     *
+     * @param name the state name
+     * @param value the formatted value
+     * @return <code>true</code> if the value was accepted
+     */
+    bool sendTopicUpdate(const char *name, const char *value);
+
+    /**
+     * Publishes the pending batch, should be called every data interval.
+     *
+     * @return <code>true</code> if nothing was pending or the batch was queued
+     */
+    bool flush();
+
+    /**
+     * Publishes the discovery payloads of all visible states, payloads are rebuilt only for a new state set.
+     *
+     * @param states the states
+     * @return <code>true</code> if all payloads were queued
+     */
+    bool sendDiscovery(OBDStates &states);
+
+    /**
+     * @return <code>true</code> if discovery should be sent immediately, e.g. after a reconnect
+     */
+    bool isDiscoveryRequested() const;
+
+    /**
+     * Prints the publisher counters and the size of the outbox.
+     *
+     * @param out the output
+     */
+    void printStats(Print &out) const;
+
+    uint32_t getPublishedMessages() const;
+
+    uint32_t getPublishedBytes() const;
+
+    uint32_t getAcknowledgedMessages() const;
+
+    uint32_t getDroppedMessages() const;
+};
+
+extern MQTTClass MQTT;
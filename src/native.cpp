@@ -0,0 +1,231 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#ifdef NATIVE
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <esp_timer.h>
+#include <chrono>
+#include "benchmark.h"
+#include "capture.h"
+#include "evaluator.h"
+#include "obd.h"
+#include "simulator.h"
+
+#ifndef PIO_UNIT_TESTING
+/**
+ * Replays a capture through the state engine and compares the values with the recorded ones.
+ *
+ * @param path the path of the capture within the root directory
+ * @param scale the time scale, <code>0</code> steps the clock to replay as fast as possible
+ * @return <code>true</code> if all recorded values were reproduced
+ */
+static bool replay(const char *path, const double scale) {
+    static ReplayStream replay;
+    if (!replay.begin(LittleFS, path)) {
+        return false;
+    }
+
+    uint32_t equalValues = 0, differentValues = 0, unknownValues = 0;
+    replay.onValue([&](const char *name, const char *value) {
+        OBDState *state = OBD.getStateByName(name);
+        if (state == nullptr) {
+            ++unknownValues;
+            return;
+        }
+
+        char current[CAPTURE_VALUE_SIZE];
+        CaptureClass::formatValue(state, current, sizeof(current));
+        if (strcmp(current, value) == 0) {
+            ++equalValues;
+        } else if (++differentValues <= 10) {
+            Serial.printf("%s: recorded %s, replayed %s\n", name, value, current);
+        }
+    });
+
+    esp_timer_set_time_scale(scale);
+    OBD.setAdapter(&replay);
+    OBD.begin("", "");
+    OBD.connect();
+
+    // stop if the engine doesn't request the remaining commands at all
+    const unsigned long timeout = replay.getDuration() / 1000 + 10000;
+    const unsigned long replayStart = millis();
+    const auto realStart = std::chrono::steady_clock::now();
+    while (!replay.isFinished() && millis() - replayStart < timeout) {
+        OBD.loop();
+        // a stepped clock only advances while waiting
+        delay(1);
+    }
+    replay.finish();
+
+    const long realTime = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - realStart).count();
+    Serial.printf("%u updates in %lu ms replayed in %ld ms\n", OBD.getCompletedUpdates(), millis() - replayStart,
+                  realTime);
+    replay.printStats(Serial);
+    Serial.printf("Values: %u equal, %u different, %u unknown\n", equalValues, differentValues, unknownValues);
+
+    return differentValues == 0 && unknownValues == 0;
+}
+
+/**
+ * Computes the CALC states over trip log segments and writes their values as CSV.
+ *
+ * @param csvPath the path of the CSV file within the root directory
+ * @param segments the paths of the segments within the root directory
+ * @param numSegments the number of segments
+ * @return <code>true</code> if all recorded CALC values were reproduced
+ */
+static bool evaluate(const char *csvPath, char **segments, const int numSegments) {
+    BatchEvaluator evaluator(OBD);
+    for (int i = 0; i < numSegments; i++) {
+        if (!evaluator.addSegment(LittleFS, segments[i])) {
+            return false;
+        }
+    }
+
+    File csv = LittleFS.open(csvPath, FILE_WRITE);
+    if (!csv) {
+        Serial.printf("Failed to open %s.\n", csvPath);
+        return false;
+    }
+    evaluator.run(csv);
+    csv.close();
+
+    evaluator.printStats(Serial);
+
+    return evaluator.isReproduced();
+}
+
+/**
+ * Measures the polling throughput of all profiles in a directory and writes the results as JSON.
+ *
+ * @param dir the path of the profiles directory within the root directory
+ * @param resultsPath the path of the results file within the root directory
+ * @param thresholdsPath the path of the thresholds file within the root directory, may be <code>nullptr</code>
+ * @return <code>true</code> if no threshold was exceeded
+ */
+static bool benchmark(const char *dir, const char *resultsPath, const char *thresholdsPath) {
+    PollBenchmark benchmark(OBD);
+    if (thresholdsPath != nullptr && !benchmark.loadThresholds(LittleFS, thresholdsPath)) {
+        return false;
+    }
+    if (!benchmark.run(LittleFS, dir)) {
+        Serial.printf("No profiles found in %s.\n", dir);
+        return false;
+    }
+
+    File results = LittleFS.open(resultsPath, FILE_WRITE);
+    if (!results) {
+        Serial.printf("Failed to open %s.\n", resultsPath);
+        return false;
+    }
+    benchmark.writeJSON(results);
+    results.close();
+
+    benchmark.printStats(Serial);
+
+    return benchmark.isPassed();
+}
+
+/**
+ * Entry point of the native build, loads the states from a host directory like the firmware does on startup.
+ * With a simulator profile, the states are polled from a simulated adapter for the given time.
+ * The simulated drive is recorded as capture if <code>capture</code> is appended, with <code>engineoff</code>
+ * the simulated engine is switched off with the ignition on.
+ * With a capture (<code>*.cap</code>), the recorded drive is replayed with the clock accelerated by the given scale,
+ * by default as fast as possible.
+ *
+ * With <code>eval</code>, the CALC states are computed over trip log segments.
+ * With <code>bench</code>, the polling throughput of every profile in a directory is measured.
+ *
+ * Usage: <code>program [root] [profile|capture] [seconds|scale] [capture|engineoff]</code>,
+ * <code>program root eval output.csv segment...</code> or
+ * <code>program root bench profiles results.json [thresholds.json]</code>,
+ * the root directory replaces the LittleFS partition.
+ */
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        LittleFS.setRoot(argv[1]);
+    }
+
+    if (!LittleFS.begin(true)) {
+        Serial.printf("Failed to open %s.\n", LittleFS.getRoot());
+        return 1;
+    }
+
+    // profiles are loaded one by one, no states.json is needed
+    if (argc > 4 && strcmp(argv[2], "bench") == 0) {
+        return benchmark(argv[3], argv[4], argc > 5 ? argv[5] : nullptr) ? 0 : 2;
+    }
+
+    const unsigned long start = micros();
+    const bool success = OBD.readStates(LittleFS);
+    Serial.printf("OBD states read %s in %lu µs\n", success ? "success" : "failed", micros() - start);
+    if (!success) {
+        return 1;
+    }
+
+    if (argc > 4 && strcmp(argv[2], "eval") == 0) {
+        return evaluate(argv[3], argv + 4, argc - 4) ? 0 : 2;
+    }
+
+    if (argc > 2 && strstr(argv[2], ".cap") != nullptr) {
+        const bool reproduced = replay(argv[2], argc > 3 ? strtod(argv[3], nullptr) : 0.0);
+        OBD.printMetrics(Serial);
+        return reproduced ? 0 : 2;
+    }
+
+    if (argc > 2) {
+        static ELM327Simulator simulator;
+        if (!simulator.begin(argv[2])) {
+            return 1;
+        }
+
+        if (argc > 4 && strcmp(argv[4], "capture") == 0) {
+            Capture.begin(LittleFS, CAPTURE_MAX_SIZE * 16, LittleFS.totalBytes() - LittleFS.usedBytes());
+        }
+        if (argc > 4 && strcmp(argv[4], "engineoff") == 0) {
+            simulator.setEngineRunning(false);
+        }
+
+        OBD.setAdapter(&simulator);
+        OBD.begin("", "");
+        OBD.connect();
+
+        const unsigned long duration = argc > 3 ? strtoul(argv[3], nullptr, 10) * 1000 : 10000;
+        const unsigned long pollStart = millis();
+        while (millis() - pollStart < duration) {
+            Capture.record(OBD.loop());
+        }
+        Capture.end();
+
+        const unsigned long elapsed = millis() - pollStart;
+        Serial.printf("%u updates in %lu ms (%.1f/s)\n", OBD.getCompletedUpdates(), elapsed,
+                      OBD.getCompletedUpdates() * 1000.0 / elapsed);
+        simulator.printStats(Serial);
+        Serial.printf("%u states suspended after %u poll guard evaluations\n", OBD.getSuspendedStates(),
+                      OBD.getGuardEvaluations());
+        Serial.printf("%u values taken from shared responses\n", OBD.getSharedReads());
+    }
+
+    OBD.printMetrics(Serial);
+
+    return 0;
+}
+#endif
+#endif
@@ -20,9 +20,91 @@
 #include <OBDStates.h>
 #include <ExprParser.h>
 #include "helper.h"
+#include "triplog.h"
+#include <functional>
+#include <map>
+
+// requests, which run into the timeout, must still get their own bucket
+static_assert(OBD_ADAPTER_TIMEOUT < 1 << (HISTOGRAM_BUCKETS / HISTOGRAM_SUB_BUCKETS + 1),
+              "the latency histogram doesn't cover the adapter timeout");
+
+StatesJSONWriter::StatesJSONWriter(OBDStates &states) : states(states), set(nullptr) {
+}
+
+StatesJSONWriter::StatesJSONWriter(OBDStates &states, const OBDStateSet *set) : states(states), set(set) {
+}
+
+void StatesJSONWriter::appendState(const OBDStateSet *set) {
+    if (index < set->states.size()) {
+        OBDState *state = set->states[index++];
+        JsonDocument doc;
+        state->toJSON(doc);
+
+        std::string stateJson;
+        serializeJson(doc, stateJson);
+        if (!lastName.empty()) {
+            pending += ',';
+        }
+        pending += stateJson;
+        lastName = state->getName();
+    } else {
+        pending += ']';
+        finished = true;
+    }
+}
+
+bool StatesJSONWriter::nextChunk() {
+    if (finished) {
+        return false;
+    }
+
+    pending.clear();
+    pendingPos = 0;
+
+    if (!started) {
+        pending = "[";
+    }
+
+    if (set != nullptr) {
+        appendState(set);
+    } else {
+        StatesReadGuard guard(states);
+        const OBDStateSet *current = states.currentStates();
+        if (started && current->generation != generation && !lastName.empty()) {
+            for (size_t i = 0; i < current->states.size(); i++) {
+                if (lastName == current->states[i]->getName()) {
+                    index = i + 1;
+                    break;
+                }
+            }
+        }
+        generation = current->generation;
+        appendState(current);
+    }
+    started = true;
+
+    return true;
+}
+
+size_t StatesJSONWriter::read(uint8_t *buffer, const size_t maxLen) {
+    size_t written = 0;
+    while (written < maxLen) {
+        if (pendingPos >= pending.size() && !nextChunk()) {
+            break;
+        }
+
+        const size_t len = std::min(maxLen - written, pending.size() - pendingPos);
+        memcpy(buffer + written, pending.data() + pendingPos, len);
+        pendingPos += len;
+        written += len;
+    }
+
+    return written;
+}
 
 OBDClass::OBDClass(): OBDStates(&elm327), elm327() {
     protocol = AUTOMATIC;
+    journalMutex = xSemaphoreCreateMutex();
 
     addCustomFunction("afRatio", [](const double fuelType) {
         switch (static_cast<int>(fuelType)) {
@@ -138,15 +220,23 @@ OBDClass::OBDClass(): OBDStates(&elm327), elm327() {
     });
 }
 
-bool OBDClass::parseJSON(std::string &json) {
-    bool success = false;
-    JsonDocument doc;
-    if (!deserializeJson(doc, json)) {
-        readJSON(doc);
-        success = true;
+bool OBDClass::parseJSON(const char *json, const size_t len) {
+    BufferStream stream(reinterpret_cast<const uint8_t *>(json), len);
+    DeserializationError validateResult = validateJSON(stream);
+    if (validateResult) {
+        Serial.printf("Failed to deserialize states: %s\n", validateResult.c_str());
+        return false;
     }
 
-    return success;
+    stream.rewind();
+    beginUpdate();
+    if (!readJSON(stream)) {
+        abortUpdate();
+        return false;
+    }
+    commitUpdate();
+
+    return true;
 }
 
 template<typename T>
@@ -167,6 +257,12 @@ void OBDClass::fromJSON(T *state, JsonDocument &doc) {
                 !doc["pid"]["scaleFactor"].isNull() ? doc["pid"]["scaleFactor"].as<std::string>().c_str() : "1",
                 !doc["pid"]["bias"].isNull() ? doc["pid"]["bias"].as<float>() : 0.0f
             );
+            state->setExtraction(
+                doc["pid"]["byteOffset"].as<uint8_t>(),
+                doc["pid"]["numBytes"].as<uint8_t>(),
+                doc["pid"]["bitOffset"].as<uint8_t>(),
+                doc["pid"]["numBits"].as<uint8_t>()
+            );
         }
     } else if (state->getType() == obd::CALC) {
         if (!doc["expr"].isNull()) {
@@ -181,91 +277,368 @@ void OBDClass::fromJSON(T *state, JsonDocument &doc) {
         setFormatFuncByName<T>(doc["value"]["func"].as<std::string>().c_str(), state);
     } else if (!doc["value"]["expr"].isNull()) {
         state->setValueFormatExpression(doc["value"]["expr"].as<std::string>().c_str());
+    } else if (!doc["value"]["expression"].isNull()) {
+        // written by previous versions
+        state->setValueFormatExpression(doc["value"]["expression"].as<std::string>().c_str());
+    }
+
+    state->setDeadband(doc["deadband"].as<float>(), doc["deadbandRelative"].as<bool>());
+    state->setMaxSilence(doc["maxSilence"].as<long>());
+    state->setMaxInterval(doc["maxInterval"].as<long>());
+    if (!doc["pollWhen"].isNull()) {
+        state->setPollWhen(doc["pollWhen"].as<std::string>().c_str());
     }
 
     // is reset by setPIDSettings
     state->setUpdateInterval(doc["interval"].as<long>());
 }
 
+/**
+ * Calculates the checksum of a file from its current position to the end.
+ *
+ * @param file the file
+ * @return the checksum
+ */
+static uint32_t checksumFile(File &file) {
+    uint8_t buffer[256];
+    uint32_t checksum = 0;
+    size_t len;
+    while ((len = file.read(buffer, sizeof(buffer))) > 0) {
+        checksum = crc32(buffer, len, checksum);
+    }
+    return checksum;
+}
+
 bool OBDClass::readStates(FS &fs) {
+    const unsigned long start = millis();
+    bool success = false;
+
     File file = fs.open(STATES_FILE, FILE_READ);
     if (file && !file.isDirectory()) {
-        JsonDocument doc;
-        DeserializationError deserializeResult = deserializeJson(doc, file);
-        if (!deserializeResult) {
-            readJSON(doc);
-            file.close();
-            return true;
+        // an edit that keeps the size, like a changed digit, must invalidate the cache as well
+        const size_t sourceSize = file.size();
+        const uint32_t sourceChecksum = checksumFile(file);
+        file.seek(0);
+
+        beginUpdate();
+        if (readStatesCache(fs, sourceSize, sourceChecksum)) {
+            Serial.printf("OBD states loaded from cache in %lums.\n", millis() - start);
+            success = true;
+        } else {
+            DeserializationError validateResult = validateJSON(file);
+            if (!validateResult) {
+                file.seek(0);
+                success = readJSON(file);
+            } else {
+                Serial.println("Failed to deserialize file states.json for reading.");
+                Serial.println(validateResult.c_str());
+            }
+
+            if (success) {
+                Serial.printf("OBD states loaded from states.json in %lums.\n", millis() - start);
+                writeStatesCache(fs, updatingStates(), sourceSize, sourceChecksum);
+            }
+        }
+        file.close();
+
+        if (success) {
+            replayJournal(fs);
+            commitUpdate();
+        } else {
+            abortUpdate();
         }
-        Serial.println("Failed to deserialize file states.json for reading.");
-        Serial.println(deserializeResult.c_str());
     }
 
+    return success;
+}
+
+template<typename T>
+bool OBDClass::patchJSON(T *state, JsonDocument &doc, std::string &error) {
+    if (!doc["pid"]["scaleFactor"].isNull() || !doc["pid"]["bias"].isNull()) {
+        if (state->getType() != obd::READ || state->hasReadFunc()) {
+            error = "pid is only supported by states, which read a PID";
+            return false;
+        }
+
+        const std::string scaleFactor = !doc["pid"]["scaleFactor"].isNull()
+                                            ? doc["pid"]["scaleFactor"].as<std::string>()
+                                            : state->getScaleFactorExpression();
+        if (!scaleFactor.empty()) {
+            ExprParser parser;
+            parser.evalExp(scaleFactor.c_str());
+            if (strlen(parser.errormsg) > 0) {
+                error = std::string("pid.scaleFactor: ") + parser.errormsg;
+                return false;
+            }
+        }
+
+        // the PID settings reset the interval
+        const long interval = state->getUpdateInterval();
+        state->setPIDSettings(state->getService(), state->getPID(), state->getHeader(), state->getNumResponses(),
+                              state->getNumExpectedBytes(), scaleFactor.c_str(),
+                              doc["pid"]["bias"] | state->getBias());
+        state->setUpdateInterval(interval);
+    }
+
+    if (!doc["enabled"].isNull()) {
+        state->setEnabled(doc["enabled"].as<bool>());
+    }
+    if (!doc["visible"].isNull()) {
+        state->setVisible(doc["visible"].as<bool>());
+    }
+    if (!doc["interval"].isNull()) {
+        state->setUpdateInterval(doc["interval"].as<long>());
+    }
+    if (!doc["deadband"].isNull() || !doc["deadbandRelative"].isNull()) {
+        state->setDeadband(doc["deadband"] | state->getDeadband(),
+                           doc["deadbandRelative"] | state->isDeadbandRelative());
+    }
+    if (!doc["maxSilence"].isNull()) {
+        state->setMaxSilence(doc["maxSilence"].as<long>());
+    }
+    if (!doc["maxInterval"].isNull()) {
+        state->setMaxInterval(doc["maxInterval"].as<long>());
+    }
+    if (!doc["pollWhen"].isNull()) {
+        state->setPollWhen(doc["pollWhen"].as<std::string>().c_str());
+    }
+
+    if (!doc["expr"].isNull()) {
+        if (state->getType() != obd::CALC) {
+            error = "expr is only supported by CALC states, use pid.scaleFactor";
+            return false;
+        }
+        state->setCalcExpression(doc["expr"].as<std::string>().c_str());
+    }
+
+    if (!doc["value"]["format"].isNull()) {
+        state->setValueFormat(doc["value"]["format"].as<std::string>().c_str());
+    }
+    if (!doc["value"]["func"].isNull()) {
+        setFormatFuncByName<T>(doc["value"]["func"].as<std::string>().c_str(), state);
+    } else if (!doc["value"]["expr"].isNull()) {
+        // an expression replaces a previously set format function
+        state->setValueFormatFuncName("");
+        state->setValueFormatFunc(nullptr);
+        state->setValueFormatExpression(doc["value"]["expr"].as<std::string>().c_str());
+    }
+
+    return true;
+}
+
+bool OBDClass::applyPatch(const char *name, JsonDocument &doc, std::string &error) {
+    OBDState *state = nullptr;
+    for (OBDState *s: updatingStates()->states) {
+        if (strcmp(s->getName(), name) == 0) {
+            state = s;
+            break;
+        }
+    }
+    if (state == nullptr) {
+        error = std::string("unknown state ") + name;
+        return false;
+    }
+
+    if (strcmp(state->valueType(), "bool") == 0) {
+        return patchJSON(reinterpret_cast<OBDStateBool *>(state), doc, error);
+    }
+    if (strcmp(state->valueType(), "int") == 0) {
+        return patchJSON(reinterpret_cast<OBDStateInt *>(state), doc, error);
+    }
+    if (strcmp(state->valueType(), "float") == 0) {
+        return patchJSON(reinterpret_cast<OBDStateFloat *>(state), doc, error);
+    }
+
+    error = std::string("unsupported value type ") + state->valueType();
     return false;
 }
 
-std::string OBDClass::buildJSON() {
-    std::string payload;
+bool OBDClass::patchState(FS &fs, const char *name, JsonDocument &doc, std::string &error) {
+    beginUpdate();
+
+    // published states are never changed, the patch is applied to a copy of the state, the others are shared
+    {
+        StatesReadGuard guard(*this);
+        for (OBDState *state: latestStates()->states) {
+            if (strcmp(state->getName(), name) == 0) {
+                addState(state->clone());
+            } else {
+                shareState(state);
+            }
+        }
+    }
+
+    if (!applyPatch(name, doc, error)) {
+        abortUpdate();
+        return false;
+    }
+
+    // one patch per line, prefixed with the state name
+    JsonDocument entry;
+    entry["name"] = name;
+    entry["patch"] = doc;
+
+    bool success = false;
+    size_t journalSize = 0;
+    xSemaphoreTake(journalMutex, portMAX_DELAY);
+    File file = fs.open(STATES_JOURNAL_FILE, FILE_APPEND);
+    if (file) {
+        success = serializeJson(entry, file) != 0 && file.write('\n') == 1;
+        journalSize = file.size();
+        file.close();
+    } else {
+        Serial.println("Failed to open file states.journal for writing.");
+        error = "failed to write states.journal";
+    }
+    xSemaphoreGive(journalMutex);
+
+    commitUpdate();
+
+    if (success && journalSize >= STATES_JOURNAL_COMPACT_SIZE) {
+        journalFS = &fs;
+        compactPending = true;
+    }
+
+    return success;
+}
+
+void OBDClass::replayJournal(FS &fs) {
+    // called during an update, the patches are applied to the not yet published states
+    File file = fs.open(STATES_JOURNAL_FILE, FILE_READ);
+    if (!file || file.isDirectory()) {
+        return;
+    }
+
+    unsigned int numPatches = 0;
+    while (file.available()) {
+        JsonDocument entry;
+        if (deserializeJson(entry, file)) {
+            // an incomplete last line is expected after a power loss while appending
+            break;
+        }
+        JsonDocument patch;
+        patch.set(entry["patch"]);
+        std::string error;
+        if (!applyPatch(entry["name"].as<std::string>().c_str(), patch, error)) {
+            Serial.printf("Failed to replay patch, %s.\n", error.c_str());
+        }
+        ++numPatches;
+
+        while (isspace(file.peek())) {
+            file.read();
+        }
+    }
+    file.close();
+
+    Serial.printf("Replayed %u patches from states.journal.\n", numPatches);
+}
+
+void OBDClass::compactJournal() {
+    if (!compactPending.exchange(false)) {
+        return;
+    }
 
+    // writeStates removes the journal, all patches are part of states.json afterward
+    if (writeStates(*journalFS)) {
+        Serial.println("Compacted states.journal into states.json.");
+    }
+}
+
+DeserializationError OBDClass::validateJSON(Stream &stream) {
+    // the filter drops all values, so only the syntax is checked without allocating the document
+    JsonDocument filter;
+    filter.set(false);
     JsonDocument doc;
-    writeJSON(doc);
-    serializeJson(doc, payload);
-
-    return payload;
-}
-
-void OBDClass::readJSON(JsonDocument &doc) {
-    clearStates();
-    const JsonArray array = doc.as<JsonArray>();
-    for (JsonDocument stateObj: array) {
-        printJSON(stateObj);
-        if (stateObj["valueType"] == "bool") {
-            auto *state = new OBDStateBool(
-                stateObj["type"].as<obd::OBDStateType>(),
-                stateObj["name"].as<std::string>().c_str(),
-                stateObj["description"].as<std::string>().c_str(),
-                !stateObj["icon"].isNull() ? stateObj["icon"].as<std::string>().c_str() : "",
-                !stateObj["unit"].isNull() ? stateObj["unit"].as<std::string>().c_str() : "",
-                !stateObj["deviceClass"].isNull() ? stateObj["deviceClass"].as<std::string>().c_str() : "",
-                stateObj["measurement"].as<bool>(),
-                stateObj["diagnostic"].as<bool>()
-            );
-            Serial.printf("initalized state variable %s\n", state->getName());
-            fromJSON(state, stateObj);
-            Serial.printf("read into state variable %s\n", state->getName());
-            addState(state);
+    return deserializeJson(doc, stream, DeserializationOption::Filter(filter));
+}
+
+bool OBDClass::readJSON(Stream &stream) {
+    if (!stream.find("[")) {
+        return false;
+    }
+
+    while (isspace(stream.peek())) {
+        stream.read();
+    }
+    if (stream.peek() == ']') {
+        return true;
+    }
+
+    const size_t heapBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    size_t heapLowest = heapBefore;
+    unsigned int numStates = 0;
+
+    // parse only one state object at a time to keep the peak heap usage independent of the number of states
+    do {
+        JsonDocument stateObj;
+        DeserializationError deserializeResult = deserializeJson(stateObj, stream);
+        if (deserializeResult) {
+            Serial.printf("Failed to deserialize state %u: %s\n", numStates, deserializeResult.c_str());
+            return false;
+        }
+        heapLowest = std::min(heapLowest, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+
+        readStateJSON(stateObj);
+        ++numStates;
+    } while (stream.findUntil(",", "]"));
+
+    const size_t heapAfter = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    Serial.printf("Read %u states, heap used by states %u bytes, peak %u bytes.\n", numStates,
+                  static_cast<unsigned>(heapBefore - heapAfter), static_cast<unsigned>(heapBefore - heapLowest));
+
+    return true;
+}
+
+void OBDClass::readStateJSON(JsonDocument &stateObj) {
+    if (stateObj["valueType"] == "bool") {
+        auto *state = new OBDStateBool(
+            stateObj["type"].as<obd::OBDStateType>(),
+            stateObj["name"].as<std::string>().c_str(),
+            stateObj["description"].as<std::string>().c_str(),
+            !stateObj["icon"].isNull() ? stateObj["icon"].as<std::string>().c_str() : "",
+            !stateObj["unit"].isNull() ? stateObj["unit"].as<std::string>().c_str() : "",
+            !stateObj["deviceClass"].isNull() ? stateObj["deviceClass"].as<std::string>().c_str() : "",
+            stateObj["measurement"].as<bool>(),
+            stateObj["diagnostic"].as<bool>()
+        );
+        Serial.printf("initalized state variable %s\n", state->getName());
+        fromJSON(state, stateObj);
+        Serial.printf("read into state variable %s\n", state->getName());
+        if (addState(state)) {
             Serial.printf("added state variable %s to OBD states\n", state->getName());
-        } else if (stateObj["valueType"] == "float") {
-            auto *state = new OBDStateFloat(
-                stateObj["type"].as<obd::OBDStateType>(),
-                stateObj["name"].as<std::string>().c_str(),
-                stateObj["description"].as<std::string>().c_str(),
-                !stateObj["icon"].isNull() ? stateObj["icon"].as<std::string>().c_str() : "",
-                !stateObj["unit"].isNull() ? stateObj["unit"].as<std::string>().c_str() : "",
-                !stateObj["deviceClass"].isNull() ? stateObj["deviceClass"].as<std::string>().c_str() : "",
-                stateObj["measurement"].as<bool>(),
-                stateObj["diagnostic"].as<bool>()
-            );
-            Serial.printf("initalized state variable %s\n", state->getName());
-            fromJSON(state, stateObj);
-            Serial.printf("read into state variable %s\n", state->getName());
-            addState(state);
+        }
+    } else if (stateObj["valueType"] == "float") {
+        auto *state = new OBDStateFloat(
+            stateObj["type"].as<obd::OBDStateType>(),
+            stateObj["name"].as<std::string>().c_str(),
+            stateObj["description"].as<std::string>().c_str(),
+            !stateObj["icon"].isNull() ? stateObj["icon"].as<std::string>().c_str() : "",
+            !stateObj["unit"].isNull() ? stateObj["unit"].as<std::string>().c_str() : "",
+            !stateObj["deviceClass"].isNull() ? stateObj["deviceClass"].as<std::string>().c_str() : "",
+            stateObj["measurement"].as<bool>(),
+            stateObj["diagnostic"].as<bool>()
+        );
+        Serial.printf("initalized state variable %s\n", state->getName());
+        fromJSON(state, stateObj);
+        Serial.printf("read into state variable %s\n", state->getName());
+        if (addState(state)) {
             Serial.printf("added state variable %s to OBD states\n", state->getName());
-        } else if (stateObj["valueType"] == "int") {
-            auto *state = new OBDStateInt(
-                stateObj["type"].as<obd::OBDStateType>(),
-                stateObj["name"].as<std::string>().c_str(),
-                stateObj["description"].as<std::string>().c_str(),
-                !stateObj["icon"].isNull() ? stateObj["icon"].as<std::string>().c_str() : "",
-                !stateObj["unit"].isNull() ? stateObj["unit"].as<std::string>().c_str() : "",
-                !stateObj["deviceClass"].isNull() ? stateObj["deviceClass"].as<std::string>().c_str() : "",
-                stateObj["measurement"].as<bool>(),
-                stateObj["diagnostic"].as<bool>()
-            );
-            Serial.printf("initalized state variable %s\n", state->getName());
-            fromJSON(state, stateObj);
-            Serial.printf("read into state variable %s\n", state->getName());
-            addState(state);
+        }
+    } else if (stateObj["valueType"] == "int") {
+        auto *state = new OBDStateInt(
+            stateObj["type"].as<obd::OBDStateType>(),
+            stateObj["name"].as<std::string>().c_str(),
+            stateObj["description"].as<std::string>().c_str(),
+            !stateObj["icon"].isNull() ? stateObj["icon"].as<std::string>().c_str() : "",
+            !stateObj["unit"].isNull() ? stateObj["unit"].as<std::string>().c_str() : "",
+            !stateObj["deviceClass"].isNull() ? stateObj["deviceClass"].as<std::string>().c_str() : "",
+            stateObj["measurement"].as<bool>(),
+            stateObj["diagnostic"].as<bool>()
+        );
+        Serial.printf("initalized state variable %s\n", state->getName());
+        fromJSON(state, stateObj);
+        Serial.printf("read into state variable %s\n", state->getName());
+        if (addState(state)) {
             Serial.printf("added state variable %s to OBD states\n", state->getName());
         }
     }
@@ -276,33 +649,255 @@ void OBDClass::printJSON(JsonDocument &doc) {
     Serial.println();
 }
 
-void OBDClass::writeJSON(JsonDocument &doc) {
-    std::vector<OBDState *> states{};
-    getStates([](const OBDState *) {
-        return true;
-    }, states);
-    for (OBDState *state: states) {
-        JsonDocument stateObj;
-        state->toJSON(stateObj);
-        doc.add(stateObj);
-    }
-}
-
 bool OBDClass::writeStates(FS &fs) {
-    bool success = false;
+    bool success = true;
+
+    // patches must not be appended between writing the states and removing the journal
+    lockUpdates();
+    xSemaphoreTake(journalMutex, portMAX_DELAY);
 
     File file = fs.open(STATES_FILE, FILE_WRITE);
     if (!file) {
         Serial.println("Failed to open file settings.json for writing.");
+        xSemaphoreGive(journalMutex);
+        unlockUpdates();
         return false;
     }
 
-    JsonDocument doc;
-    writeJSON(doc);
-    success = serializeJson(doc, file);
+    StatesJSONWriter writer(*this, latestStates());
+    uint8_t buffer[256];
+    size_t size = 0;
+    uint32_t checksum = 0;
+    size_t len;
+    while ((len = writer.read(buffer, sizeof(buffer))) > 0) {
+        if (file.write(buffer, len) != len) {
+            success = false;
+            break;
+        }
+        size += len;
+        checksum = crc32(buffer, len, checksum);
+    }
 
     file.close();
 
+    if (success) {
+        fs.remove(STATES_JOURNAL_FILE);
+        StatesReadGuard guard(*this);
+        writeStatesCache(fs, latestStates(), size, checksum);
+    }
+
+    xSemaphoreGive(journalMutex);
+    unlockUpdates();
+
+    return success;
+}
+
+template<typename T>
+static void toCache(TypedOBDState<T> *state, StatesCacheRecord &record,
+                    const std::function<uint32_t(const char *)> &addString) {
+    record.readFunc = addString(state->getReadFuncName());
+    record.valueFormat = addString(state->getValueFormat());
+    record.valueFormatExpression = addString(state->getValueFormatExpression());
+    record.valueFormatFunc = addString(state->getValueFormatFuncName());
+}
+
+bool OBDClass::writeStatesCache(FS &fs, const OBDStateSet *set, const size_t sourceSize,
+                                const uint32_t sourceChecksum) {
+    std::vector<StatesCacheRecord> records{};
+    records.reserve(set->states.size());
+
+    // equal strings like units or formats are stored only once
+    std::string pool;
+    std::map<std::string, uint32_t> poolIndex{};
+    auto addString = [&](const char *str) -> uint32_t {
+        auto it = poolIndex.find(str);
+        if (it != poolIndex.end()) {
+            return it->second;
+        }
+        const auto offset = static_cast<uint32_t>(pool.size());
+        pool.append(str, strlen(str) + 1);
+        poolIndex.insert({str, offset});
+        return offset;
+    };
+
+    for (OBDState *state: set->states) {
+        StatesCacheRecord record{};
+        record.scaleFactor = state->getScaleFactor();
+        record.interval = state->getUpdateInterval();
+        record.deadband = state->getDeadband();
+        record.maxSilence = state->getMaxSilence();
+        record.maxInterval = state->getMaxInterval();
+        record.bias = state->getBias();
+        record.pid = state->getPID();
+        record.header = state->getHeader();
+        record.type = state->getType();
+        record.flags = (state->isEnabled() ? 0x01 : 0) | (state->isVisible() ? 0x02 : 0) |
+                       (state->isMeasurement() ? 0x04 : 0) | (state->isDiagnostic() ? 0x08 : 0) |
+                       (state->isDeadbandRelative() ? 0x10 : 0);
+        record.service = state->getService();
+        record.numResponses = state->getNumResponses();
+        record.numExpectedBytes = state->getNumExpectedBytes();
+        record.byteOffset = state->getByteOffset();
+        record.numBytes = state->getNumBytes();
+        record.bitOffset = state->getBitOffset();
+        record.numBits = state->getNumBits();
+        record.name = addString(state->getName());
+        record.description = addString(state->getDescription());
+        record.icon = addString(state->getIcon());
+        record.unit = addString(state->getUnit());
+        record.deviceClass = addString(state->getDeviceClass());
+        record.scaleFactorExpression = addString(state->getScaleFactorExpression());
+        record.calcExpression = addString(state->getCalcExpression());
+        record.pollWhen = addString(state->getPollWhen());
+
+        if (strcmp(state->valueType(), "bool") == 0) {
+            record.valueType = 0;
+            toCache(reinterpret_cast<TypedOBDState<bool> *>(state), record, addString);
+        } else if (strcmp(state->valueType(), "int") == 0) {
+            record.valueType = 1;
+            toCache(reinterpret_cast<TypedOBDState<int> *>(state), record, addString);
+        } else if (strcmp(state->valueType(), "float") == 0) {
+            record.valueType = 2;
+            toCache(reinterpret_cast<TypedOBDState<float> *>(state), record, addString);
+        } else {
+            continue;
+        }
+
+        records.push_back(record);
+    }
+
+    StatesCacheHeader header{};
+    memcpy(header.magic, STATES_CACHE_MAGIC, sizeof(header.magic));
+    header.version = STATES_CACHE_VERSION;
+    header.recordSize = sizeof(StatesCacheRecord);
+    header.numStates = records.size();
+    header.sourceSize = sourceSize;
+    header.sourceChecksum = sourceChecksum;
+    header.poolSize = pool.size();
+    header.checksum = crc32(reinterpret_cast<const uint8_t *>(records.data()),
+                            records.size() * sizeof(StatesCacheRecord));
+    header.checksum = crc32(reinterpret_cast<const uint8_t *>(pool.data()), pool.size(), header.checksum);
+
+    File file = fs.open(STATES_CACHE_FILE, FILE_WRITE);
+    if (!file) {
+        Serial.println("Failed to open file states.bin for writing.");
+        return false;
+    }
+
+    const size_t expected = sizeof(header) + records.size() * sizeof(StatesCacheRecord) + pool.size();
+    size_t written = file.write(reinterpret_cast<const uint8_t *>(&header), sizeof(header));
+    written += file.write(reinterpret_cast<const uint8_t *>(records.data()),
+                          records.size() * sizeof(StatesCacheRecord));
+    written += file.write(reinterpret_cast<const uint8_t *>(pool.data()), pool.size());
+    file.close();
+
+    if (written != expected) {
+        fs.remove(STATES_CACHE_FILE);
+        return false;
+    }
+
+    return true;
+}
+
+template<typename T>
+void OBDClass::fromCache(T *state, const StatesCacheRecord &record, const char *pool, const size_t poolSize) {
+    auto str = [&](const uint32_t offset) -> const char * {
+        return offset < poolSize ? pool + offset : "";
+    };
+
+    state->setEnabled(record.flags & 0x01);
+    state->setVisible(record.flags & 0x02);
+
+    if (state->getType() == obd::READ) {
+        if (strlen(str(record.readFunc)) != 0) {
+            setReadFuncByName<T>(str(record.readFunc), state);
+        } else {
+            // scale factor is already evaluated
+            state->setPIDSettings(record.service, record.pid, record.header, record.numResponses,
+                                  record.numExpectedBytes, record.scaleFactor, record.bias);
+            state->setScaleFactorExpression(str(record.scaleFactorExpression));
+            state->setExtraction(record.byteOffset, record.numBytes, record.bitOffset, record.numBits);
+        }
+    } else if (state->getType() == obd::CALC) {
+        if (strlen(str(record.calcExpression)) != 0) {
+            state->setCalcExpression(str(record.calcExpression));
+        }
+    }
+
+    state->setValueFormat(str(record.valueFormat));
+    if (strlen(str(record.valueFormatFunc)) != 0) {
+        setFormatFuncByName<T>(str(record.valueFormatFunc), state);
+    } else if (strlen(str(record.valueFormatExpression)) != 0) {
+        state->setValueFormatExpression(str(record.valueFormatExpression));
+    }
+
+    state->setDeadband(record.deadband, record.flags & 0x10);
+    state->setMaxSilence(record.maxSilence);
+    state->setMaxInterval(record.maxInterval);
+    state->setPollWhen(str(record.pollWhen));
+
+    // is reset by setPIDSettings
+    state->setUpdateInterval(record.interval);
+}
+
+bool OBDClass::readStatesCache(FS &fs, const size_t sourceSize, const uint32_t sourceChecksum) {
+    File file = fs.open(STATES_CACHE_FILE, FILE_READ);
+    if (!file || file.isDirectory()) {
+        return false;
+    }
+
+    bool success = false;
+    StatesCacheHeader header{};
+    if (file.read(reinterpret_cast<uint8_t *>(&header), sizeof(header)) == sizeof(header) &&
+        memcmp(header.magic, STATES_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+        header.version == STATES_CACHE_VERSION &&
+        header.recordSize == sizeof(StatesCacheRecord) &&
+        header.sourceSize == sourceSize &&
+        header.sourceChecksum == sourceChecksum) {
+        const size_t recordsSize = header.numStates * sizeof(StatesCacheRecord);
+        const size_t dataSize = recordsSize + header.poolSize;
+        auto *data = dataSize == file.size() - sizeof(header) ? static_cast<uint8_t *>(malloc(dataSize)) : nullptr;
+        if (data != nullptr && file.read(data, dataSize) == dataSize && crc32(data, dataSize) == header.checksum) {
+            const auto *records = reinterpret_cast<const StatesCacheRecord *>(data);
+            const char *pool = reinterpret_cast<const char *>(data + recordsSize);
+
+            for (uint32_t i = 0; i < header.numStates; i++) {
+                const StatesCacheRecord &record = records[i];
+                auto str = [&](const uint32_t offset) -> const char * {
+                    return offset < header.poolSize ? pool + offset : "";
+                };
+                const auto type = static_cast<obd::OBDStateType>(record.type);
+
+                if (record.valueType == 0) {
+                    auto *state = new OBDStateBool(type, str(record.name), str(record.description), str(record.icon),
+                                                   str(record.unit), str(record.deviceClass), record.flags & 0x04,
+                                                   record.flags & 0x08);
+                    fromCache(state, record, pool, header.poolSize);
+                    addState(state);
+                } else if (record.valueType == 1) {
+                    auto *state = new OBDStateInt(type, str(record.name), str(record.description), str(record.icon),
+                                                  str(record.unit), str(record.deviceClass), record.flags & 0x04,
+                                                  record.flags & 0x08);
+                    fromCache(state, record, pool, header.poolSize);
+                    addState(state);
+                } else if (record.valueType == 2) {
+                    auto *state = new OBDStateFloat(type, str(record.name), str(record.description), str(record.icon),
+                                                    str(record.unit), str(record.deviceClass), record.flags & 0x04,
+                                                    record.flags & 0x08);
+                    fromCache(state, record, pool, header.poolSize);
+                    addState(state);
+                }
+            }
+            success = true;
+        }
+        free(data);
+    }
+    file.close();
+
+    if (!success) {
+        Serial.println("States cache outdated or invalid, fallback to states.json.");
+    }
+
     return success;
 }
 
@@ -404,6 +999,7 @@ void OBDClass::BTEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
         if (OBD.initDone && !OBD.stopConnect) {
             // FIXME get reconnect working - failed with "getChannels() failed timeout"
             // OBD.connect(true);
+            TripLog.end();
             ESP.restart();
         }
     }
@@ -440,6 +1036,7 @@ void OBDClass::onBLEDisconnect() {
     if (OBD.initDone && !OBD.stopConnect) {
         // FIXME get reconnect working
         // OBD.connect(true);
+        TripLog.end();
         ESP.restart();
     }
 }
@@ -485,6 +1082,9 @@ void OBDClass::begin(const String &devName, const String &devMac, const char pro
 
 void OBDClass::end() {
     stopConnect = true;
+    if (adapter != nullptr) {
+        return;
+    }
 #ifdef USE_BLE
     serialBLE.disconnect();
     serialBLE.end();
@@ -494,14 +1094,11 @@ void OBDClass::end() {
 #endif
 }
 
-void OBDClass::connect(bool reconnect) {
-    stopConnect = false;
-
-connect:
-    if (stopConnect || reconnect && !initDone) {
-        return;
-    }
+void OBDClass::setAdapter(Stream *adapter) {
+    this->adapter = adapter;
+}
 
+void OBDClass::connectBluetooth() {
 #ifdef USE_BLE
     if (!serialBLE.begin("OBD2MQTT")) {
         Serial.println("========== serialBLE failed!");
@@ -627,7 +1224,8 @@ connect:
 #ifdef USE_BLE
     if (!stopConnect && !serialBLE.isClosed() && serialBLE.connected()) {
         int retryCount = 0;
-        while (!elm327.begin(serialBLE, debug, 2000, protocol) && retryCount < 3) {
+        while (!elm327.begin(traceStream.attach(captureStream.attach(serialBLE)), debug, OBD_ADAPTER_TIMEOUT,
+                             protocol) && retryCount < 3) {
             Serial.println("Couldn't connect to OBD scanner - Phase 2");
             delay(BT_DISCOVER_TIME);
             retryCount++;
@@ -635,7 +1233,8 @@ connect:
 #else
     if (!stopConnect && !serialBt.isClosed() && serialBt.connected()) {
         int retryCount = 0;
-        while (!elm327.begin(serialBt, debug, 2000, protocol) && retryCount < 3) {
+        while (!elm327.begin(traceStream.attach(captureStream.attach(serialBt)), debug, OBD_ADAPTER_TIMEOUT,
+                             protocol) && retryCount < 3) {
             Serial.println("Couldn't connect to OBD scanner - Phase 2");
             delay(BT_DISCOVER_TIME);
             retryCount++;
@@ -644,6 +1243,27 @@ connect:
     } else if (!stopConnect) {
         Serial.println("Couldn't connect to OBD scanner - Phase 1");
     }
+}
+
+void OBDClass::connect(bool reconnect) {
+    stopConnect = false;
+
+connect:
+    if (stopConnect || reconnect && !initDone) {
+        return;
+    }
+
+    if (adapter != nullptr) {
+        int retryCount = 0;
+        while (!stopConnect &&
+               !elm327.begin(traceStream.attach(captureStream.attach(*adapter)), debug, OBD_ADAPTER_TIMEOUT,
+                             protocol) && retryCount < 3) {
+            Serial.println("Couldn't connect to OBD scanner - Phase 2");
+            retryCount++;
+        }
+    } else {
+        connectBluetooth();
+    }
 
     // if connection stopped (AP connected) wait before reconnect
     while (stopConnect) {
@@ -653,11 +1273,13 @@ connect:
     if (!elm327.connected) {
         delay(BT_DISCOVER_TIME);
         Serial.println("Restarting OBD connect.");
+        if (adapter == nullptr) {
 #ifdef USE_BLE
-        serialBLE.end();
+            serialBLE.end();
 #else
-        serialBt.end();
+            serialBt.end();
 #endif
+        }
         if (connectErrorCallback) {
             connectErrorCallback();
         }
@@ -666,6 +1288,9 @@ connect:
 
     Serial.println("Connected to ELM327");
 
+    // requests, which failed without a connection, say nothing about the states
+    resetFailures();
+
     if (connectedCallback) {
         connectedCallback();
     }
@@ -684,14 +1309,19 @@ connect:
     }
 }
 
-void OBDClass::loop() {
+OBDState *OBDClass::loop() {
+    OBDState *state = nullptr;
+
+    // configuration changes take effect between two requests
+    synchronize();
+
 #ifdef USE_BLE
-    if (!stopConnect && serialBLE && !serialBLE.isClosed()) {
+    if (!stopConnect && (adapter != nullptr || serialBLE && !serialBLE.isClosed())) {
 #else
-    if (!stopConnect && serialBt && !serialBt.isClosed()) {
+    if (!stopConnect && (adapter != nullptr || serialBt && !serialBt.isClosed())) {
 #endif
+        state = nextState();
 #ifdef DEBUG_OBDSTATE
-        OBDState *state = nextState();
         if (state != nullptr && state->getType() == READ && state->getLastUpdate() != -1 && state->isSupported()) {
             if (state->valueType() == "int") {
                 auto s = reinterpret_cast<TypedOBDState<int> *>(state);
@@ -706,12 +1336,12 @@ void OBDClass::loop() {
                 Serial.printf("%s %d -> %d\n", s->getName(), s->getOldValue(), s->getValue());
             }
         }
-#else
-        nextState();
 #endif
     } else {
         delay(500);
     }
+
+    return state;
 }
 
 void OBDClass::onConnected(const std::function<void()> &callback) {
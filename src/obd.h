@@ -21,10 +21,14 @@
 #include <BluetoothSerial.h>
 #endif
 
+#include <atomic>
 #include <bitset>
 #include <FS.h>
 #include <OBDStates.h>
 
+#include "capture.h"
+#include "trace.h"
+
 #include "ELMduino.h"
 
 // ELM327
@@ -35,7 +39,17 @@
 #define OBD_ADP_NAME        "OBDBLE"
 #endif
 
+// the time in ms the adapter may take for a response
+#define OBD_ADAPTER_TIMEOUT 2000
+
 #define STATES_FILE          "/states.json"
+#define STATES_CACHE_FILE    "/states.bin"
+#define STATES_JOURNAL_FILE  "/states.journal"
+
+#define STATES_JOURNAL_COMPACT_SIZE 4096
+
+#define STATES_CACHE_MAGIC   "OBSC"
+#define STATES_CACHE_VERSION 6
 
 #define BT_DISCOVER_TIME    10000
 
@@ -71,6 +85,113 @@
 #define KPH_TO_MPH          1.60934f
 #define LITER_TO_GALLON     3.7854f
 
+/**
+ * Header of the binary states cache, followed by the records and the string pool.
+ */
+struct StatesCacheHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t numStates;
+    uint32_t sourceSize;
+    uint32_t sourceChecksum;
+    uint32_t poolSize;
+    uint32_t checksum;
+};
+
+/**
+ * A compiled state with pre-evaluated numbers, all strings are offsets into the string pool.
+ */
+struct StatesCacheRecord {
+    double scaleFactor;
+    int32_t interval;
+    float bias;
+    float deadband;
+    int32_t maxSilence;
+    int32_t maxInterval;
+    uint16_t pid;
+    uint16_t header;
+    uint8_t type;
+    uint8_t valueType;
+    uint8_t flags;
+    uint8_t service;
+    uint8_t numResponses;
+    uint8_t numExpectedBytes;
+    uint8_t byteOffset;
+    uint8_t numBytes;
+    uint8_t bitOffset;
+    uint8_t numBits;
+    uint8_t reserved[2];
+    uint32_t name;
+    uint32_t description;
+    uint32_t icon;
+    uint32_t unit;
+    uint32_t deviceClass;
+    uint32_t scaleFactorExpression;
+    uint32_t calcExpression;
+    uint32_t readFunc;
+    uint32_t valueFormat;
+    uint32_t valueFormatExpression;
+    uint32_t valueFormatFunc;
+    uint32_t pollWhen;
+};
+
+/**
+ * Serializes all states as JSON array into consecutive chunks, one state at a time.
+ * Only the currently serialized state is held in memory.
+ * Every state is read within its own StatesReadGuard, so a slow client can't delay the deletion of replaced sets.
+ * If the states are replaced in between, the array continues after the last serialized state of the new set.
+ */
+class StatesJSONWriter {
+    OBDStates &states;
+
+    /** the set to serialize, <code>nullptr</code> for the current states */
+    const OBDStateSet *set;
+
+    uint32_t generation = 0;
+
+    size_t index = 0;
+
+    std::string lastName;
+
+    bool started = false;
+
+    bool finished = false;
+
+    std::string pending;
+
+    size_t pendingPos = 0;
+
+    bool nextChunk();
+
+    void appendState(const OBDStateSet *set);
+
+public:
+    /**
+     * Serializes the current states.
+     *
+     * @param states the states
+     */
+    explicit StatesJSONWriter(OBDStates &states);
+
+    /**
+     * Serializes a fixed set, which must be kept alive by the caller, e.g. with locked updates.
+     *
+     * @param states the states
+     * @param set the set
+     */
+    StatesJSONWriter(OBDStates &states, const OBDStateSet *set);
+
+    /**
+     * Fills the buffer with the next part of the JSON array.
+     *
+     * @param buffer the buffer
+     * @param maxLen the size of the buffer
+     * @return the number of bytes written, <code>0</code> if finished
+     */
+    size_t read(uint8_t *buffer, size_t maxLen);
+};
+
 class DTCs {
     std::vector<std::string> v_codes;
 
@@ -92,6 +213,12 @@ class OBDClass : public OBDStates {
 #endif
     ELM327 elm327;
 
+    TraceStream traceStream;
+
+    CaptureStream captureStream;
+
+    Stream *adapter = nullptr;
+
     bool initDone = false;
     bool stopConnect = false;
 
@@ -102,6 +229,13 @@ class OBDClass : public OBDStates {
     bool debug = false;
     bool specifyNumResponses = true;
 
+    SemaphoreHandle_t journalMutex;
+
+    FS *journalFS = nullptr;
+
+    /** set by a patch, which grew the journal beyond its compact size */
+    std::atomic_bool compactPending{false};
+
     DTCs dtcs;
 
     std::string connectedBTAddress;
@@ -116,6 +250,8 @@ class OBDClass : public OBDStates {
     std::function<void(BTScanResults *scanResult)> devDiscoveredCallback = nullptr;
 #endif
 
+    void connectBluetooth();
+
 #ifndef USE_BLE
     static void BTEvent(esp_spp_cb_event_t event, esp_spp_cb_param_t *param);
 
@@ -131,9 +267,25 @@ class OBDClass : public OBDStates {
     template<typename T>
     void fromJSON(T *state, JsonDocument &doc);
 
-    void readJSON(JsonDocument &doc);
+    static DeserializationError validateJSON(Stream &stream);
+
+    bool readJSON(Stream &stream);
 
-    void writeJSON(JsonDocument &doc);
+    void readStateJSON(JsonDocument &stateObj);
+
+    template<typename T>
+    bool patchJSON(T *state, JsonDocument &doc, std::string &error);
+
+    bool applyPatch(const char *name, JsonDocument &doc, std::string &error);
+
+    void replayJournal(FS &fs);
+
+    template<typename T>
+    void fromCache(T *state, const StatesCacheRecord &record, const char *pool, size_t poolSize);
+
+    bool readStatesCache(FS &fs, size_t sourceSize, uint32_t sourceChecksum);
+
+    bool writeStatesCache(FS &fs, const OBDStateSet *set, size_t sourceSize, uint32_t sourceChecksum);
 
     template<typename T>
     T *setReadFuncByName(const char *funcName, T *state);
@@ -144,22 +296,48 @@ class OBDClass : public OBDStates {
 public:
     OBDClass();
 
-    bool parseJSON(std::string &json);
+    bool parseJSON(const char *json, size_t len);
 
     bool readStates(FS &fs);
 
-    std::string buildJSON();
-
     bool writeStates(FS &fs);
 
+    /**
+     * Updates a single state and persists the change in the states journal. Only the patched state is copied into
+     * the next state set, all other states are shared with the published set.
+     * Supported fields are interval, enabled, visible, deadband, deadbandRelative, maxSilence, maxInterval, pollWhen,
+     * expr for CALC states, pid (scaleFactor, bias) for states, which read a PID, and value (format, func, expr).
+     *
+     * @param fs the filesystem
+     * @param name the name of the state
+     * @param doc the changed fields
+     * @param error receives the reason, e.g. the field, which can't be applied
+     * @return <code>true</code> if the state exists and all fields were applied
+     */
+    bool patchState(FS &fs, const char *name, JsonDocument &doc, std::string &error);
+
+    /**
+     * Writes the patches of the states journal into states.json, if a patch grew the journal beyond
+     * STATES_JOURNAL_COMPACT_SIZE. Must be called periodically by a task, which may block on the flash,
+     * e.g. the output task.
+     */
+    void compactJournal();
+
     void begin(const String &devName, const String &devMac, char protocol = AUTOMATIC, bool checkPidSupport = false,
                bool debug = false, bool specifyNumResponses = true);
 
     void end();
 
+    /**
+     * Uses the stream instead of Bluetooth, e.g. a simulated adapter. Must be called before connect().
+     *
+     * @param adapter the adapter stream, <code>nullptr</code> to use Bluetooth
+     */
+    void setAdapter(Stream *adapter);
+
     void connect(bool reconnect = false);
 
-    void loop();
+    OBDState *loop();
 
     void onConnected(const std::function<void()> &callback);
 
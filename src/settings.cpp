@@ -25,12 +25,16 @@ void SettingsClass::readJson(JsonDocument &doc) {
     General.readJson(doc);
     WiFi.readJson(doc);
     OBD2.readJson(doc);
+    MQTT.readJson(doc);
+    Logging.readJson(doc);
 }
 
 void SettingsClass::writeJson(JsonDocument &doc) {
     General.writeJson(doc);
     WiFi.writeJson(doc);
     OBD2.writeJson(doc);
+    MQTT.writeJson(doc);
+    Logging.writeJson(doc);
 }
 
 bool SettingsClass::readSettings(fs::FS &fs) {
@@ -67,14 +71,11 @@ bool SettingsClass::writeSettings(fs::FS &fs) {
     return success;
 }
 
-std::string SettingsClass::buildJson() {
-    std::string payload;
-
+size_t SettingsClass::printJson(Print &output) {
     JsonDocument doc;
     writeJson(doc);
-    serializeJson(doc, payload);
 
-    return payload;
+    return serializeJson(doc, output);
 }
 
 bool SettingsClass::parseJson(std::string json) {
@@ -149,6 +150,7 @@ void OBD2Settings::readJson(JsonDocument &doc) {
     obd2.checkPIDSupport = doc["obd2"]["checkPIDSupport"] | false;
     obd2.debug = doc["obd2"]["debug"] | false;
     obd2.specifyNumResponses = doc["obd2"]["specifyNumResponses"] | true;
+    obd2.scaleIntervals = doc["obd2"]["scaleIntervals"] | false;
     obd2.protocol = doc["obd2"]["protocol"] | '0';
 }
 
@@ -158,6 +160,7 @@ void OBD2Settings::writeJson(JsonDocument &doc) {
     doc["obd2"]["checkPIDSupport"] = obd2.checkPIDSupport;
     doc["obd2"]["debug"] = obd2.debug;
     doc["obd2"]["specifyNumResponses"] = obd2.specifyNumResponses;
+    doc["obd2"]["scaleIntervals"] = obd2.scaleIntervals;
     doc["obd2"]["protocol"] = obd2.protocol;
 }
 
@@ -204,6 +207,14 @@ void OBD2Settings::setSpecifyNumResponses(bool specifyNumResponses) {
     obd2.specifyNumResponses = specifyNumResponses;
 }
 
+bool OBD2Settings::getScaleIntervals() const {
+    return obd2.scaleIntervals;
+}
+
+void OBD2Settings::setScaleIntervals(bool scaleIntervals) {
+    obd2.scaleIntervals = scaleIntervals;
+}
+
 char OBD2Settings::getProtocol() const {
     return obd2.protocol;
 }
@@ -212,4 +223,176 @@ void OBD2Settings::setProtocol(char protocol) {
     obd2.protocol = protocol;
 }
 
+void MQTTSettings::readJson(JsonDocument &doc) {
+    mqtt.protocol = doc["mqtt"]["protocol"] | 0;
+    strlcpy(mqtt.hostname, doc["mqtt"]["hostname"] | "", sizeof(mqtt.hostname));
+    mqtt.port = doc["mqtt"]["port"] | 1883;
+    mqtt.secure = doc["mqtt"]["secure"] | false;
+    strlcpy(mqtt.username, doc["mqtt"]["username"] | "", sizeof(mqtt.username));
+    strlcpy(mqtt.password, doc["mqtt"]["password"] | "", sizeof(mqtt.password));
+    mqtt.allowOffline = doc["mqtt"]["allowOffline"] | false;
+    mqtt.dataInterval = doc["mqtt"]["dataInterval"] | 1;
+    mqtt.diagnosticInterval = doc["mqtt"]["diagnosticInterval"] | 60;
+    mqtt.discoveryInterval = doc["mqtt"]["discoveryInterval"] | 1800;
+    mqtt.locationInterval = doc["mqtt"]["locationInterval"] | 30;
+    mqtt.batch = doc["mqtt"]["batch"] | true;
+}
+
+void MQTTSettings::writeJson(JsonDocument &doc) {
+    doc["mqtt"]["protocol"] = mqtt.protocol;
+    doc["mqtt"]["hostname"] = mqtt.hostname;
+    doc["mqtt"]["port"] = mqtt.port;
+    doc["mqtt"]["secure"] = mqtt.secure;
+    doc["mqtt"]["username"] = mqtt.username;
+    doc["mqtt"]["password"] = mqtt.password;
+    doc["mqtt"]["allowOffline"] = mqtt.allowOffline;
+    doc["mqtt"]["dataInterval"] = mqtt.dataInterval;
+    doc["mqtt"]["diagnosticInterval"] = mqtt.diagnosticInterval;
+    doc["mqtt"]["discoveryInterval"] = mqtt.discoveryInterval;
+    doc["mqtt"]["locationInterval"] = mqtt.locationInterval;
+    doc["mqtt"]["batch"] = mqtt.batch;
+}
+
+int MQTTSettings::getProtocol() const {
+    return mqtt.protocol;
+}
+
+void MQTTSettings::setProtocol(int protocol) {
+    mqtt.protocol = protocol;
+}
+
+String MQTTSettings::getHostname() const {
+    return mqtt.hostname;
+}
+
+void MQTTSettings::setHostname(const char *hostname) {
+    strlcpy(mqtt.hostname, hostname, sizeof(mqtt.hostname));
+}
+
+unsigned int MQTTSettings::getPort() const {
+    return mqtt.port;
+}
+
+void MQTTSettings::setPort(unsigned int port) {
+    mqtt.port = port;
+}
+
+bool MQTTSettings::getSecure() const {
+    return mqtt.secure;
+}
+
+void MQTTSettings::setSecure(bool secure) {
+    mqtt.secure = secure;
+}
+
+String MQTTSettings::getUsername() const {
+    return mqtt.username;
+}
+
+void MQTTSettings::setUsername(const char *username) {
+    strlcpy(mqtt.username, username, sizeof(mqtt.username));
+}
+
+String MQTTSettings::getPassword() const {
+    return mqtt.password;
+}
+
+void MQTTSettings::setPassword(const char *password) {
+    strlcpy(mqtt.password, password, sizeof(mqtt.password));
+}
+
+bool MQTTSettings::getAllowOffline() const {
+    return mqtt.allowOffline;
+}
+
+void MQTTSettings::setAllowOffline(bool allowOffline) {
+    mqtt.allowOffline = allowOffline;
+}
+
+unsigned int MQTTSettings::getDataInterval() const {
+    return mqtt.dataInterval;
+}
+
+void MQTTSettings::setDataInterval(unsigned int dataInterval) {
+    mqtt.dataInterval = dataInterval;
+}
+
+unsigned int MQTTSettings::getDiagnosticInterval() const {
+    return mqtt.diagnosticInterval;
+}
+
+void MQTTSettings::setDiagnosticInterval(unsigned int diagnosticInterval) {
+    mqtt.diagnosticInterval = diagnosticInterval;
+}
+
+unsigned int MQTTSettings::getDiscoveryInterval() const {
+    return mqtt.discoveryInterval;
+}
+
+void MQTTSettings::setDiscoveryInterval(unsigned int discoveryInterval) {
+    mqtt.discoveryInterval = discoveryInterval;
+}
+
+unsigned int MQTTSettings::getLocationInterval() const {
+    return mqtt.locationInterval;
+}
+
+void MQTTSettings::setLocationInterval(unsigned int locationInterval) {
+    mqtt.locationInterval = locationInterval;
+}
+
+bool MQTTSettings::getBatch() const {
+    return mqtt.batch;
+}
+
+void MQTTSettings::setBatch(bool batch) {
+    mqtt.batch = batch;
+}
+
+void LoggingSettings::readJson(JsonDocument &doc) {
+    logging.enabled = doc["logging"]["enabled"] | false;
+    logging.maxSize = doc["logging"]["maxSize"] | 64 * 1024;
+    logging.capture = doc["logging"]["capture"] | false;
+    logging.captureMaxSize = doc["logging"]["captureMaxSize"] | 256 * 1024;
+}
+
+void LoggingSettings::writeJson(JsonDocument &doc) {
+    doc["logging"]["enabled"] = logging.enabled;
+    doc["logging"]["maxSize"] = logging.maxSize;
+    doc["logging"]["capture"] = logging.capture;
+    doc["logging"]["captureMaxSize"] = logging.captureMaxSize;
+}
+
+bool LoggingSettings::getEnabled() const {
+    return logging.enabled;
+}
+
+void LoggingSettings::setEnabled(bool enabled) {
+    logging.enabled = enabled;
+}
+
+unsigned int LoggingSettings::getMaxSize() const {
+    return logging.maxSize;
+}
+
+void LoggingSettings::setMaxSize(unsigned int maxSize) {
+    logging.maxSize = maxSize;
+}
+
+bool LoggingSettings::getCapture() const {
+    return logging.capture;
+}
+
+void LoggingSettings::setCapture(bool capture) {
+    logging.capture = capture;
+}
+
+unsigned int LoggingSettings::getCaptureMaxSize() const {
+    return logging.captureMaxSize;
+}
+
+void LoggingSettings::setCaptureMaxSize(unsigned int captureMaxSize) {
+    logging.captureMaxSize = captureMaxSize;
+}
+
 SettingsClass Settings;
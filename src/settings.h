@@ -131,6 +131,7 @@ class OBD2Settings {
         bool checkPIDSupport;
         bool debug;
         bool specifyNumResponses;
+        bool scaleIntervals;
         char protocol;
     } obd2{};
 
@@ -161,6 +162,10 @@ public:
 
     void setSpecifyNumResponses(bool specifyNumResponses);
 
+    bool getScaleIntervals() const;
+
+    void setScaleIntervals(bool scaleIntervals);
+
     char getProtocol() const;
 
     void setProtocol(char protocol);
@@ -179,6 +184,7 @@ class MQTTSettings {
         unsigned int diagnosticInterval;
         unsigned int discoveryInterval;
         unsigned int locationInterval;
+        bool batch;
     } mqtt{};
 
     void readJson(JsonDocument &doc);
@@ -231,6 +237,42 @@ public:
     unsigned int getLocationInterval() const;
 
     void setLocationInterval(unsigned int locationInterval);
+
+    bool getBatch() const;
+
+    void setBatch(bool batch);
+};
+
+class LoggingSettings {
+    struct {
+        bool enabled;
+        unsigned int maxSize;
+        bool capture;
+        unsigned int captureMaxSize;
+    } logging{};
+
+    void readJson(JsonDocument &doc);
+
+    void writeJson(JsonDocument &doc);
+
+    friend class SettingsClass;
+
+public:
+    bool getEnabled() const;
+
+    void setEnabled(bool enabled);
+
+    unsigned int getMaxSize() const;
+
+    void setMaxSize(unsigned int maxSize);
+
+    bool getCapture() const;
+
+    void setCapture(bool capture);
+
+    unsigned int getCaptureMaxSize() const;
+
+    void setCaptureMaxSize(unsigned int captureMaxSize);
 };
 
 class SettingsClass {
@@ -251,11 +293,13 @@ public:
 
     MQTTSettings MQTT;
 
+    LoggingSettings Logging;
+
     bool readSettings(fs::FS &fs);
 
     bool writeSettings(fs::FS &fs);
 
-    std::string buildJson();
+    size_t printJson(Print &output);
 
     bool parseJson(std::string json);
 };
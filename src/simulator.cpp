@@ -0,0 +1,550 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "simulator.h"
+#include <algorithm>
+#include <esp_timer.h>
+
+// one city/highway cycle of the default drive in seconds
+#define DRIVE_CYCLE         600.0
+
+static double driveSpeed(const double time) {
+    const double t = fmod(time, DRIVE_CYCLE);
+    if (t < 30) {
+        return 0;
+    }
+    if (t < 300) {
+        // city traffic with a stop every 45 s
+        return 25 - 25 * cos(2 * M_PI * (t - 30) / 45);
+    }
+    if (t < 540) {
+        return std::min(110.0, 50 + (t - 300) * 2) + 5 * sin(t / 7);
+    }
+    return 110 * (DRIVE_CYCLE - t) / 60;
+}
+
+static double driveRPM(const double time) {
+    const double speed = driveSpeed(time);
+    return speed < 1 ? 800 : std::min(3500.0, 1100 + speed * 20);
+}
+
+static double driveLoad(const double time) {
+    return 20 + driveSpeed(time) * 0.5;
+}
+
+static double driveMAF(const double time) {
+    return 2 + driveRPM(time) * driveLoad(time) / 100 * 0.012;
+}
+
+static double warmUp(const double time, const double from, const double to, const double tau) {
+    return to - (to - from) * exp(-time / tau);
+}
+
+static double driveDistance(const double time) {
+    // the mean speed of one cycle is about 50 km/h
+    return time * 50 / 3600;
+}
+
+static uint64_t clampRaw(const double value, const uint64_t max) {
+    return value <= 0 ? 0 : value >= static_cast<double>(max) ? max : static_cast<uint64_t>(lround(value));
+}
+
+/**
+ * Changes the response of a running engine like with the engine switched off and the ignition on.
+ *
+ * @param service the service
+ * @param pid the PID
+ * @param payload the data bytes of the running engine, cleared for PIDs, which read zero
+ * @return <code>false</code> if the ECU doesn't answer
+ */
+static bool respondEngineOff(const uint8_t service, const uint16_t pid, std::vector<uint8_t> &payload) {
+    if (service != 0x01) {
+        return true;
+    }
+
+    switch (pid) {
+        case 0x0E:
+        case 0x5E:
+            // timing advance and fuel rate
+            return false;
+        case 0x04:
+        case 0x0C:
+        case 0x0D:
+        case 0x10:
+            // load, RPM, speed and MAF
+            std::fill(payload.begin(), payload.end(), 0);
+            return true;
+        default:
+            return true;
+    }
+}
+
+uint32_t SimulatedECU::key(const uint8_t service, const uint16_t pid) {
+    return static_cast<uint32_t>(service) << 16 | pid;
+}
+
+SimulatedECU::SimulatedECU(const uint16_t requestHeader, const uint16_t responseHeader)
+    : requestHeader(requestHeader), responseHeader(responseHeader) {
+}
+
+SimulatedECU &SimulatedECU::addPID(const uint8_t service, const uint16_t pid, const uint8_t numBytes,
+                                   const SimulatedValue &value) {
+    pids[key(service, pid)] = {numBytes, value, {}};
+    return *this;
+}
+
+SimulatedECU &SimulatedECU::addPID(const uint8_t service, const uint16_t pid, const std::vector<uint8_t> &bytes) {
+    pids[key(service, pid)] = {static_cast<uint8_t>(bytes.size()), nullptr, bytes};
+    return *this;
+}
+
+uint16_t SimulatedECU::getRequestHeader() const {
+    return requestHeader;
+}
+
+uint16_t SimulatedECU::getResponseHeader() const {
+    return responseHeader;
+}
+
+uint32_t SimulatedECU::supportedPIDs(const uint8_t base) const {
+    uint32_t bitmap = 0;
+    for (const auto &entry: pids) {
+        if (entry.first >> 16 != 0x01) {
+            continue;
+        }
+        const uint16_t pid = entry.first & 0xFFFF;
+        if (pid > base && pid <= base + 0x20) {
+            bitmap |= 1UL << (base + 0x20 - pid);
+        } else if (pid > base + 0x20) {
+            // the next range is supported
+            bitmap |= 1;
+        }
+    }
+    return bitmap;
+}
+
+bool SimulatedECU::respond(const uint8_t service, const uint16_t pid, const double time,
+                           std::vector<uint8_t> &data) const {
+    data.clear();
+
+    const auto it = pids.find(key(service, pid));
+    if (it != pids.end()) {
+        if (it->second.value == nullptr) {
+            data = it->second.bytes;
+        } else {
+            const uint64_t value = it->second.value(time);
+            for (int i = it->second.numBytes - 1; i >= 0; i--) {
+                data.push_back(i < 8 ? static_cast<uint8_t>(value >> (i * 8)) : 0);
+            }
+        }
+        return true;
+    }
+
+    if (service == 0x01 && pid % 0x20 == 0 && pid <= 0xE0) {
+        const uint32_t bitmap = supportedPIDs(pid);
+        if (pid == 0 || bitmap != 0) {
+            for (int i = 3; i >= 0; i--) {
+                data.push_back(static_cast<uint8_t>(bitmap >> (i * 8)));
+            }
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool ELM327Simulator::begin(const char *profile) {
+    const SimulatorProfile *selected = nullptr;
+    for (const auto &p: SIMULATOR_PROFILES) {
+        if (strcmp(p.name, profile) == 0) {
+            selected = &p;
+        }
+    }
+    if (selected == nullptr) {
+        Serial.printf("Unknown simulator profile %s.\n", profile);
+        return false;
+    }
+
+    this->profile = selected;
+    if (ecus.empty()) {
+        addDefaultECUs();
+    }
+    startTime = millis();
+    reset();
+    output.clear();
+    outputPos = 0;
+    inputLen = 0;
+
+    Serial.printf("ELM327 simulator started with profile %s and %u ECUs.\n", selected->name,
+                  static_cast<unsigned>(ecus.size()));
+
+    return true;
+}
+
+void ELM327Simulator::addECU(const SimulatedECU &ecu) {
+    ecus.push_back(ecu);
+}
+
+void ELM327Simulator::addDefaultECUs() {
+    SimulatedECU engine(0x7E0, 0x7E8);
+    engine.addPID(0x01, 0x01, 4, [](double) { return 0x00076500; })
+        .addPID(0x01, 0x04, 1, [](const double t) { return clampRaw(driveLoad(t) * 255 / 100, 0xFF); })
+        .addPID(0x01, 0x05, 1, [](const double t) { return clampRaw(warmUp(t, 15, 90, 300) + 40, 0xFF); })
+        .addPID(0x01, 0x0B, 1, [](const double t) { return clampRaw(30 + driveLoad(t) * 0.7, 0xFF); })
+        .addPID(0x01, 0x0C, 2, [](const double t) { return clampRaw(driveRPM(t) * 4, 0xFFFF); })
+        .addPID(0x01, 0x0D, 1, [](const double t) { return clampRaw(driveSpeed(t), 0xFF); })
+        .addPID(0x01, 0x0E, 1, [](const double t) { return clampRaw((10 + driveSpeed(t) * 0.1 + 64) * 2, 0xFF); })
+        .addPID(0x01, 0x0F, 1, [](double) { return 25 + 40; })
+        .addPID(0x01, 0x10, 2, [](const double t) { return clampRaw(driveMAF(t) * 100, 0xFFFF); })
+        .addPID(0x01, 0x11, 1, [](const double t) { return clampRaw((15 + driveSpeed(t) * 0.4) * 255 / 100, 0xFF); })
+        .addPID(0x01, 0x2F, 1, [](const double t) { return clampRaw((75 - t / 3600 * 5) * 255 / 100, 0xFF); })
+        .addPID(0x01, 0x46, 1, [](double) { return 15 + 40; })
+        .addPID(0x01, 0x51, 1, [](double) { return 0x01; })
+        .addPID(0x01, 0x5A, 1, [](const double t) { return clampRaw((15 + driveSpeed(t) * 0.4) * 255 / 100, 0xFF); })
+        .addPID(0x01, 0x5C, 1, [](const double t) { return clampRaw(warmUp(t, 15, 95, 500) + 40, 0xFF); })
+        .addPID(0x01, 0x5E, 2, [](const double t) {
+            // gasoline with stoichiometric ratio and 740 g/l
+            return clampRaw(driveMAF(t) * 3600 / (14.7 * 740) * 20, 0xFFFF);
+        })
+        .addPID(0x01, 0xA6, 4, [](const double t) { return clampRaw((123456 + driveDistance(t)) * 10, 0xFFFFFFFF); })
+        // VW UDS identifiers of the bundled profiles
+        .addPID(0x22, 0x028C, 1, [](double) { return clampRaw(80.0 * 255 / 100, 0xFF); })
+        .addPID(0x22, 0x10E0, 4, [](const double t) { return clampRaw(123456 + driveDistance(t), 0xFFFFFFFF); })
+        .addPID(0x22, 0x11BA, 4, [](double) { return clampRaw(60 * 249.6, 0xFFFFFFFF); })
+        .addPID(0x22, 0x11BB, 4, [](double) { return clampRaw(40 * 249.6, 0xFFFFFFFF); })
+        .addPID(0x22, 0x11BD, 2, [](const double t) { return clampRaw((warmUp(t, 15, 95, 500) + 199.37) / 0.07921, 0xFFFF); })
+        .addPID(0x22, 0x1291, 2, [](double) { return clampRaw(15 / 0.00184594, 0xFFFF); })
+        .addPID(0x22, 0xF40D, 1, [](const double t) { return clampRaw(driveSpeed(t), 0xFF); });
+
+    const char vin[] = "WVWZZZAUZLW000001";
+    std::vector<uint8_t> vinData = {0x01};
+    vinData.insert(vinData.end(), vin, vin + strlen(vin));
+    engine.addPID(0x09, 0x02, vinData);
+    addECU(engine);
+
+    // most cars have a second emission related ECU, which answers broadcast requests as well
+    SimulatedECU transmission(0x7E1, 0x7E9);
+    transmission.addPID(0x01, 0x01, 4, [](double) { return 0x00040000; });
+    addECU(transmission);
+}
+
+float ELM327Simulator::getBatteryVoltage() const {
+    // the engine idles when the car stands still, so the alternator is always charging
+    return engineRunning ? 14.2f : 12.4f;
+}
+
+void ELM327Simulator::setEngineRunning(const bool running) {
+    engineRunning = running;
+}
+
+void ELM327Simulator::reset() {
+    echo = true;
+    spaces = true;
+    headers = false;
+    header = SIMULATOR_FUNCTIONAL_HEADER;
+}
+
+uint32_t ELM327Simulator::random() {
+    // xorshift32, deterministic to make runs comparable
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+uint32_t ELM327Simulator::jitter() {
+    return profile->jitter != 0 ? random() % profile->jitter : 0;
+}
+
+void ELM327Simulator::appendHex(const uint32_t value, const uint8_t digits, const bool separator) {
+    char hex[9];
+    snprintf(hex, sizeof(hex), "%0*X", digits, value);
+    if (separator && spaces && !output.empty() && output.back() != '\r') {
+        output += ' ';
+    }
+    output += hex;
+}
+
+void ELM327Simulator::appendFrames(const uint16_t responseHeader, const std::vector<uint8_t> &data) {
+    if (data.size() <= 7) {
+        if (headers) {
+            appendHex(responseHeader, 3);
+            appendHex(data.size(), 2);
+        }
+        for (const uint8_t b: data) {
+            appendHex(b, 2);
+        }
+        output += '\r';
+        return;
+    }
+
+    // ISO-TP first frame with 6 bytes, consecutive frames with 7 bytes
+    if (!headers) {
+        appendHex(data.size(), 3);
+        output += '\r';
+    }
+    size_t pos = 0;
+    for (uint8_t frame = 0; pos < data.size(); frame++) {
+        const size_t len = frame == 0 ? 6 : 7;
+        if (headers) {
+            appendHex(responseHeader, 3);
+            if (frame == 0) {
+                appendHex(0x10 | (data.size() >> 8 & 0x0F), 2);
+                appendHex(data.size() & 0xFF, 2);
+            } else {
+                appendHex(0x20 | (frame & 0x0F), 2);
+            }
+        } else {
+            appendHex(frame & 0x0F, 1);
+            output += ':';
+        }
+        for (size_t i = 0; i < len && pos < data.size(); i++) {
+            appendHex(data[pos++], 2);
+        }
+        output += '\r';
+    }
+}
+
+uint32_t ELM327Simulator::executeAT(const char *command) {
+    const char *arg = command + 2;
+
+    if (strcmp(arg, "Z") == 0 || strcmp(arg, "WS") == 0) {
+        reset();
+        output += "\r\r" SIMULATOR_VERSION "\r";
+    } else if (strcmp(arg, "I") == 0) {
+        output += SIMULATOR_VERSION "\r";
+    } else if (strcmp(arg, "D") == 0) {
+        reset();
+        output += "OK\r";
+    } else if (strcmp(arg, "E0") == 0 || strcmp(arg, "E1") == 0) {
+        echo = arg[1] == '1';
+        output += "OK\r";
+    } else if (strcmp(arg, "S0") == 0 || strcmp(arg, "S1") == 0) {
+        spaces = arg[1] == '1';
+        output += "OK\r";
+    } else if (strcmp(arg, "H0") == 0 || strcmp(arg, "H1") == 0) {
+        headers = arg[1] == '1';
+        output += "OK\r";
+    } else if (strncmp(arg, "SP", 2) == 0 || strncmp(arg, "TP", 2) == 0) {
+        autoProtocol = arg[2] == 'A' || arg[2] == '0';
+        protocolFound = !autoProtocol;
+        output += "OK\r";
+    } else if (strncmp(arg, "SH", 2) == 0 && strlen(arg) == 5) {
+        header = strtoul(arg + 2, nullptr, 16);
+        output += "OK\r";
+    } else if (strcmp(arg, "DP") == 0) {
+        output += autoProtocol ? "AUTO, " SIMULATOR_PROTOCOL "\r" : SIMULATOR_PROTOCOL "\r";
+    } else if (strcmp(arg, "DPN") == 0) {
+        output += autoProtocol ? "A6\r" : "6\r";
+    } else if (strcmp(arg, "RV") == 0) {
+        char voltage[8];
+        snprintf(voltage, sizeof(voltage), "%.1fV\r", getBatteryVoltage());
+        output += voltage;
+    } else {
+        output += "OK\r";
+    }
+
+    return profile->commandLatency + jitter();
+}
+
+uint32_t ELM327Simulator::executeRequest(const char *command) {
+    const size_t len = strlen(command);
+    for (size_t i = 0; i < len; i++) {
+        if (!isxdigit(command[i])) {
+            output += "?\r";
+            return profile->commandLatency;
+        }
+    }
+
+    // service and PID optionally followed by the number of expected responses
+    const uint8_t service = len >= 2 ? strtoul(std::string(command, 2).c_str(), nullptr, 16) : 0;
+    const size_t pidDigits = service == 0x03 ? 0 : service == 0x22 ? 4 : 2;
+    if (len != 2 + pidDigits && len != 3 + pidDigits) {
+        output += "?\r";
+        return profile->commandLatency;
+    }
+    const uint16_t pid = pidDigits != 0 ? strtoul(std::string(command + 2, pidDigits).c_str(), nullptr, 16) : 0;
+    const uint8_t numResponses = len == 3 + pidDigits ? strtoul(command + len - 1, nullptr, 16) : 0;
+
+    ++numRequests;
+    uint32_t latency = profile->requestLatency + jitter();
+
+    if (!protocolFound) {
+        output += "SEARCHING...\r";
+        latency += profile->searchLatency;
+        protocolFound = true;
+    }
+
+    const double time = (millis() - startTime) / 1000.0;
+    const bool lost = profile->lossRate != 0 && random() % 1000 < profile->lossRate;
+    uint8_t responses = 0;
+    std::vector<uint8_t> data;
+    for (const auto &ecu: ecus) {
+        if (lost || (numResponses != 0 && responses >= numResponses)) {
+            break;
+        }
+        if (header != SIMULATOR_FUNCTIONAL_HEADER && header != ecu.getRequestHeader()) {
+            continue;
+        }
+
+        std::vector<uint8_t> payload;
+        if (service == 0x03) {
+            // no stored DTCs, only the engine ECU answers
+            if (&ecu != &ecus.front()) {
+                continue;
+            }
+            payload.push_back(0x00);
+        } else if (!ecu.respond(service, pid, time, payload) ||
+                   !engineRunning && !respondEngineOff(service, pid, payload)) {
+            continue;
+        }
+
+        data.clear();
+        data.push_back(service + 0x40);
+        if (pidDigits == 4) {
+            data.push_back(pid >> 8);
+        }
+        if (pidDigits != 0) {
+            data.push_back(pid & 0xFF);
+        }
+        data.insert(data.end(), payload.begin(), payload.end());
+
+        if (responses != 0) {
+            latency += profile->responseLatency;
+        }
+        if (data.size() > 7) {
+            const size_t consecutiveFrames = (data.size() - 6 + 7 - 1) / 7;
+            latency += consecutiveFrames * SIMULATOR_FRAME_LATENCY;
+        }
+        appendFrames(ecu.getResponseHeader(), data);
+        ++responses;
+    }
+
+    // without the number of responses, the adapter waits for further ECUs until its timeout
+    if (responses == 0 || numResponses == 0 || responses < numResponses) {
+        latency += profile->collectTimeout;
+    }
+
+    if (responses == 0) {
+        output += "NO DATA\r";
+        ++numNoData;
+    }
+
+    return latency;
+}
+
+void ELM327Simulator::execute(const char *command) {
+    ++numCommands;
+
+    output.clear();
+    outputPos = 0;
+    if (echo) {
+        output += command;
+        output += '\r';
+    }
+
+    // commands are case insensitive and may contain spaces
+    char normalized[SIMULATOR_MAX_COMMAND_LEN + 1];
+    size_t len = 0;
+    for (const char *c = command; *c != '\0'; c++) {
+        if (*c != ' ') {
+            normalized[len++] = static_cast<char>(toupper(*c));
+        }
+    }
+    normalized[len] = '\0';
+
+    uint32_t latency;
+    if (len == 0) {
+        latency = 0;
+    } else if (strncmp(normalized, "AT", 2) == 0) {
+        latency = executeAT(normalized);
+    } else {
+        latency = executeRequest(normalized);
+    }
+
+    output += "\r>";
+    respond(latency);
+}
+
+void ELM327Simulator::respond(const uint32_t latency) {
+    totalLatency += latency;
+    readyAt = esp_timer_get_time() + latency;
+}
+
+void ELM327Simulator::printStats(Print &out) const {
+    out.printf("Simulator %s: %u commands, %u requests, %u NO DATA, mean latency %u µs\n", profile->name,
+               numCommands, numRequests, numNoData,
+               numCommands != 0 ? static_cast<uint32_t>(totalLatency / numCommands) : 0);
+}
+
+uint32_t ELM327Simulator::getCommands() const {
+    return numCommands;
+}
+
+uint32_t ELM327Simulator::getRequests() const {
+    return numRequests;
+}
+
+int ELM327Simulator::available() {
+    if (outputPos >= output.size() || esp_timer_get_time() < readyAt) {
+        return 0;
+    }
+    return static_cast<int>(output.size() - outputPos);
+}
+
+int ELM327Simulator::read() {
+    if (available() == 0) {
+        return -1;
+    }
+    return static_cast<uint8_t>(output[outputPos++]);
+}
+
+int ELM327Simulator::peek() {
+    if (available() == 0) {
+        return -1;
+    }
+    return static_cast<uint8_t>(output[outputPos]);
+}
+
+void ELM327Simulator::flush() {
+}
+
+size_t ELM327Simulator::write(const uint8_t c) {
+    // any character interrupts a pending request
+    if (outputPos < output.size() && esp_timer_get_time() < readyAt) {
+        output = "STOPPED\r\r>";
+        outputPos = 0;
+        readyAt = 0;
+        return 1;
+    }
+
+    if (c == '\r') {
+        input[inputLen] = '\0';
+        inputLen = 0;
+        execute(input);
+    } else if (c != '\n' && inputLen < SIMULATOR_MAX_COMMAND_LEN) {
+        input[inputLen++] = static_cast<char>(c);
+    }
+
+    return 1;
+}
+
+size_t ELM327Simulator::write(const uint8_t *buffer, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        write(buffer[i]);
+    }
+    return size;
+}
@@ -0,0 +1,257 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SIMULATOR_FUNCTIONAL_HEADER 0x7DF
+#define SIMULATOR_MAX_COMMAND_LEN   32
+#define SIMULATOR_FRAME_LATENCY     1000
+#define SIMULATOR_VERSION           "ELM327 v1.5"
+#define SIMULATOR_PROTOCOL          "ISO 15765-4 (CAN 11/500)"
+
+/**
+ * Timing of an adapter, all times in µs.
+ */
+struct SimulatorProfile {
+    const char *name;
+    /** AT commands, which are handled by the adapter itself */
+    uint32_t commandLatency;
+    /** OBD request until the first ECU response */
+    uint32_t requestLatency;
+    /** every further ECU response */
+    uint32_t responseLatency;
+    /** wait for further responses, if the number of responses isn't part of the request */
+    uint32_t collectTimeout;
+    /** protocol search on the first request after automatic protocol selection */
+    uint32_t searchLatency;
+    /** random latency added to every command */
+    uint32_t jitter;
+    /** requests answered with NO DATA although an ECU would respond, per mille */
+    uint16_t lossRate;
+};
+
+/**
+ * Typical latencies on CAN 11/500 of an OBDLink, a vLinker and a cheap ELM327 v1.5 clone,
+ * "ideal" answers immediately.
+ */
+static const SimulatorProfile SIMULATOR_PROFILES[] = {
+    {"ideal", 0, 0, 0, 0, 0, 0, 0},
+    {"obdlink", 2000, 18000, 4000, 25000, 800000, 4000, 0},
+    {"vlinker", 5000, 35000, 6000, 50000, 1200000, 10000, 2},
+    {"clone", 15000, 80000, 15000, 200000, 2500000, 40000, 10},
+};
+
+/**
+ * Generates the raw value of a PID.
+ *
+ * @param time the seconds since the simulator started
+ * @return the raw value, big endian encoded into the expected number of bytes
+ */
+typedef std::function<uint64_t(double time)> SimulatedValue;
+
+/**
+ * ECU model with the PIDs it answers, the supported PID bitmaps of service 01 are derived from them.
+ */
+class SimulatedECU {
+    struct Data {
+        uint8_t numBytes;
+        SimulatedValue value;
+        std::vector<uint8_t> bytes;
+    };
+
+    uint16_t requestHeader;
+
+    uint16_t responseHeader;
+
+    std::map<uint32_t, Data> pids{};
+
+    static uint32_t key(uint8_t service, uint16_t pid);
+
+    uint32_t supportedPIDs(uint8_t base) const;
+
+public:
+    /**
+     * @param requestHeader the physical request id, e.g. <code>0x7E0</code>
+     * @param responseHeader the response id, e.g. <code>0x7E8</code>
+     */
+    SimulatedECU(uint16_t requestHeader, uint16_t responseHeader);
+
+    /**
+     * Adds a PID with a value, which changes over time.
+     *
+     * @param service the service, e.g. <code>0x01</code> or <code>0x22</code>
+     * @param pid the PID
+     * @param numBytes the number of data bytes
+     * @param value the value generator
+     * @return this ECU
+     */
+    SimulatedECU &addPID(uint8_t service, uint16_t pid, uint8_t numBytes, const SimulatedValue &value);
+
+    /**
+     * Adds a PID with fixed data, e.g. the VIN, which can exceed a single frame.
+     *
+     * @param service the service
+     * @param pid the PID
+     * @param bytes the data bytes
+     * @return this ECU
+     */
+    SimulatedECU &addPID(uint8_t service, uint16_t pid, const std::vector<uint8_t> &bytes);
+
+    uint16_t getRequestHeader() const;
+
+    uint16_t getResponseHeader() const;
+
+    /**
+     * @param service the service
+     * @param pid the PID
+     * @param time the seconds since the simulator started
+     * @param data receives the data bytes following the service and PID
+     * @return <code>true</code> if the ECU answers the request
+     */
+    bool respond(uint8_t service, uint16_t pid, double time, std::vector<uint8_t> &data) const;
+};
+
+/**
+ * Simulated ELM327 adapter, which is used instead of the Bluetooth stream.
+ *
+ * Commands are answered like by a real adapter including echo, spaces, headers, protocol search, multiple ECU
+ * responses and NO DATA. The response becomes readable after the latency of the selected profile,
+ * so polling behaves like with a real adapter, but without any Bluetooth or CAN traffic.
+ */
+class ELM327Simulator : public Stream {
+    const SimulatorProfile *profile = &SIMULATOR_PROFILES[0];
+
+    std::vector<SimulatedECU> ecus{};
+
+    char input[SIMULATOR_MAX_COMMAND_LEN + 1]{};
+
+    size_t inputLen = 0;
+
+    std::string output{};
+
+    size_t outputPos = 0;
+
+    int64_t readyAt = 0;
+
+    unsigned long startTime = 0;
+
+    uint32_t seed = 0x2545F491;
+
+    bool echo = true;
+
+    bool spaces = true;
+
+    bool headers = false;
+
+    bool autoProtocol = true;
+
+    bool protocolFound = false;
+
+    bool engineRunning = true;
+
+    uint16_t header = SIMULATOR_FUNCTIONAL_HEADER;
+
+    uint32_t numCommands = 0;
+
+    uint32_t numRequests = 0;
+
+    uint32_t numNoData = 0;
+
+    uint64_t totalLatency = 0;
+
+    void reset();
+
+    uint32_t random();
+
+    uint32_t jitter();
+
+    void execute(const char *command);
+
+    uint32_t executeAT(const char *command);
+
+    uint32_t executeRequest(const char *command);
+
+    void appendFrames(uint16_t responseHeader, const std::vector<uint8_t> &data);
+
+    void appendHex(uint32_t value, uint8_t digits, bool separator = true);
+
+    void respond(uint32_t latency);
+
+public:
+    /**
+     * Selects the timing profile and adds the default ECUs, if no ECU was added.
+     *
+     * @param profile the name of one of the SIMULATOR_PROFILES
+     * @return <code>false</code> if the profile is unknown
+     */
+    bool begin(const char *profile = "ideal");
+
+    /**
+     * Adds an ECU, the engine ECU should be added first.
+     *
+     * @param ecu the ECU
+     */
+    void addECU(const SimulatedECU &ecu);
+
+    /**
+     * Adds an engine ECU with the PIDs of the bundled profiles and a transmission ECU, which also answers
+     * some service 01 requests, following a repeating city/highway drive.
+     */
+    void addDefaultECUs();
+
+    /**
+     * @return the battery voltage reported by <code>AT RV</code>
+     */
+    float getBatteryVoltage() const;
+
+    /**
+     * Switches the engine off with the ignition on. The ECUs answer the engine PIDs with zeros, fuel rate and
+     * timing advance with NO DATA.
+     *
+     * @param running <code>false</code> to switch the engine off
+     */
+    void setEngineRunning(bool running);
+
+    /**
+     * Prints the number of commands, requests and the mean latency.
+     *
+     * @param out the output
+     */
+    void printStats(Print &out) const;
+
+    uint32_t getCommands() const;
+
+    uint32_t getRequests() const;
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    void flush() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+
+    using Print::write;
+};
@@ -0,0 +1,392 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "spool.h"
+#include "helper.h"
+
+static size_t putU16(uint8_t *buf, const uint16_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    return 2;
+}
+
+static size_t putU32(uint8_t *buf, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (value >> (i * 8)) & 0xFF;
+    }
+    return 4;
+}
+
+static uint16_t getU16(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | (static_cast<uint32_t>(buf[3]) << 24);
+}
+
+void SpoolClass::segmentPath(char *path, const size_t len, const uint32_t seq) const {
+    snprintf(path, len, SPOOL_DIR "/%08u.bin", seq);
+}
+
+bool SpoolClass::begin(fs::FS &fs, const size_t maxSize, const size_t freeBytes) {
+    if (buffer != nullptr) {
+        return true;
+    }
+
+    this->fs = &fs;
+
+    if (!fs.exists(SPOOL_DIR)) {
+        fs.mkdir(SPOOL_DIR);
+    }
+
+    // new records always go into a new segment, a record cut off by a reset is detected on drain
+    uint32_t oldestSeq = UINT32_MAX;
+    writeSeq = 0;
+    usedBytes = 0;
+    File dir = fs.open(SPOOL_DIR);
+    if (dir && dir.isDirectory()) {
+        File file = dir.openNextFile();
+        while (file) {
+            const uint32_t seq = strtoul(file.name(), nullptr, 10);
+            oldestSeq = std::min(oldestSeq, seq);
+            if (seq >= writeSeq) {
+                writeSeq = seq + 1;
+            }
+            usedBytes += file.size();
+            file.close();
+            file = dir.openNextFile();
+        }
+        dir.close();
+    }
+    readSeq = ackSeq = oldestSeq != UINT32_MAX ? oldestSeq : writeSeq;
+    readOffset = nextReadOffset = 0;
+    sentRecords.clear();
+
+    // keep two buffers reserve for other files
+    const size_t available = usedBytes + freeBytes > 2 * SPOOL_BUFFER_SIZE
+                                 ? usedBytes + freeBytes - 2 * SPOOL_BUFFER_SIZE
+                                 : 0;
+    this->maxSize = std::min(maxSize, available);
+    if (this->maxSize < SPOOL_SEGMENT_SIZE) {
+        Serial.printf("Spool disabled, not enough space (%u bytes).\n", this->maxSize);
+        return false;
+    }
+
+    buffer = static_cast<uint8_t *>(malloc(SPOOL_BUFFER_SIZE));
+    if (buffer == nullptr) {
+        return false;
+    }
+    bufferPos = 0;
+    lastFlush = millis();
+
+    Serial.printf("Spool started with %u segments (%u bytes).\n", writeSeq - readSeq, usedBytes);
+
+    return true;
+}
+
+void SpoolClass::end() {
+    if (buffer == nullptr) {
+        return;
+    }
+
+    flushBuffer();
+    closeWriteSegment();
+    if (readSegment) {
+        readSegment.close();
+    }
+}
+
+bool SpoolClass::isEnabled() const {
+    return buffer != nullptr;
+}
+
+bool SpoolClass::isEmpty() const {
+    return readSeq >= writeSeq && bufferPos == 0;
+}
+
+bool SpoolClass::push(const char *topic, const uint8_t *payload, const size_t len) {
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    const size_t topicLen = strlen(topic);
+    const size_t recordLen = SPOOL_RECORD_HEADER_SIZE + topicLen + len;
+    if (recordLen > SPOOL_BUFFER_SIZE) {
+        ++droppedRecords;
+        return false;
+    }
+
+    if (bufferPos + recordLen > SPOOL_BUFFER_SIZE) {
+        flushBuffer();
+    }
+
+    uint8_t *record = buffer + bufferPos;
+    const uint32_t crc = crc32(payload, len, crc32(reinterpret_cast<const uint8_t *>(topic), topicLen));
+    size_t pos = 0;
+    pos += putU16(record + pos, SPOOL_RECORD_MAGIC);
+    pos += putU16(record + pos, topicLen);
+    pos += putU32(record + pos, len);
+    pos += putU32(record + pos, crc);
+    memcpy(record + pos, topic, topicLen);
+    memcpy(record + pos + topicLen, payload, len);
+
+    bufferPos += recordLen;
+    ++bufferRecords;
+    ++pushedRecords;
+    pushedBytes += topicLen + len;
+
+    return true;
+}
+
+bool SpoolClass::peek(std::string &topic, std::string &payload) {
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    for (;;) {
+        if (readSeq >= writeSeq) {
+            if (bufferPos == 0) {
+                return false;
+            }
+            // the remaining records are only buffered, write them to drain them like all others
+            flushBuffer();
+            closeWriteSegment();
+            if (readSeq >= writeSeq) {
+                return false;
+            }
+            continue;
+        }
+
+        if (writeSegment && readSeq == writeSeq - 1) {
+            flushBuffer();
+            closeWriteSegment();
+        }
+
+        if (!readSegment) {
+            char path[32];
+            segmentPath(path, sizeof(path), readSeq);
+            readSegment = fs->open(path, FILE_READ);
+            if (!readSegment) {
+                nextReadSegment();
+                continue;
+            }
+        }
+
+        if (readOffset >= readSegment.size()) {
+            nextReadSegment();
+            continue;
+        }
+
+        uint8_t header[SPOOL_RECORD_HEADER_SIZE];
+        readSegment.seek(readOffset);
+        if (readSegment.read(header, sizeof(header)) != sizeof(header) ||
+            getU16(header) != SPOOL_RECORD_MAGIC ||
+            readOffset + sizeof(header) + getU16(header + 2) + getU32(header + 4) > readSegment.size()) {
+            // the rest of the segment can't be trusted, e.g. after a reset during write
+            ++corruptRecords;
+            nextReadSegment();
+            continue;
+        }
+
+        const size_t topicLen = getU16(header + 2);
+        const size_t len = getU32(header + 4);
+        topic.resize(topicLen);
+        payload.resize(len);
+        readSegment.read(reinterpret_cast<uint8_t *>(&topic[0]), topicLen);
+        readSegment.read(reinterpret_cast<uint8_t *>(&payload[0]), len);
+        nextReadOffset = readOffset + sizeof(header) + topicLen + len;
+
+        const uint32_t crc = crc32(reinterpret_cast<const uint8_t *>(payload.data()), len,
+                                   crc32(reinterpret_cast<const uint8_t *>(topic.data()), topicLen));
+        if (crc != getU32(header + 8)) {
+            ++corruptRecords;
+            readOffset = nextReadOffset;
+            continue;
+        }
+
+        if (drainStart == 0) {
+            drainStart = millis();
+        }
+        lastRecordSize = topicLen + len;
+
+        return true;
+    }
+}
+
+void SpoolClass::sent(const uint16_t id) {
+    if (nextReadOffset <= readOffset) {
+        return;
+    }
+
+    sentRecords.push_back({id, readSeq, readOffset, lastRecordSize});
+    readOffset = nextReadOffset;
+
+    if (readSegment && readOffset >= readSegment.size()) {
+        nextReadSegment();
+    }
+}
+
+void SpoolClass::acknowledge(const uint16_t id) {
+    const auto it = std::find_if(sentRecords.begin(), sentRecords.end(), [&](const SentRecord &record) {
+        return record.id == id;
+    });
+    if (it == sentRecords.end()) {
+        return;
+    }
+
+    // acknowledgments arrive in the order the records were sent
+    for (auto record = sentRecords.begin(); record != it + 1; ++record) {
+        ++drainedRecords;
+        drainedBytes += record->size;
+    }
+    sentRecords.erase(sentRecords.begin(), it + 1);
+    removeAcknowledgedSegments();
+
+    if (isEmpty() && sentRecords.empty() && drainStart != 0) {
+        drainTime += millis() - drainStart;
+        drainStart = 0;
+    }
+}
+
+void SpoolClass::rewind() {
+    if (sentRecords.empty()) {
+        return;
+    }
+
+    if (readSegment) {
+        readSegment.close();
+    }
+    readSeq = sentRecords.front().seq;
+    readOffset = nextReadOffset = sentRecords.front().offset;
+    resentRecords += sentRecords.size();
+    sentRecords.clear();
+}
+
+void SpoolClass::loop() {
+    if (bufferPos != 0 && millis() - lastFlush >= SPOOL_FLUSH_INTERVAL) {
+        flushBuffer();
+    }
+}
+
+void SpoolClass::flushBuffer() {
+    if (bufferPos == 0) {
+        return;
+    }
+
+    // rotate only between buffers, records never span two segments
+    if (writeSegment && writeSegmentSize + bufferPos > SPOOL_SEGMENT_SIZE) {
+        closeWriteSegment();
+    }
+
+    if ((writeSegment || openWriteSegment()) && writeSegment.write(buffer, bufferPos) == bufferPos) {
+        writeSegment.flush();
+        writeSegmentSize += bufferPos;
+        usedBytes += bufferPos;
+        writtenBytes += bufferPos;
+    } else {
+        droppedRecords += bufferRecords;
+    }
+
+    bufferPos = 0;
+    bufferRecords = 0;
+    lastFlush = millis();
+}
+
+bool SpoolClass::openWriteSegment() {
+    enforceBudget();
+
+    char path[32];
+    segmentPath(path, sizeof(path), writeSeq);
+    writeSegment = fs->open(path, FILE_WRITE);
+    if (!writeSegment) {
+        Serial.printf("Failed to open spool segment %s.\n", path);
+        return false;
+    }
+
+    ++writeSeq;
+    writeSegmentSize = 0;
+
+    return true;
+}
+
+void SpoolClass::closeWriteSegment() {
+    if (writeSegment) {
+        writeSegment.close();
+    }
+    writeSegmentSize = 0;
+}
+
+void SpoolClass::nextReadSegment() {
+    if (readSegment) {
+        readSegment.close();
+    }
+
+    ++readSeq;
+    readOffset = nextReadOffset = 0;
+
+    removeAcknowledgedSegments();
+}
+
+void SpoolClass::removeAcknowledgedSegments() {
+    // all records of a segment before the one being sent are acknowledged, if none of them waits anymore
+    while (ackSeq < readSeq && (sentRecords.empty() || sentRecords.front().seq > ackSeq)) {
+        char path[32];
+        segmentPath(path, sizeof(path), ackSeq);
+
+        File file = fs->open(path, FILE_READ);
+        if (file) {
+            usedBytes -= std::min(usedBytes, static_cast<size_t>(file.size()));
+            file.close();
+        }
+        fs->remove(path);
+
+        ++ackSeq;
+    }
+}
+
+void SpoolClass::enforceBudget() {
+    // make room for the next segment, the oldest records are dropped even if they were already sent
+    while (usedBytes + SPOOL_SEGMENT_SIZE > maxSize && ackSeq < writeSeq) {
+        ++droppedSegments;
+        while (!sentRecords.empty() && sentRecords.front().seq == ackSeq) {
+            sentRecords.pop_front();
+        }
+        if (readSeq == ackSeq) {
+            nextReadSegment();
+        } else {
+            removeAcknowledgedSegments();
+        }
+    }
+}
+
+void SpoolClass::printStats(Print &out) const {
+    if (buffer == nullptr) {
+        return;
+    }
+
+    const unsigned long time = drainTime + (drainStart != 0 ? millis() - drainStart : 0);
+    out.printf("Spool: %u pushed (%u bytes), %u bytes written (amplification %.2f), "
+               "%u drained (%u bytes, %lu bytes/s), %u in flight, %u resent, %u dropped, %u segments dropped, "
+               "%u corrupt, %u bytes used\n",
+               pushedRecords, pushedBytes, writtenBytes,
+               pushedBytes != 0 ? static_cast<double>(writtenBytes) / pushedBytes : 0.0,
+               drainedRecords, drainedBytes, time != 0 ? static_cast<unsigned long>(drainedBytes * 1000ULL / time) : 0UL,
+               static_cast<unsigned>(sentRecords.size()), resentRecords, droppedRecords, droppedSegments,
+               corruptRecords, static_cast<unsigned>(usedBytes));
+}
+
+SpoolClass Spool;
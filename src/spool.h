@@ -0,0 +1,200 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <FS.h>
+#include <deque>
+#include <string>
+
+#define SPOOL_DIR                   "/spool"
+
+#define SPOOL_RECORD_MAGIC          0x5352          // "RS"
+#define SPOOL_RECORD_HEADER_SIZE    12
+#define SPOOL_BUFFER_SIZE           4096
+#define SPOOL_SEGMENT_SIZE          (8 * SPOOL_BUFFER_SIZE)
+#define SPOOL_MAX_SIZE              (256 * 1024)
+#define SPOOL_FLUSH_INTERVAL        30000
+
+/**
+ * Persistent FIFO for messages, which couldn't be published while the broker was unreachable.
+ *
+ * Records (topic, payload and a CRC) are collected in a RAM buffer, which is appended to the newest
+ * segment file if it is full or after the flush interval, so the flash is written in large chunks.
+ * Sent records are kept until they are acknowledged, segments are removed after all their records were acknowledged.
+ * The oldest segments are removed if the size budget is exceeded.
+ * Delivery is at least once, records not acknowledged before a reconnect or restart are sent again.
+ *
+ * All methods must be called by the output task.
+ */
+class SpoolClass {
+    fs::FS *fs = nullptr;
+
+    size_t maxSize = 0;
+
+    uint8_t *buffer = nullptr;
+
+    size_t bufferPos = 0;
+
+    uint32_t bufferRecords = 0;
+
+    unsigned long lastFlush = 0;
+
+    File writeSegment;
+
+    uint32_t writeSeq = 0;
+
+    size_t writeSegmentSize = 0;
+
+    File readSegment;
+
+    /** the segment of the next record to send */
+    uint32_t readSeq = 0;
+
+    size_t readOffset = 0;
+
+    size_t nextReadOffset = 0;
+
+    size_t lastRecordSize = 0;
+
+    /** the oldest segment with records, which weren't acknowledged yet */
+    uint32_t ackSeq = 0;
+
+    /**
+     * A record, which was sent and waits for its acknowledgment.
+     */
+    struct SentRecord {
+        uint16_t id;
+        uint32_t seq;
+        size_t offset;
+        size_t size;
+    };
+
+    std::deque<SentRecord> sentRecords{};
+
+    size_t usedBytes = 0;
+
+    uint32_t pushedRecords = 0;
+
+    uint32_t pushedBytes = 0;
+
+    uint32_t writtenBytes = 0;
+
+    uint32_t resentRecords = 0;
+
+    uint32_t drainedRecords = 0;
+
+    uint32_t drainedBytes = 0;
+
+    unsigned long drainStart = 0;
+
+    unsigned long drainTime = 0;
+
+    uint32_t droppedRecords = 0;
+
+    uint32_t droppedSegments = 0;
+
+    uint32_t corruptRecords = 0;
+
+    void segmentPath(char *path, size_t len, uint32_t seq) const;
+
+    void flushBuffer();
+
+    bool openWriteSegment();
+
+    void closeWriteSegment();
+
+    void nextReadSegment();
+
+    void removeAcknowledgedSegments();
+
+    void enforceBudget();
+
+public:
+    /**
+     * Opens the spool and continues with the segments of the last run.
+     *
+     * @param fs the filesystem
+     * @param maxSize the maximum size of all segments in bytes
+     * @param freeBytes the free bytes it may use in addition to its own files
+     * @return <code>true</code> if the spool can be used
+     */
+    bool begin(fs::FS &fs, size_t maxSize, size_t freeBytes);
+
+    /**
+     * Writes the buffered records, should be called before restart or sleep.
+     */
+    void end();
+
+    bool isEnabled() const;
+
+    /**
+     * @return <code>true</code> if no record is waiting to be sent
+     */
+    bool isEmpty() const;
+
+    /**
+     * Appends a record, the oldest records are dropped if the size budget is exceeded.
+     *
+     * @param topic the topic
+     * @param payload the payload
+     * @param len the payload length
+     * @return <code>true</code> if the record was added
+     */
+    bool push(const char *topic, const uint8_t *payload, size_t len);
+
+    /**
+     * Reads the oldest record, which wasn't sent yet, corrupt records are skipped.
+     *
+     * @param topic receives the topic
+     * @param payload receives the payload
+     * @return <code>false</code> if no record is waiting to be sent
+     */
+    bool peek(std::string &topic, std::string &payload);
+
+    /**
+     * Marks the record returned by the last peek() as sent, it is kept until it is acknowledged.
+     *
+     * @param id the id to acknowledge the record with, e.g. the MQTT packet id
+     */
+    void sent(uint16_t id);
+
+    /**
+     * Removes the sent record with the given id and all records sent before it, unknown ids are ignored.
+     *
+     * @param id the id of the record
+     */
+    void acknowledge(uint16_t id);
+
+    /**
+     * Returns the records, which weren't acknowledged yet, to be sent again, e.g. after the connection was lost.
+     */
+    void rewind();
+
+    /**
+     * Writes the buffered records once per flush interval.
+     */
+    void loop();
+
+    /**
+     * Prints the spool counters, drain throughput and write amplification.
+     *
+     * @param out the output
+     */
+    void printStats(Print &out) const;
+};
+
+extern SpoolClass Spool;
@@ -0,0 +1,263 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "trace.h"
+
+#include <ArduinoJson.h>
+#include <ELMduino.h>
+#include <esp_timer.h>
+
+bool TraceClass::begin() {
+    if (events == nullptr) {
+        events = static_cast<TraceEvent *>(calloc(TRACE_BUFFER_SIZE, sizeof(TraceEvent)));
+    }
+    return events != nullptr;
+}
+
+bool TraceClass::isEnabled() const {
+    return events != nullptr;
+}
+
+void TraceClass::record(const trace::EventKind kind, const char *name, const char *result, const int64_t start,
+                        const uint32_t duration, const int8_t status) {
+    if (events == nullptr) {
+        return;
+    }
+
+    portENTER_CRITICAL(&mux);
+    TraceEvent &event = events[head];
+    head = (head + 1) % TRACE_BUFFER_SIZE;
+    event.start = start;
+    event.duration = duration;
+    event.kind = kind;
+    event.status = status;
+    strlcpy(event.name, name, sizeof(event.name));
+    strlcpy(event.result, result != nullptr ? result : "", sizeof(event.result));
+    ++recorded;
+    portEXIT_CRITICAL(&mux);
+}
+
+size_t TraceClass::snapshot(TraceEvent *snapshot) {
+    if (events == nullptr) {
+        return 0;
+    }
+
+    portENTER_CRITICAL(&mux);
+    const size_t count = std::min(recorded.load(), static_cast<uint32_t>(TRACE_BUFFER_SIZE));
+    const size_t first = (head + TRACE_BUFFER_SIZE - count) % TRACE_BUFFER_SIZE;
+    const size_t tail = std::min(count, TRACE_BUFFER_SIZE - first);
+    memcpy(snapshot, events + first, tail * sizeof(TraceEvent));
+    memcpy(snapshot + tail, events, (count - tail) * sizeof(TraceEvent));
+    portEXIT_CRITICAL(&mux);
+
+    return count;
+}
+
+uint32_t TraceClass::getRecorded() const {
+    return recorded;
+}
+
+TraceClass Trace;
+
+TraceStream &TraceStream::attach(Stream &stream) {
+    this->stream = &stream;
+    inputLen = 0;
+    responseLen = 0;
+    waiting = false;
+    return *this;
+}
+
+int TraceStream::available() {
+    return stream->available();
+}
+
+int TraceStream::read() {
+    const int c = stream->read();
+    traceRead(c);
+    return c;
+}
+
+int TraceStream::peek() {
+    return stream->peek();
+}
+
+void TraceStream::flush() {
+    stream->flush();
+}
+
+size_t TraceStream::write(const uint8_t c) {
+    traceWrite(c);
+    return stream->write(c);
+}
+
+size_t TraceStream::write(const uint8_t *buffer, const size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        traceWrite(buffer[i]);
+    }
+    return stream->write(buffer, size);
+}
+
+void TraceStream::traceWrite(const uint8_t c) {
+    if (c != '\r' && c != '\n') {
+        if (inputLen < sizeof(input) - 1) {
+            input[inputLen++] = static_cast<char>(c);
+        }
+        return;
+    }
+
+    if (inputLen == 0) {
+        return;
+    }
+
+    // the previous command never got its prompt
+    if (waiting) {
+        finish(ELM_TIMEOUT);
+    }
+
+    memcpy(command, input, inputLen);
+    command[inputLen] = '\0';
+    inputLen = 0;
+    responseLen = 0;
+    commandStart = esp_timer_get_time();
+    waiting = true;
+}
+
+void TraceStream::traceRead(const int c) {
+    if (!waiting || c < 0) {
+        return;
+    }
+
+    if (c == '>') {
+        response[responseLen] = '\0';
+        finish(strncmp(response, "NO DATA", 7) == 0 ? ELM_NO_DATA : ELM_SUCCESS);
+    } else if (c == '\r' || c == '\n') {
+        if (responseLen != 0 && responseLen < sizeof(response) - 1 && response[responseLen - 1] != ' ') {
+            response[responseLen++] = ' ';
+        }
+    } else if (isprint(c) && responseLen < sizeof(response) - 1) {
+        response[responseLen++] = static_cast<char>(c);
+    }
+}
+
+void TraceStream::finish(const int8_t status) {
+    while (responseLen != 0 && response[responseLen - 1] == ' ') {
+        --responseLen;
+    }
+    response[responseLen] = '\0';
+
+    Trace.record(trace::COMMAND, command, response, commandStart,
+                 static_cast<uint32_t>(esp_timer_get_time() - commandStart), status);
+    waiting = false;
+    responseLen = 0;
+}
+
+static const char *statusName(const int8_t status) {
+    switch (status) {
+        case ELM_SUCCESS:
+            return "ok";
+        case ELM_NO_RESPONSE:
+            return "no response";
+        case ELM_BUFFER_OVERFLOW:
+            return "buffer overflow";
+        case ELM_GARBAGE:
+            return "garbage";
+        case ELM_UNABLE_TO_CONNECT:
+            return "unable to connect";
+        case ELM_NO_DATA:
+            return "no data";
+        case ELM_STOPPED:
+            return "stopped";
+        case ELM_TIMEOUT:
+            return "timeout";
+        default:
+            return "error";
+    }
+}
+
+TraceJSONWriter::TraceJSONWriter() {
+    events = static_cast<TraceEvent *>(malloc(TRACE_BUFFER_SIZE * sizeof(TraceEvent)));
+    if (events != nullptr) {
+        count = Trace.snapshot(events);
+    }
+}
+
+TraceJSONWriter::~TraceJSONWriter() {
+    free(events);
+}
+
+bool TraceJSONWriter::fill() {
+    pending.clear();
+    pendingPos = 0;
+
+    if (stage == 0) {
+        pending = "{\"traceEvents\":["
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"ELM327\"}},"
+                "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"States\"}}";
+        stage = 1;
+        return true;
+    }
+
+    if (stage == 1) {
+        if (index >= count) {
+            stage = 2;
+            return fill();
+        }
+
+        const TraceEvent &event = events[index++];
+        const bool header = strncasecmp(event.name, "ATSH", 4) == 0 || strncasecmp(event.name, "AT SH", 5) == 0;
+
+        JsonDocument doc;
+        doc["name"] = event.name;
+        doc["cat"] = event.kind == trace::REQUEST ? "state" : header ? "header" : "command";
+        doc["ph"] = "X";
+        doc["ts"] = event.start;
+        doc["dur"] = event.duration;
+        doc["pid"] = 1;
+        doc["tid"] = event.kind == trace::REQUEST ? 2 : 1;
+        doc["args"]["status"] = statusName(event.status);
+        if (event.result[0] != '\0') {
+            doc["args"]["response"] = event.result;
+        }
+
+        std::string json;
+        serializeJson(doc, json);
+        pending = "," + json;
+        return true;
+    }
+
+    if (stage == 2) {
+        pending = "],\"displayTimeUnit\":\"ms\"}";
+        stage = 3;
+        return true;
+    }
+
+    return false;
+}
+
+size_t TraceJSONWriter::read(uint8_t *buffer, const size_t maxLen) {
+    size_t len = 0;
+    while (len < maxLen) {
+        if (pendingPos >= pending.length() && !fill()) {
+            break;
+        }
+
+        const size_t n = std::min(maxLen - len, pending.length() - pendingPos);
+        memcpy(buffer + len, pending.data() + pendingPos, n);
+        pendingPos += n;
+        len += n;
+    }
+    return len;
+}
@@ -0,0 +1,179 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <string>
+
+#define TRACE_BUFFER_SIZE       256
+#define TRACE_TEXT_SIZE         16
+
+namespace trace {
+    typedef enum {
+        COMMAND,
+        REQUEST,
+    } EventKind;
+}
+
+/**
+ * A finished adapter command or state request.
+ */
+struct TraceEvent {
+    int64_t start;
+    uint32_t duration;
+    uint8_t kind;
+    int8_t status;
+    char name[TRACE_TEXT_SIZE];
+    char result[TRACE_TEXT_SIZE];
+};
+
+/**
+ * Ring buffer of the latest adapter commands and state requests with µs timestamps.
+ *
+ * Recording copies one small event under a spinlock, the exporter takes a snapshot of the whole buffer,
+ * so the polling task is never blocked by a download.
+ */
+class TraceClass {
+    TraceEvent *events = nullptr;
+
+    uint32_t head = 0;
+
+    portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+
+    std::atomic<uint32_t> recorded{0};
+
+public:
+    /**
+     * Allocates the ring buffer.
+     *
+     * @return <code>true</code> if tracing is available
+     */
+    bool begin();
+
+    bool isEnabled() const;
+
+    /**
+     * Adds an event, the oldest event is overwritten if the buffer is full.
+     *
+     * @param kind the event kind
+     * @param name the command or state name
+     * @param result the response, may be <code>nullptr</code>
+     * @param start the start time from <code>esp_timer_get_time()</code>
+     * @param duration the duration in µs
+     * @param status the ELM327 receive state
+     */
+    void record(trace::EventKind kind, const char *name, const char *result, int64_t start, uint32_t duration,
+                int8_t status);
+
+    /**
+     * Copies the buffered events, oldest first.
+     *
+     * @param snapshot receives the events
+     * @return the number of copied events
+     */
+    size_t snapshot(TraceEvent *snapshot);
+
+    uint32_t getRecorded() const;
+};
+
+extern TraceClass Trace;
+
+/**
+ * Stream wrapper, which traces every command written to and every response read from the adapter.
+ * A command ends with a carriage return, its response with the <code>&gt;</code> prompt.
+ * A command without prompt is recorded as timeout when the next command is sent.
+ */
+class TraceStream : public Stream {
+    Stream *stream = nullptr;
+
+    char input[TRACE_TEXT_SIZE]{};
+
+    size_t inputLen = 0;
+
+    char command[TRACE_TEXT_SIZE]{};
+
+    char response[TRACE_TEXT_SIZE]{};
+
+    size_t responseLen = 0;
+
+    int64_t commandStart = 0;
+
+    bool waiting = false;
+
+    void traceWrite(uint8_t c);
+
+    void traceRead(int c);
+
+    void finish(int8_t status);
+
+public:
+    /**
+     * @param stream the adapter stream
+     * @return this wrapper
+     */
+    TraceStream &attach(Stream &stream);
+
+    int available() override;
+
+    int read() override;
+
+    int peek() override;
+
+    void flush() override;
+
+    size_t write(uint8_t c) override;
+
+    size_t write(const uint8_t *buffer, size_t size) override;
+};
+
+/**
+ * Serializes a snapshot of the trace buffer as Chrome trace event JSON in chunks.
+ * Adapter commands and state requests are shown as separate threads.
+ */
+class TraceJSONWriter {
+    TraceEvent *events = nullptr;
+
+    size_t count = 0;
+
+    size_t index = 0;
+
+    std::string pending{};
+
+    size_t pendingPos = 0;
+
+    uint8_t stage = 0;
+
+    bool fill();
+
+public:
+    TraceJSONWriter();
+
+    TraceJSONWriter(const TraceJSONWriter &) = delete;
+
+    TraceJSONWriter &operator=(const TraceJSONWriter &) = delete;
+
+    ~TraceJSONWriter();
+
+    /**
+     * Copies the next part of the JSON.
+     *
+     * @param buffer the buffer
+     * @param maxLen the size of the buffer
+     * @return the number of bytes copied, <code>0</code> at the end
+     */
+    size_t read(uint8_t *buffer, size_t maxLen);
+};
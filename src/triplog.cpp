@@ -0,0 +1,448 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include "triplog.h"
+
+#include <climits>
+
+static size_t putU8(uint8_t *buf, const uint8_t value) {
+    buf[0] = value;
+    return 1;
+}
+
+static size_t putU16(uint8_t *buf, const uint16_t value) {
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    return 2;
+}
+
+static size_t putU32(uint8_t *buf, const uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (value >> (i * 8)) & 0xFF;
+    }
+    return 4;
+}
+
+static size_t putVarInt(uint8_t *buf, uint64_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = static_cast<uint8_t>(value);
+    return len;
+}
+
+static size_t putZigZag(uint8_t *buf, const int64_t value) {
+    return putVarInt(buf, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+TripLogClass::TripLogClass() = default;
+
+bool TripLogClass::begin(fs::FS &fs, const size_t maxSize, const size_t freeBytes) {
+    if (running) {
+        return true;
+    }
+
+    this->fs = &fs;
+
+    if (!fs.exists(TRIPLOG_DIR)) {
+        fs.mkdir(TRIPLOG_DIR);
+    }
+
+    size_t usedBytes = 0;
+    segmentSeq = 0;
+    File dir = fs.open(TRIPLOG_DIR);
+    if (dir && dir.isDirectory()) {
+        File file = dir.openNextFile();
+        while (file) {
+            const uint32_t seq = strtoul(file.name(), nullptr, 10);
+            if (seq >= segmentSeq) {
+                segmentSeq = seq + 1;
+            }
+            usedBytes += file.size();
+            file.close();
+            file = dir.openNextFile();
+        }
+        dir.close();
+    }
+
+    // keep two pages reserve for other files
+    const size_t available = usedBytes + freeBytes > 2 * TRIPLOG_PAGE_SIZE
+                                 ? usedBytes + freeBytes - 2 * TRIPLOG_PAGE_SIZE
+                                 : 0;
+    this->maxSize = std::min(maxSize, available);
+    if (this->maxSize < TRIPLOG_SEGMENT_SIZE) {
+        Serial.printf("Trip log disabled, not enough space (%u bytes).\n", static_cast<unsigned>(this->maxSize));
+        return false;
+    }
+
+    buffers = static_cast<TripLogBuffer *>(malloc(sizeof(TripLogBuffer) * TRIPLOG_NUM_BUFFERS));
+    page = static_cast<uint8_t *>(malloc(TRIPLOG_PAGE_SIZE));
+    block = static_cast<uint8_t *>(malloc(TRIPLOG_MAX_BLOCK_SIZE));
+    freeBuffers = xQueueCreate(TRIPLOG_NUM_BUFFERS, sizeof(TripLogBuffer *));
+    fullBuffers = xQueueCreate(TRIPLOG_NUM_BUFFERS + 1, sizeof(TripLogBuffer *));
+    if (buffers == nullptr || page == nullptr || block == nullptr || freeBuffers == nullptr ||
+        fullBuffers == nullptr) {
+        Serial.println("Failed to allocate trip log buffers.");
+        releaseResources();
+        return false;
+    }
+
+    for (int i = 0; i < TRIPLOG_NUM_BUFFERS; i++) {
+        TripLogBuffer *buffer = &buffers[i];
+        buffer->count = 0;
+        xQueueSend(freeBuffers, &buffer, 0);
+    }
+    activeBuffer = nullptr;
+    pagePos = 0;
+    pageFlushed = 0;
+    segmentSize = 0;
+    lastFlush = millis();
+
+    running = true;
+    writerRunning = true;
+    xTaskCreatePinnedToCore(writerTask, "TripLogTask", 4096, this, 1, &writerTaskHdl, 0);
+
+    Serial.printf("Trip log started, segment %u, budget %u bytes.\n", segmentSeq, static_cast<unsigned>(this->maxSize));
+
+    return true;
+}
+
+void TripLogClass::end() {
+    if (!running) {
+        return;
+    }
+    running = false;
+
+    // the polling task may still fill the active buffer, it's checked after recording is set
+    const unsigned long waitStart = millis();
+    while (recording && millis() - waitStart < 1000) {
+        delay(1);
+    }
+
+    if (activeBuffer != nullptr) {
+        xQueueSend(fullBuffers, &activeBuffer, 0);
+        activeBuffer = nullptr;
+    }
+
+    // nullptr signals the writer to flush and stop
+    TripLogBuffer *stop = nullptr;
+    xQueueSend(fullBuffers, &stop, portMAX_DELAY);
+
+    const unsigned long start = millis();
+    while (writerRunning && millis() - start < 5000) {
+        delay(10);
+    }
+
+    if (!writerRunning) {
+        releaseResources();
+    }
+}
+
+void TripLogClass::releaseResources() {
+    if (freeBuffers != nullptr) {
+        vQueueDelete(freeBuffers);
+        freeBuffers = nullptr;
+    }
+    if (fullBuffers != nullptr) {
+        vQueueDelete(fullBuffers);
+        fullBuffers = nullptr;
+    }
+    free(buffers);
+    buffers = nullptr;
+    free(page);
+    page = nullptr;
+    free(block);
+    block = nullptr;
+}
+
+int TripLogClass::findColumn(OBDState *state) {
+    const uint8_t count = numColumns;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(columns[i].name, state->getName()) == 0) {
+            return i;
+        }
+    }
+
+    if (count >= TRIPLOG_MAX_COLUMNS) {
+        return -1;
+    }
+
+    TripLogColumn &column = columns[count];
+    strlcpy(column.name, state->getName(), sizeof(column.name));
+    if (strcmp(state->valueType(), "float") == 0) {
+        column.valueType = triplog::FLOAT;
+        column.decimals = TRIPLOG_FLOAT_DECIMALS;
+    } else if (strcmp(state->valueType(), "bool") == 0) {
+        column.valueType = triplog::BOOL;
+        column.decimals = 0;
+    } else {
+        column.valueType = triplog::INT;
+        column.decimals = 0;
+    }
+    column.lastUpdate = 0;
+    // publish column to writer after it's complete
+    numColumns = count + 1;
+
+    return count;
+}
+
+void TripLogClass::record(OBDState *state) {
+    if (state == nullptr || state->isProcessing() || state->getLastUpdate() == 0) {
+        return;
+    }
+
+    recording = true;
+    if (running) {
+        recordSample(state);
+    }
+    recording = false;
+}
+
+void TripLogClass::recordSample(OBDState *state) {
+    const int column = findColumn(state);
+    if (column == -1 || columns[column].lastUpdate == state->getLastUpdate()) {
+        return;
+    }
+    columns[column].lastUpdate = state->getLastUpdate();
+
+    if (activeBuffer == nullptr && xQueueReceive(freeBuffers, &activeBuffer, 0) != pdTRUE) {
+        activeBuffer = nullptr;
+        ++droppedSamples;
+        return;
+    }
+
+    int32_t value = 0;
+    if (columns[column].valueType == triplog::FLOAT) {
+        const double scaled = reinterpret_cast<OBDStateFloat *>(state)->getValue() * pow(
+                                  10, TRIPLOG_FLOAT_DECIMALS);
+        value = static_cast<int32_t>(std::max(static_cast<double>(INT32_MIN),
+                                              std::min(static_cast<double>(INT32_MAX), round(scaled))));
+    } else if (columns[column].valueType == triplog::BOOL) {
+        value = reinterpret_cast<OBDStateBool *>(state)->getValue() ? 1 : 0;
+    } else {
+        value = reinterpret_cast<OBDStateInt *>(state)->getValue();
+    }
+
+    TripLogSample &sample = activeBuffer->samples[activeBuffer->count++];
+    sample.timestamp = state->getLastUpdate();
+    sample.value = value;
+    sample.column = column;
+
+    if (activeBuffer->count == TRIPLOG_BUFFER_SAMPLES ||
+        millis() - activeBuffer->samples[0].timestamp >= TRIPLOG_FLUSH_INTERVAL) {
+        xQueueSend(fullBuffers, &activeBuffer, 0);
+        activeBuffer = nullptr;
+    }
+}
+
+uint32_t TripLogClass::getDroppedSamples() const {
+    return droppedSamples;
+}
+
+void TripLogClass::writerTask(void *parameters) {
+    auto *log = static_cast<TripLogClass *>(parameters);
+
+    for (;;) {
+        TripLogBuffer *buffer = nullptr;
+        if (xQueueReceive(log->fullBuffers, &buffer, pdMS_TO_TICKS(1000)) == pdTRUE) {
+            if (buffer == nullptr) {
+                break;
+            }
+
+            if (buffer->count > 0) {
+                if (!log->segment && !log->openSegment()) {
+                    log->droppedSamples += buffer->count;
+                } else {
+                    const size_t len = log->encodeBlock(buffer);
+                    log->appendToPage(log->block, len);
+
+                    // rotate only between blocks, so each segment can be decoded on its own
+                    if (log->segmentSize + log->pagePos >= TRIPLOG_SEGMENT_SIZE) {
+                        log->closeSegment();
+                    }
+                }
+            }
+
+            buffer->count = 0;
+            xQueueSend(log->freeBuffers, &buffer, 0);
+        } else if (log->pagePos > log->pageFlushed && millis() - log->lastFlush >= TRIPLOG_FLUSH_INTERVAL) {
+            log->flushPage();
+        }
+    }
+
+    log->closeSegment();
+    log->writerTaskHdl = nullptr;
+    log->writerRunning = false;
+    vTaskDelete(nullptr);
+}
+
+size_t TripLogClass::encodeBlock(const TripLogBuffer *buffer) {
+    const uint32_t baseTime = buffer->samples[0].timestamp;
+    const uint8_t count = numColumns;
+
+    size_t pos = 0;
+    pos += putU32(block + pos, TRIPLOG_BLOCK_MAGIC);
+    const size_t lengthPos = pos;
+    pos += putU16(block + pos, 0);
+    pos += putU16(block + pos, buffer->count);
+    pos += putU32(block + pos, baseTime);
+    const size_t columnsPos = pos;
+    pos += putU8(block + pos, 0);
+
+    uint8_t blockColumns = 0;
+    for (uint8_t c = 0; c < count; c++) {
+        uint16_t numSamples = 0;
+        for (uint16_t i = 0; i < buffer->count; i++) {
+            if (buffer->samples[i].column == c) {
+                ++numSamples;
+            }
+        }
+        if (numSamples == 0) {
+            continue;
+        }
+
+        const TripLogColumn &column = columns[c];
+        const uint8_t nameLen = strlen(column.name);
+        pos += putU8(block + pos, c);
+        pos += putU8(block + pos, column.valueType);
+        pos += putU8(block + pos, column.decimals);
+        pos += putU8(block + pos, nameLen);
+        memcpy(block + pos, column.name, nameLen);
+        pos += nameLen;
+        pos += putVarInt(block + pos, numSamples);
+
+        uint32_t prevTime = baseTime;
+        int32_t prevValue = 0;
+        for (uint16_t i = 0; i < buffer->count; i++) {
+            const TripLogSample &sample = buffer->samples[i];
+            if (sample.column == c) {
+                pos += putVarInt(block + pos, sample.timestamp - prevTime);
+                pos += putZigZag(block + pos, static_cast<int64_t>(sample.value) - prevValue);
+                prevTime = sample.timestamp;
+                prevValue = sample.value;
+            }
+        }
+        ++blockColumns;
+    }
+
+    putU16(block + lengthPos, pos);
+    putU8(block + columnsPos, blockColumns);
+
+    return pos;
+}
+
+void TripLogClass::appendToPage(const uint8_t *data, size_t len) {
+    while (len > 0) {
+        const size_t n = std::min(len, TRIPLOG_PAGE_SIZE - pagePos);
+        memcpy(page + pagePos, data, n);
+        pagePos += n;
+        data += n;
+        len -= n;
+
+        if (pagePos == TRIPLOG_PAGE_SIZE) {
+            flushPage();
+        }
+    }
+}
+
+void TripLogClass::flushPage() {
+    if (pagePos == pageFlushed || !segment) {
+        return;
+    }
+
+    // a partial page is appended without padding, the page is filled further and its rest appended later
+    segment.write(page + pageFlushed, pagePos - pageFlushed);
+    segment.flush();
+    pageFlushed = pagePos;
+
+    if (pagePos == TRIPLOG_PAGE_SIZE) {
+        segmentSize += TRIPLOG_PAGE_SIZE;
+        pagePos = 0;
+        pageFlushed = 0;
+    }
+    lastFlush = millis();
+}
+
+bool TripLogClass::openSegment() {
+    enforceBudget();
+
+    char path[32];
+    snprintf(path, sizeof(path), TRIPLOG_DIR "/%08u.bin", segmentSeq);
+    segment = fs->open(path, FILE_WRITE);
+    if (!segment) {
+        Serial.printf("Failed to open trip log segment %s.\n", path);
+        return false;
+    }
+
+    uint8_t header[TRIPLOG_HEADER_SIZE] = {0};
+    memcpy(header, TRIPLOG_MAGIC, 4);
+    putU16(header + 4, TRIPLOG_VERSION);
+    putU16(header + 6, TRIPLOG_PAGE_SIZE);
+    putU32(header + 8, segmentSeq);
+    putU32(header + 12, millis());
+
+    segmentSize = 0;
+    pagePos = 0;
+    pageFlushed = 0;
+    appendToPage(header, sizeof(header));
+    ++segmentSeq;
+
+    return true;
+}
+
+void TripLogClass::closeSegment() {
+    if (segment) {
+        flushPage();
+        segment.close();
+    }
+    segmentSize = 0;
+}
+
+void TripLogClass::enforceBudget() {
+    for (;;) {
+        size_t usedBytes = 0;
+        uint32_t oldestSeq = UINT32_MAX;
+
+        File dir = fs->open(TRIPLOG_DIR);
+        if (!dir || !dir.isDirectory()) {
+            return;
+        }
+        File file = dir.openNextFile();
+        while (file) {
+            const uint32_t seq = strtoul(file.name(), nullptr, 10);
+            oldestSeq = std::min(oldestSeq, seq);
+            usedBytes += file.size();
+            file.close();
+            file = dir.openNextFile();
+        }
+        dir.close();
+
+        // make room for the next segment
+        if (oldestSeq == UINT32_MAX || usedBytes + TRIPLOG_SEGMENT_SIZE <= maxSize) {
+            return;
+        }
+
+        char path[32];
+        snprintf(path, sizeof(path), TRIPLOG_DIR "/%08u.bin", oldestSeq);
+        if (!fs->remove(path)) {
+            return;
+        }
+    }
+}
+
+TripLogClass TripLog;
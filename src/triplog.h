@@ -0,0 +1,173 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <Arduino.h>
+#include <atomic>
+#include <FS.h>
+#include <OBDState.h>
+
+#define TRIPLOG_DIR                 "/triplog"
+
+#define TRIPLOG_MAGIC               "OTLG"
+#define TRIPLOG_BLOCK_MAGIC         0x424C544F      // "OTLB"
+#define TRIPLOG_VERSION             1
+#define TRIPLOG_HEADER_SIZE         16
+
+#define TRIPLOG_PAGE_SIZE           4096
+#define TRIPLOG_SEGMENT_SIZE        (8 * TRIPLOG_PAGE_SIZE)
+#define TRIPLOG_MAX_COLUMNS         64
+#define TRIPLOG_BUFFER_SAMPLES      256
+#define TRIPLOG_NUM_BUFFERS         3
+#define TRIPLOG_FLUSH_INTERVAL      60000
+#define TRIPLOG_FLOAT_DECIMALS      3
+
+// block header + per column (id, type, decimals, name, count) + per sample (time delta, value delta)
+#define TRIPLOG_MAX_BLOCK_SIZE      (13 + TRIPLOG_MAX_COLUMNS * 41 + TRIPLOG_BUFFER_SAMPLES * 10)
+
+namespace triplog {
+    typedef enum {
+        BOOL,
+        INT,
+        FLOAT,
+    } ValueType;
+}
+
+struct TripLogSample {
+    uint32_t timestamp;
+    int32_t value;
+    uint8_t column;
+};
+
+struct TripLogBuffer {
+    uint16_t count;
+    TripLogSample samples[TRIPLOG_BUFFER_SAMPLES];
+};
+
+struct TripLogColumn {
+    char name[33];
+    uint8_t valueType;
+    uint8_t decimals;
+    long lastUpdate;
+};
+
+/**
+ * Persistent trip log on the filesystem.
+ *
+ * Samples are collected by the polling task into RAM buffers and handed over to a writer task,
+ * which encodes them as self-describing, delta-encoded blocks with one column per state.
+ * Blocks are collected in a page buffer, which is appended to the segment file when it is full.
+ * The periodic flush appends only the new part of a partial page, so slow signals don't rewrite whole pages.
+ * The oldest segments are removed if the configured size budget is exceeded.
+ *
+ * @see tools/trip-log-decoder
+ */
+class TripLogClass {
+    fs::FS *fs = nullptr;
+
+    size_t maxSize = 0;
+
+    std::atomic_bool running{false};
+
+    std::atomic_bool writerRunning{false};
+
+    std::atomic_bool recording{false};
+
+    TripLogColumn columns[TRIPLOG_MAX_COLUMNS]{};
+
+    std::atomic<uint8_t> numColumns{0};
+
+    TripLogBuffer *buffers = nullptr;
+
+    TripLogBuffer *activeBuffer = nullptr;
+
+    QueueHandle_t freeBuffers = nullptr;
+
+    QueueHandle_t fullBuffers = nullptr;
+
+    TaskHandle_t writerTaskHdl = nullptr;
+
+    std::atomic<uint32_t> droppedSamples{0};
+
+    uint8_t *page = nullptr;
+
+    size_t pagePos = 0;
+
+    /** the part of the page, which was already appended to the segment */
+    size_t pageFlushed = 0;
+
+    uint8_t *block = nullptr;
+
+    File segment;
+
+    uint32_t segmentSeq = 0;
+
+    size_t segmentSize = 0;
+
+    unsigned long lastFlush = 0;
+
+    int findColumn(OBDState *state);
+
+    void recordSample(OBDState *state);
+
+    static void writerTask(void *parameters);
+
+    size_t encodeBlock(const TripLogBuffer *buffer);
+
+    void appendToPage(const uint8_t *data, size_t len);
+
+    void flushPage();
+
+    bool openSegment();
+
+    void closeSegment();
+
+    void enforceBudget();
+
+    void releaseResources();
+
+public:
+    TripLogClass();
+
+    /**
+     * Starts the trip log writer.
+     *
+     * @param fs the filesystem
+     * @param maxSize the maximum size of all segments in bytes
+     * @param freeBytes the free bytes it may use in addition to its own files
+     * @return <code>true</code> if started
+     */
+    bool begin(fs::FS &fs, size_t maxSize, size_t freeBytes);
+
+    /**
+     * Flushes all pending samples and stops the writer.
+     * Should be called before restart or sleep to keep the last samples.
+     * Waits until the polling task has left record(), before its buffer is handed over.
+     */
+    void end();
+
+    /**
+     * Records the current value of given state if it was updated since the last call.
+     * Never blocks, samples are dropped if the writer can't keep up.
+     *
+     * @param state the state, may be <code>nullptr</code>
+     */
+    void record(OBDState *state);
+
+    uint32_t getDroppedSamples() const;
+};
+
+extern TripLogClass TripLog;
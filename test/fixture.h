@@ -0,0 +1,49 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#pragma once
+#include <unity.h>
+#include <LittleFS.h>
+#include <dirent.h>
+#include <string>
+#include <unistd.h>
+
+/**
+ * Mounts LittleFS on a new temporary directory, to be called by setUp() of suites, which use the filesystem.
+ */
+inline void beginTestFS() {
+    char root[] = "/tmp/obledash-test-XXXXXX";
+    TEST_ASSERT_NOT_NULL(mkdtemp(root));
+    LittleFS.setRoot(root);
+    TEST_ASSERT_TRUE(LittleFS.begin(true));
+}
+
+/**
+ * Removes the temporary directory of beginTestFS() with all files, to be called by tearDown().
+ */
+inline void endTestFS() {
+    const std::string root = LittleFS.getRoot();
+    DIR *dir = opendir(root.c_str());
+    if (dir != nullptr) {
+        while (const dirent *entry = readdir(dir)) {
+            if (entry->d_name[0] != '.') {
+                unlink((root + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+    rmdir(root.c_str());
+}
@@ -0,0 +1,283 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <unity.h>
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include "obd.h"
+#include "../fixture.h"
+
+#define READER_THREADS 3
+#define UPDATES 200
+
+void setUp() {
+    beginTestFS();
+}
+
+void tearDown() {
+    OBD.clearStates();
+    OBD.synchronize();
+    endTestFS();
+}
+
+/**
+ * @return a JSON array of states named by the prefix and their index
+ */
+static std::string buildStates(const char prefix, const size_t count) {
+    std::string json = "[";
+    for (size_t i = 0; i < count; i++) {
+        char state[320];
+        snprintf(state, sizeof(state),
+                 R"(%s{"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": 100,
+                 "name": "%c%u", "description": "", "measurement": true, "diagnostic": false, "pid": {"service": 1,
+                 "pid": %u, "numResponses": 1, "numExpectedBytes": 1, "scaleFactor": "1"}})", i != 0 ? "," : "",
+                 prefix, static_cast<unsigned>(i), static_cast<unsigned>(i + 1));
+        json += state;
+    }
+    return json + "]";
+}
+
+static std::string readAll(OBDStates &states) {
+    StatesJSONWriter writer(states);
+    std::string json;
+    uint8_t buffer[128];
+    size_t len;
+    while ((len = writer.read(buffer, sizeof(buffer))) > 0) {
+        json.append(reinterpret_cast<char *>(buffer), len);
+    }
+    return json;
+}
+
+/**
+ * @return <code>true</code> if the JSON is an array of states without duplicates
+ */
+static bool isValidStatesJSON(const std::string &json) {
+    JsonDocument doc;
+    if (deserializeJson(doc, json.c_str(), json.size()) || !doc.is<JsonArray>()) {
+        return false;
+    }
+    std::set<std::string> names;
+    for (JsonVariant state: doc.as<JsonArray>()) {
+        if (!names.insert(state["name"].as<std::string>()).second) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_readers_during_updates() {
+    const std::string statesA = buildStates('a', 8);
+    const std::string statesB = buildStates('b', 16);
+    TEST_ASSERT_TRUE(OBD.parseJSON(statesA.c_str(), statesA.size()));
+    OBD.synchronize();
+
+    std::atomic_bool stop{false};
+    std::atomic_bool updating{true};
+    std::atomic<uint32_t> reads{0};
+    std::atomic<uint32_t> inconsistent{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READER_THREADS; i++) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                bool consistent;
+                {
+                    StatesReadGuard guard(OBD);
+                    const OBDStateSet *set = OBD.currentStates();
+                    // every state of a set belongs to the same configuration, shared or copied by a patch
+                    const char prefix = set->states.front()->getName()[0];
+                    const size_t expected = prefix == 'a' ? 8 : 16;
+                    consistent = set->states.size() == expected;
+                    for (OBDState *state: set->states) {
+                        consistent = consistent && state->getName()[0] == prefix && state->getUpdateInterval() > 0;
+                        reinterpret_cast<OBDStateInt *>(state)->getSnapshot();
+                    }
+                }
+
+                // each state is serialized within its own guard, the sets may be replaced in between
+                consistent = consistent && isValidStatesJSON(readAll(OBD));
+
+                if (!consistent) {
+                    ++inconsistent;
+                }
+                ++reads;
+            }
+        });
+    }
+
+    // configuration changes by the web server, full replacements and patches of a single state
+    std::thread updater([&]() {
+        JsonDocument patch;
+        std::string error;
+        for (int i = 0; i < UPDATES; i++) {
+            const std::string &states = i % 2 == 0 ? statesB : statesA;
+            OBD.parseJSON(states.c_str(), states.size());
+            patch["interval"] = 100 + i;
+            OBD.patchState(LittleFS, i % 2 == 0 ? "b3" : "a3", patch, error);
+        }
+        updating = false;
+    });
+
+    // the polling task publishes the committed sets and deletes the replaced ones,
+    // the output task compacts the journal in between
+    const uint32_t generation = OBD.currentStates()->generation;
+    while (updating) {
+        OBD.synchronize();
+        OBD.compactJournal();
+    }
+    updater.join();
+    while (reads < 1000) {
+        OBD.synchronize();
+    }
+    stop = true;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+    OBD.synchronize();
+    OBD.synchronize();
+
+    TEST_ASSERT_EQUAL(0, inconsistent.load());
+    TEST_ASSERT_GREATER_THAN(generation, OBD.currentStates()->generation);
+    TEST_ASSERT_EQUAL('a', OBD.currentStates()->states.front()->getName()[0]);
+
+    // grows the journal until the next compaction is due
+    JsonDocument patch;
+    std::string error;
+    patch["interval"] = 500;
+    File journal;
+    do {
+        TEST_ASSERT_TRUE(OBD.patchState(LittleFS, "a3", patch, error));
+        journal = LittleFS.open(STATES_JOURNAL_FILE, FILE_READ);
+    } while (journal.size() < STATES_JOURNAL_COMPACT_SIZE);
+    journal.close();
+
+    OBD.compactJournal();
+    TEST_ASSERT_FALSE(LittleFS.exists(STATES_JOURNAL_FILE));
+
+    File file = LittleFS.open(STATES_FILE, FILE_READ);
+    JsonDocument states;
+    TEST_ASSERT_FALSE(deserializeJson(states, file));
+    file.close();
+    TEST_ASSERT_EQUAL(8, states.size());
+    TEST_ASSERT_EQUAL_STRING("a3", states[3]["name"].as<const char *>());
+    TEST_ASSERT_EQUAL(500, states[3]["interval"].as<int>());
+}
+
+/**
+ * Applies values, which are derived from their timestamp, like the polling task,
+ * while other threads check every snapshot against it.
+ */
+template<typename T>
+static void checkSnapshots(TypedOBDState<T> &state, T (*valueAt)(long)) {
+    std::atomic_bool stop{false};
+    std::atomic<uint32_t> snapshots{0};
+    std::atomic<uint32_t> torn{0};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < READER_THREADS; i++) {
+        readers.emplace_back([&]() {
+            while (!stop) {
+                const OBDValueSnapshot<T> snapshot = state.getSnapshot();
+                if (snapshot.value != valueAt(snapshot.lastUpdate) ||
+                    snapshot.oldValue != valueAt(snapshot.previousUpdate) ||
+                    snapshot.previousUpdate != snapshot.lastUpdate - 1) {
+                    ++torn;
+                }
+                ++snapshots;
+            }
+        });
+    }
+
+    // the polling task, only one writer
+    for (long timestamp = 2; timestamp < 2000000 || snapshots < 100000; timestamp++) {
+        state.applyValue(valueAt(timestamp), timestamp);
+    }
+    stop = true;
+    for (auto &reader: readers) {
+        reader.join();
+    }
+
+    TEST_ASSERT_EQUAL(0, torn.load());
+}
+
+static int intAt(const long timestamp) {
+    return static_cast<int>(timestamp * 3);
+}
+
+static float floatAt(const long timestamp) {
+    // exact for all used timestamps
+    return static_cast<float>(timestamp) / 4;
+}
+
+static bool boolAt(const long timestamp) {
+    return timestamp % 2 == 0;
+}
+
+void test_snapshots_not_torn() {
+    OBDStateInt intState(obd::READ, "rpm", "", "", "");
+    intState.applyValue(intAt(1), 1);
+    checkSnapshots<int>(intState, intAt);
+
+    OBDStateFloat floatState(obd::READ, "mafRate", "", "", "");
+    floatState.applyValue(floatAt(1), 1);
+    checkSnapshots<float>(floatState, floatAt);
+
+    OBDStateBool boolState(obd::READ, "milOn", "", "", "");
+    boolState.applyValue(boolAt(1), 1);
+    checkSnapshots<bool>(boolState, boolAt);
+}
+
+void test_writer_doesnt_pin_states() {
+    const std::string statesA = buildStates('a', 8);
+    const std::string statesB = buildStates('b', 16);
+    TEST_ASSERT_TRUE(OBD.parseJSON(statesA.c_str(), statesA.size()));
+    OBD.synchronize();
+    const uint32_t generation = OBD.currentStates()->generation;
+
+    // a stalled client after the first chunk
+    StatesJSONWriter writer(OBD);
+    std::string json;
+    uint8_t buffer[400];
+    size_t len = writer.read(buffer, sizeof(buffer));
+    json.append(reinterpret_cast<char *>(buffer), len);
+
+    // the second replacement is only published after the first replaced set was deleted
+    TEST_ASSERT_TRUE(OBD.parseJSON(statesB.c_str(), statesB.size()));
+    OBD.synchronize();
+    TEST_ASSERT_TRUE(OBD.parseJSON(statesA.c_str(), statesA.size()));
+    OBD.synchronize();
+    OBD.synchronize();
+    TEST_ASSERT_GREATER_THAN(generation, OBD.currentStates()->generation);
+    TEST_ASSERT_EQUAL('a', OBD.currentStates()->states.front()->getName()[0]);
+
+    while ((len = writer.read(buffer, sizeof(buffer))) > 0) {
+        json.append(reinterpret_cast<char *>(buffer), len);
+    }
+    TEST_ASSERT_TRUE(isValidStatesJSON(json));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_readers_during_updates);
+    RUN_TEST(test_writer_doesnt_pin_states);
+    RUN_TEST(test_snapshots_not_torn);
+    return UNITY_END();
+}
@@ -0,0 +1,126 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <unity.h>
+#include <ExprParser.h>
+#include <cstring>
+#include <string>
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static double eval(ExprParser &parser, const char *expression) {
+    const double result = parser.evalExp(expression);
+    TEST_ASSERT_EQUAL_STRING("", parser.errormsg);
+    return result;
+}
+
+void test_operator_precedence() {
+    ExprParser parser;
+    TEST_ASSERT_EQUAL_FLOAT(7, eval(parser, "1 + 2 * 3"));
+    TEST_ASSERT_EQUAL_FLOAT(9, eval(parser, "(1 + 2) * 3"));
+    TEST_ASSERT_EQUAL_FLOAT(0.25, eval(parser, "1.0 / 4.0"));
+    TEST_ASSERT_EQUAL_FLOAT(100.0 / 255.0, eval(parser, "100.0 / 255.0"));
+    TEST_ASSERT_EQUAL_FLOAT(13, eval(parser, "1 + 3 * 2 ^ 2"));
+    TEST_ASSERT_EQUAL_FLOAT(-5, eval(parser, "-2 - 3"));
+}
+
+void test_bitwise_and() {
+    ExprParser parser;
+    TEST_ASSERT_EQUAL_FLOAT(4, eval(parser, "12 & 6"));
+    TEST_ASSERT_EQUAL_FLOAT(1, eval(parser, "(255 & 128) / 128"));
+}
+
+void test_functions() {
+    ExprParser parser;
+    TEST_ASSERT_EQUAL_FLOAT(4, eval(parser, "sqrt(16)"));
+    TEST_ASSERT_EQUAL_FLOAT(4, eval(parser, "SQRT(16)"));
+    TEST_ASSERT_EQUAL_FLOAT(3, eval(parser, "round(2.6)"));
+    TEST_ASSERT_EQUAL_FLOAT(2, eval(parser, "int(2.6)"));
+    TEST_ASSERT_EQUAL_FLOAT(300, eval(parser, "max(120, 300)"));
+    TEST_ASSERT_EQUAL_FLOAT(120, eval(parser, "min(120, 300)"));
+    TEST_ASSERT_FLOAT_WITHIN(1e-9, 1, eval(parser, "sin(90)"));
+}
+
+void test_custom_functions() {
+    ExprParser parser;
+    parser.addCustomFunction("double", [](const double value) {
+        return value * 2;
+    });
+    TEST_ASSERT_EQUAL_FLOAT(10, eval(parser, "double(5)"));
+    TEST_ASSERT_EQUAL_FLOAT(11, eval(parser, "Double(2 + 3) + 1"));
+
+    parser.evalExp("unknown(5)");
+    TEST_ASSERT_EQUAL_STRING("Unknown Function", parser.errormsg);
+}
+
+void test_variables() {
+    ExprParser parser;
+    parser.setVariable('X', 3);
+    TEST_ASSERT_EQUAL_FLOAT(6, eval(parser, "x * 2"));
+
+    eval(parser, "y = 4");
+    TEST_ASSERT_EQUAL_FLOAT(4, parser.getVariable('Y'));
+    TEST_ASSERT_EQUAL_FLOAT(5, eval(parser, "sqrt(x ^ 2 + y ^ 2)"));
+}
+
+void test_resolved_variables() {
+    ExprParser parser;
+    std::string resolved;
+    parser.setVariableResolveFunction([&resolved](const char *name) {
+        resolved += name;
+        resolved += ";";
+        return strcmp(name, "$rpm") == 0 ? 2000.0 : strcmp(name, "$speed") == 0 ? 50.0 : 0.0;
+    });
+
+    TEST_ASSERT_EQUAL_FLOAT(1700, eval(parser, "max($rpm, 300) - 300"));
+    TEST_ASSERT_EQUAL_FLOAT(2050, eval(parser, "$rpm+$speed"));
+    TEST_ASSERT_EQUAL_FLOAT(100, eval(parser, "$speed * 2"));
+    TEST_ASSERT_EQUAL_STRING("$rpm;$rpm;$speed;$speed;", resolved.c_str());
+}
+
+void test_errors() {
+    ExprParser parser;
+    parser.evalExp("1.0 / (4");
+    TEST_ASSERT_EQUAL_STRING("Unbalanced Parentheses", parser.errormsg);
+
+    parser.evalExp("");
+    TEST_ASSERT_EQUAL_STRING("No Expression Present", parser.errormsg);
+
+    parser.evalExp(nullptr);
+    TEST_ASSERT_EQUAL_STRING("No Expression Present", parser.errormsg);
+
+    parser.evalExp("1 2");
+    TEST_ASSERT_EQUAL_STRING("Syntax Error", parser.errormsg);
+
+    // the error is reset by the next evaluation
+    TEST_ASSERT_EQUAL_FLOAT(2, eval(parser, "1 + 1"));
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_operator_precedence);
+    RUN_TEST(test_bitwise_and);
+    RUN_TEST(test_functions);
+    RUN_TEST(test_custom_functions);
+    RUN_TEST(test_variables);
+    RUN_TEST(test_resolved_variables);
+    RUN_TEST(test_errors);
+    return UNITY_END();
+}
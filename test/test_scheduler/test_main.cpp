@@ -0,0 +1,170 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <unity.h>
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <map>
+#include <string>
+#include "obd.h"
+#include "simulator.h"
+
+// the delay of the polling task between two iterations
+#define POLL_LOOP_DELAY 10
+
+void setUp() {
+}
+
+void tearDown() {
+    OBD.setScaleIntervals(false);
+    OBD.clearStates();
+    OBD.synchronize();
+}
+
+static std::string readState(const char *name, const uint16_t pid, const long interval, const char *extra = "") {
+    char json[384];
+    snprintf(json, sizeof(json),
+             R"({"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": %ld, "name": "%s",
+             "description": "", "measurement": true, "diagnostic": false, "pid": {"service": 1, "pid": %u,
+             "numResponses": 1, "numExpectedBytes": 1, "scaleFactor": "1"}%s})", interval, name, pid, extra);
+    return json;
+}
+
+/**
+ * Publishes the states like the polling task, nothing is carried over from the previous test.
+ */
+static void load(const std::vector<std::string> &states) {
+    std::string json = "[";
+    for (const auto &state: states) {
+        json += json.size() > 1 ? "," + state : state;
+    }
+    json += "]";
+
+    OBD.clearStates();
+    OBD.synchronize();
+    TEST_ASSERT_TRUE(OBD.parseJSON(json.c_str(), json.size()));
+    OBD.synchronize();
+}
+
+/**
+ * Polls the states on the stepped clock and counts the updates of every state.
+ *
+ * @return the requests, which were sent to the adapter
+ */
+static uint32_t poll(const char *adapter, const unsigned long seconds, std::map<std::string, uint32_t> &updates) {
+    ELM327Simulator simulator;
+    TEST_ASSERT_TRUE(simulator.begin(adapter));
+    OBD.setAdapter(&simulator);
+    OBD.connect();
+
+    std::map<const OBDState *, long> lastUpdates{};
+    const unsigned long start = millis();
+    while (millis() - start < seconds * 1000) {
+        const OBDState *state = OBD.loop();
+        if (state != nullptr && lastUpdates[state] != state->getLastUpdate()) {
+            lastUpdates[state] = state->getLastUpdate();
+            ++updates[state->getName()];
+        }
+        delay(POLL_LOOP_DELAY);
+    }
+    OBD.setAdapter(nullptr);
+
+    return simulator.getRequests();
+}
+
+static const OBDState *findState(const char *name) {
+    for (const OBDState *state: OBD.currentStates()->states) {
+        if (strcmp(state->getName(), name) == 0) {
+            return state;
+        }
+    }
+    return nullptr;
+}
+
+void test_configured_intervals_met() {
+    load({readState("rpm", 12, 100), readState("speed", 13, 200), readState("fuelLevel", 47, 1000)});
+
+    std::map<std::string, uint32_t> updates;
+    poll("ideal", 20, updates);
+
+    // a state is due once its interval has passed, the loop delay adds up to one iteration
+    TEST_ASSERT_GREATER_OR_EQUAL(20000 / (100 + 2 * POLL_LOOP_DELAY), updates["rpm"]);
+    TEST_ASSERT_LESS_OR_EQUAL(20000 / 100, updates["rpm"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(20000 / (200 + 2 * POLL_LOOP_DELAY), updates["speed"]);
+    TEST_ASSERT_LESS_OR_EQUAL(20000 / 200, updates["speed"]);
+    TEST_ASSERT_GREATER_OR_EQUAL(20000 / (1000 + 2 * POLL_LOOP_DELAY), updates["fuelLevel"]);
+    TEST_ASSERT_LESS_OR_EQUAL(20000 / 1000, updates["fuelLevel"]);
+}
+
+void test_once_and_disabled_states() {
+    load({readState("rpm", 12, 100), readState("supportedPids_1_20", 0, -1),
+          readState("speed", 13, 100, R"(, "enabled": false)")});
+
+    std::map<std::string, uint32_t> updates;
+    poll("ideal", 5, updates);
+
+    TEST_ASSERT_GREATER_THAN(0, updates["rpm"]);
+    TEST_ASSERT_EQUAL(1, updates["supportedPids_1_20"]);
+    TEST_ASSERT_EQUAL(0, updates["speed"]);
+    TEST_ASSERT_EQUAL(0, findState("supportedPids_1_20")->getPlannedInterval());
+}
+
+void test_overloaded_link_shares_rest() {
+    // a slow adapter can't serve all intervals, the states with the shortest intervals are planned first
+    load({readState("rpm", 12, 100), readState("speed", 13, 100), readState("engineLoad", 4, 100),
+          readState("coolantTemp", 5, 2000), readState("fuelLevel", 47, 5000)});
+    OBD.setScaleIntervals(true);
+
+    std::map<std::string, uint32_t> updates;
+    poll("clone", 60, updates);
+
+    for (const OBDState *state: OBD.currentStates()->states) {
+        TEST_ASSERT_GREATER_OR_EQUAL(state->getUpdateInterval(), state->getPlannedInterval());
+        // no state starves, even the one with the longest interval is polled
+        TEST_ASSERT_GREATER_THAN(0, updates[state->getName()]);
+    }
+    TEST_ASSERT_GREATER_THAN(100, findState("engineLoad")->getPlannedInterval());
+    TEST_ASSERT_GREATER_THAN(updates["coolantTemp"], updates["rpm"]);
+    TEST_ASSERT_GREATER_THAN(updates["fuelLevel"], updates["coolantTemp"]);
+}
+
+void test_shared_request_sent_once() {
+    load({readState("rpm", 12, 100)});
+    std::map<std::string, uint32_t> single;
+    const uint32_t singleRequests = poll("vlinker", 20, single);
+
+    // a second state of the same PID is served by the response of the first
+    load({readState("rpm", 12, 100), readState("rpmCopy", 12, 100)});
+    std::map<std::string, uint32_t> shared;
+    const uint32_t sharedRequests = poll("vlinker", 20, shared);
+
+    TEST_ASSERT_LESS_OR_EQUAL(singleRequests + singleRequests / 10, sharedRequests);
+    TEST_ASSERT_EQUAL(100, findState("rpmCopy")->getPlannedInterval());
+    TEST_ASSERT_GREATER_THAN(single["rpm"] / 2, shared["rpmCopy"]);
+}
+
+int main(int argc, char **argv) {
+    // a stepped clock, the results only depend on the simulated latencies
+    esp_timer_set_time_scale(0);
+    OBD.begin("", "");
+
+    UNITY_BEGIN();
+    RUN_TEST(test_configured_intervals_met);
+    RUN_TEST(test_once_and_disabled_states);
+    RUN_TEST(test_overloaded_link_shares_rest);
+    RUN_TEST(test_shared_request_sent_once);
+    return UNITY_END();
+}
@@ -0,0 +1,217 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <unity.h>
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <string>
+#include "obd.h"
+#include "../fixture.h"
+
+static const char *STATES_JSON = R"([
+  {"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": 100, "name": "rpm",
+   "description": "Revolutions per minute", "icon": "engine", "unit": "", "measurement": true, "diagnostic": false,
+   "pid": {"service": 1, "pid": 12, "numResponses": 1, "numExpectedBytes": 2, "scaleFactor": "1.0 / 4.0"},
+   "value": {"format": "%d"}},
+  {"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": 30000, "name": "fuelLevel",
+   "description": "Fuel Level", "icon": "fuel", "unit": "%", "measurement": true, "diagnostic": false,
+   "pid": {"service": 1, "pid": 47, "numResponses": 1, "numExpectedBytes": 1, "scaleFactor": "100.0 / 255.0"},
+   "value": {"format": "%d"}},
+  {"type": 0, "valueType": "bool", "enabled": false, "visible": true, "interval": 60000, "name": "milOn",
+   "description": "MIL on", "measurement": false, "diagnostic": true,
+   "pid": {"service": 1, "pid": 1, "numResponses": 1, "numExpectedBytes": 4, "byteOffset": 0, "bitOffset": 7,
+           "numBits": 1}},
+  {"type": 1, "valueType": "bool", "enabled": true, "visible": true, "interval": 100, "name": "engineRunning",
+   "description": "Engine Running", "icon": "engine", "measurement": false, "diagnostic": false,
+   "expr": "max($rpm, 300) - 300", "value": {"format": "%d"}}
+])";
+
+void setUp() {
+    beginTestFS();
+}
+
+void tearDown() {
+    endTestFS();
+}
+
+static void writeFile(const char *path, const std::string &content) {
+    File file = LittleFS.open(path, FILE_WRITE);
+    TEST_ASSERT_TRUE(static_cast<bool>(file));
+    TEST_ASSERT_EQUAL(content.size(), file.write(reinterpret_cast<const uint8_t *>(content.data()), content.size()));
+    file.close();
+}
+
+/**
+ * Reads the states and publishes them like the polling task.
+ */
+static bool readStates() {
+    const bool success = OBD.readStates(LittleFS);
+    OBD.synchronize();
+    return success;
+}
+
+static std::string serializeStates() {
+    StatesJSONWriter writer(OBD);
+    std::string json;
+    uint8_t buffer[64];
+    size_t len;
+    while ((len = writer.read(buffer, sizeof(buffer))) > 0) {
+        json.append(reinterpret_cast<const char *>(buffer), len);
+    }
+    return json;
+}
+
+static OBDState *findState(const char *name) {
+    for (OBDState *state: OBD.currentStates()->states) {
+        if (strcmp(state->getName(), name) == 0) {
+            return state;
+        }
+    }
+    return nullptr;
+}
+
+void test_read_json() {
+    writeFile(STATES_FILE, STATES_JSON);
+    TEST_ASSERT_TRUE(readStates());
+    TEST_ASSERT_EQUAL(4, OBD.currentStates()->states.size());
+
+    const OBDState *rpm = findState("rpm");
+    TEST_ASSERT_NOT_NULL(rpm);
+    TEST_ASSERT_EQUAL(obd::READ, rpm->getType());
+    TEST_ASSERT_EQUAL_STRING("int", rpm->valueType());
+    TEST_ASSERT_EQUAL(100, rpm->getUpdateInterval());
+    TEST_ASSERT_EQUAL(12, rpm->getPID());
+    TEST_ASSERT_EQUAL(2, rpm->getNumExpectedBytes());
+    TEST_ASSERT_EQUAL_FLOAT(0.25, rpm->getScaleFactor());
+    TEST_ASSERT_EQUAL_STRING("1.0 / 4.0", rpm->getScaleFactorExpression());
+
+    const OBDState *mil = findState("milOn");
+    TEST_ASSERT_NOT_NULL(mil);
+    TEST_ASSERT_FALSE(mil->isEnabled());
+    TEST_ASSERT_EQUAL(7, mil->getBitOffset());
+    TEST_ASSERT_EQUAL(1, mil->getNumBits());
+
+    const OBDState *running = findState("engineRunning");
+    TEST_ASSERT_NOT_NULL(running);
+    TEST_ASSERT_EQUAL(obd::CALC, running->getType());
+    TEST_ASSERT_EQUAL_STRING("max($rpm, 300) - 300", running->getCalcExpression());
+}
+
+void test_read_cache() {
+    writeFile(STATES_FILE, STATES_JSON);
+    TEST_ASSERT_TRUE(readStates());
+    const std::string fromJSON = serializeStates();
+    TEST_ASSERT_TRUE(LittleFS.exists(STATES_CACHE_FILE));
+
+    // the second read is served from the cache and must restore the same states
+    TEST_ASSERT_TRUE(readStates());
+    const std::string fromCache = serializeStates();
+    TEST_ASSERT_EQUAL_STRING(fromJSON.c_str(), fromCache.c_str());
+}
+
+void test_cache_invalidated_by_same_size_edit() {
+    std::string json = STATES_JSON;
+    writeFile(STATES_FILE, json);
+    TEST_ASSERT_TRUE(readStates());
+    TEST_ASSERT_EQUAL(30000, findState("fuelLevel")->getUpdateInterval());
+
+    const size_t pos = json.find("30000");
+    json.replace(pos, 5, "60000");
+    writeFile(STATES_FILE, json);
+    TEST_ASSERT_TRUE(readStates());
+    TEST_ASSERT_EQUAL(60000, findState("fuelLevel")->getUpdateInterval());
+}
+
+void test_corrupt_cache_falls_back_to_json() {
+    writeFile(STATES_FILE, STATES_JSON);
+    TEST_ASSERT_TRUE(readStates());
+
+    File file = LittleFS.open(STATES_CACHE_FILE, FILE_READ);
+    std::string cache(file.size(), '\0');
+    file.read(reinterpret_cast<uint8_t *>(&cache[0]), cache.size());
+    file.close();
+    cache[cache.size() / 2] ^= 0x5a;
+    writeFile(STATES_CACHE_FILE, cache);
+
+    TEST_ASSERT_TRUE(readStates());
+    TEST_ASSERT_EQUAL(4, OBD.currentStates()->states.size());
+    TEST_ASSERT_EQUAL_STRING("1.0 / 4.0", findState("rpm")->getScaleFactorExpression());
+}
+
+void test_invalid_json_keeps_states() {
+    writeFile(STATES_FILE, STATES_JSON);
+    TEST_ASSERT_TRUE(readStates());
+
+    writeFile(STATES_FILE, "[{\"type\": 0, \"name\": \"rpm\",");
+    LittleFS.remove(STATES_CACHE_FILE);
+    TEST_ASSERT_FALSE(readStates());
+    TEST_ASSERT_EQUAL(4, OBD.currentStates()->states.size());
+}
+
+void test_journal_replayed() {
+    writeFile(STATES_FILE, STATES_JSON);
+    TEST_ASSERT_TRUE(readStates());
+
+    JsonDocument patch;
+    patch["interval"] = 250;
+    std::string error;
+    TEST_ASSERT_TRUE(OBD.patchState(LittleFS, "rpm", patch, error));
+    OBD.synchronize();
+    TEST_ASSERT_EQUAL(250, findState("rpm")->getUpdateInterval());
+
+    // the journal is applied on top of the cache
+    TEST_ASSERT_TRUE(readStates());
+    TEST_ASSERT_EQUAL(250, findState("rpm")->getUpdateInterval());
+    TEST_ASSERT_EQUAL(30000, findState("fuelLevel")->getUpdateInterval());
+}
+
+void test_patch_copies_state() {
+    writeFile(STATES_FILE, STATES_JSON);
+    TEST_ASSERT_TRUE(readStates());
+
+    JsonDocument patch;
+    patch["pollWhen"] = "$engineRunning";
+    std::string error;
+    TEST_ASSERT_TRUE(OBD.patchState(LittleFS, "fuelLevel", patch, error));
+    OBD.synchronize();
+    const std::string json = serializeStates();
+    const OBDState *fuelLevel = findState("fuelLevel");
+    const OBDState *rpm = findState("rpm");
+
+    // an unchanged interval, the copy must serialize like the original
+    patch.clear();
+    patch["interval"] = 30000;
+    TEST_ASSERT_TRUE(OBD.patchState(LittleFS, "fuelLevel", patch, error));
+    OBD.synchronize();
+    OBD.synchronize();
+    const std::string copied = serializeStates();
+    TEST_ASSERT_EQUAL_STRING(json.c_str(), copied.c_str());
+    TEST_ASSERT_TRUE(findState("fuelLevel") != fuelLevel);
+    TEST_ASSERT_TRUE(findState("rpm") == rpm);
+    TEST_ASSERT_EQUAL_STRING("$engineRunning", findState("fuelLevel")->getPollWhen());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_read_json);
+    RUN_TEST(test_read_cache);
+    RUN_TEST(test_cache_invalidated_by_same_size_edit);
+    RUN_TEST(test_corrupt_cache_falls_back_to_json);
+    RUN_TEST(test_invalid_json_keeps_states);
+    RUN_TEST(test_journal_replayed);
+    RUN_TEST(test_patch_copies_state);
+    return UNITY_END();
+}
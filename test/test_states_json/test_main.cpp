@@ -0,0 +1,132 @@
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+#include <unity.h>
+#include <Arduino.h>
+#include <string>
+#include "obd.h"
+
+static const char *STATES_JSON = R"([
+  {"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": -1, "name": "supportedPids_1_20",
+   "description": "Supported PIDs 1-20", "icon": "", "unit": "", "deviceClass": "", "measurement": false,
+   "diagnostic": true, "pid": {"service": 1, "pid": 0, "numResponses": 1, "numExpectedBytes": 4, "scaleFactor": "1"},
+   "value": {"format": "%d", "func": "toBitStr"}},
+  {"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": 100, "name": "rpm",
+   "description": "Revolutions \"per\" minute", "icon": "engine", "unit": "1/min", "measurement": true,
+   "diagnostic": false, "deadband": 25, "maxSilence": 10000, "pollWhen": "$engineRunning",
+   "pid": {"service": 1, "pid": 12, "numResponses": 1, "numExpectedBytes": 2, "scaleFactor": "1.0 / 4.0"},
+   "value": {"format": "%d"}},
+  {"type": 0, "valueType": "float", "enabled": false, "visible": false, "interval": 1000, "name": "timingAdvance",
+   "description": "Timing Advance", "icon": "engine", "unit": "°", "measurement": true, "diagnostic": false,
+   "deadband": 0.5, "deadbandRelative": true,
+   "pid": {"service": 1, "pid": 14, "numResponses": 1, "numExpectedBytes": 1, "scaleFactor": "1.0 / 2.0",
+           "bias": -64}, "value": {"format": "%.1f", "expr": "$value * 2"}},
+  {"type": 0, "valueType": "bool", "enabled": true, "visible": true, "interval": 60000, "name": "milOn",
+   "description": "MIL on", "measurement": false, "diagnostic": true,
+   "pid": {"service": 1, "pid": 1, "header": 2016, "numResponses": 1, "numExpectedBytes": 4, "byteOffset": 0,
+           "bitOffset": 7, "numBits": 1}},
+  {"type": 0, "valueType": "float", "enabled": true, "visible": true, "interval": 30000, "name": "batteryVoltage",
+   "description": "Battery Voltage", "icon": "battery", "unit": "V", "deviceClass": "voltage", "measurement": true,
+   "diagnostic": false, "readFunc": "batteryVoltage", "value": {"format": "%4.2f"}},
+  {"type": 1, "valueType": "float", "enabled": true, "visible": true, "interval": 100, "name": "consumption",
+   "description": "Calculated consumption", "icon": "gas-station", "unit": "L", "deviceClass": "volume",
+   "measurement": true, "diagnostic": false,
+   "expr": "$consumption + ($mafRate * 3600 / (afRatio($fuelType) * density($fuelType))) / 3600",
+   "value": {"format": "%4.2f"}}
+])";
+
+void setUp() {
+}
+
+void tearDown() {
+}
+
+static void load(const char *json) {
+    OBD.clearStates();
+    OBD.synchronize();
+    TEST_ASSERT_TRUE(OBD.parseJSON(json, strlen(json)));
+    OBD.synchronize();
+}
+
+/**
+ * The serializer of /api/states before the chunked writer, one document with all states.
+ */
+static std::string serializeDocument() {
+    JsonDocument doc;
+    StatesReadGuard guard(OBD);
+    for (OBDState *state: OBD.currentStates()->states) {
+        JsonDocument stateObj;
+        state->toJSON(stateObj);
+        doc.add(stateObj);
+    }
+
+    std::string json;
+    serializeJson(doc, json);
+    return json;
+}
+
+static std::string serializeChunked(const size_t chunkSize) {
+    StatesJSONWriter writer(OBD);
+    std::string json;
+    std::vector<uint8_t> buffer(chunkSize);
+    size_t len;
+    while ((len = writer.read(buffer.data(), buffer.size())) > 0) {
+        TEST_ASSERT_LESS_OR_EQUAL(chunkSize, len);
+        json.append(reinterpret_cast<const char *>(buffer.data()), len);
+    }
+    // finished writers stay finished
+    TEST_ASSERT_EQUAL(0, writer.read(buffer.data(), buffer.size()));
+    return json;
+}
+
+void test_chunks_match_document() {
+    load(STATES_JSON);
+    TEST_ASSERT_EQUAL(6, OBD.currentStates()->states.size());
+
+    const std::string expected = serializeDocument();
+    // from a single byte to more than the whole output, e.g. the TCP segment size of the web server
+    for (const size_t chunkSize: {1, 2, 7, 64, 256, 1436, 8192}) {
+        const std::string actual = serializeChunked(chunkSize);
+        TEST_ASSERT_EQUAL(expected.size(), actual.size());
+        TEST_ASSERT_EQUAL_STRING(expected.c_str(), actual.c_str());
+    }
+}
+
+void test_single_state() {
+    load(R"([{"type": 0, "valueType": "int", "enabled": true, "visible": true, "interval": 100, "name": "speed",
+             "description": "Speed", "measurement": true, "diagnostic": false,
+             "pid": {"service": 1, "pid": 13, "numResponses": 1, "numExpectedBytes": 1, "scaleFactor": "1"}}])");
+
+    const std::string expected = serializeDocument();
+    const std::string actual = serializeChunked(16);
+    TEST_ASSERT_EQUAL_STRING(expected.c_str(), actual.c_str());
+}
+
+void test_no_states() {
+    load("[]");
+
+    // the document serialized an empty array as null, the writer always writes an array
+    const std::string actual = serializeChunked(64);
+    TEST_ASSERT_EQUAL_STRING("[]", actual.c_str());
+}
+
+int main(int argc, char **argv) {
+    UNITY_BEGIN();
+    RUN_TEST(test_chunks_match_document);
+    RUN_TEST(test_single_state);
+    RUN_TEST(test_no_states);
+    return UNITY_END();
+}
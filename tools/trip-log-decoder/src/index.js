@@ -0,0 +1,183 @@
+#!/usr/bin/env node
+/*
+ * This program is free software; you can use it, redistribute it
+ * and / or modify it under the terms of the GNU General Public License
+ * (GPL) as published by the Free Software Foundation; either version 3
+ * of the License or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ *  WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program, in a file called gpl.txt or license.txt.
+ *  If not, write to the Free Software Foundation Inc.,
+ *  59 Temple Place - Suite 330, Boston, MA  02111-1307 USA
+ */
+
+import { readFileSync } from "node:fs";
+import { parseArgs } from "node:util";
+
+const SEGMENT_MAGIC = "OTLG";
+const BLOCK_MAGIC = 0x424C544F;
+const HEADER_SIZE = 16;
+const SUPPORTED_VERSION = 1;
+
+const {
+    values: {
+        help,
+        wide
+    },
+    positionals: files
+} = parseArgs({
+    options: {
+        help: {
+            type: "boolean",
+            short: "h",
+        },
+        wide: {
+            type: "boolean"
+        }
+    },
+    allowPositionals: true
+});
+
+if (help || files.length === 0) {
+    console.log("trip-log-decoder [ -h | --help ] [--wide] <segment file>...");
+    process.exit(help ? 0 : 1);
+}
+
+class Reader {
+    constructor(buffer, pos = 0) {
+        this.buffer = buffer;
+        this.pos = pos;
+    }
+
+    u8() {
+        return this.buffer.readUInt8(this.pos++);
+    }
+
+    u16() {
+        const v = this.buffer.readUInt16LE(this.pos);
+        this.pos += 2;
+        return v;
+    }
+
+    u32() {
+        const v = this.buffer.readUInt32LE(this.pos);
+        this.pos += 4;
+        return v;
+    }
+
+    varInt() {
+        let result = 0;
+        let factor = 1;
+        for (; ;) {
+            const b = this.u8();
+            result += (b & 0x7F) * factor;
+            if ((b & 0x80) === 0) {
+                return result;
+            }
+            factor *= 128;
+        }
+    }
+
+    zigZag() {
+        const v = this.varInt();
+        return v % 2 === 0 ? v / 2 : -(v + 1) / 2;
+    }
+
+    string(len) {
+        const s = this.buffer.toString("utf8", this.pos, this.pos + len);
+        this.pos += len;
+        return s;
+    }
+}
+
+function decodeBlock(reader, segment, samples) {
+    const start = reader.pos - 4;
+    const length = reader.u16();
+    reader.u16();
+    const baseTime = reader.u32();
+    const numColumns = reader.u8();
+
+    for (let c = 0; c < numColumns; c++) {
+        reader.u8();
+        const type = reader.u8();
+        const decimals = reader.u8();
+        const name = reader.string(reader.u8());
+        const count = reader.varInt();
+
+        let time = baseTime;
+        let value = 0;
+        for (let i = 0; i < count; i++) {
+            time += reader.varInt();
+            value += reader.zigZag();
+            samples.push({
+                segment,
+                time,
+                state: name,
+                value: type === 2 ? (value / Math.pow(10, decimals)).toFixed(decimals) : String(value)
+            });
+        }
+    }
+
+    reader.pos = start + length;
+}
+
+function decodeSegment(file) {
+    const buffer = readFileSync(file);
+    if (buffer.length < HEADER_SIZE || buffer.toString("ascii", 0, 4) !== SEGMENT_MAGIC) {
+        throw new Error(`${file} is not a trip log segment`);
+    }
+
+    const header = new Reader(buffer, 4);
+    const version = header.u16();
+    const pageSize = header.u16();
+    const segment = header.u32();
+    if (version !== SUPPORTED_VERSION) {
+        throw new Error(`${file} has unsupported version ${version}`);
+    }
+
+    const samples = [];
+    const reader = new Reader(buffer, HEADER_SIZE);
+    while (reader.pos + 4 <= buffer.length) {
+        const magic = reader.u32();
+        if (magic === BLOCK_MAGIC) {
+            try {
+                decodeBlock(reader, segment, samples);
+                continue;
+            } catch (e) {
+                process.stderr.write(`${file}: skipping corrupt block at ${reader.pos}\n`);
+            }
+        }
+        // zero padding or corruption, continue at the next page
+        reader.pos = (Math.floor((reader.pos - 1) / pageSize) + 1) * pageSize;
+    }
+
+    return samples.sort((a, b) => a.time - b.time);
+}
+
+const samples = files.flatMap(decodeSegment);
+
+if (wide) {
+    const states = [...new Set(samples.map(s => s.state))];
+    const rows = new Map();
+    for (const s of samples) {
+        const key = `${s.segment};${s.time}`;
+        if (!rows.has(key)) {
+            rows.set(key, {segment: s.segment, time: s.time, values: {}});
+        }
+        rows.get(key).values[s.state] = s.value;
+    }
+    process.stdout.write(["segment", "time", ...states].join(",") + "\n");
+    for (const row of rows.values()) {
+        process.stdout.write([row.segment, row.time, ...states.map(s => row.values[s] ?? "")].join(",") + "\n");
+    }
+} else {
+    process.stdout.write("segment,time,state,value\n");
+    for (const s of samples) {
+        process.stdout.write(`${s.segment},${s.time},${s.state},${s.value}\n`);
+    }
+}
@@ -189,6 +189,14 @@ export class OBDStatesComponent implements OnInit {
             enabled: new FormControl<boolean>(true, Validators.required),
             visible: new FormControl<boolean>(true, Validators.required),
             interval: new FormControl<number>(1000, [Validators.required, Validators.min(-1)]),
+            deadband: new FormControl<number>(0, [Validators.required, Validators.min(0)]),
+            deadbandRelative: new FormControl<boolean>(false),
+            maxSilence: new FormControl<number>(0, [Validators.required, Validators.min(0)]),
+            maxInterval: new FormControl<number>(0, [Validators.required, Validators.min(0)]),
+            pollWhen: new FormControl<string | null>(null, [
+                expressionValidator(true, BuildInExpressionVars, BuildInExpressionFuncs),
+                Validators.maxLength(256)
+            ]),
             name: new FormControl<string>(null, [Validators.required, Validators.maxLength(32), Validators.pattern("[a-zA-Z0-9_]+")]),
             description: new FormControl<string>(null, [Validators.required, Validators.maxLength(256)]),
             icon: new FormControl<string>(null, Validators.maxLength(32)),
@@ -209,6 +217,10 @@ export class OBDStatesComponent implements OnInit {
                 numExpectedBytes: new FormControl<number>(0, [Validators.required, Validators.min(0), Validators.max(16)]),
                 scaleFactor: new FormControl<string | null>(null, [Validators.maxLength(256)]),
                 bias: new FormControl<number>(0),
+                byteOffset: new FormControl<number>(0, [Validators.min(0), Validators.max(15)]),
+                numBytes: new FormControl<number>(0, [Validators.min(0), Validators.max(8)]),
+                bitOffset: new FormControl<number>(0, [Validators.min(0), Validators.max(63)]),
+                numBits: new FormControl<number>(0, [Validators.min(0), Validators.max(64)]),
             }),
             value: new FormGroup({
                 format: new FormControl<string | null>(null),
@@ -70,6 +70,8 @@ export class SettingsComponent implements OnInit {
 
     obd2: FormGroup;
 
+    mqtt: FormGroup;
+
     focus$ = new Subject<string>();
 
     click$ = new Subject<string>();
@@ -99,13 +101,29 @@ export class SettingsComponent implements OnInit {
             checkPIDSupport: new FormControl<boolean>(false),
             debug: new FormControl<boolean>(false),
             specifyNumResponses: new FormControl<boolean>(true),
+            scaleIntervals: new FormControl<boolean>(false),
             protocol: new FormControl(OBD2Protocol.AUTOMATIC),
         });
 
+        this.mqtt = new FormGroup({
+            hostname: new FormControl("", Validators.maxLength(64)),
+            port: new FormControl<number>(1883, [Validators.min(1), Validators.max(65535)]),
+            secure: new FormControl<boolean>(false),
+            username: new FormControl("", Validators.maxLength(32)),
+            password: new FormControl("", Validators.maxLength(32)),
+            allowOffline: new FormControl<boolean>(false),
+            dataInterval: new FormControl<number>(dataIntervals[0]),
+            diagnosticInterval: new FormControl<number>(diagnosticIntervals[1]),
+            discoveryInterval: new FormControl<number>(discoveryIntervals[1]),
+            locationInterval: new FormControl<number>(locationIntervals[1]),
+            batch: new FormControl<boolean>(true),
+        });
+
         this.form = new FormGroup({
             general: this.general,
             wifi: this.wifi,
             obd2: this.obd2,
+            mqtt: this.mqtt,
         });
     }
 
@@ -201,6 +219,7 @@ export class SettingsComponent implements OnInit {
 
     private fixJson(input: any): Settings {
         const res = Object.assign({}, input);
+        res.mqtt = Object.assign({}, input.mqtt);
         res.mqtt.dataInterval = typeof input.mqtt.dataInterval == "string" ?
             parseInt(input.mqtt.dataInterval, 10) : input.mqtt.dataInterval;
         res.mqtt.discoveryInterval = typeof input.mqtt.discoveryInterval == "string" ?
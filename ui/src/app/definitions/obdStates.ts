@@ -34,6 +34,10 @@ export interface PID {
     numExpectedBytes: number;
     scaleFactor?: string;
     bias: number;
+    byteOffset?: number;
+    numBytes?: number;
+    bitOffset?: number;
+    numBits?: number;
 }
 
 export interface ValueFormat {
@@ -48,6 +52,11 @@ export interface OBDState {
     enabled: boolean;
     visible: boolean;
     interval: number;
+    deadband?: number;
+    deadbandRelative?: boolean;
+    maxSilence?: number;
+    maxInterval?: number;
+    pollWhen?: string;
 
     name: string;
     description: string;
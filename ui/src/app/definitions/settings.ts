@@ -45,13 +45,29 @@ export interface OBD2Settings {
     checkPIDSupport?: boolean;
     debug?: boolean;
     specifyNumResponses?: boolean;
+    scaleIntervals?: boolean;
     protocol?: OBD2Protocol;
 }
 
+export interface MQTTSettings {
+    hostname?: string;
+    port?: number;
+    secure?: boolean;
+    username?: string;
+    password?: string;
+    allowOffline?: boolean;
+    dataInterval?: number;
+    diagnosticInterval?: number;
+    discoveryInterval?: number;
+    locationInterval?: number;
+    batch?: boolean;
+}
+
 export interface Settings {
     general?: GeneralSettings;
     wifi?: WiFiSettings;
     obd2?: OBD2Settings;
+    mqtt?: MQTTSettings;
 }
 
 export const dataIntervals = [1, 3, 5];